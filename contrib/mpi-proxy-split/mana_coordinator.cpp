@@ -331,8 +331,7 @@ unblockRanks(const ClientToStateMap& clientStates, long int size)
     JTRACE("Sending query to client")(q)
       (c.second.rank)(c.second.comm)(c.second.st);
     msg.extraBytes = sizeof q;
-    c.first->sock() << msg;
-    c.first->sock().writeAll((const char*)&q, msg.extraBytes);
+    c.first->send(msg, &q);
   }
   free(queries);
 }
@@ -32,6 +32,7 @@
 #include <set>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -236,5 +237,12 @@ class map : public std::map<K, V, std::less<K>,
 template<typename K>
 class set : public std::set<K, std::less<K>, DmtcpAlloc<K> >
 {};
+
+template<typename K, typename V>
+class unordered_map : public std::unordered_map<K, V, std::hash<K>,
+                                                std::equal_to<K>,
+                                                DmtcpAlloc<std::pair<K const,
+                                                                     V> > >
+{};
 }
 #endif // ifndef DMTCPALLOC_H
@@ -63,7 +63,18 @@ typedef char *VA;  /* VA = virtual address */
 
 typedef enum ProcMapsAreaProperties {
   DMTCP_ZERO_PAGE = 0x0001,
-  DMTCP_SKIP_WRITING_TEXT_SEGMENTS = 0x0002
+  DMTCP_SKIP_WRITING_TEXT_SEGMENTS = 0x0002,
+  DMTCP_LZ_COMPRESSED = 0x0004,
+
+  // A SysV shm segment is saved as a DMTCP_SYSV_SHM_SEGMENT area with no
+  // data, which tells mtcp_restart to recreate and attach the segment,
+  // followed by DMTCP_SYSV_SHM_DATA areas that are read into it in place.
+  DMTCP_SYSV_SHM_SEGMENT = 0x0008,
+  DMTCP_SYSV_SHM_DATA = 0x0010,
+
+  // The area header carries CRC32C checksums of itself and of the data that
+  // follows it in the image (see mtcp/mtcp_crc32c.h).
+  DMTCP_CHECKSUMMED = 0x0020
 } ProcMapsAreaProperties;
 
 typedef union ProcMapsArea {
@@ -114,6 +125,12 @@ typedef union ProcMapsArea {
     uint64_t properties;
 
     char name[FILENAMESIZE];
+
+    // If DMTCP_CHECKSUMMED: 'checksum' is the CRC of the bytes that follow
+    // this header in the image (compressed, if DMTCP_LZ_COMPRESSED), and
+    // 'headerChecksum' is the CRC of this header, with headerChecksum = 0.
+    uint32_t checksum;
+    uint32_t headerChecksum;
   };
   char _padding[4096];
 } ProcMapsArea;
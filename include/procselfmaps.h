@@ -25,17 +25,37 @@ class ProcSelfMaps
 
     int getNextArea(ProcMapsArea *area);
 
+    // Makes getNextArea() start again from the first area.
+    void rewind() { dataIdx = 0; }
+
+    // Finds the area containing addr, by binary search.  Returns 1 if found.
+    // Does not move the position of getNextArea().
+    int getAreaContaining(VA addr, ProcMapsArea *area);
+
+    /* A snapshot shared by all of DMTCP and its plugins for the current
+     * phase of a checkpoint or restart, so that /proc/self/maps is read and
+     * indexed only once.  It is discarded when a checkpoint starts, when the
+     * memory is about to be written, and on resume and restart.  A caller
+     * that maps or unmaps memory in between must call invalidateSnapshot().
+     * snapshot() rewinds it.  For the checkpoint thread only.
+     */
+    static ProcSelfMaps &snapshot();
+    static void invalidateSnapshot();
+
   private:
     unsigned long int readDec();
     unsigned long int readHex();
+    VA lineAddr(size_t line);
     bool isValidData();
 
     char *data;
+    size_t *lineStart;  // Offset of each line in data, in order of address
     size_t dataIdx;
     size_t numAreas;
     size_t numBytes;
     int fd;
     int numAllocExpands;
+    bool checkAllocExpands;
 };
 }
 
@@ -42,7 +42,7 @@
 #define CON_ID_LEN \
   (sizeof(DmtcpUniqueProcessId) + sizeof(int64_t))
 
-#define SHM_VERSION_STR          "DMTCP_GLOBAL_AREA_V0.99"
+#define SHM_VERSION_STR          "DMTCP_GLOBAL_AREA_V1.01"
 #define VIRT_PTS_PREFIX_STR      "/dev/pts/v"
 
 #define SYSV_SHM_ID              1
@@ -63,14 +63,24 @@ typedef struct CoordinatorInfo {
 namespace SharedData
 {
 // All structs should be 64-bit aligned.
+
+// The pid and IPC-id maps are open-addressed hash tables, keyed by the
+// virtual id.  The key and the value of an entry are separate 64-bit words,
+// each holding a 32-bit id tagged with ID_MAP_USED, so that every int32,
+// -1 included, is a valid key (the SysV key map holds user-chosen keys); a
+// zero word is unset.  A slot is claimed by a CAS on its key and the value
+// is published after it, so lookups need no lock.  The number of slots
+// (MAX_PID_MAPS, MAX_IPC_ID_MAPS) must be a power of two.
+#define ID_MAP_USED              (1ULL << 32)
+
 struct PidMap {
-  pid_t virt;
-  pid_t real;
+  uint64_t key;
+  uint64_t value;
 };
 
 struct IPCIdMap {
-  int32_t virt;
-  int32_t real;
+  uint64_t key;
+  uint64_t value;
 };
 
 struct PtyNameMap {
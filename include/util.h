@@ -71,12 +71,15 @@ EXTERNC void initializeJalib();
 
 EXTERNC int dmtcp_infiniband_enabled(void) __attribute__((weak));
 EXTERNC int dmtcp_alloc_enabled(void) __attribute__((weak));
+EXTERNC int dmtcp_alloc_in_progress(void) __attribute__((weak));
+EXTERNC int dmtcp_alloc_defer_ckpt_signal(void) __attribute__((weak));
 EXTERNC int dmtcp_dl_enabled(void) __attribute__((weak));
 EXTERNC int dmtcp_batch_queue_enabled(void) __attribute__((weak));
 EXTERNC int dmtcp_modify_env_enabled(void) __attribute__((weak));
 EXTERNC int dmtcp_ptrace_enabled(void) __attribute__((weak));
 EXTERNC int dmtcp_unique_ckpt_enabled(void) __attribute__((weak));
 EXTERNC bool dmtcp_svipc_inside_shmdt(void) __attribute__((weak));
+EXTERNC int dmtcp_svipc_enabled(void) __attribute__((weak));
 
 
 /*
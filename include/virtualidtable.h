@@ -41,14 +41,109 @@ template<typename IdType>
 class VirtualIdTable
 {
   protected:
+    typedef typename map<IdType, IdType>::iterator id_iterator;
+    typedef typename unordered_map<IdType, IdType>::iterator rev_iterator;
+    typedef typename unordered_map<IdType, vector<IdType> >::iterator
+      others_iterator;
+
+    // Lookups take the table lock shared, so concurrent readers (e.g.,
+    // getpid/gettid translations from many threads) do not serialize.
     void _do_lock_tbl()
     {
-      JASSERT(pthread_mutex_lock(&tblLock) == 0) (JASSERT_ERRNO);
+      JASSERT(pthread_rwlock_wrlock(&tblLock) == 0) (JASSERT_ERRNO);
+    }
+
+    void _do_rdlock_tbl()
+    {
+      JASSERT(pthread_rwlock_rdlock(&tblLock) == 0) (JASSERT_ERRNO);
     }
 
     void _do_unlock_tbl()
     {
-      JASSERT(pthread_mutex_unlock(&tblLock) == 0) (JASSERT_ERRNO);
+      JASSERT(pthread_rwlock_unlock(&tblLock) == 0) (JASSERT_ERRNO);
+    }
+
+    // _realToVirtualTable is a reverse index of _idMapTable, hashed so that
+    // realToVirtual() takes O(1).  A real id that is mapped from more than
+    // one virtual id (rare) is in it under the most recent one; the others
+    // are kept in _otherVirtualIds, so that erasing a mapping never needs a
+    // scan of _idMapTable.  All updates to _idMapTable must go through the
+    // following helpers, called with the table lock held exclusively, to
+    // keep the maps consistent.
+    void _indexMapping(IdType virtualId, IdType realId)
+    {
+      rev_iterator j = _realToVirtualTable.find(realId);
+      if (j == _realToVirtualTable.end()) {
+        _realToVirtualTable[realId] = virtualId;
+      } else {
+        _otherVirtualIds[realId].push_back(j->second);
+        j->second = virtualId;
+      }
+    }
+
+    void _setMapping(IdType virtualId, IdType realId)
+    {
+      id_iterator i = _idMapTable.find(virtualId);
+      if (i != _idMapTable.end()) {
+        if (i->second == realId) {
+          return;
+        }
+        _eraseMapping(i);
+      }
+      _idMapTable[virtualId] = realId;
+      _indexMapping(virtualId, realId);
+    }
+
+    void _eraseMapping(id_iterator i)
+    {
+      IdType virtualId = i->first;
+      IdType realId = i->second;
+
+      _idMapTable.erase(i);
+      rev_iterator j = _realToVirtualTable.find(realId);
+      if (j == _realToVirtualTable.end()) {
+        return;
+      }
+      others_iterator others = _otherVirtualIds.find(realId);
+      if (others == _otherVirtualIds.end()) {
+        if (j->second == virtualId) {
+          _realToVirtualTable.erase(j);
+        }
+        return;
+      }
+
+      vector<IdType> &ids = others->second;
+      if (j->second == virtualId) {
+        j->second = ids.back();
+        ids.pop_back();
+      } else {
+        for (size_t n = 0; n < ids.size(); n++) {
+          if (ids[n] == virtualId) {
+            ids[n] = ids.back();
+            ids.pop_back();
+            break;
+          }
+        }
+      }
+      if (ids.empty()) {
+        _otherVirtualIds.erase(others);
+      }
+    }
+
+    void _clearMappings()
+    {
+      _idMapTable.clear();
+      _realToVirtualTable.clear();
+      _otherVirtualIds.clear();
+    }
+
+    void _rebuildReverseIndex()
+    {
+      _realToVirtualTable.clear();
+      _otherVirtualIds.clear();
+      for (id_iterator i = _idMapTable.begin(); i != _idMapTable.end(); ++i) {
+        _indexMapping(i->first, i->second);
+      }
     }
 
   public:
@@ -61,11 +156,11 @@ class VirtualIdTable
 #endif // ifdef JALIB_ALLOCATOR
     VirtualIdTable(string typeStr, IdType base, size_t max = MAX_VIRTUAL_ID)
     {
-      pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+      pthread_rwlock_t lock = PTHREAD_RWLOCK_INITIALIZER;
 
       tblLock = lock;
       _do_lock_tbl();
-      _idMapTable.clear();
+      _clearMappings();
       _do_unlock_tbl();
       _typeStr = typeStr;
       _base = base;
@@ -91,7 +186,7 @@ class VirtualIdTable
 
     size_t size()
     {
-      _do_lock_tbl();
+      _do_rdlock_tbl();
       size_t size = _idMapTable.size();
       _do_unlock_tbl();
       return size;
@@ -100,7 +195,7 @@ class VirtualIdTable
     void clear()
     {
       _do_lock_tbl();
-      _idMapTable.clear();
+      _clearMappings();
       resetNextVirtualId();
       _do_unlock_tbl();
     }
@@ -108,7 +203,7 @@ class VirtualIdTable
     void postRestart()
     {
       _do_lock_tbl();
-      _idMapTable.clear();
+      _clearMappings();
       resetNextVirtualId();
       _do_unlock_tbl();
     }
@@ -116,7 +211,7 @@ class VirtualIdTable
     void resetOnFork(IdType newBase)
     {
       _base = newBase;
-      pthread_mutex_t newlock = PTHREAD_MUTEX_INITIALIZER;
+      pthread_rwlock_t newlock = PTHREAD_RWLOCK_INITIALIZER;
       tblLock = newlock;
       resetNextVirtualId();
     }
@@ -155,7 +250,7 @@ class VirtualIdTable
     {
       bool retVal = false;
 
-      _do_lock_tbl();
+      _do_rdlock_tbl();
       id_iterator j = _idMapTable.find(id);
       if (j != _idMapTable.end()) {
         retVal = true;
@@ -169,12 +264,9 @@ class VirtualIdTable
     {
       bool retval = false;
 
-      _do_lock_tbl();
-      for (id_iterator i = _idMapTable.begin(); i != _idMapTable.end(); ++i) {
-        if (i->second == id) {
-          retval = true;
-          break;
-        }
+      _do_rdlock_tbl();
+      if (_realToVirtualTable.find(id) != _realToVirtualTable.end()) {
+        retval = true;
       }
       _do_unlock_tbl();
       return retval;
@@ -183,14 +275,17 @@ class VirtualIdTable
     void updateMapping(IdType virtualId, IdType realId)
     {
       _do_lock_tbl();
-      _idMapTable[virtualId] = realId;
+      _setMapping(virtualId, realId);
       _do_unlock_tbl();
     }
 
     void erase(IdType virtualId)
     {
       _do_lock_tbl();
-      _idMapTable.erase(virtualId);
+      id_iterator i = _idMapTable.find(virtualId);
+      if (i != _idMapTable.end()) {
+        _eraseMapping(i);
+      }
       _do_unlock_tbl();
     }
 
@@ -221,7 +316,7 @@ class VirtualIdTable
     vector<IdType>getIdVector()
     {
       vector<IdType>idVec;
-      _do_lock_tbl();
+      _do_rdlock_tbl();
       for (id_iterator i = _idMapTable.begin(); i != _idMapTable.end(); ++i) {
         idVec.push_back(i->first);
       }
@@ -236,7 +331,7 @@ class VirtualIdTable
       /* This code is called from MTCP while the checkpoint thread is holding
          the JASSERT log lock. Therefore, don't call JTRACE/JASSERT/JINFO/etc. in
          this function. */
-      _do_lock_tbl();
+      _do_rdlock_tbl();
       id_iterator i = _idMapTable.find(virtualId);
       if (i == _idMapTable.end()) {
         retVal = virtualId;
@@ -252,22 +347,24 @@ class VirtualIdTable
       /* This code is called from MTCP while the checkpoint thread is holding
          the JASSERT log lock. Therefore, don't call JTRACE/JASSERT/JINFO/etc. in
          this function. */
-      _do_lock_tbl();
-      for (id_iterator i = _idMapTable.begin(); i != _idMapTable.end(); ++i) {
-        if (realId == i->second) {
-          _do_unlock_tbl();
-          return i->first;
-        }
-      }
+      IdType retVal = realId;
 
+      _do_rdlock_tbl();
+      rev_iterator i = _realToVirtualTable.find(realId);
+      if (i != _realToVirtualTable.end()) {
+        retVal = i->second;
+      }
       _do_unlock_tbl();
-      return realId;
+      return retVal;
     }
 
     void serialize(jalib::JBinarySerializer &o)
     {
       JSERIALIZE_ASSERT_POINT("VirtualIdTable:");
       o & _idMapTable;
+      if (o.isReader()) {
+        _rebuildReverseIndex();
+      }
       JSERIALIZE_ASSERT_POINT("EOF");
       printMaps();
     }
@@ -311,6 +408,7 @@ class VirtualIdTable
       while (!maprd.isEOF()) {
         maprd & _idMapTable;
       }
+      _rebuildReverseIndex();
 
       _do_unlock_tbl();
 
@@ -326,11 +424,12 @@ class VirtualIdTable
 
   private:
     string _typeStr;
-    pthread_mutex_t tblLock;
+    pthread_rwlock_t tblLock;
 
   protected:
-    typedef typename map<IdType, IdType>::iterator id_iterator;
     map<IdType, IdType>_idMapTable;
+    unordered_map<IdType, IdType>_realToVirtualTable;
+    unordered_map<IdType, vector<IdType> >_otherVirtualIds;
     IdType _base;
     size_t _max;
     IdType _nextVirtualId;
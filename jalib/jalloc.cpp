@@ -24,6 +24,7 @@
 #include "jalloc.h"
 #include <pthread.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <unistd.h>
 
@@ -31,7 +32,7 @@
 
 // Make highest chunk size large; avoid a raw_alloc calling mmap()
 // during /proc/self/maps
-#define MAX_CHUNKSIZE (4 * 1024)
+#define MAX_CHUNKSIZE (64 * 1024)
 
 using namespace jalib;
 
@@ -123,164 +124,239 @@ _dealloc_raw(void *ptr, size_t n)
 # endif // ifdef JALIB_USE_MALLOC
 }
 
-template<size_t _N>
-class JFixedAllocStack
+/* The free chunks of each size class are kept in a lock-free stack.  The
+ * root of the stack holds the top pointer together with a counter that is
+ * bumped on every update, so that a pop cannot succeed against a root that
+ * was popped and pushed back by other threads in the meantime (ABA).
+ * Chunks are never returned to the kernel, so reading item->next of a chunk
+ * that another thread has just popped is harmless; the CAS will then fail.
+ */
+typedef uint64_t TaggedRoot;
+
+# if __SIZEOF_POINTER__ == 8
+#  define ROOT_TAG_SHIFT 48 // User-space addresses fit in 48 bits.
+# else // if __SIZEOF_POINTER__ == 8
+#  define ROOT_TAG_SHIFT 32
+# endif // if __SIZEOF_POINTER__ == 8
+# define ROOT_PTR_MASK ((1ULL << ROOT_TAG_SHIFT) - 1)
+
+struct FreeItem {
+  FreeItem *next;
+};
+
+static inline FreeItem *
+rootPtr(TaggedRoot root)
 {
-  public:
-    enum { N = _N };
-    JFixedAllocStack()
-    {
-      if (_blockSize == 0) {
-        _blockSize = 4 * MAX_CHUNKSIZE;
-      }
-      _root = NULL;
-      _numExpands = 0;
-    }
+  return (FreeItem *)(uintptr_t)(root & ROOT_PTR_MASK);
+}
 
-    void initialize(int blockSize)
-    {
-      _blockSize = blockSize;
-    }
+static inline TaggedRoot
+newRoot(TaggedRoot old, FreeItem *item)
+{
+  return (((old >> ROOT_TAG_SHIFT) + 1) << ROOT_TAG_SHIFT) | (uintptr_t)item;
+}
 
-    size_t chunkSize() { return N; }
+// NOTE: This must remain an aggregate (no constructors), so that the stacks
+// below are initialized statically.  Allocations can happen before the
+// static constructors of this library have run.
+struct JFixedAllocStack {
+  TaggedRoot volatile root;
+  size_t chunkSize;
+  size_t blockSize;
+  int volatile numExpands;
+  char padding[128];
+
+  // allocate a chunk of size chunkSize
+  void *allocate()
+  {
+    while (true) {
+      TaggedRoot old = root;
+      FreeItem *item = rootPtr(old);
+      if (item == NULL) {
+        // NOTE: root could still be empty after this (if other threads
+        // consumed all chunks that were made available by expand()).  In
+        // such case, we loop once again.
+        expand();
+      } else if (__sync_bool_compare_and_swap(&root, old,
+                                              newRoot(old, item->next))) {
+        item->next = NULL;
+        return item;
+      }
+    }
+  }
 
-    // allocate a chunk of size N
-    void *allocate()
-    {
-      FreeItem *item = NULL;
+  // deallocate a chunk of size chunkSize
+  void deallocate(void *ptr)
+  {
+    if (ptr == NULL) { return; }
+    FreeItem *item = static_cast<FreeItem *>(ptr);
+    deallocateList(item, item);
+  }
 
-      do {
-        if (_root == NULL) {
-          expand();
-        }
+  // Push the chunks first..last, already linked through next, with a
+  // single CAS.
+  void deallocateList(FreeItem *first, FreeItem *last)
+  {
+    TaggedRoot old;
 
-        // NOTE: _root could still be NULL (if other threads consumed all
-        // blocks that were made available from expand().  In such case, we
-        // loop once again.
+    do {
+      old = root;
+      last->next = rootPtr(old);
+    } while (!__sync_bool_compare_and_swap(&root, old, newRoot(old, first)));
+  }
 
-        /* Atomically does the following operation:
-         *   item = _root;
-         *   _root = item->next;
-         */
-        item = _root;
-      } while (!item ||
-               !__sync_bool_compare_and_swap(&_root, item, item->next));
+  void preExpand()
+  {
+    // Force at least numChunks chunks to become free.
+    const int numAllocs = 10;
+    void *allocatedItem[numAllocs];
 
-      item->next = NULL;
-      return item;
+    for (int i = 0; i < numAllocs; i++) {
+      allocatedItem[i] = allocate();
     }
 
-    // deallocate a chunk of size N
-    void deallocate(void *ptr)
-    {
-      if (ptr == NULL) { return; }
-      FreeItem *item = static_cast<FreeItem *>(ptr);
-      do {
-        /* Atomically does the following operation:
-         *   item->next = _root;
-         *   _root = item;
-         */
-        item->next = _root;
-      } while (!__sync_bool_compare_and_swap(&_root, item->next, item));
+    for (int i = 0; i < numAllocs; i++) {
+      deallocate(allocatedItem[i]);
     }
+  }
 
-    int numExpands()
-    {
-      return _numExpands;
+  // allocate more raw memory when stack is empty
+  void expand()
+  {
+    numExpands++;
+    if (rootPtr(root) != NULL &&
+        fred_record_replay_enabled && fred_record_replay_enabled()) {
+      // TODO: why is expand being called? If you see this message, raise lvl2
+      // allocation level.
+      char expand_msg[] = "\n\n\n******* EXPAND IS CALLED *******\n\n\n";
+      jalib::write(2, expand_msg, sizeof(expand_msg));
+
+      // jalib::fflush(stderr);
+      abort();
     }
+    char *buf = static_cast<char *>(_alloc_raw(blockSize));
+    size_t count = blockSize / chunkSize;
+    for (size_t i = 0; i < count - 1; ++i) {
+      ((FreeItem *)(buf + i * chunkSize))->next =
+        (FreeItem *)(buf + (i + 1) * chunkSize);
+    }
+    deallocateList((FreeItem *)buf, (FreeItem *)(buf + (count - 1) * chunkSize));
+  }
+};
 
-    void preExpand()
-    {
-      // Force at least numChunks chunks to become free.
-      const int numAllocs = 10;
-      void *allocatedItem[numAllocs];
+/* Size classes.  Requests of up to 1 KB keep the historical 64/256/1024
+ * classes; above that, the classes are powers of two up to MAX_CHUNKSIZE, so
+ * that mid-sized buffers waste at most half a chunk instead of going to
+ * mmap().
+ */
+# define NUM_SIZE_CLASSES 9
+
+static JFixedAllocStack allocStacks[NUM_SIZE_CLASSES] = {
+  { 0, 64 }, { 0, 256 }, { 0, 1024 },
+  { 0, 2 * 1024 }, { 0, 4 * 1024 }, { 0, 8 * 1024 },
+  { 0, 16 * 1024 }, { 0, 32 * 1024 }, { 0, MAX_CHUNKSIZE }
+};
 
-      for (int i = 0; i < numAllocs; i++) {
-        allocatedItem[i] = allocate();
-      }
+static inline int
+sizeClass(size_t n)
+{
+  if (n <= 64) {
+    return 0;
+  } else if (n <= 256) {
+    return 1;
+  } else if (n <= 1024) {
+    return 2;
+  }
 
-      // if (_root == NULL) { expand(); }
-      for (int i = 0; i < numAllocs; i++) {
-        deallocate(allocatedItem[i]);
-      }
-    }
+  // ceil(log2(n)) is 11 for 2 KB, the first power-of-two class.
+  int log2n = sizeof(unsigned long) * 8 - __builtin_clzl(n - 1);
+  return 3 + log2n - 11;
+}
 
-  protected:
-    // allocate more raw memory when stack is empty
-    void expand()
-    {
-      _numExpands++;
-      if (_root != NULL &&
-          fred_record_replay_enabled && fred_record_replay_enabled()) {
-        // TODO: why is expand being called? If you see this message, raise lvl2
-        // allocation level.
-        char expand_msg[] = "\n\n\n******* EXPAND IS CALLED *******\n\n\n";
-        jalib::write(2, expand_msg, sizeof(expand_msg));
-
-        // jalib::fflush(stderr);
-        abort();
-      }
-      FreeItem *bufs = static_cast<FreeItem *>(_alloc_raw(_blockSize));
-      int count = _blockSize / sizeof(FreeItem);
-      for (int i = 0; i < count - 1; ++i) {
-        bufs[i].next = bufs + i + 1;
-      }
+/* Each thread caches a few free chunks of each size class in a "magazine",
+ * so that a thread that frees and reallocates chunks does not touch the
+ * shared stacks at all.  A full magazine returns half its chunks to the
+ * shared stack in one CAS; an empty one simply allocates from the shared
+ * stack.  The largest classes are not cached, to bound the memory held by
+ * idle threads.
+ *
+ * A signal handler (e.g., the checkpoint signal) may allocate while the
+ * interrupted code is updating the magazine; the state flag makes such
+ * nested calls go straight to the shared stack.
+ */
+# define MAGAZINE_SIZE 16
+
+static const int magazineCapacity[NUM_SIZE_CLASSES] = {
+  16, 16, 16, 8, 4, 2, 0, 0, 0
+};
 
-      do {
-        /* Atomically does the following operation:
-         *   bufs[count-1].next = _root;
-         *   _root = bufs;
-         */
-        bufs[count - 1].next = _root;
-      } while (!__sync_bool_compare_and_swap(&_root, bufs[count - 1].next,
-                                             bufs));
-    }
+struct Magazine {
+  int count;
+  FreeItem *items[MAGAZINE_SIZE];
+};
 
-  protected:
-    struct FreeItem {
-      union {
-        FreeItem *next;
-        char buf[N];
-      };
-    };
-
-  private:
-    FreeItem *volatile _root;
-    size_t _blockSize;
-    char padding[128];
-    int volatile _numExpands;
+enum MagazineState {
+  MAGAZINE_READY = 0,
+  MAGAZINE_BUSY,
+  MAGAZINE_DISABLED
 };
-} // namespace jalib
 
-jalib::JFixedAllocStack<64>lvl1;
-jalib::JFixedAllocStack<256>lvl2;
-jalib::JFixedAllocStack<1024>lvl3;
-# if MAX_CHUNKSIZE <= 1024
-#  error MAX_CHUNKSIZE must be larger
-# endif // if MAX_CHUNKSIZE <= 1024
-jalib::JFixedAllocStack<MAX_CHUNKSIZE>lvl4;
+static __thread Magazine magazines[NUM_SIZE_CLASSES];
+static __thread int magazineState = MAGAZINE_READY;
+
+static inline void
+compilerBarrier()
+{
+  asm volatile ("" ::: "memory");
+}
+
+// Return the chunks items[keep..count-1] of a magazine to the shared stack.
+static void
+flushMagazine(int idx, int keep)
+{
+  Magazine *mag = &magazines[idx];
+
+  if (mag->count <= keep) {
+    return;
+  }
+  for (int i = keep; i < mag->count - 1; i++) {
+    mag->items[i]->next = mag->items[i + 1];
+  }
+  allocStacks[idx].deallocateList(mag->items[keep], mag->items[mag->count - 1]);
+  mag->count = keep;
+}
+} // namespace jalib
 
 void
 jalib::JAllocDispatcher::initialize(void)
 {
+  size_t smallBlockSize;
+  size_t largeBlockSize;
+
   if (fred_record_replay_enabled != 0 && fred_record_replay_enabled()) {
     /* We need a greater arena size to eliminate mmap() calls that could happen
        at different times for record vs. replay. */
-    lvl1.initialize(1024 * 1024 * 16);
-    lvl2.initialize(1024 * 1024 * 16);
-    lvl3.initialize(1024 * 32 * 16);
-    lvl4.initialize(1024 * 32 * 16);
+    smallBlockSize = 1024 * 1024 * 16;
+    largeBlockSize = 1024 * 32 * 16;
   } else {
 #ifdef MPI
     // MANA: increased initial size to avoid inconsistency in ProcSelfMaps
-    lvl1.initialize(1024 * 1024 * 16);
-    lvl2.initialize(1024 * 1024 * 16);
+    smallBlockSize = 1024 * 1024 * 16;
 #else
-    lvl1.initialize(1024 * 16);
-    lvl2.initialize(1024 * 16);
+    smallBlockSize = 1024 * 16;
 #endif
-    lvl3.initialize(1024 * 32);
-    lvl4.initialize(1024 * 32);
+    largeBlockSize = 1024 * 32;
+  }
+
+  for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+    JFixedAllocStack *stack = &allocStacks[i];
+    if (stack->chunkSize <= 256) {
+      stack->blockSize = smallBlockSize;
+    } else {
+      // At least four chunks per expand().
+      stack->blockSize = largeBlockSize > 4 * stack->chunkSize ?
+                         largeBlockSize : 4 * stack->chunkSize;
+    }
   }
   _initialized = true;
 }
@@ -291,19 +367,27 @@ jalib::JAllocDispatcher::allocate(size_t n)
   if (!_initialized) {
     initialize();
   }
-  void *retVal;
-  if (n <= lvl1.chunkSize()) {
-    retVal = lvl1.allocate();
-  } else if (n <= lvl2.chunkSize()) {
-    retVal = lvl2.allocate();
-  } else if (n <= lvl3.chunkSize()) {
-    retVal = lvl3.allocate();
-  } else if (n <= lvl4.chunkSize()) {
-    retVal = lvl4.allocate();
-  } else {
-    retVal = _alloc_raw(n);
+  if (n > MAX_CHUNKSIZE) {
+    return _alloc_raw(n);
   }
-  return retVal;
+
+  int idx = sizeClass(n);
+  FreeItem *item = NULL;
+  if (magazineState == MAGAZINE_READY) {
+    magazineState = MAGAZINE_BUSY;
+    compilerBarrier();
+    Magazine *mag = &magazines[idx];
+    if (mag->count > 0) {
+      item = mag->items[--mag->count];
+      item->next = NULL;
+    }
+    compilerBarrier();
+    magazineState = MAGAZINE_READY;
+  }
+  if (item == NULL) {
+    return allocStacks[idx].allocate();
+  }
+  return item;
 }
 
 void
@@ -314,33 +398,65 @@ jalib::JAllocDispatcher::deallocate(void *ptr, size_t n)
     jalib::write(2, msg, sizeof(msg));
     abort();
   }
-  if (n <= lvl1.N) {
-    lvl1.deallocate(ptr);
-  } else if (n <= lvl2.N) {
-    lvl2.deallocate(ptr);
-  } else if (n <= lvl3.N) {
-    lvl3.deallocate(ptr);
-  } else if (n <= lvl4.N) {
-    lvl4.deallocate(ptr);
-  } else {
+  if (n > MAX_CHUNKSIZE) {
     _dealloc_raw(ptr, n);
+    return;
+  }
+  if (ptr == NULL) {
+    return;
+  }
+
+  int idx = sizeClass(n);
+  int capacity = magazineCapacity[idx];
+  if (capacity == 0 || magazineState != MAGAZINE_READY) {
+    allocStacks[idx].deallocate(ptr);
+    return;
+  }
+
+  magazineState = MAGAZINE_BUSY;
+  compilerBarrier();
+  Magazine *mag = &magazines[idx];
+  if (mag->count == capacity) {
+    flushMagazine(idx, capacity / 2);
+  }
+  mag->items[mag->count++] = static_cast<FreeItem *>(ptr);
+  compilerBarrier();
+  magazineState = MAGAZINE_READY;
+}
+
+void
+jalib::JAllocDispatcher::threadExit()
+{
+  if (magazineState != MAGAZINE_READY) {
+    return;
+  }
+
+  // Later calls from this thread (e.g., while it unwinds) bypass the
+  // magazines, so that no chunks are stranded when it exits.
+  magazineState = MAGAZINE_DISABLED;
+  compilerBarrier();
+  for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+    flushMagazine(i, 0);
   }
 }
 
 int
 jalib::JAllocDispatcher::numExpands()
 {
-  return lvl1.numExpands() + lvl2.numExpands() +
-         lvl3.numExpands() + lvl4.numExpands();
+  int n = 0;
+
+  for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+    n += allocStacks[i].numExpands;
+  }
+  return n;
 }
 
 void
 jalib::JAllocDispatcher::preExpand()
 {
-  lvl1.preExpand();
-  lvl2.preExpand();
-  lvl3.preExpand();
-  lvl4.preExpand();
+  for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+    allocStacks[i].preExpand();
+  }
 }
 
 #else // ifdef JALIB_ALLOCATOR
@@ -360,6 +476,10 @@ jalib::JAllocDispatcher::deallocate(void *ptr, size_t)
 {
   ::free(ptr);
 }
+
+void
+jalib::JAllocDispatcher::threadExit()
+{}
 #endif // ifdef JALIB_ALLOCATOR
 
 #ifdef OVERRIDE_GLOBAL_ALLOCATOR
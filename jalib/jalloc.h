@@ -55,6 +55,10 @@ class JAllocDispatcher
 
     static int numExpands();
     static void preExpand();
+
+    // Returns the chunks cached by the calling thread to the shared free
+    // lists.  Called once, when the thread exits.
+    static void threadExit();
 };
 
 class JAlloc
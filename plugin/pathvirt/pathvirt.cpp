@@ -13,8 +13,10 @@
 
 #include <dirent.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <sys/mman.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -39,7 +41,12 @@
 #define ENV_NEW_DPP        "DMTCP_NEW_PATH_PREFIX"
 #define MAX_ENV_VAR_SIZE   10*1024
 
-#define VIRTUAL_TO_PHYSICAL_PATH(virt) virtual_to_physical_path(virt)
+/* Translates into buf, a char[PATH_MAX] on the caller's stack, and returns
+ * buf, or returns virt itself if no translation applies. */
+#define VIRTUAL_TO_PHYSICAL_PATH(virt, buf) virtual_to_physical_path(virt, buf)
+
+/* Max. symlinks followed by resolve_symlink() */
+#define MAX_SYMLINK_DEPTH  8
 
 #define _real_open       NEXT_FNC(open)
 #define _real_open64     NEXT_FNC(open64)
@@ -69,10 +76,6 @@
 #define _real_pathconf   NEXT_FNC(pathconf)
 #define _real_statfs     NEXT_FNC(statfs)
 
-/* paths should only be swapped on restarts (not on initial run), so this flag
-   is set on restart */
-static int shouldSwap;
-
 /* NOTE: DMTCP_PATH_PREFIX env variables cannot exceed MAX_ENV_VAR_SIZE
    characters in length */
 static char oldPathPrefixList[MAX_ENV_VAR_SIZE];
@@ -82,8 +85,43 @@ static char newPathPrefixList[MAX_ENV_VAR_SIZE];
 static bool tmpBufferModified = false;
 static pthread_rwlock_t  listRwLock;
 
-static dmtcp::string
-virtual_to_physical_path(const char *virt_path);
+/*
+ * The prefix lists, compiled into a trie of the old prefixes, one node per
+ * character.  A node where an old prefix ends records the prefix's index in
+ * the list, and so, the new prefix to swap in.
+ *
+ * A trie is never modified once published in activeTrie, so the wrappers
+ * read it without a lock.  Paths should only be swapped on restarts (not on
+ * the initial run), so activeTrie stays NULL, and the wrappers return at
+ * once, until a restart (or an exec after a restart) publishes a trie.  The
+ * trie that it replaces may still be in use by a thread that was suspended
+ * in a wrapper; so, it is freed only when the next one is published.
+ */
+typedef struct TrieNode {
+  char c;
+  int firstChild;
+  int nextSibling;
+  int prefixIndex;     // The old prefix that ends here, or -1.
+} TrieNode;
+
+typedef struct PrefixEntry {
+  size_t oldLen;
+  const char *newPrefix;  // NULL if the new list has no element for it
+  size_t newLen;
+} PrefixEntry;
+
+typedef struct PrefixTrie {
+  size_t mapSize;
+  int numNodes;
+  TrieNode *nodes;        // nodes[0] is the root.
+  PrefixEntry *prefixes;
+} PrefixTrie;
+
+static PrefixTrie *activeTrie = NULL;
+static PrefixTrie *retiredTrie = NULL;
+
+static const char *
+virtual_to_physical_path(const char *virt_path, char *buf, int depth = 0);
 
 EXTERNC int dmtcp_pathvirt_enabled() { return 1; }
 
@@ -92,110 +130,153 @@ EXTERNC int dmtcp_pathvirt_enabled() { return 1; }
  */
 
 /*
- * Compare the input path and the path delimited by start and end.
- * Return true if the latter is the prefix of path.
- * */
-
-static bool
-pathsCmp(const char *path,
-         const char *start,
-         const char *end)
+ * Adds the old prefix at 'index' in the list, of length 'len', to the trie.
+ * If a prefix occurs twice, the first one wins, as it would in a linear
+ * search of the list.
+ */
+static void
+trieInsert(PrefixTrie *trie, const char *prefix, size_t len, int index)
 {
-  return (end - start > 0 &&
-          strncmp(path, start, end - start) == 0 &&
-          (path[end - start] == '\0' || // they are equal
-           path[end - start] == '/'));  // path has additional sub dirs
+  int node = 0;
+
+  for (size_t i = 0; i < len; i++) {
+    int child = trie->nodes[node].firstChild;
+    while (child != -1 && trie->nodes[child].c != prefix[i]) {
+      child = trie->nodes[child].nextSibling;
+    }
+    if (child == -1) {
+      child = trie->numNodes++;
+      trie->nodes[child].c = prefix[i];
+      trie->nodes[child].firstChild = -1;
+      trie->nodes[child].nextSibling = trie->nodes[node].firstChild;
+      trie->nodes[child].prefixIndex = -1;
+      trie->nodes[node].firstChild = child;
+    }
+    node = child;
+  }
+  if (trie->nodes[node].prefixIndex == -1) {
+    trie->nodes[node].prefixIndex = index;
+  }
 }
 
 /*
- * clfind - returns first index in colonList which is a prefix for path
- *          modifies the @listPtr to point to the element in colonList
+ * trieMatch - returns the first index in the old prefix list of a prefix of
+ *             path, or -1.  A prefix matches if it is equal to path, or path
+ *             continues with a '/' after it.
  */
 static int
-clfind(const char *colonList,  // IN
-       const char *path,       // IN
-       char **listPtr)         // OUT
-{
-    int index = 0;
-    char *element = const_cast<char *>(colonList);
-    char *colon = NULL;
-
-    /* while there is a colon present, loop */
-    while ((colon = strchr(element, ':'))) {
-        /* check if element is a prefix of path. here, colon - element is
-           an easy way to calculate the length of the element in the list
-           to use as the size parameter to strncmp */
-        if (pathsCmp(path, element, colon)) {
-            JTRACE("Prefix match for path") (element) (path);
-            *listPtr = element;
-            return index;
-        }
-
-        /* move element to point to next element */
-        element = colon + 1;
+trieMatch(const PrefixTrie *trie, const char *path)
+{
+  int best = -1;
+  int node = 0;
 
-        index++;
+  for (const char *p = path; *p != '\0'; p++) {
+    int child = trie->nodes[node].firstChild;
+    while (child != -1 && trie->nodes[child].c != *p) {
+      child = trie->nodes[child].nextSibling;
     }
-
-    /* process the last element in the list */
-    if (pathsCmp(path, element, element + strlen(element))) {
-        JTRACE("Prefix match for path") (element) (path);
-        *listPtr = element;
-        return index;
+    if (child == -1) {
+      break;
     }
+    node = child;
 
-    /* not found */
-    JTRACE("No match found") (colonList) (path);
-    return -1;
+    int index = trie->nodes[node].prefixIndex;
+    if (index != -1 && (p[1] == '\0' || p[1] == '/') &&
+        (best == -1 || index < best)) {
+      best = index;
+    }
+  }
+  return best;
 }
 
 /*
- * clget - returns pointer to element in colonList at index i
- *         and NULL if not found
- *
- * NOTE: argument `int i` is declared signed (versus unsigned) because we
- * commonly expect this argument to be the return value of a `clfind` call. If
- * the `clfind` caller did not check the return value and passes in a negative
- * int, this will harmless fail in a "clean" manner, typewise, rather than
- * "harmlessly" failing due to an underlying signed->unsigned type cast.
+ * Compiles the colon-separated prefix lists into a new trie.  The trie, its
+ * prefix table, and a copy of the new list are placed in one mapping, so that
+ * they can be freed at once, and no malloc arena lock is involved.
  */
-static char*
-clget(const char *colonList, int i)
-{
-    int curr_ind = 0;
-    char *element = const_cast<char *>(colonList);
-    char *colon = NULL;
-
-    /* iterate through elements until last one */
-    while ((colon = strchr(element, ':'))) {
-        /* if we are at the request index, return pointer to start of element */
-        if (curr_ind == i)
-            return element;
-
-        /* otherwise, advance pointer to next element and bump current index */
-        element = colon + 1;
-        curr_ind++;
+static PrefixTrie *
+compilePrefixLists(const char *oldList, const char *newList)
+{
+  size_t oldListLen = strlen(oldList);
+  size_t newListLen = strlen(newList);
+  int maxPrefixes = 1;
+
+  for (const char *p = oldList; *p != '\0'; p++) {
+    maxPrefixes += (*p == ':');
+  }
+
+  size_t size = sizeof(PrefixTrie) +
+                (oldListLen + 1) * sizeof(TrieNode) +
+                maxPrefixes * sizeof(PrefixEntry) +
+                newListLen + 1;
+  void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  JASSERT(addr != MAP_FAILED) (size) (JASSERT_ERRNO);
+
+  PrefixTrie *trie = (PrefixTrie *)addr;
+  trie->mapSize = size;
+  trie->nodes = (TrieNode *)(trie + 1);
+  trie->prefixes = (PrefixEntry *)(trie->nodes + oldListLen + 1);
+  char *newPrefixes = (char *)(trie->prefixes + maxPrefixes);
+  memcpy(newPrefixes, newList, newListLen + 1);
+
+  trie->numNodes = 1;
+  trie->nodes[0].c = '\0';
+  trie->nodes[0].firstChild = -1;
+  trie->nodes[0].nextSibling = -1;
+  trie->nodes[0].prefixIndex = -1;
+
+  /* Empty elements never match, but they still count as an index. */
+  const char *element = oldList;
+  for (int index = 0; index < maxPrefixes; index++) {
+    const char *colon = strchr(element, ':');
+    size_t len = colon ? colon - element : strlen(element);
+    trie->prefixes[index].oldLen = len;
+    trie->prefixes[index].newPrefix = NULL;
+    trie->prefixes[index].newLen = 0;
+    if (len > 0) {
+      trieInsert(trie, element, len, index);
     }
+    element = colon + 1;
+  }
 
-    /* last element */
-    if (curr_ind == i)
-        return element;
+  char *newElement = newPrefixes;
+  for (int index = 0; index < maxPrefixes; index++) {
+    char *colon = strchr(newElement, ':');
+    if (colon != NULL) {
+      *colon = '\0';
+    }
+    trie->prefixes[index].newPrefix = newElement;
+    trie->prefixes[index].newLen = strlen(newElement);
+    if (colon == NULL) {
+      break;
+    }
+    newElement = colon + 1;
+  }
 
-    /* not found */
-    return NULL;
+  return trie;
 }
 
-/*
- * clgetsize - returns size of an element pointed to by @element in the
- *             list
- */
-static size_t
-clgetsize(const char *colonList, const char *element)
+/* Called on restart and after exec, while no other user thread runs. */
+static void
+publishPrefixTrie()
 {
-    /* either calculate the element's length, or call
-     * strlen if element was last one */
-    const char *colon = strchr(element, ':');
-    return colon ? colon - element : strlen(element);
+  PrefixTrie *trie = NULL;
+
+  /* we should only swap if oldPathPrefixList contains something,
+   * meaning DMTCP_PATH_PREFIX was supplied on launch, and
+   * newPathPrefixList contains something, meaning DMTCP_PATH_PREFIX
+   * was supplied on restart.
+   */
+  if (*oldPathPrefixList && *newPathPrefixList) {
+    trie = compilePrefixLists(oldPathPrefixList, newPathPrefixList);
+  }
+
+  if (retiredTrie != NULL) {
+    munmap(retiredTrie, retiredTrie->mapSize);
+  }
+  retiredTrie = activeTrie;
+  __atomic_store_n(&activeTrie, trie, __ATOMIC_RELEASE);
 }
 
 static void
@@ -264,14 +345,11 @@ pathvirtInitialize()
     }
     JTRACE("Old prefix list") (oldPathPrefixList);
 
-    /* we should only swap if oldPathPrefixList contains something,
-     * meaning DMTCP_PATH_PREFIX was supplied on launch, and
-     * newPathPrefixList contains something, meaning DMTCP_PATH_PREFIX
-     * was supplied on restart. this line will run whether
-     * DMTCP_PATH_PREFIX was given on restart or not (ret == -1), so
-     * virtual_to_physical_path can know whether to try to swap or not
+    /* this runs whether DMTCP_PATH_PREFIX was given on restart or not
+     * (ret == -1), so that virtual_to_physical_path knows whether to try
+     * to swap or not
      */
-    shouldSwap = *oldPathPrefixList && *newPathPrefixList;
+    publishPrefixTrie();
 }
 
 EXTERNC void
@@ -307,9 +385,8 @@ get_new_path_prefix_list()
 EXTERNC const char*
 get_virtual_to_physical_path(const char *virt_path)
 {
-  static dmtcp::string temp;
-  temp = VIRTUAL_TO_PHYSICAL_PATH(virt_path);
-  return temp.c_str();
+  static char buf[PATH_MAX];
+  return VIRTUAL_TO_PHYSICAL_PATH(virt_path, buf);
 }
 
 /*
@@ -336,7 +413,7 @@ dmtcp_pathvirt_event_hook(DmtcpEvent_t event, DmtcpEventData_t *data)
     }
     case DMTCP_EVENT_PRE_EXEC:
     {
-      if (shouldSwap) {
+      if (activeTrie != NULL) {
           setenv(ENV_NEW_DPP, newPathPrefixList, 0);
       }
       break;
@@ -362,7 +439,7 @@ dmtcp_pathvirt_event_hook(DmtcpEvent_t event, DmtcpEventData_t *data)
                     "%s", oldPrefixList);
            snprintf(newPathPrefixList, sizeof(newPathPrefixList),
                     "%s", newPrefixList);
-           shouldSwap = *oldPathPrefixList && *newPathPrefixList;
+           publishPrefixTrie();
        }
        break;
     }
@@ -406,8 +483,8 @@ DMTCP_DECL_PLUGIN(pathvirt_plugin);
 static int _open_open64_work(int(*fn) (const char *path, int flags, ...),
                              const char *path, int flags, mode_t mode)
 {
-  dmtcp::string temp = VIRTUAL_TO_PHYSICAL_PATH(path);
-  const char *phys_path = temp.c_str();
+  char phys_buf[PATH_MAX];
+  const char *phys_path = VIRTUAL_TO_PHYSICAL_PATH(path, phys_buf);
 
   int fd = -1;
   fd = (*fn)(phys_path, flags, mode);
@@ -469,8 +546,8 @@ static FILE *_fopen_fopen64_work(FILE*(*fn) (const char *path,
                                              const char *mode),
                                  const char *path, const char *mode)
 {
-  dmtcp::string temp = VIRTUAL_TO_PHYSICAL_PATH(path);
-  const char *phys_path = temp.c_str();
+  char phys_buf[PATH_MAX];
+  const char *phys_path = VIRTUAL_TO_PHYSICAL_PATH(path, phys_buf);
 
   FILE* file = NULL;
   file = (*fn)(phys_path, mode);
@@ -490,8 +567,8 @@ extern "C" FILE *fopen64(const char* path, const char* mode)
 
 extern "C" FILE *freopen(const char *path, const char *mode, FILE *stream)
 {
-  dmtcp::string temp = VIRTUAL_TO_PHYSICAL_PATH(path);
-  const char *phys_path = temp.c_str();
+  char phys_buf[PATH_MAX];
+  const char *phys_path = VIRTUAL_TO_PHYSICAL_PATH(path, phys_buf);
   FILE *file = _real_freopen(phys_path, mode, stream);
 
   return file;
@@ -503,8 +580,8 @@ extern "C" int openat(int dirfd, const char *path, int flags, ...)
   va_start(arg, flags);
   mode_t mode = va_arg(arg, int);
   va_end(arg);
-  dmtcp::string temp = VIRTUAL_TO_PHYSICAL_PATH(path);
-  const char *phys_path = temp.c_str();
+  char phys_buf[PATH_MAX];
+  const char *phys_path = VIRTUAL_TO_PHYSICAL_PATH(path, phys_buf);
   int fd = _real_openat(dirfd, phys_path, flags, mode);
   return fd;
 }
@@ -525,8 +602,8 @@ extern "C" int openat64(int dirfd, const char *path, int flags, ...)
   va_start(arg, flags);
   mode_t mode = va_arg(arg, int);
   va_end(arg);
-  dmtcp::string temp = VIRTUAL_TO_PHYSICAL_PATH(path);
-  const char *phys_path = temp.c_str();
+  char phys_buf[PATH_MAX];
+  const char *phys_path = VIRTUAL_TO_PHYSICAL_PATH(path, phys_buf);
   int fd = _real_openat64(dirfd, phys_path, flags, mode);
   return fd;
 }
@@ -543,8 +620,8 @@ extern "C" int __openat64_2(int dirfd, const char *path, int flags)
 
 extern "C" DIR *opendir(const char *name)
 {
-  dmtcp::string temp = VIRTUAL_TO_PHYSICAL_PATH(name);
-  const char *phys_path = temp.c_str();
+  char phys_buf[PATH_MAX];
+  const char *phys_path = VIRTUAL_TO_PHYSICAL_PATH(name, phys_buf);
   DIR *dir = _real_opendir(phys_path);
   return dir;
 }
@@ -555,8 +632,8 @@ extern "C" int __xstat(int vers, const char *path, struct stat *buf)
   if (retval == -1 && errno == EFAULT) {
     // EFAULT means path or buf was a bad address.  So, we're done.  Return.
   } else {
-    dmtcp::string temp = VIRTUAL_TO_PHYSICAL_PATH(path);
-    const char *phys_path = temp.c_str();
+    char phys_buf[PATH_MAX];
+    const char *phys_path = VIRTUAL_TO_PHYSICAL_PATH(path, phys_buf);
     retval = _real_xstat(vers, phys_path, buf); // Re-do it with correct path.
   }
   return retval;
@@ -568,8 +645,8 @@ extern "C" int __xstat64(int vers, const char *path, struct stat64 *buf)
   if (retval == -1 && errno == EFAULT) {
     // EFAULT means path or buf was a bad address.  So, we're done.  Return.
   } else {
-    dmtcp::string temp = VIRTUAL_TO_PHYSICAL_PATH(path);
-    const char *phys_path = temp.c_str();
+    char phys_buf[PATH_MAX];
+    const char *phys_path = VIRTUAL_TO_PHYSICAL_PATH(path, phys_buf);
     retval = _real_xstat64(vers, phys_path, buf);
   }
   return retval;
@@ -581,8 +658,8 @@ extern "C" int __lxstat(int vers, const char *path, struct stat *buf)
   if (retval == -1 && errno == EFAULT) {
     // EFAULT means path or buf was a bad address.  So, we're done.  Return.
   } else {
-    dmtcp::string temp = VIRTUAL_TO_PHYSICAL_PATH(path);
-    const char *phys_path = temp.c_str();
+    char phys_buf[PATH_MAX];
+    const char *phys_path = VIRTUAL_TO_PHYSICAL_PATH(path, phys_buf);
     retval = _real_lxstat(vers, phys_path, buf);
   }
   return retval;
@@ -594,8 +671,8 @@ extern "C" int __lxstat64(int vers, const char *path, struct stat64 *buf)
   if (retval == -1 && errno == EFAULT) {
     // EFAULT means path or buf was a bad address.  So, we're done.  Return.
   } else {
-    dmtcp::string temp = VIRTUAL_TO_PHYSICAL_PATH(path);
-    const char *phys_path = temp.c_str();
+    char phys_buf[PATH_MAX];
+    const char *phys_path = VIRTUAL_TO_PHYSICAL_PATH(path, phys_buf);
     retval = _real_lxstat64(vers, phys_path, buf);
   }
   return retval;
@@ -603,8 +680,8 @@ extern "C" int __lxstat64(int vers, const char *path, struct stat64 *buf)
 
 extern "C" ssize_t readlink(const char *path, char *buf, size_t bufsiz)
 {
-  dmtcp::string temp = VIRTUAL_TO_PHYSICAL_PATH(path);
-  const char *phys_path = temp.c_str();
+  char phys_buf[PATH_MAX];
+  const char *phys_path = VIRTUAL_TO_PHYSICAL_PATH(path, phys_buf);
   ssize_t retval = _real_readlink(phys_path, buf, bufsiz);
   return retval;
 }
@@ -617,8 +694,8 @@ extern "C" ssize_t __readlink_chk(const char *path, char *buf,
 
 extern "C" char *realpath(const char *path, char *resolved_path)
 {
-  dmtcp::string temp = VIRTUAL_TO_PHYSICAL_PATH(path);
-  const char *phys_path = temp.c_str();
+  char phys_buf[PATH_MAX];
+  const char *phys_path = VIRTUAL_TO_PHYSICAL_PATH(path, phys_buf);
   char *ret = _real_realpath(phys_path, resolved_path);
   return ret;
 }
@@ -641,110 +718,110 @@ extern "C" char *canonicalize_file_name(const char *path)
 
 extern "C" int access(const char *path, int mode)
 {
-  dmtcp::string temp = VIRTUAL_TO_PHYSICAL_PATH(path);
-  const char *phys_path = temp.c_str();
+  char phys_buf[PATH_MAX];
+  const char *phys_path = VIRTUAL_TO_PHYSICAL_PATH(path, phys_buf);
 
   return _real_access(phys_path, mode);
 }
 
 extern "C" int truncate(const char *path, off_t length)
 {
-  dmtcp::string temp = VIRTUAL_TO_PHYSICAL_PATH(path);
-  const char *phys_path = temp.c_str();
+  char phys_buf[PATH_MAX];
+  const char *phys_path = VIRTUAL_TO_PHYSICAL_PATH(path, phys_buf);
 
   return _real_truncate(phys_path, length);
 }
 
 extern "C" int rename(const char *oldpath, const char *newpath)
 {
-  dmtcp::string temp1 = VIRTUAL_TO_PHYSICAL_PATH(oldpath);
-  dmtcp::string temp2 = VIRTUAL_TO_PHYSICAL_PATH(newpath);
-  const char *old_phys_path = temp1.c_str();
-  const char *new_phys_path = temp2.c_str();
+  char phys_buf1[PATH_MAX];
+  char phys_buf2[PATH_MAX];
+  const char *old_phys_path = VIRTUAL_TO_PHYSICAL_PATH(oldpath, phys_buf1);
+  const char *new_phys_path = VIRTUAL_TO_PHYSICAL_PATH(newpath, phys_buf2);
 
   return _real_rename(old_phys_path, new_phys_path);
 }
 
 extern "C" int mkdir(const char *path, mode_t mode)
 {
-  dmtcp::string temp = VIRTUAL_TO_PHYSICAL_PATH(path);
-  const char *phys_path = temp.c_str();
+  char phys_buf[PATH_MAX];
+  const char *phys_path = VIRTUAL_TO_PHYSICAL_PATH(path, phys_buf);
 
   return _real_mkdir(phys_path, mode);
 }
 
 extern "C" int chmod(const char *path, mode_t mode)
 {
-  dmtcp::string temp = VIRTUAL_TO_PHYSICAL_PATH(path);
-  const char *phys_path = temp.c_str();
+  char phys_buf[PATH_MAX];
+  const char *phys_path = VIRTUAL_TO_PHYSICAL_PATH(path, phys_buf);
 
   return _real_chmod(phys_path, mode);
 }
 
 extern "C" int unlink(const char *path)
 {
-  dmtcp::string temp = VIRTUAL_TO_PHYSICAL_PATH(path);
-  const char *phys_path = temp.c_str();
+  char phys_buf[PATH_MAX];
+  const char *phys_path = VIRTUAL_TO_PHYSICAL_PATH(path, phys_buf);
 
   return _real_unlink(phys_path);
 }
 
 extern "C" int chdir(const char *path)
 {
-  dmtcp::string temp = VIRTUAL_TO_PHYSICAL_PATH(path);
-  const char *phys_path = temp.c_str();
+  char phys_buf[PATH_MAX];
+  const char *phys_path = VIRTUAL_TO_PHYSICAL_PATH(path, phys_buf);
 
   return _real_chdir(phys_path);
 }
 
 extern "C" int remove(const char *path)
 {
-  dmtcp::string temp = VIRTUAL_TO_PHYSICAL_PATH(path);
-  const char *phys_path = temp.c_str();
+  char phys_buf[PATH_MAX];
+  const char *phys_path = VIRTUAL_TO_PHYSICAL_PATH(path, phys_buf);
 
   return _real_remove(phys_path);
 }
 
 extern "C" int rmdir(const char *path)
 {
-  dmtcp::string temp = VIRTUAL_TO_PHYSICAL_PATH(path);
-  const char *phys_path = temp.c_str();
+  char phys_buf[PATH_MAX];
+  const char *phys_path = VIRTUAL_TO_PHYSICAL_PATH(path, phys_buf);
 
   return _real_rmdir(phys_path);
 }
 
 extern "C" int link(const char *oldpath, const char *newpath)
 {
-  dmtcp::string temp1 = VIRTUAL_TO_PHYSICAL_PATH(oldpath);
-  dmtcp::string temp2 = VIRTUAL_TO_PHYSICAL_PATH(newpath);
-  const char *old_phys_path = temp1.c_str();
-  const char *new_phys_path = temp2.c_str();
+  char phys_buf1[PATH_MAX];
+  char phys_buf2[PATH_MAX];
+  const char *old_phys_path = VIRTUAL_TO_PHYSICAL_PATH(oldpath, phys_buf1);
+  const char *new_phys_path = VIRTUAL_TO_PHYSICAL_PATH(newpath, phys_buf2);
 
   return _real_link(old_phys_path, new_phys_path);
 }
 
 extern "C" int symlink(const char *oldpath, const char *newpath)
 {
-  dmtcp::string temp1 = VIRTUAL_TO_PHYSICAL_PATH(oldpath);
-  dmtcp::string temp2 = VIRTUAL_TO_PHYSICAL_PATH(newpath);
-  const char *old_phys_path = temp1.c_str();
-  const char *new_phys_path = temp2.c_str();
+  char phys_buf1[PATH_MAX];
+  char phys_buf2[PATH_MAX];
+  const char *old_phys_path = VIRTUAL_TO_PHYSICAL_PATH(oldpath, phys_buf1);
+  const char *new_phys_path = VIRTUAL_TO_PHYSICAL_PATH(newpath, phys_buf2);
 
   return _real_symlink(old_phys_path, new_phys_path);
 }
 
 extern "C" long pathconf(const char *path, int name)
 {
-  dmtcp::string temp = VIRTUAL_TO_PHYSICAL_PATH(path);
-  const char *phys_path = temp.c_str();
+  char phys_buf[PATH_MAX];
+  const char *phys_path = VIRTUAL_TO_PHYSICAL_PATH(path, phys_buf);
 
   return _real_pathconf(phys_path, name);
 }
 
 extern "C" int statfs(const char *path, struct statfs *buf)
 {
-  dmtcp::string temp = VIRTUAL_TO_PHYSICAL_PATH(path);
-  const char *phys_path = temp.c_str();
+  char phys_buf[PATH_MAX];
+  const char *phys_path = VIRTUAL_TO_PHYSICAL_PATH(path, phys_buf);
 
   return _real_statfs(phys_path, buf);
 }
@@ -752,18 +829,26 @@ extern "C" int statfs(const char *path, struct statfs *buf)
 /*
  * Resolve the path if path is a symbolic link
  *
- * path should be a physical path.
+ * path should be a physical path.  The result is placed in buf, unless it is
+ * path itself.
  */
-static dmtcp::string
-resolve_symlink(const char *path)
+static const char *
+resolve_symlink(const char *path, char *buf, int depth)
 {
   struct stat statBuf;
-  if (_real_lxstat(_STAT_VER, path, &statBuf) == 0
-      && S_ISLNK(statBuf.st_mode)) {
-    char buf[PATH_MAX];
-    memset(buf, 0, sizeof(buf));
-    JASSERT(_real_readlink(path, buf, sizeof(buf) - 1) != -1);
-    return virtual_to_physical_path(buf);
+  if (depth < MAX_SYMLINK_DEPTH &&
+      _real_lxstat(_STAT_VER, path, &statBuf) == 0 &&
+      S_ISLNK(statBuf.st_mode)) {
+    char target[PATH_MAX];
+    memset(target, 0, sizeof(target));
+    JASSERT(_real_readlink(path, target, sizeof(target) - 1) != -1);
+    const char *phys_path =
+      virtual_to_physical_path(target, buf, depth + 1);
+    if (phys_path == target) {
+      strcpy(buf, target);
+      phys_path = buf;
+    }
+    return phys_path;
   }
 
   return path;
@@ -772,9 +857,9 @@ resolve_symlink(const char *path)
 /*
  * virtual_to_physical_path - translate virtual to physical path
  *
- * Returns a dmtcp::string for the corresponding physical path to the given
- * virtual path. If no path translation occurred, the given virtual path
- * will simply be returned as a dmtcp::string.
+ * Returns the corresponding physical path to the given virtual path, written
+ * into buf (of size PATH_MAX).  If no path translation occurred, the given
+ * virtual path itself is returned.
  *
  * Conceptually, an original path prior to the first checkpoint is considered a
  * "virtual path".  After a restart, it will be substituted using the latest
@@ -784,52 +869,42 @@ resolve_symlink(const char *path)
  * virtual path to the latest "physical path", which will correspond to the
  * current, post-restart filesystem.
  */
-dmtcp::string
-virtual_to_physical_path(const char *virt_path)
+static const char *
+virtual_to_physical_path(const char *virt_path, char *buf, int depth)
 {
-    char *oldPathPtr = NULL;
-    dmtcp::string virtPathString(virt_path?virt_path:"");
-    dmtcp::string physPathString;
+    const PrefixTrie *trie = __atomic_load_n(&activeTrie, __ATOMIC_ACQUIRE);
 
     /* quickly return if no swap or NULL path */
-    if (!shouldSwap || !virt_path) {
-        return virtPathString;
+    if (trie == NULL || virt_path == NULL) {
+        return virt_path;
     }
 
     /* yes, should swap */
 
-    pthread_rwlock_rdlock(&listRwLock);
     /* check if path is in list of registered paths to swap out */
-    int index = clfind(oldPathPrefixList, virt_path, &oldPathPtr);
+    int index = trieMatch(trie, virt_path);
     if (index == -1) {
-      pthread_rwlock_unlock(&listRwLock);
-      return resolve_symlink(virtPathString.c_str());
+      return resolve_symlink(virt_path, buf, depth);
     }
 
-    /* found it in old list, now get a pointer to the new prefix to swap in*/
-    char *physPathPtr = clget(newPathPrefixList, index);
-    if (physPathPtr == NULL) {
-        pthread_rwlock_unlock(&listRwLock);
-        return virtPathString;
+    /* found it in old list, now get the new prefix to swap in */
+    const PrefixEntry *entry = &trie->prefixes[index];
+    if (entry->newPrefix == NULL) {
+        return virt_path;
     }
 
-    size_t newElementSz = clgetsize(newPathPrefixList, physPathPtr);
-    size_t oldElementSz = clgetsize(oldPathPrefixList, oldPathPtr);
-
-    /* temporarily null terminate new element */
-    physPathPtr[newElementSz] = '\0';
-
     /* finally, create full path with the new prefix swapped in */
-    physPathString = physPathPtr;
-    physPathString += "/";
-    physPathString += (virt_path + oldElementSz);
-    JTRACE("Matching virtual path to real path")
-      (virtPathString) (physPathString);
-
-    /* repair the colon list */
-    physPathPtr[newElementSz] = ':';
-
-    pthread_rwlock_unlock(&listRwLock);
+    const char *rest = virt_path + entry->oldLen;
+    size_t restLen = strlen(rest);
+    if (entry->newLen + 1 + restLen >= PATH_MAX) {
+        JWARNING(false) (virt_path) (entry->newPrefix)
+          .Text("Translated path too long; not translating it");
+        return virt_path;
+    }
+    memcpy(buf, entry->newPrefix, entry->newLen);
+    buf[entry->newLen] = '/';
+    memcpy(buf + entry->newLen + 1, rest, restLen + 1);
+    JTRACE("Matching virtual path to real path") (virt_path) (buf);
 
-    return resolve_symlink(physPathString.c_str());
+    return resolve_symlink(buf, buf, depth);
 }
@@ -43,7 +43,9 @@ class BarrierInfo
       callback(barrier.callback),
       callback2(barrier.callback2),
       id(barrier.id),
-      pluginName(_pluginName)
+      pluginName(_pluginName),
+      execTime(0),
+      cbExecTime(0)
     {}
 
     string toString() const
@@ -79,10 +81,11 @@ class BarrierInfo
     void (*callback2)(const void* );
     const string id;
     const string pluginName;
-#ifdef TIMING
+
+    // Seconds spent, at the last checkpoint or restart, waiting for the
+    // barrier to be released and then in the callbacks.
     double execTime;
     double cbExecTime;
-#endif
 };
 
 static inline ostream&
@@ -0,0 +1,201 @@
+/****************************************************************************
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#include "ckptmetrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "jassert.h"
+#include "constants.h"
+#include "coordinatorapi.h"
+#include "dmtcp.h"
+#include "dmtcpalloc.h"
+#include "util.h"
+
+#define MAX_METRICS     256
+#define MAX_METRIC_NAME 96
+
+using namespace dmtcp;
+
+typedef struct Metric {
+  char name[MAX_METRIC_NAME];
+  double value;
+} Metric;
+
+static Metric metrics[MAX_METRICS];
+static int numMetrics = 0;
+static int metricsLock = 0;
+static int isEnabled = -1;
+
+static const char *areaClassNames[CkptMetrics::AREA_NUM_CLASSES] = {
+  "heap", "stack", "anon", "file", "shm"
+};
+
+static void
+lockMetrics()
+{
+  while (__sync_lock_test_and_set(&metricsLock, 1)) {
+    while (metricsLock) {}
+  }
+}
+
+static void
+unlockMetrics()
+{
+  __sync_lock_release(&metricsLock);
+}
+
+bool
+CkptMetrics::enabled()
+{
+  if (isEnabled == -1) {
+    const char *env = getenv(ENV_VAR_METRICS);
+    isEnabled = (env == NULL || strcmp(env, "0") != 0);
+  }
+  return isEnabled;
+}
+
+uint64_t
+CkptMetrics::now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+double
+CkptMetrics::elapsed(uint64_t start)
+{
+  return (now() - start) / 1e9;
+}
+
+void
+CkptMetrics::reset()
+{
+  lockMetrics();
+  numMetrics = 0;
+  unlockMetrics();
+}
+
+void
+CkptMetrics::add(const char *name, double value)
+{
+  if (!enabled()) {
+    return;
+  }
+
+  lockMetrics();
+  int i;
+  for (i = 0; i < numMetrics; i++) {
+    if (strncmp(metrics[i].name, name, MAX_METRIC_NAME - 1) == 0) {
+      break;
+    }
+  }
+  if (i == numMetrics) {
+    if (numMetrics == MAX_METRICS) {
+      unlockMetrics();
+      return;
+    }
+    strncpy(metrics[i].name, name, MAX_METRIC_NAME - 1);
+    metrics[i].name[MAX_METRIC_NAME - 1] = '\0';
+    metrics[i].value = 0;
+    numMetrics++;
+  }
+  metrics[i].value += value;
+  unlockMetrics();
+}
+
+void
+CkptMetrics::add(const char *prefix,
+                 const char *name,
+                 const char *suffix,
+                 double value)
+{
+  char buf[MAX_METRIC_NAME];
+
+  if (!enabled()) {
+    return;
+  }
+  snprintf(buf, sizeof(buf), "%s%s%s", prefix, name, suffix);
+  add(buf, value);
+}
+
+void
+CkptMetrics::recordArea(AreaClass cls,
+                        size_t bytes,
+                        size_t zeroBytes,
+                        uint64_t start)
+{
+  const char *name = areaClassNames[cls];
+
+  if (!enabled()) {
+    return;
+  }
+  add("area.", name, ".count", 1);
+  add("area.", name, ".bytes", bytes);
+  add("area.", name, ".zero_bytes", zeroBytes);
+  add("area.", name, ".write_s", elapsed(start));
+}
+
+// MANA checkpoints each rank into <ckptdir>/ckpt_rank_<N>.  The coordinator
+// labels the metrics of a process with its rank, if known.
+static long
+mpiRank()
+{
+  const char *dir = dmtcp_get_ckpt_dir();
+  const char *base;
+
+  if (dir == NULL) {
+    return -1;
+  }
+  base = strrchr(dir, '/');
+  base = (base == NULL) ? dir : base + 1;
+  if (!Util::strStartsWith(base, "ckpt_rank_")) {
+    return -1;
+  }
+
+  char *end;
+  long rank = strtol(base + strlen("ckpt_rank_"), &end, 10);
+  return *end == '\0' ? rank : -1;
+}
+
+void
+CkptMetrics::sendToCoordinator()
+{
+  if (!enabled() || dmtcp_no_coordinator()) {
+    reset();
+    return;
+  }
+
+  // One "name,value" line per metric.
+  char line[MAX_METRIC_NAME + 32];
+  snprintf(line, sizeof(line), "rank,%ld\n", mpiRank());
+  string data = line;
+  lockMetrics();
+  for (int i = 0; i < numMetrics; i++) {
+    snprintf(line, sizeof(line), "%s,%.15g\n",
+             metrics[i].name, metrics[i].value);
+    data += line;
+  }
+  numMetrics = 0;
+  unlockMetrics();
+
+  CoordinatorAPI::sendMsgToCoordinator(DmtcpMessage(DMT_METRICS), data);
+}
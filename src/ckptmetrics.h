@@ -0,0 +1,71 @@
+/****************************************************************************
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#ifndef CKPTMETRICS_H
+#define CKPTMETRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Checkpoint/restart phase metrics.
+ *
+ * Unlike the JTIMERs, which exist only in a --enable-timing build, these are
+ * always collected (unless DMTCP_METRICS=0).  Each process accumulates named
+ * values (seconds, bytes, counts) during a checkpoint or restart, and sends
+ * them to the coordinator just before it reports itself RUNNING again.  The
+ * coordinator aggregates them across all processes; see
+ * 'dmtcp_command --metrics'.
+ *
+ * The metrics are kept in a fixed-size table, so that recording a value never
+ * allocates memory; writeckpt.cpp records per-area values while it walks
+ * /proc/self/maps.
+ */
+namespace dmtcp
+{
+namespace CkptMetrics
+{
+enum AreaClass {
+  AREA_HEAP,
+  AREA_STACK,
+  AREA_ANON,
+  AREA_FILE,
+  AREA_SHM,
+  AREA_NUM_CLASSES
+};
+
+bool enabled();
+
+// Monotonic clock, in nanoseconds.
+uint64_t now();
+
+// Seconds elapsed since 'start', a value returned by now().
+double elapsed(uint64_t start);
+
+void reset();
+void add(const char *name, double value);
+void add(const char *prefix, const char *name, const char *suffix,
+         double value);
+void recordArea(AreaClass cls, size_t bytes, size_t zeroBytes,
+                uint64_t start);
+
+// Sends the metrics of the current checkpoint or restart to the coordinator,
+// and resets them.
+void sendToCoordinator();
+}
+}
+#endif // ifndef CKPTMETRICS_H
@@ -40,9 +40,17 @@
 #endif // ifdef __aarch64__
 #include <fcntl.h>
 #include <signal.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#include "../jalib/jfilesystem.h"
+#include "mtcp/mtcp_crc32c.h"
+#include "mtcp/mtcp_header.h"
 #include "ckptserializer.h"
 #include "constants.h"
+#include "coordinatorapi.h"
 #include "dmtcp.h"
 #include "protectedfds.h"
 #include "syscallwrappers.h"
@@ -68,6 +76,21 @@ static struct sigaction saved_sigchld_action;
 static int open_ckpt_to_write(int fd, int pipe_fds[2], char **extcomp_args);
 void mtcp_writememoryareas(int fd) __attribute__((weak));
 
+/* In-process (DMTCP_LZ) compression.  The scratch buffer holds one
+ * compressed block followed by the hash table of the encoder.  It is mapped
+ * MAP_SHARED so that the kernel never merges it with a neighboring area, and
+ * writeckpt.cpp can skip it by its address.
+ */
+#define LZ_HASH_BITS    14
+#define LZ_HASH_SIZE    (1 << LZ_HASH_BITS)
+#define LZ_MAX_OFFSET   65535
+#define LZ_LAST_LITERALS 5
+#define LZ_MFLIMIT      12
+#define LZ_SCRATCH_SIZE (MTCP_LZ_BLOCK_SIZE + LZ_HASH_SIZE * sizeof(uint32_t))
+
+static bool use_lz_compression = false;
+static char *lzScratch = NULL;
+
 /* We handle SIGCHLD while checkpointing. */
 static void
 default_sigchld_handler(int sig)
@@ -234,6 +257,11 @@ perform_open_ckpt_image_fd(const char *tempCkptFilename,
   return fd;
 #endif // ifdef FAST_RST_VIA_MMAP
 
+  /* The memory areas are already compressed in process. */
+  if (use_lz_compression) {
+    return fd;
+  }
+
   /* 2. Test if using GZIP/HBICT compression */
   /* 2a. Test if using GZIP compression */
   int use_gzip_compression = 0;
@@ -414,17 +442,169 @@ CkptSerializer::createCkptDir()
   .Text("ERROR: Missing execute- or write-access to checkpoint dir");
 }
 
+/* Multi-level checkpointing (--local-ckptdir): the image is written to a
+ * fast node-local directory, and the process resumes as soon as that is done.
+ * A detached grandchild then copies ("drains") the image to the ckpt dir, and
+ * tells the coordinator, which reports a checkpoint generation as durable once
+ * all of its images have been drained.  The drains of all processes on a node
+ * take turns on a lock file in the local directory, so that they do not
+ * compete for the bandwidth of the shared filesystem.
+ */
+static string lastLocalCkptFilename;
+
+static const char *
+local_ckpt_dir()
+{
+  const char *dir = getenv(ENV_VAR_LOCAL_CKPT_DIR);
+
+  return (dir != NULL && dir[0] != '\0') ? dir : NULL;
+}
+
+static void
+create_local_ckpt_dir(const char *dir)
+{
+  JASSERT(mkdir(dir, S_IRWXU) == 0 || errno == EEXIST)
+    (JASSERT_ERRNO) (dir)
+  .Text("Error creating node-local checkpoint directory");
+
+  JASSERT(0 == access(dir, X_OK | W_OK)) (dir)
+  .Text("ERROR: Missing execute- or write-access to node-local ckpt dir");
+}
+
+/* Copies the image to dest.temp, and renames it into place, as
+ * writeCkptImage() does.
+ */
+static bool
+copy_ckpt_image(int srcFd, const string &dest)
+{
+  string tempDest = dest + ".temp";
+  int destFd = _real_open(tempDest.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0600);
+
+  if (destFd == -1) {
+    JWARNING(false) (tempDest) (JASSERT_ERRNO).Text("Error creating file.");
+    return false;
+  }
+
+  off_t offset = 0;
+  ssize_t rc;
+  while ((rc = sendfile(destFd, srcFd, &offset, 1 << 30)) > 0) {}
+  if (rc == -1 && offset == 0 && (errno == EINVAL || errno == ENOSYS)) {
+    // No sendfile() between these two filesystems.
+    char buf[64 * 1024];
+    while ((rc = Util::readAll(srcFd, buf, sizeof(buf))) > 0) {
+      if (Util::writeAll(destFd, buf, rc) != rc) {
+        rc = -1;
+        break;
+      }
+    }
+  }
+
+  bool success = rc == 0 && fsync(destFd) == 0;
+  JWARNING(success) (dest) (JASSERT_ERRNO)
+    .Text("Error copying checkpoint image from node-local ckpt dir");
+  _real_close(destFd);
+  if (success) {
+    success = rename(tempDest.c_str(), dest.c_str()) == 0;
+  } else {
+    unlink(tempDest.c_str());
+  }
+  return success;
+}
+
+static void
+drain_ckpt_image(const string &localFilename, const string &ckptFilename)
+{
+  uint32_t generation = ProcessInfo::instance().get_generation();
+
+  // We are not a client of the coordinator.  Don't hold the connection of
+  // the checkpointed process open.
+  _real_close(PROTECTED_COORD_FD);
+
+  // Open the image before waiting for the lock, since the next checkpoint may
+  // replace it in the meantime.
+  int srcFd = _real_open(localFilename.c_str(), O_RDONLY, 0);
+  JWARNING(srcFd != -1) (localFilename) (JASSERT_ERRNO);
+  if (srcFd == -1) {
+    return;
+  }
+
+  string lockFilename = string(local_ckpt_dir()) + "/.dmtcp-drain.lock";
+  int lockFd = _real_open(lockFilename.c_str(), O_CREAT | O_RDWR, 0600);
+  if (lockFd != -1) {
+    // Released when we exit.
+    while (flock(lockFd, LOCK_EX) == -1 && errno == EINTR) {}
+  }
+
+  // flock() is not FIFO: the drain of a newer checkpoint of this process may
+  // have gone first.  If the local image is no longer the one we opened, a
+  // newer one replaced it, and its drain will copy (or has copied) that
+  // instead; copying ours now could rename older content over it.
+  struct stat srcStat;
+  struct stat localStat;
+  if (fstat(srcFd, &srcStat) == 0 &&
+      stat(localFilename.c_str(), &localStat) == 0 &&
+      (srcStat.st_dev != localStat.st_dev ||
+       srcStat.st_ino != localStat.st_ino)) {
+    JTRACE("newer local image; skipping drain") (localFilename) (generation);
+    _real_close(srcFd);
+    return;
+  }
+
+  if (copy_ckpt_image(srcFd, ckptFilename)) {
+    CoordinatorAPI::sendCkptDurable(generation, ckptFilename);
+  }
+  _real_close(srcFd);
+}
+
+static void
+start_drain(const string &localFilename, const string &ckptFilename)
+{
+  if (forked_ckpt_status == FORKED_CKPT_CHILD) {
+    // Already a detached grandchild.
+    drain_ckpt_image(localFilename, ckptFilename);
+    return;
+  }
+
+  prepare_sigchld_handler();
+  pid_t cpid = _real_sys_fork();
+  if (cpid == -1) {
+    JWARNING(false) (JASSERT_ERRNO)
+    .Text("Failed to fork; draining checkpoint image before resuming");
+    sigaction(SIGCHLD, &saved_sigchld_action, NULL);
+    drain_ckpt_image(localFilename, ckptFilename);
+  } else if (cpid > 0) {
+    restore_sigchld_handler_and_wait_for_zombie(cpid);
+  } else {
+    if (_real_sys_fork() != 0) {
+      _exit(0); /* child exits */
+    }
+
+    /* grandchild continues; no need now to waitpid() on grandchild */
+    drain_ckpt_image(localFilename, ckptFilename);
+    _exit(0);
+  }
+}
+
 // See comments above for open_ckpt_to_read()
 void
 CkptSerializer::writeCkptImage(void *mtcpHdr, size_t mtcpHdrLen)
 {
   string ckptFilename = ProcessInfo::instance().getCkptFilename();
-  string tempCkptFilename = ckptFilename;
+  const char *localDir = local_ckpt_dir();
 
-  tempCkptFilename += ".temp";
+  // With a node-local ckpt dir, the image is written there first.
+  string imageFilename = ckptFilename;
+  if (localDir != NULL) {
+    imageFilename = string(localDir) + "/" +
+                    jalib::Filesystem::BaseName(ckptFilename);
+  }
+  string tempCkptFilename = imageFilename + ".temp";
 
   JTRACE("Thread performing checkpoint.") (dmtcp_gettid());
   createCkptDir();
+  if (localDir != NULL) {
+    create_local_ckpt_dir(localDir);
+  }
   forked_ckpt_status = test_and_prepare_for_forked_ckpt();
   if (forked_ckpt_status == FORKED_CKPT_PARENT) {
     JTRACE("*** Using forked checkpointing.\n");
@@ -438,19 +618,39 @@ CkptSerializer::writeCkptImage(void *mtcpHdr, size_t mtcpHdrLen)
   int fdCkptFileOnDisk = -1;
   int fd = -1;
 
+#ifndef FAST_RST_VIA_MMAP
+  const char *lzEnv = getenv(ENV_VAR_LZ_COMPRESSION);
+  use_lz_compression = lzEnv != NULL && strcmp(lzEnv, "1") == 0;
+#endif // ifndef FAST_RST_VIA_MMAP
+
   fd = perform_open_ckpt_image_fd(tempCkptFilename.c_str(), &use_compression,
                                   &fdCkptFileOnDisk);
   JASSERT(fdCkptFileOnDisk >= 0);
   JASSERT(use_compression || fd == fdCkptFileOnDisk);
 
   // The rest of this function is for compatibility with original definition.
-  writeDmtcpHeader(fd);
+  uint32_t dmtcpHeaderChecksum = writeDmtcpHeader(fd);
 
   // Write MTCP header
+  JASSERT(mtcpHdrLen == sizeof(MtcpHeader)) (mtcpHdrLen);
+  MtcpHeader *hdr = (MtcpHeader *)mtcpHdr;
+  hdr->checksummed = 1;
+  hdr->dmtcpHeaderChecksum = dmtcpHeaderChecksum;
+  hdr->headerChecksum = 0;
+  hdr->headerChecksum = mtcp_crc32c(0, hdr, sizeof(*hdr));
   JASSERT(Util::writeAll(fd, mtcpHdr, mtcpHdrLen) == (ssize_t)mtcpHdrLen);
 
   JTRACE("MTCP is about to write checkpoint image.")(ckptFilename);
+  if (use_lz_compression) {
+    lzScratch = (char *)mmap(NULL, LZ_SCRATCH_SIZE, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    JASSERT(lzScratch != MAP_FAILED) (JASSERT_ERRNO);
+  }
   mtcp_writememoryareas(fd);
+  if (lzScratch != NULL) {
+    JASSERT(munmap(lzScratch, LZ_SCRATCH_SIZE) == 0) (JASSERT_ERRNO);
+    lzScratch = NULL;
+  }
 
   if (use_compression) {
     /* In perform_open_ckpt_image_fd(), we set SIGCHLD to our own handler.
@@ -469,7 +669,18 @@ CkptSerializer::writeCkptImage(void *mtcpHdr, size_t mtcpHdrLen)
    * checkpoint file.  Uses rename() syscall, which doesn't change i-nodes.
    * So, gzip process can continue to write to file even after renaming.
    */
-  JASSERT(rename(tempCkptFilename.c_str(), ckptFilename.c_str()) == 0);
+  JASSERT(rename(tempCkptFilename.c_str(), imageFilename.c_str()) == 0);
+
+  if (localDir != NULL) {
+    // With --unique-ckpt, each generation has a new name.  Keep only the
+    // newest image on the node.
+    if (!lastLocalCkptFilename.empty() &&
+        lastLocalCkptFilename != imageFilename) {
+      unlink(lastLocalCkptFilename.c_str());
+    }
+    lastLocalCkptFilename = imageFilename;
+    start_drain(imageFilename, ckptFilename);
+  }
 
   if (forked_ckpt_status == FORKED_CKPT_CHILD) {
     // Use _exit() instead of exit() to avoid popping atexit() handlers
@@ -480,14 +691,33 @@ CkptSerializer::writeCkptImage(void *mtcpHdr, size_t mtcpHdrLen)
   JTRACE("checkpoint complete");
 }
 
-void
+// Computes the checksum of the ProcessInfo as it is serialized.
+class ChecksumWriter : public jalib::JBinarySerializeWriterRaw
+{
+  public:
+    ChecksumWriter(int fd, uint32_t crc)
+      : jalib::JBinarySerializeWriterRaw("", fd), _crc(crc) {}
+
+    void readOrWrite(void *buffer, size_t len)
+    {
+      jalib::JBinarySerializeWriterRaw::readOrWrite(buffer, len);
+      _crc = mtcp_crc32c(_crc, buffer, len);
+    }
+
+    uint32_t crc() const { return _crc; }
+
+  private:
+    uint32_t _crc;
+};
+
+uint32_t
 CkptSerializer::writeDmtcpHeader(int fd)
 {
   const ssize_t len = strlen(DMTCP_FILE_HEADER);
 
   JASSERT(write(fd, DMTCP_FILE_HEADER, len) == len);
 
-  jalib::JBinarySerializeWriterRaw wr("", fd);
+  ChecksumWriter wr(fd, mtcp_crc32c(0, DMTCP_FILE_HEADER, len));
   ProcessInfo::instance().serialize(wr);
   ssize_t written = len + wr.bytes();
 
@@ -495,5 +725,156 @@ CkptSerializer::writeDmtcpHeader(int fd)
   const ssize_t pagesize = Util::pageSize();
   ssize_t remaining = pagesize - (written % pagesize);
   char buf[remaining];
+  memset(buf, 0, remaining);
   JASSERT(Util::writeAll(fd, buf, remaining) == remaining);
+  return mtcp_crc32c(wr.crc(), buf, remaining);
+}
+
+static inline uint32_t
+lz_read32(const unsigned char *p)
+{
+  uint32_t v;
+
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint32_t
+lz_hash(uint32_t v)
+{
+  return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+static inline unsigned char *
+lz_write_length(unsigned char *op, size_t len)
+{
+  for (; len >= 255; len -= 255) {
+    *op++ = 255;
+  }
+  *op++ = (unsigned char)len;
+  return op;
+}
+
+/* Greedy LZ77 encoder for the format described in mtcp_header.h.  Returns
+ * the compressed size, or 0 if the block does not compress to fewer than
+ * srcLen bytes.  dst must hold srcLen bytes.
+ */
+static size_t
+lz_compress(const unsigned char *src, size_t srcLen,
+            unsigned char *dst, uint32_t *table)
+{
+  const unsigned char *ip = src;
+  const unsigned char *anchor = src;
+  const unsigned char *iend = src + srcLen;
+  const unsigned char *mflimit = iend - LZ_MFLIMIT;
+  const unsigned char *matchlimit = iend - LZ_LAST_LITERALS;
+  unsigned char *op = dst;
+  unsigned char *olimit = dst + srcLen - 1;
+
+  memset(table, 0, LZ_HASH_SIZE * sizeof(uint32_t));
+  if (srcLen > LZ_MFLIMIT) {
+    ip++;
+    while (ip < mflimit) {
+      uint32_t seq = lz_read32(ip);
+      uint32_t h = lz_hash(seq);
+      const unsigned char *match = src + table[h];
+      table[h] = (uint32_t)(ip - src);
+      if (match >= ip || ip - match > LZ_MAX_OFFSET ||
+          lz_read32(match) != seq) {
+        ip += 1 + ((ip - anchor) >> 6);
+        continue;
+      }
+
+      const unsigned char *mend = ip + MTCP_LZ_MIN_MATCH;
+      const unsigned char *m = match + MTCP_LZ_MIN_MATCH;
+      while (mend < matchlimit && *mend == *m) {
+        mend++;
+        m++;
+      }
+
+      size_t litLen = ip - anchor;
+      size_t matchLen = mend - ip - MTCP_LZ_MIN_MATCH;
+      // token + literals + length bytes + offset
+      if (op + 1 + litLen + litLen / 255 + 1 + 2 + matchLen / 255 + 1
+          > olimit) {
+        return 0;
+      }
+
+      unsigned char *token = op++;
+      *token = (unsigned char)((litLen >= 15 ? 15 : litLen) << 4);
+      if (litLen >= 15) {
+        op = lz_write_length(op, litLen - 15);
+      }
+      memcpy(op, anchor, litLen);
+      op += litLen;
+
+      size_t offset = ip - match;
+      *op++ = (unsigned char)(offset & 0xff);
+      *op++ = (unsigned char)(offset >> 8);
+      *token |= (unsigned char)(matchLen >= 15 ? 15 : matchLen);
+      if (matchLen >= 15) {
+        op = lz_write_length(op, matchLen - 15);
+      }
+
+      ip = anchor = mend;
+    }
+  }
+
+  // Last sequence: literals only.
+  size_t litLen = iend - anchor;
+  if (op + 1 + litLen + litLen / 255 + 1 > olimit) {
+    return 0;
+  }
+  *op++ = (unsigned char)((litLen >= 15 ? 15 : litLen) << 4);
+  if (litLen >= 15) {
+    op = lz_write_length(op, litLen - 15);
+  }
+  memcpy(op, anchor, litLen);
+  op += litLen;
+  return op - dst;
+}
+
+bool
+CkptSerializer::lzCompressionEnabled()
+{
+  return lzScratch != NULL;
+}
+
+bool
+CkptSerializer::isLzScratchArea(const void *addr)
+{
+  return lzScratch != NULL && addr == lzScratch;
+}
+
+// Writes the contents of a memory area as a sequence of MtcpLzBlockHeader
+// and (possibly compressed) data; see mtcp_header.h.
+uint32_t
+CkptSerializer::writeLzCompressed(int fd, const void *addr, size_t size)
+{
+  const unsigned char *src = (const unsigned char *)addr;
+  unsigned char *dst = (unsigned char *)lzScratch;
+  uint32_t *table = (uint32_t *)(lzScratch + MTCP_LZ_BLOCK_SIZE);
+  uint32_t crc = 0;
+
+  JASSERT(lzScratch != NULL);
+  while (size > 0) {
+    MtcpLzBlockHeader blk;
+    blk.size = size < MTCP_LZ_BLOCK_SIZE ? size : MTCP_LZ_BLOCK_SIZE;
+    blk.compressedSize = lz_compress(src, blk.size, dst, table);
+
+    const void *data = dst;
+    if (blk.compressedSize == 0) {
+      blk.compressedSize = blk.size;
+      data = src;
+    }
+    JASSERT(Util::writeAll(fd, &blk, sizeof(blk)) == sizeof(blk))
+      (JASSERT_ERRNO);
+    JASSERT(Util::writeAll(fd, data, blk.compressedSize) ==
+            (ssize_t)blk.compressedSize) (JASSERT_ERRNO);
+    crc = mtcp_crc32c(crc, &blk, sizeof(blk));
+    crc = mtcp_crc32c(crc, data, blk.compressedSize);
+    src += blk.size;
+    size -= blk.size;
+  }
+  return crc;
 }
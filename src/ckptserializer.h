@@ -33,7 +33,16 @@ namespace CkptSerializer
 int openCkptFileToWrite(const string &path);
 void createCkptDir();
 void writeCkptImage(void *mtcpHdr, size_t mtcpHdrLen);
-void writeDmtcpHeader(int fd);
+
+// Returns the checksum of the header, recorded in the MTCP header.
+uint32_t writeDmtcpHeader(int fd);
+
+// In-process compression of memory areas (DMTCP_LZ).
+bool lzCompressionEnabled();
+bool isLzScratchArea(const void *addr);
+
+// Returns the checksum of the bytes written.
+uint32_t writeLzCompressed(int fd, const void *addr, size_t size);
 }
 }
 #endif // ifndef CKPT_SERIZLIZER_H
@@ -81,6 +81,7 @@
 #define ENV_VAR_HIJACK_LIBS         "DMTCP_HIJACK_LIBS"
 #define ENV_VAR_HIJACK_LIBS_M32     "DMTCP_HIJACK_LIBS_M32"
 #define ENV_VAR_CHECKPOINT_DIR      "DMTCP_CHECKPOINT_DIR"
+#define ENV_VAR_LOCAL_CKPT_DIR      "DMTCP_LOCAL_CKPT_DIR"
 #define ENV_VAR_TMPDIR              "DMTCP_TMPDIR"
 #define ENV_VAR_CKPT_OPEN_FILES     "DMTCP_CKPT_OPEN_FILES"
 #define ENV_VAR_ALLOW_OVERWRITE_WITH_CKPTED_FILES \
@@ -98,12 +99,15 @@
                                     "DMTCP_SKIP_WRITING_TEXT_SEGMENTS"
 
 #define ENV_VAR_COORD_LOGFILE       "DMTCP_COORD_LOG_FILENAME"
+#define ENV_VAR_AGGREGATOR_SOCKET   "DMTCP_AGGREGATOR_SOCKET"
 
 // it is not yet safe to change these; these names are hard-wired in the code
 #define ENV_VAR_STDERR_PATH         "JALIB_STDERR_PATH"
 #define ENV_VAR_COMPRESSION         "DMTCP_GZIP"
+#define ENV_VAR_LZ_COMPRESSION      "DMTCP_LZ"
 #define ENV_VAR_ALLOC_PLUGIN        "DMTCP_ALLOC_PLUGIN"
 #define ENV_VAR_DL_PLUGIN           "DMTCP_DL_PLUGIN"
+#define ENV_VAR_METRICS             "DMTCP_METRICS"
 #ifdef HBICT_DELTACOMP
   # define ENV_VAR_DELTACOMPRESSION "DMTCP_HBICT"
   # define ENV_DELTACOMPRESSION     ENV_VAR_DELTACOMPRESSION
@@ -135,19 +139,23 @@
   ENV_VAR_HIJACK_LIBS_M32,            \
   ENV_VAR_PLUGIN,                     \
   ENV_VAR_CHECKPOINT_DIR,             \
+  ENV_VAR_LOCAL_CKPT_DIR,             \
   ENV_VAR_TMPDIR,                     \
   ENV_VAR_CKPT_OPEN_FILES,            \
   ENV_VAR_QUIET,                      \
   ENV_VAR_STDERR_PATH,                \
   ENV_VAR_COMPRESSION,                \
+  ENV_VAR_LZ_COMPRESSION,             \
   ENV_VAR_ALLOC_PLUGIN,               \
   ENV_VAR_DL_PLUGIN,                  \
+  ENV_VAR_METRICS,                    \
   ENV_VAR_SIGCKPT,                    \
   ENV_VAR_SCREENDIR,                  \
   ENV_VAR_DLSYM_OFFSET,               \
   ENV_VAR_DLSYM_OFFSET_M32,           \
   ENV_VAR_VIRTUAL_PID,                \
   ENV_VAR_SKIP_WRITING_TEXT_SEGMENTS, \
+  ENV_VAR_AGGREGATOR_SOCKET,          \
   ENV_DELTACOMPRESSION
 
 #define DMTCP_RESTART_CMD       "dmtcp_restart"
@@ -155,6 +163,9 @@
 #define RESTART_SCRIPT_BASENAME "dmtcp_restart_script"
 #define RESTART_SCRIPT_EXT      "sh"
 
+#define RESTART_MANIFEST_BASENAME "dmtcp_restart_manifest"
+#define RESTART_MANIFEST_EXT      "bin"
+
 #define DMTCP_FILE_HEADER       "DMTCP_CHECKPOINT_IMAGE_v2.0\n"
 
 // #define MIN_SIGNAL 1
@@ -24,12 +24,15 @@
 
 #include "coordinatorapi.h"
 #include <arpa/inet.h>
+#include <algorithm>
 #include <fcntl.h>
 #include <netdb.h>
 #include <poll.h>
+#include <pthread.h>
 #include <semaphore.h>  // for sem_post(&sem_launch)
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include "../jalib/jconvert.h"
 #include "../jalib/jfilesystem.h"
@@ -52,6 +55,22 @@ namespace CoordinatorAPI {
 const int coordinatorSocket = PROTECTED_COORD_FD;
 int nsSock = -1;
 
+// A child of fork() does not wait for the coordinator to accept it; the
+// reply is read before any other message; see recvPendingHandshake().
+static bool _handshakePending = false;
+static pthread_mutex_t _handshakeLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Virtual pids for the children of this process, reserved from the
+// coordinator a block at a time; see getVirtualPidForChild().  The blocks
+// grow from VIRTUAL_PID_BLOCK_MIN pids, so that a process that forks a few
+// times does not hold many.
+#define VIRTUAL_PID_BLOCK_MIN 4
+#define VIRTUAL_PID_BLOCK_MAX 64
+static pid_t _virtualPidBlock[VIRTUAL_PID_BLOCK_MAX];
+static uint32_t _virtualPidBlockSize = 0;
+static uint32_t _virtualPidBlockNext = 0;
+static uint32_t _virtualPidBlockRequest = VIRTUAL_PID_BLOCK_MIN;
+
 static bool _firstTime = true;
 static const char *_cachedHost = NULL;
 static int _cachedPort = 0;
@@ -66,6 +85,9 @@ DmtcpMessage sendRecvHandshake(int fd,
                                DmtcpMessage msg,
                                string progname,
                                UniquePid *compId = NULL);
+void sendHandshake(int fd, DmtcpMessage msg, string progname);
+void checkHandshakeReply(const DmtcpMessage &msg, UniquePid *compId);
+void recvPendingHandshake();
 
 void sendMsgToCoordinatorRaw(int fd,
                              DmtcpMessage msg,
@@ -94,6 +116,11 @@ eventHook(DmtcpEvent_t event, DmtcpEventData_t *data)
       init();
       break;
 
+    case DMTCP_EVENT_PRE_EXEC:
+      // The new program would take the reply for a message to it.
+      recvPendingHandshake();
+      break;
+
     case DMTCP_EVENT_EXIT:
       JTRACE("exit() in progress, disconnecting from dmtcp coordinator");
       closeConnection();
@@ -125,11 +152,22 @@ pluginDescr()
   return coordinatorAPIPlugin;
 }
 
+static void
+resetVirtualPidBlock()
+{
+  _virtualPidBlockSize = 0;
+  _virtualPidBlockNext = 0;
+  _virtualPidBlockRequest = VIRTUAL_PID_BLOCK_MIN;
+}
+
 void
 restart()
 {
   _real_close(nsSock);
   nsSock = -1;
+
+  // The pids were reserved from the coordinator of the checkpoint.
+  resetVirtualPidBlock();
 }
 
 void
@@ -217,6 +255,61 @@ createNewSocketToCoordinator(CoordinatorMode mode)
   return jalib::JClientSocket(host.c_str(), port).sockfd();
 }
 
+/* With DMTCP_AGGREGATOR_SOCKET set, a process connects to the aggregator of
+ * its node (see dmtcp_aggregator.cpp), which has the only connection of the
+ * node to the coordinator.  Returns -1 if no aggregator is listening.  The
+ * name-service connection and the one-shot requests still go directly to
+ * the coordinator; the name-service requests made while not running (as at
+ * restart) go through the aggregator, on coordinatorSocket.
+ */
+static int
+createNewSocketToAggregator()
+{
+  const char *path = getenv(ENV_VAR_AGGREGATOR_SOCKET);
+  struct sockaddr_un addr;
+
+  if (path == NULL || strlen(path) >= sizeof(addr.sun_path)) {
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  int sockfd = _real_socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sockfd == -1) {
+    return -1;
+  }
+  if (_real_connect(sockfd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    JTRACE("Aggregator not found; connecting to the coordinator")
+      (path) (JASSERT_ERRNO);
+    _real_close(sockfd);
+    return -1;
+  }
+  return sockfd;
+}
+
+// Records the address of the coordinator: the peer of the connection to it,
+// or, through an aggregator, the address of the coordinator host and port.
+static void
+setCoordAddr(CoordinatorInfo *coordInfo)
+{
+  coordInfo->addrLen = sizeof(coordInfo->addr);
+  JASSERT(getpeername(coordinatorSocket,
+                      (struct sockaddr *)&coordInfo->addr,
+                      &coordInfo->addrLen) == 0)
+    (JASSERT_ERRNO);
+
+  if (coordInfo->addr.ss_family == AF_UNIX) {
+    string host = "";
+    int port = UNINITIALIZED_PORT;
+    getCoordHostAndPort(COORD_ANY, host, &port);
+    jalib::JSockAddr coordAddr(host.c_str(), port);
+    JASSERT(coordAddr.addrcnt() > 0) (host) (port);
+    coordInfo->addrLen = coordAddr.addrlen();
+    memcpy(&coordInfo->addr, coordAddr.addr(), coordInfo->addrLen);
+  }
+}
+
 void init()
 {
   JTRACE("Informing coordinator of new process") (UniquePid::ThisProcess());
@@ -232,6 +325,11 @@ void resetOnFork(int sock)
   Util::changeFd(sock, PROTECTED_COORD_FD);
   JASSERT(Util::isValidFd(coordinatorSocket));
 
+  // The parent might have held the lock in its checkpoint thread.
+  pthread_mutex_init(&_handshakeLock, NULL);
+  _handshakePending = true;
+  resetVirtualPidBlock();
+
   JTRACE("Informing coordinator of new process") (UniquePid::ThisProcess());
 
   DmtcpMessage msg(DMT_UPDATE_PROCESS_INFO_AFTER_FORK);
@@ -374,6 +472,10 @@ recvMsgFromCoordinatorRaw(int fd, DmtcpMessage *msg, void **extraData)
     sem_launch_first_time = false;
   }
 
+  if (fd == coordinatorSocket) {
+    recvPendingHandshake();
+  }
+
   if (Util::readAll(fd, msg, sizeof(*msg)) != sizeof(*msg)) {
     // Perhaps the process is exit()'ing.
     return;
@@ -500,7 +602,13 @@ void
 createNewConnToCoord(CoordinatorMode mode)
 {
   int sockfd = -1;
-  if (mode & COORD_JOIN) {
+  if (!(mode & COORD_NEW)) {
+    sockfd = createNewSocketToAggregator();
+  }
+
+  if (sockfd != -1) {
+    JTRACE("Connected to the coordinator through the aggregator");
+  } else if (mode & COORD_JOIN) {
     sockfd = createNewSocketToCoordinator(mode);
     JASSERT(sockfd != -1) (JASSERT_ERRNO)
       .Text("Coordinator not found, but --join was specified. Exiting.");
@@ -526,11 +634,8 @@ createNewConnToCoord(CoordinatorMode mode)
   JASSERT(Util::isValidFd(coordinatorSocket));
 }
 
-DmtcpMessage
-sendRecvHandshake(int fd,
-                  DmtcpMessage msg,
-                  string progname,
-                  UniquePid *compId)
+void
+sendHandshake(int fd, DmtcpMessage msg, string progname)
 {
   if (dmtcp_virtual_to_real_pid) {
     msg.realPid = dmtcp_virtual_to_real_pid(getpid());
@@ -548,8 +653,11 @@ sendRecvHandshake(int fd,
   strcpy(&buf[hostname.length() + 1], progname.c_str());
 
   sendMsgToCoordinatorRaw(fd, msg, buf, buflen);
+}
 
-  recvMsgFromCoordinatorRaw(fd, &msg);
+void
+checkHandshakeReply(const DmtcpMessage &msg, UniquePid *compId)
+{
   msg.assertValid();
   if (msg.type == DMT_KILL_PEER) {
     JTRACE("Received KILL message from coordinator, exiting");
@@ -578,9 +686,35 @@ sendRecvHandshake(int fd,
         (coordinatorPort);
   }
   JASSERT(msg.type == DMT_ACCEPT)(msg.type);
+}
+
+DmtcpMessage
+sendRecvHandshake(int fd,
+                  DmtcpMessage msg,
+                  string progname,
+                  UniquePid *compId)
+{
+  sendHandshake(fd, msg, progname);
+  recvMsgFromCoordinatorRaw(fd, &msg);
+  checkHandshakeReply(msg, compId);
   return msg;
 }
 
+void
+recvPendingHandshake()
+{
+  JASSERT(_real_pthread_mutex_lock(&_handshakeLock) == 0) (JASSERT_ERRNO);
+  if (_handshakePending) {
+    DmtcpMessage msg;
+    msg.poison();
+    JASSERT(Util::readAll(coordinatorSocket, &msg, sizeof(msg)) == sizeof(msg))
+      (JASSERT_ERRNO).Text("Coordinator closed the connection of new process");
+    checkHandshakeReply(msg, NULL);
+    _handshakePending = false;
+  }
+  JASSERT(_real_pthread_mutex_unlock(&_handshakeLock) == 0) (JASSERT_ERRNO);
+}
+
 void
 connectToCoordOnStartup(CoordinatorMode mode,
                         string progname,
@@ -615,14 +749,59 @@ connectToCoordOnStartup(CoordinatorMode mode,
   *compId = hello_remote.compGroup.upid();
   coordInfo->id = hello_remote.from.upid();
   coordInfo->timeStamp = hello_remote.coordTimeStamp;
-  coordInfo->addrLen = sizeof (coordInfo->addr);
-  JASSERT(getpeername(coordinatorSocket,
-                      (struct sockaddr*) &coordInfo->addr,
-                      &coordInfo->addrLen) == 0)
-    (JASSERT_ERRNO);
+  setCoordAddr(coordInfo);
   memcpy(localIP, &hello_remote.ipAddr, sizeof hello_remote.ipAddr);
 }
 
+// Returns a virtual pid reserved for a child of this process.  It is called
+// only from the fork() wrapper, under the exclusive wrapper-execution lock.
+static pid_t
+getVirtualPidForChild()
+{
+  if (_virtualPidBlockNext < _virtualPidBlockSize) {
+    return _virtualPidBlock[_virtualPidBlockNext++];
+  }
+
+  DmtcpMessage msg(DMT_RESERVE_VIRTUAL_PIDS);
+  msg.virtualPid = getpid();
+  msg.numPeers = _virtualPidBlockRequest;
+
+  if (nsSock == -1) {
+    nsSock = createNewSocketToCoordinator(COORD_ANY);
+    JASSERT(nsSock != -1);
+    nsSock = Util::changeFd(nsSock, PROTECTED_NS_FD);
+    JASSERT(nsSock == PROTECTED_NS_FD);
+    DmtcpMessage m(DMT_NAME_SERVICE_WORKER);
+    JASSERT(Util::writeAll(nsSock, &m, sizeof(m)) == sizeof(m));
+  }
+
+  JASSERT(Util::writeAll(nsSock, &msg, sizeof(msg)) == sizeof(msg));
+  msg.poison();
+  JASSERT(Util::readAll(nsSock, &msg, sizeof(msg)) == sizeof(msg));
+  msg.assertValid();
+  JASSERT(msg.type == DMT_RESERVE_VIRTUAL_PIDS_RESPONSE &&
+          msg.extraBytes > 0 &&
+          msg.extraBytes <= sizeof(_virtualPidBlock)) (msg.type)
+    (msg.extraBytes);
+  JASSERT(Util::readAll(nsSock, _virtualPidBlock, msg.extraBytes) ==
+          msg.extraBytes);
+  JTRACE("Reserved virtual pids from coordinator")
+    (msg.extraBytes / sizeof(pid_t));
+
+  _virtualPidBlockSize = msg.extraBytes / sizeof(pid_t);
+  _virtualPidBlockNext = 0;
+  _virtualPidBlockRequest = std::min(2 * _virtualPidBlockRequest,
+                                     (uint32_t)VIRTUAL_PID_BLOCK_MAX);
+  return _virtualPidBlock[_virtualPidBlockNext++];
+}
+
+/* The child's virtual pid comes from a block reserved by this process, and
+ * the DMT_NEW_WORKER message is sent, but the reply is left for the child
+ * to read; see recvPendingHandshake().  So, fork() waits for the
+ * coordinator only once per block.  The connection is made now, so that the
+ * coordinator, or the aggregator, has it queued before this process can next
+ * reach a barrier; see DmtcpCoordinator::acceptPendingConnections().
+ */
 int
 createNewConnectionBeforeFork(string& progname)
 {
@@ -630,22 +809,27 @@ createNewConnectionBeforeFork(string& progname)
   .Text("Process attempted to call fork() while in --no-coordinator mode\n"
         "  Because the coordinator is embedded in a single process,\n"
         "    DMTCP will not work with multiple processes.");
-  struct sockaddr_storage addr;
-  uint32_t len;
-  SharedData::getCoordAddr((struct sockaddr *)&addr, &len);
-  socklen_t addrlen = len;
-  int sock = jalib::JClientSocket((struct sockaddr *)&addr, addrlen);
+  pid_t virtualPid = getVirtualPidForChild();
+
+  int sock = createNewSocketToAggregator();
+  if (sock == -1) {
+    struct sockaddr_storage addr;
+    uint32_t len;
+    SharedData::getCoordAddr((struct sockaddr *)&addr, &len);
+    socklen_t addrlen = len;
+    sock = jalib::JClientSocket((struct sockaddr *)&addr, addrlen);
+  }
   JASSERT(sock != -1);
 
   DmtcpMessage hello_local(DMT_NEW_WORKER);
-  DmtcpMessage hello_remote = sendRecvHandshake(sock, hello_local, progname);
-  JASSERT(hello_remote.virtualPid != -1);
+  hello_local.virtualPid = virtualPid;
+  sendHandshake(sock, hello_local, progname);
 
   if (dmtcp_virtual_to_real_pid) {
-    JTRACE("Got virtual pid from coordinator") (hello_remote.virtualPid);
+    JTRACE("Using reserved virtual pid") (virtualPid);
     pid_t pid = getpid();
     pid_t realPid = dmtcp_virtual_to_real_pid(pid);
-    Util::setVirtualPidEnvVar(hello_remote.virtualPid, pid, realPid);
+    Util::setVirtualPidEnvVar(virtualPid, pid, realPid);
   }
   return sock;
 }
@@ -680,11 +864,7 @@ connectToCoordOnRestart(CoordinatorMode  mode,
   if (coordInfo != NULL) {
     coordInfo->id = hello_remote.from.upid();
     coordInfo->timeStamp = hello_remote.coordTimeStamp;
-    coordInfo->addrLen = sizeof(coordInfo->addr);
-    JASSERT(getpeername(coordinatorSocket,
-                        (struct sockaddr *)&coordInfo->addr,
-                        &coordInfo->addrLen) == 0)
-      (JASSERT_ERRNO);
+    setCoordAddr(coordInfo);
   }
   if (localIP != NULL) {
     memcpy(localIP, &hello_remote.ipAddr, sizeof hello_remote.ipAddr);
@@ -694,7 +874,7 @@ connectToCoordOnRestart(CoordinatorMode  mode,
 }
 
 void
-sendCkptFilename()
+sendCkptFilename(void *libsStart, void *libsEnd, void *highMemStart)
 {
   if (noCoordinator()) {
     return;
@@ -717,17 +897,68 @@ sendCkptFilename()
   }
   JTRACE("recording filenames") (ckptFilename) (hostname) (shellType);
 
+  // For MPI, also send the memory layout information from the MTCP header,
+  // so that the coordinator can write the checkpoint manifest.
+  char mpiInfo[64] = "";
+  if (libsStart != NULL && highMemStart != NULL) {
+    snprintf(mpiInfo, sizeof(mpiInfo), "%lx,%lx,%lx",
+             (unsigned long)libsStart, (unsigned long)libsEnd,
+             (unsigned long)highMemStart);
+  }
+
+  // With --local-ckptdir, the image is still being drained to ckptFilename.
+  string localFilename;
+  const char *localDir = getenv(ENV_VAR_LOCAL_CKPT_DIR);
+  if (localDir != NULL && localDir[0] != '\0') {
+    localFilename = string(localDir) + "/" +
+                    jalib::Filesystem::BaseName(ckptFilename);
+  }
+
   size_t buflen = hostname.length() + shellType.length() +
-                  ckptFilename.length() + 3;
+                  ckptFilename.length() + strlen(mpiInfo) +
+                  localFilename.length() + 5;
   char buf[buflen];
   strcpy(buf, ckptFilename.c_str());
   strcpy(&buf[ckptFilename.length() + 1], shellType.c_str());
   strcpy(&buf[ckptFilename.length() + 1 + shellType.length() + 1],
          hostname.c_str());
+  strcpy(&buf[ckptFilename.length() + 1 + shellType.length() + 1 +
+              hostname.length() + 1],
+         mpiInfo);
+  strcpy(&buf[ckptFilename.length() + 1 + shellType.length() + 1 +
+              hostname.length() + 1 + strlen(mpiInfo) + 1],
+         localFilename.c_str());
 
   sendMsgToCoordinator(msg, buf, buflen);
 }
 
+void
+sendCkptDurable(uint32_t generation, const string &ckptFilename)
+{
+  if (noCoordinator()) {
+    return;
+  }
+
+  // "<generation>\0<ckptFilename>\0"
+  string data = jalib::XToString(generation);
+  data += '\0';
+  data += ckptFilename;
+  data += '\0';
+
+  DmtcpMessage msg(DMT_CKPT_DURABLE);
+  msg.extraBytes = data.length();
+
+  int sock = createNewSocketToCoordinator(COORD_ANY);
+  JWARNING(sock != -1) (JASSERT_ERRNO)
+    .Text("Failed to connect to the coordinator");
+  if (sock == -1) {
+    return;
+  }
+  Util::writeAll(sock, &msg, sizeof(msg));
+  Util::writeAll(sock, data.c_str(), data.length());
+  _real_close(sock);
+}
+
 int
 sendKeyValPairToCoordinator(const char *id,
                             const void *key,
@@ -926,6 +1157,65 @@ sendQueryAllToCoordinator(const char *id, void **buf, int *len)
   return -1;
 }
 
+// Sends all keys in one DMT_NAME_SERVICE_QUERY_BATCH message, and reads the
+// values into the caller's buffer; see LookupService::respondToBatchQuery().
+int
+sendQueriesToCoordinator(const char *id,
+                         const void *keys,
+                         uint32_t key_len,
+                         uint32_t num_keys,
+                         void *buf,
+                         uint32_t *len)
+{
+  DmtcpMessage msg(DMT_NAME_SERVICE_QUERY_BATCH);
+
+  JWARNING(strlen(id) < sizeof(msg.nsid));
+  strncpy(msg.nsid, id, sizeof msg.nsid);
+  msg.keyLen = key_len;
+  msg.valLen = 0;
+  msg.extraBytes = key_len * num_keys;
+  int sock = coordinatorSocket;
+
+  if (keys == NULL || key_len == 0 || num_keys == 0 || buf == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (dmtcp_is_running_state()) {
+    if (nsSock == -1) {
+      nsSock = createNewSocketToCoordinator(COORD_ANY);
+      JASSERT(nsSock != -1);
+      nsSock = Util::changeFd(nsSock, PROTECTED_NS_FD);
+      JASSERT(nsSock == PROTECTED_NS_FD);
+      DmtcpMessage m(DMT_NAME_SERVICE_WORKER);
+      JASSERT(Util::writeAll(nsSock, &m, sizeof(m)) == sizeof(m));
+    }
+    sock = nsSock;
+  }
+
+  JASSERT(Util::writeAll(sock, &msg, sizeof(msg)) == sizeof(msg));
+  JASSERT(Util::writeAll(sock, keys, msg.extraBytes) ==
+          (ssize_t)msg.extraBytes);
+  msg.poison();
+
+  JASSERT(Util::readAll(sock, &msg, sizeof(msg)) == sizeof(msg));
+  msg.assertValid();
+  JASSERT(msg.type == DMT_NAME_SERVICE_QUERY_BATCH_RESPONSE &&
+          msg.extraBytes == msg.valLen);
+
+  if (*len < msg.extraBytes) {
+    // Drain the reply, so that there's no stale data on the socket.
+    void *tmp = JALLOC_HELPER_MALLOC(msg.extraBytes);
+    JASSERT(Util::readAll(sock, tmp, msg.extraBytes) == msg.extraBytes);
+    JALLOC_HELPER_FREE(tmp);
+    errno = ERANGE;
+    return -1;
+  }
+  JASSERT(Util::readAll(sock, buf, msg.extraBytes) == msg.extraBytes);
+  *len = msg.extraBytes;
+  return 0;
+}
+
 /*
  * Setup a virtual coordinator. It's part of the running process (i.e., no
  * separate process is created).
@@ -80,7 +80,15 @@ char *connectAndSendUserCommand(char c,
 void updateCoordCkptDir(const char *dir);
 string getCoordCkptDir(void);
 
-void sendCkptFilename();
+// The MPI memory bounds, if known, are recorded in the checkpoint manifest.
+void sendCkptFilename(void *libsStart = NULL,
+                      void *libsEnd = NULL,
+                      void *highMemStart = NULL);
+
+// Called by the process that copied a checkpoint image of the given
+// generation from the node-local ckpt dir to the ckpt dir.  It uses a new
+// connection, since that process is not a client of the coordinator.
+void sendCkptDurable(uint32_t generation, const string &ckptFilename);
 
 int sendKeyValPairToCoordinator(const char *id,
                                 const void *key,
@@ -100,6 +108,12 @@ int getUniqueIdFromCoordinator(const char *id,
                                uint32_t offset = 1);
 
 int sendQueryAllToCoordinator(const char *id, void **buf, int *len);
+int sendQueriesToCoordinator(const char *id,
+                             const void *keys,
+                             uint32_t key_len,
+                             uint32_t num_keys,
+                             void *buf,
+                             uint32_t *len);
 
 } // namespace CoordinatorAPI
 } // namespace dmtcp
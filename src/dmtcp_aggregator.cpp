@@ -0,0 +1,571 @@
+/****************************************************************************
+ *   Copyright (C) 2006-2013 by Jason Ansel, Kapil Arya, and Gene Cooperman *
+ *   jansel@csail.mit.edu, kapil@ccs.neu.edu, gene@ccs.neu.edu              *
+ *                                                                          *
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+/****************************************************************************
+ * A per-node aggregator between the workers of a node and the coordinator. *
+ * The workers connect to it over a UNIX socket (DMTCP_AGGREGATOR_SOCKET),  *
+ *   and it has a single TCP connection to the coordinator, opened with a   *
+ *   DMT_AGGREGATOR hello.                                                  *
+ * Each worker gets a route, a small number in DmtcpMessage::route, so that *
+ *   the coordinator can tell the workers apart on that one connection.  A  *
+ *   message of a worker is passed up with its route; a reply is passed     *
+ *   down to the worker of its route.                                       *
+ * Barriers:  a DMT_OK of a worker is held until every worker of the node   *
+ *   has sent one (or for HOLD_TIMEOUT_MS at most); then all of them go up  *
+ *   in one DMT_AGGREGATED_OK, with their routes as extra data.  A message  *
+ *   that the coordinator broadcasts comes once, with the route             *
+ *   DMTCPMESSAGE_ROUTE_BROADCAST, and is passed down to every worker that  *
+ *   the coordinator accepted.  So, a barrier costs the coordinator one     *
+ *   message in and one out per node, rather than per process.              *
+ * A worker that is gone is reported with DMT_WORKER_DISCONNECTED; the      *
+ *   coordinator sends the same message to have one closed (a rejected      *
+ *   worker).  If the coordinator is gone, so is the aggregator, and the    *
+ *   workers see their connections closed.                                  *
+ * Other messages are passed up one at a time, in order: the DMT_OKs held   *
+ *   are sent first, so that the coordinator sees the messages of each      *
+ *   worker in the order they were sent.  This includes the name-service    *
+ *   requests that a worker sends while it is not running (as during        *
+ *   restart); the coordinator answers them with the route of the request.  *
+ *   A running worker has its own name-service connection.                  *
+ ****************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../jalib/jassert.h"
+#include "../jalib/jconvert.h"
+#include "../jalib/jsocket.h"
+#include "constants.h"
+#include "coordinatorapi.h"
+#include "dmtcpalloc.h"
+#include "dmtcpmessagetypes.h"
+#include "util.h"
+
+#define BINARY_NAME "dmtcp_aggregator"
+
+using namespace dmtcp;
+
+static const char *theUsage =
+  "Usage: dmtcp_aggregator [OPTIONS]\n"
+  "Passes the messages of the processes of this node to and from the\n"
+  "dmtcp_coordinator over a single connection, and combines their arrivals\n"
+  "at each checkpoint and restart barrier into one message.\n"
+  "Processes use it if DMTCP_AGGREGATOR_SOCKET is set to its socket.\n\n"
+  "Options:\n"
+  "  -h, --coord-host HOSTNAME (environment variable DMTCP_COORD_HOST)\n"
+  "      Hostname where dmtcp_coordinator is run (default: localhost)\n"
+  "  -p, --coord-port PORT_NUM (environment variable DMTCP_COORD_PORT)\n"
+  "      Port where dmtcp_coordinator is run (default: "
+                                                STRINGIFY(DEFAULT_PORT) ")\n"
+  "  --socket PATH (environment variable DMTCP_AGGREGATOR_SOCKET)\n"
+  "      UNIX socket to listen on for the processes of this node\n"
+  "  --daemon\n"
+  "      Run silently in the background after detaching from the parent "
+  "process.\n"
+  "  --help:\n"
+  "      Print this message and exit.\n"
+  "  --version:\n"
+  "      Print version information and exit.\n"
+  "\n"
+  HELP_AND_CONTACT_INFO
+  "\n";
+
+// How long a DMT_OK is held for the other workers of the node, at most; a
+// worker that is late to a barrier only costs the others an extra message.
+#define HOLD_TIMEOUT_MS 100
+#define MAX_EVENTS      256
+
+// The epoll data of the listener and of the coordinator; that of a worker is
+// its route.
+#define LISTENER_EVENT    0
+#define COORDINATOR_EVENT DMTCPMESSAGE_ROUTE_BROADCAST
+
+struct LocalWorker {
+  int fd;
+  uint32_t route;
+  bool accepted;  // The coordinator accepted it; it gets the broadcasts.
+  bool arrived;   // Its DMT_OK is held for the next DMT_AGGREGATED_OK.
+  WorkerState::eWorkerState state;
+};
+
+static jalib::JSocket coordSock(-1);
+static int listenFd = -1;
+static int epollFd = -1;
+static string socketPath;
+
+static map<uint32_t, LocalWorker *>workers;
+static uint32_t nextRoute = 1;
+static size_t numArrived = 0;
+static uint64_t firstArrivalTime = 0;
+
+static uint64_t
+monotonicTimeMs()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void
+sendToCoordinator(DmtcpMessage &msg, const void *extraData)
+{
+  coordSock << msg;
+  if (msg.extraBytes > 0) {
+    coordSock.writeAll((const char *)extraData, msg.extraBytes);
+  }
+}
+
+// A worker that is gone is removed when its connection reports it.
+static void
+sendToWorker(LocalWorker *worker, DmtcpMessage &msg, const char *extraData)
+{
+  msg.route = 0;
+  if (Util::writeAll(worker->fd, &msg, sizeof(msg)) == sizeof(msg) &&
+      msg.extraBytes > 0) {
+    Util::writeAll(worker->fd, extraData, msg.extraBytes);
+  }
+}
+
+// Reads a message and its extra data from a worker; returns false if the
+// worker is gone.
+static bool
+readWorkerMessage(int fd, DmtcpMessage *msg, char **extraData)
+{
+  *extraData = NULL;
+  if (Util::readAll(fd, msg, sizeof(*msg)) != sizeof(*msg) ||
+      !msg->isValid()) {
+    return false;
+  }
+  if (msg->extraBytes > 0) {
+    *extraData = new char[msg->extraBytes];
+    if (Util::readAll(fd, *extraData, msg->extraBytes) !=
+        (ssize_t)msg->extraBytes) {
+      delete[] *extraData;
+      *extraData = NULL;
+      return false;
+    }
+  }
+  return true;
+}
+
+// Sends the DMT_OKs held, one DMT_AGGREGATED_OK per state.
+static void
+flushArrivals()
+{
+  map<int, vector<uint32_t> >arrivals;
+
+  for (map<uint32_t, LocalWorker *>::iterator it = workers.begin();
+       it != workers.end(); ++it) {
+    if (it->second->arrived) {
+      arrivals[it->second->state].push_back(it->first);
+      it->second->arrived = false;
+    }
+  }
+  numArrived = 0;
+
+  for (map<int, vector<uint32_t> >::iterator it = arrivals.begin();
+       it != arrivals.end(); ++it) {
+    DmtcpMessage msg(DMT_AGGREGATED_OK);
+    msg.state = (WorkerState::eWorkerState)it->first;
+    msg.extraBytes = it->second.size() * sizeof(uint32_t);
+    JTRACE("sending DMT_AGGREGATED_OK") (msg.state) (it->second.size());
+    sendToCoordinator(msg, &it->second[0]);
+  }
+}
+
+// A worker in its handshake counts: it may be a child of fork() that is
+// to join the current checkpoint.
+static void
+flushArrivalsIfAll()
+{
+  if (numArrived > 0 && numArrived == workers.size()) {
+    flushArrivals();
+  }
+}
+
+static void
+removeWorker(LocalWorker *worker, bool notifyCoordinator)
+{
+  JASSERT(epoll_ctl(epollFd, EPOLL_CTL_DEL, worker->fd, NULL) != -1)
+    (JASSERT_ERRNO);
+  close(worker->fd);
+  if (worker->arrived) {
+    numArrived--;
+  }
+  workers.erase(worker->route);
+
+  if (notifyCoordinator) {
+    DmtcpMessage msg(DMT_WORKER_DISCONNECTED);
+    msg.route = worker->route;
+    sendToCoordinator(msg, NULL);
+  }
+  JTRACE("worker disconnected") (worker->route) (workers.size());
+  delete worker;
+
+  flushArrivalsIfAll();
+}
+
+// Accepts a worker and passes its hello up, with its new route.
+static void
+onConnect()
+{
+  int fd = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+  if (fd == -1) {
+    return;
+  }
+
+  DmtcpMessage hello;
+  char *extraData;
+  if (!readWorkerMessage(fd, &hello, &extraData) ||
+      (hello.type != DMT_NEW_WORKER && hello.type != DMT_RESTART_WORKER)) {
+    JWARNING(false) (hello.type).Text("Bad hello from worker.  Closing.");
+    delete[] extraData;
+    close(fd);
+    return;
+  }
+
+  LocalWorker *worker = new LocalWorker;
+  worker->fd = fd;
+  worker->route = nextRoute++;
+  if (nextRoute == DMTCPMESSAGE_ROUTE_BROADCAST) {
+    nextRoute = 1;
+  }
+  worker->accepted = false;
+  worker->arrived = false;
+  worker->state = hello.state;
+  workers[worker->route] = worker;
+
+  struct epoll_event ev;
+  ev.events = EPOLLIN | EPOLLRDHUP;
+  ev.data.u64 = worker->route;
+  JASSERT(epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) != -1) (JASSERT_ERRNO);
+
+  hello.route = worker->route;
+  sendToCoordinator(hello, extraData);
+  delete[] extraData;
+  JTRACE("worker connected") (hello.from) (worker->route);
+}
+
+/* Accepts the connections queued on the listener, without blocking.  A child
+ * of fork() connects before its parent can next reach a barrier; so, its
+ * hello goes up before the DMT_OK of its parent, as with a direct connection
+ * (see DmtcpCoordinator::acceptPendingConnections()).
+ */
+static void
+acceptPendingConnections()
+{
+  struct pollfd pfd;
+
+  pfd.fd = listenFd;
+  pfd.events = POLLIN;
+  while (poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN)) {
+    onConnect();
+  }
+}
+
+static void
+onWorkerDisconnect(LocalWorker *worker)
+{
+  acceptPendingConnections();
+  if (worker->arrived) {
+    flushArrivals();
+  }
+  removeWorker(worker, true);
+}
+
+static void
+onWorkerData(LocalWorker *worker)
+{
+  DmtcpMessage msg;
+  char *extraData;
+
+  if (!readWorkerMessage(worker->fd, &msg, &extraData)) {
+    onWorkerDisconnect(worker);
+    return;
+  }
+
+  if (msg.type == DMT_OK) {
+    acceptPendingConnections();
+    if (worker->arrived) {
+      flushArrivals();
+    }
+    worker->arrived = true;
+    worker->state = msg.state;
+    if (numArrived++ == 0) {
+      firstArrivalTime = monotonicTimeMs();
+    }
+    flushArrivalsIfAll();
+  } else {
+    if (worker->arrived) {
+      flushArrivals();
+    }
+    msg.route = worker->route;
+    sendToCoordinator(msg, extraData);
+  }
+  delete[] extraData;
+}
+
+// Returns false if the coordinator is gone.
+static bool
+onCoordinatorData()
+{
+  DmtcpMessage msg;
+  char *extraData = NULL;
+
+  if (Util::readAll(coordSock.sockfd(), &msg, sizeof(msg)) != sizeof(msg)) {
+    return false;
+  }
+  msg.assertValid();
+  if (msg.extraBytes > 0) {
+    extraData = new char[msg.extraBytes];
+    if (coordSock.readAll(extraData, msg.extraBytes) !=
+        (ssize_t)msg.extraBytes) {
+      delete[] extraData;
+      return false;
+    }
+  }
+
+  if (msg.route == DMTCPMESSAGE_ROUTE_BROADCAST) {
+    for (map<uint32_t, LocalWorker *>::iterator it = workers.begin();
+         it != workers.end(); ++it) {
+      if (it->second->accepted) {
+        sendToWorker(it->second, msg, extraData);
+      }
+    }
+  } else {
+    // The worker may be gone already.
+    map<uint32_t, LocalWorker *>::iterator it = workers.find(msg.route);
+    if (it != workers.end()) {
+      LocalWorker *worker = it->second;
+      if (msg.type == DMT_WORKER_DISCONNECTED) {
+        removeWorker(worker, false);
+      } else {
+        if (msg.type == DMT_ACCEPT) {
+          worker->accepted = true;
+        }
+        sendToWorker(worker, msg, extraData);
+      }
+    }
+  }
+  delete[] extraData;
+  return true;
+}
+
+static void
+eventLoop()
+{
+  struct epoll_event events[MAX_EVENTS];
+  struct epoll_event ev;
+
+  epollFd = epoll_create(MAX_EVENTS);
+  JASSERT(epollFd != -1) (JASSERT_ERRNO);
+
+  ev.events = EPOLLIN;
+  ev.data.u64 = LISTENER_EVENT;
+  JASSERT(epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &ev) != -1)
+    (JASSERT_ERRNO);
+  ev.events = EPOLLIN | EPOLLRDHUP;
+  ev.data.u64 = COORDINATOR_EVENT;
+  JASSERT(epoll_ctl(epollFd, EPOLL_CTL_ADD, coordSock.sockfd(), &ev) != -1)
+    (JASSERT_ERRNO);
+
+  while (true) {
+    int timeout = -1;
+    if (numArrived > 0) {
+      uint64_t held = monotonicTimeMs() - firstArrivalTime;
+      if (held >= HOLD_TIMEOUT_MS) {
+        JTRACE("not all workers arrived; sending the others")
+          (numArrived) (workers.size());
+        flushArrivals();
+      } else {
+        timeout = HOLD_TIMEOUT_MS - held;
+      }
+    }
+
+    int nfds = epoll_wait(epollFd, events, MAX_EVENTS, timeout);
+    JASSERT(nfds != -1 || errno == EINTR) (JASSERT_ERRNO);
+
+    for (int n = 0; n < nfds; ++n) {
+      uint64_t id = events[n].data.u64;
+
+      // A message is read before a hangup, so that the last messages of a
+      // connection are not lost.
+      if (id == COORDINATOR_EVENT) {
+        if (!(events[n].events & EPOLLIN) || !onCoordinatorData()) {
+          JNOTE("coordinator disconnected; exiting") (workers.size());
+          unlink(socketPath.c_str());
+          exit(0);
+        }
+      } else if (id == LISTENER_EVENT) {
+        // The connections may have been accepted already, by an earlier
+        // event of this batch; see acceptPendingConnections().
+        acceptPendingConnections();
+      } else {
+        // The worker may have been removed by an earlier event of this
+        // batch, if the coordinator rejected it.
+        map<uint32_t, LocalWorker *>::iterator it = workers.find(id);
+        if (it == workers.end()) {
+          continue;
+        }
+        if (events[n].events & EPOLLIN) {
+          onWorkerData(it->second);
+        } else {
+          onWorkerDisconnect(it->second);
+        }
+      }
+    }
+  }
+}
+
+static int
+createListenSocket(const string &path)
+{
+  struct sockaddr_un addr;
+
+  if (path.length() >= sizeof(addr.sun_path)) {
+    fprintf(stderr, BINARY_NAME ": socket path too long: %s\n",
+            path.c_str());
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path.c_str());
+
+  // A socket left by an earlier aggregator that did not exit cleanly.
+  unlink(path.c_str());
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1 ||
+      bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+      listen(fd, 128) == -1) {
+    perror(BINARY_NAME ": listen");
+    return -1;
+  }
+  return fd;
+}
+
+// shift args
+#define shift argc--, argv++
+
+int
+main(int argc, char **argv)
+{
+  bool daemon = false;
+
+  initializeJalib();
+
+  if (getenv(ENV_VAR_AGGREGATOR_SOCKET) != NULL) {
+    socketPath = getenv(ENV_VAR_AGGREGATOR_SOCKET);
+  }
+
+  shift;
+  while (argc > 0) {
+    string s = argv[0];
+    if (s == "--help" && argc == 1) {
+      printf("%s", theUsage);
+      return 1;
+    } else if ((s == "--version") && argc == 1) {
+      printf("%s", DMTCP_VERSION_AND_COPYRIGHT_INFO);
+      return 1;
+    } else if (argc > 1 &&
+               (s == "-h" || s == "--coord-host" || s == "--host")) {
+      setenv(ENV_VAR_NAME_HOST, argv[1], 1);
+      shift; shift;
+    } else if (argc > 1 &&
+               (s == "-p" || s == "--coord-port" || s == "--port")) {
+      setenv(ENV_VAR_NAME_PORT, argv[1], 1);
+      shift; shift;
+    } else if (argv[0][0] == '-' && argv[0][1] == 'p' &&
+               isdigit(argv[0][2])) { // else if -p0, for example
+      setenv(ENV_VAR_NAME_PORT, argv[0] + 2, 1);
+      shift;
+    } else if (argc > 1 && s == "--socket") {
+      socketPath = argv[1];
+      shift; shift;
+    } else if (s == "--daemon") {
+      daemon = true;
+      shift;
+    } else {
+      fprintf(stderr, "%s", theUsage);
+      return 1;
+    }
+  }
+
+  if (socketPath.empty()) {
+    fprintf(stderr, "%s", theUsage);
+    return 1;
+  }
+
+  // A worker may exit before it is sent a message.
+  signal(SIGPIPE, SIG_IGN);
+
+  string host = "";
+  int port = UNINITIALIZED_PORT;
+  CoordinatorAPI::getCoordHostAndPort(COORD_ANY, host, &port);
+  coordSock = jalib::JClientSocket(host.c_str(), port);
+  if (!coordSock.isValid()) {
+    fprintf(stderr, BINARY_NAME ": no coordinator at %s:%d\n",
+            host.c_str(), port);
+    return 1;
+  }
+  int one = 1;
+  setsockopt(coordSock.sockfd(), IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  DmtcpMessage hello(DMT_AGGREGATOR);
+  sendToCoordinator(hello, NULL);
+
+  // Listen before backgrounding, so that the socket is there once this
+  // returns.
+  listenFd = createListenSocket(socketPath);
+  if (listenFd == -1) {
+    return 1;
+  }
+
+  if (daemon) {
+    int fd = open("/dev/null", O_RDWR);
+    JASSERT(dup2(fd, STDIN_FILENO) == STDIN_FILENO);
+    JASSERT(dup2(fd, STDOUT_FILENO) == STDOUT_FILENO);
+    JASSERT(dup2(fd, STDERR_FILENO) == STDERR_FILENO);
+    JASSERT_CLOSE_STDERR();
+    if (fd > STDERR_FILENO) {
+      close(fd);
+    }
+    if (fork() > 0) {
+      exit(0);
+    }
+  }
+
+  eventLoop();
+  return 0;
+}
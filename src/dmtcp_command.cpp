@@ -48,6 +48,8 @@ static const char *theUsage =
   "Commands for Coordinator:\n"
   "    -s, --status:          Print status message\n"
   "    -l, --list:            List connected clients\n"
+  "    -m, --metrics:         Print metrics (CSV) of the last checkpoint or\n"
+  "                           restart, aggregated over all clients\n"
   "    -c, --checkpoint:      Checkpoint all nodes\n"
   "    -bc, --bcheckpoint:    Checkpoint all nodes, blocking until done\n"
 
@@ -114,7 +116,8 @@ main(int argc, char **argv)
         fprintf(stderr, theUsage, "");
         return 1;
       } else if (*cmd == 's' || *cmd == 'i' || *cmd == 'c' || *cmd == 'b' ||
-                 *cmd == 'x' || *cmd == 'k' || *cmd == 'q' || *cmd == 'l') {
+                 *cmd == 'x' || *cmd == 'k' || *cmd == 'q' || *cmd == 'l' ||
+                 *cmd == 'm') {
         request = s;
         if (*cmd == 'i') {
           if (isdigit(cmd[1])) { // if -i5, for example
@@ -169,6 +172,7 @@ main(int argc, char **argv)
                                               &ckptInterval);
     break;
   case 'l':
+  case 'm':
     workerList =
       CoordinatorAPI::connectAndSendUserCommand(*cmd, &coordCmdStatus);
     break;
@@ -212,6 +216,14 @@ main(int argc, char **argv)
     return 2;
   }
 
+  if (*cmd == 'm') {
+    if (workerList) {
+      printf("%s", workerList);
+      JALLOC_HELPER_FREE(workerList);
+    }
+    return 0;
+  }
+
   if(*cmd == 's' || *cmd == 'l'){
     printf("Coordinator:\n");
     char *host = getenv(ENV_VAR_NAME_HOST);
@@ -60,13 +60,19 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <netdb.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/stat.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "../contrib/mpi-proxy-split/mana_coordinator.h"
@@ -85,7 +91,9 @@
 #include "constants.h"
 #include "dmtcpmessagetypes.h"
 #include "lookup_service.h"
+#include "mtcp/mtcp_header.h"
 #include "protectedfds.h"
+#include "restartmanifest.h"
 #include "restartscript.h"
 #include "syscallwrappers.h"
 #include "util.h"
@@ -103,6 +111,7 @@ static const char *theHelpMessage =
   "  c : Checkpoint all nodes\n"
   "  i : Print current checkpoint interval\n"
   "      (To change checkpoint interval, use dmtcp_command)\n"
+  "  m : Print metrics of the last checkpoint or restart\n"
   "  k : Kill all nodes\n"
   "  q : Kill all nodes and quit\n"
   "  ? : Show this message\n"
@@ -133,6 +142,9 @@ static const char *theUsage =
   "      (default: 0, disabled)\n"
   "  --coord-logfile PATH (environment variable DMTCP_COORD_LOG_FILENAME\n"
   "              Coordinator will dump its logs to the given file\n"
+  "  --io-threads N\n"
+  "      Number of threads that read the messages of the workers and answer\n"
+  "      their name-service queries (default: 1, the main thread only)\n"
   "  -q, --quiet \n"
   "      Skip startup msg; Skip NOTE msgs; if given twice, also skip WARNINGs\n"
   "  --help:\n"
@@ -198,6 +210,11 @@ JTIMER(checkpoint);
 JTIMER(twoPc);
 JTIMER(restart);
 
+// Monotonic start of the current checkpoint or restart, and its duration as
+// seen by the coordinator; reported with the metrics of the workers.
+static uint64_t phaseStartTime = 0;
+static double phaseTime = 0.0;
+
 static UniquePid compId;
 static int numPeers = -1;
 static int workersAtCurrentBarrier = 0;
@@ -217,6 +234,41 @@ struct epoll_event events[MAX_EVENTS];
 int epollFd;
 static jalib::JSocket *listenSock = NULL;
 
+/* With --io-threads N (N > 1), the sockets of the workers are divided among N
+ * I/O threads, each with its own epoll set (a shard).  An I/O thread reads
+ * each message in full, and answers the name-service requests that come on
+ * a name-service connection (DMT_NAME_SERVICE_WORKER) itself.  Every other
+ * message, and every disconnection, is queued for the main thread, which
+ * remains the only thread to change the state of the computation: barriers,
+ * client list, checkpoint filenames, etc.  The main thread still accepts the
+ * connections and validates the handshake of each worker.
+ *
+ * The data socket and the name-service connection of a process are in the
+ * same shard, so that name-service data registered before a DMT_OK is seen
+ * before the barrier is released.  A socket is removed from its shard before
+ * its disconnection is queued, so the main thread may then delete the client.
+ */
+#define MAX_IO_THREADS 64
+#define IO_THREAD_MAX_EVENTS 256
+
+struct IoShard {
+  int epollFd;
+  pthread_t thread;
+};
+
+struct ClientEvent {
+  CoordClient *client;
+  DmtcpMessage msg;
+  char *extraData;
+  bool disconnect;
+};
+
+static int numIoThreads = 1;
+static IoShard ioShards[MAX_IO_THREADS];
+static vector<ClientEvent> clientEvents;
+static pthread_mutex_t clientEventsLock = PTHREAD_MUTEX_INITIALIZER;
+static int clientEventsFd = -1;
+
 static void removeStaleSharedAreaFile();
 static void preExitCleanup();
 
@@ -225,6 +277,12 @@ static pid_t _nextVirtualPid = INITIAL_VIRTUAL_PID;
 static int theNextClientNumber = 1;
 vector<CoordClient *>clients;
 
+// The workers of each aggregator (see dmtcp_aggregator.cpp) that are in
+// 'clients', by route.  A worker behind an aggregator has no socket of its
+// own, and is not in an epoll set: its messages come on the socket of the
+// aggregator, with its route, and are passed on by processAggregatorMessage.
+static map<CoordClient *, map<uint32_t, CoordClient *> >aggregators;
+
 CoordClient::CoordClient(const jalib::JSocket &sock,
                          const struct sockaddr_storage *addr,
                          socklen_t len,
@@ -233,6 +291,8 @@ CoordClient::CoordClient(const jalib::JSocket &sock,
   : _sock(sock)
 {
   _isNSWorker = isNSWorker;
+  _aggregator = NULL;
+  _route = 0;
   _realPid = hello_remote.realPid;
   _clientNumber = theNextClientNumber++;
   _identity = hello_remote.from;
@@ -241,15 +301,36 @@ CoordClient::CoordClient(const jalib::JSocket &sock,
   _ip = inet_ntoa(in->sin_addr);
 }
 
+// 'extraData' is that of the hello message: "hostname\0progname\0".
+void
+CoordClient::setProcessInfo(const char *extraData)
+{
+  _hostname = extraData;
+  _progname = extraData + _hostname.length() + 1;
+}
+
+// Sends a message, and its extra data, to the worker; through its
+// aggregator, if any.
 void
-CoordClient::readProcessInfo(DmtcpMessage &msg)
+CoordClient::send(DmtcpMessage &msg, const void *extraData)
 {
+  msg.route = _route;
+  _sock << msg;
   if (msg.extraBytes > 0) {
-    char *extraData = new char[msg.extraBytes];
-    _sock.readAll(extraData, msg.extraBytes);
-    _hostname = extraData;
-    _progname = extraData + _hostname.length() + 1;
-    delete[] extraData;
+    _sock.writeAll((const char *)extraData, msg.extraBytes);
+  }
+}
+
+// Closes the connection of the worker.  The aggregator, if any, closes it
+// when told so.
+void
+CoordClient::close()
+{
+  if (_aggregator == NULL) {
+    _sock.close();
+  } else {
+    DmtcpMessage msg(DMT_WORKER_DISCONNECTED);
+    send(msg);
   }
 }
 
@@ -258,7 +339,8 @@ DmtcpCoordinator::getNewVirtualPid()
 {
   pid_t pid = -1;
 
-  JASSERT(_virtualPidToClientMap.size() < MAX_VIRTUAL_PID / 1000)
+  JASSERT(_virtualPidToClientMap.size() + _reservedVirtualPids.size() <
+          MAX_VIRTUAL_PID / 1000)
   .Text("Exceeded maximum number of processes allowed");
   while (1) {
     pid = _nextVirtualPid;
@@ -266,7 +348,8 @@ DmtcpCoordinator::getNewVirtualPid()
     if (_nextVirtualPid > MAX_VIRTUAL_PID) {
       _nextVirtualPid = INITIAL_VIRTUAL_PID;
     }
-    if (_virtualPidToClientMap.find(pid) == _virtualPidToClientMap.end()) {
+    if (_virtualPidToClientMap.find(pid) == _virtualPidToClientMap.end() &&
+        _reservedVirtualPids.find(pid) == _reservedVirtualPids.end()) {
       break;
     }
   }
@@ -274,6 +357,74 @@ DmtcpCoordinator::getNewVirtualPid()
   return pid;
 }
 
+/* A process reserves virtual pids for its children a block at a time, so
+ * that fork() need not wait for the coordinator; see
+ * CoordinatorAPI::createNewConnectionBeforeFork().  msg.numPeers is the
+ * number of pids wanted, and msg.virtualPid is the pid of the process.
+ */
+void
+DmtcpCoordinator::reserveVirtualPids(CoordClient *client,
+                                     const DmtcpMessage &msg)
+{
+  uint32_t count = msg.numPeers;
+  vector<pid_t> pids;
+
+  JWARNING(count > 0 && count <= 1024) (count) (msg.from);
+  count = std::min(std::max(count, 1u), 1024u);
+  for (uint32_t i = 0; i < count; i++) {
+    pid_t pid = getNewVirtualPid();
+    _reservedVirtualPids[pid] = msg.virtualPid;
+    pids.push_back(pid);
+  }
+
+  DmtcpMessage reply(DMT_RESERVE_VIRTUAL_PIDS_RESPONSE);
+  reply.extraBytes = count * sizeof(pid_t);
+  client->send(reply, &pids[0]);
+}
+
+// Releases the reserved pids that a process did not use.
+void
+DmtcpCoordinator::releaseVirtualPids(pid_t owner)
+{
+  map<pid_t, pid_t>::iterator it = _reservedVirtualPids.begin();
+  while (it != _reservedVirtualPids.end()) {
+    if (it->second == owner) {
+      _reservedVirtualPids.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+}
+
+/* Accepts the connections queued on the listener, without blocking.
+ *
+ * The connection of a child of fork() is queued before its parent can
+ * report to a barrier or disconnect, but the coordinator reads the two
+ * sockets in no particular order.  So, this is also called before the
+ * suspend barrier is counted and when a process disconnects, so that the
+ * child is not left out of the checkpoint or of the computation.
+ */
+void
+DmtcpCoordinator::acceptPendingConnections()
+{
+  struct pollfd pfd;
+
+  pfd.fd = listenSock->sockfd();
+  pfd.events = POLLIN;
+  while (poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN)) {
+    onConnect();
+  }
+}
+
+static uint64_t
+monotonicTime()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 static string replyData = "";
 
 void
@@ -329,6 +480,15 @@ DmtcpCoordinator::handleUserCommand(char cmd, DmtcpMessage *reply /*= NULL*/)
       JASSERT_STDERR << printList();
     }
     break;
+  case 'm': case 'M':
+    replyData = _metricsSummary.empty() ? "No metrics recorded yet.\n"
+                                        : _metricsSummary;
+    if (reply != NULL) {
+      reply->extraBytes = replyData.length() + 1;
+    } else {
+      JASSERT_STDERR << replyData;
+    }
+    break;
   case 'u': case 'U':
   {
     JASSERT_STDERR << "Host List:\n";
@@ -354,7 +514,13 @@ DmtcpCoordinator::handleUserCommand(char cmd, DmtcpMessage *reply /*= NULL*/)
     broadcastMessage(DMT_KILL_PEER);
     JASSERT_STDERR << "DMTCP coordinator exiting... (per request)\n";
     for (size_t i = 0; i < clients.size(); i++) {
-      clients[i]->sock().close();
+      if (clients[i]->aggregator() == NULL) {
+        clients[i]->sock().close();
+      }
+    }
+    for (map<CoordClient *, map<uint32_t, CoordClient *> >::iterator it =
+           aggregators.begin(); it != aggregators.end(); ++it) {
+      it->first->sock().close();
     }
     listenSock->close();
     preExitCleanup();
@@ -445,15 +611,21 @@ DmtcpCoordinator::printStatus(size_t numPeers, bool isRunning)
     // << "Exit after checkpoint (first time only): " << exitAfterCkptOnce
     // << std::endl
     << "Computation Id: " << compId << std::endl
-    << "Checkpoint Dir: " << ckptDir << std::endl
-    << "NUM_PEERS=" << numPeers << std::endl
+    << "Checkpoint Dir: " << ckptDir << std::endl;
+  if (_lastDurableGeneration > 0) {
+    o << "Last durable checkpoint generation: " << _lastDurableGeneration
+      << std::endl;
+  }
+  o << "NUM_PEERS=" << numPeers << std::endl
     << "RUNNING=" << (isRunning ? "yes" : "no") << std::endl;
 
   printf("%s", o.str().c_str());
   printf("\n%s\n", lookupService.getSummaryStats().c_str());
   if (mpiMode) {
     printNonReadyRanks();
+    lookupService.readLock();
     printMpiDrainStatus(lookupService);
+    lookupService.unlock();
   }
   fflush(stdout);
 }
@@ -530,13 +702,16 @@ DmtcpCoordinator::updateMinimumState()
     }
     if (nextRestartBarrier == restartBarriers.size()) {
       JTIMER_STOP(restart);
+      phaseTime = (monotonicTime() - phaseStartTime) / 1e9;
       JNOTE("Resuming all nodes after restart");
     }
   }
 }
 
 void
-DmtcpCoordinator::recordCkptFilename(CoordClient *client, const char *extraData)
+DmtcpCoordinator::recordCkptFilename(CoordClient *client,
+                                     const char *extraData,
+                                     size_t extraBytes)
 {
   client->setState(WorkerState::CHECKPOINTED);
   JASSERT(extraData != NULL)
@@ -550,6 +725,20 @@ DmtcpCoordinator::recordCkptFilename(CoordClient *client, const char *extraData)
   shellType = extraData + ckptFilename.length() + 1;
   hostname = extraData + shellType.length() + 1 + ckptFilename.length() + 1;
 
+  // Older clients do not send the MPI memory bounds.
+  size_t mpiInfoOffset = ckptFilename.length() + 1 + shellType.length() + 1 +
+                         hostname.length() + 1;
+  const char *mpiInfo = mpiInfoOffset < extraBytes ? extraData + mpiInfoOffset
+                                                   : "";
+  recordManifestEntry(ckptFilename, mpiInfo);
+
+  // With --local-ckptdir, the image is in a node-local dir, and is still
+  // being drained to ckptFilename.
+  size_t localOffset = mpiInfoOffset + strlen(mpiInfo) + 1;
+  if (localOffset < extraBytes && extraData[localOffset] != '\0') {
+    _numLocalImages++;
+  }
+
   JTRACE("recording restart info") (ckptFilename) (hostname);
   JTRACE ( "recording restart info with shellType" )
     ( ckptFilename ) ( hostname ) (shellType);
@@ -566,6 +755,8 @@ DmtcpCoordinator::recordCkptFilename(CoordClient *client, const char *extraData)
   _numRestartFilenames++;
 
   if (_numRestartFilenames == _numCkptWorkers) {
+    writeCkptManifest();
+
     const string restartScriptPath =
       RestartScript::writeScript(ckptDir,
                                  uniqueCkptFilenames,
@@ -577,9 +768,27 @@ DmtcpCoordinator::recordCkptFilename(CoordClient *client, const char *extraData)
                                  _rshCmdFileNames,
                                  _sshCmdFileNames);
 
+    RestartManifest::writeManifest(ckptDir,
+                                   uniqueCkptFilenames,
+                                   theCheckpointInterval,
+                                   thePort,
+                                   compId,
+                                   _restartFilenames,
+                                   _rshCmdFileNames,
+                                   _sshCmdFileNames);
+
     JNOTE("Checkpoint complete. Wrote restart script") (restartScriptPath);
+    if (_numLocalImages > 0) {
+      uint32_t generation = compId.computationGeneration();
+      JNOTE("Checkpoint is local-complete; draining images to ckpt dir")
+        (generation) (_numLocalImages);
+      _drainStartTime[generation] = monotonicTime();
+      _numImagesToDrain[generation] = _numLocalImages;
+      checkCkptDurable(generation);
+    }
 
     JTIMER_STOP(checkpoint);
+    phaseTime = (monotonicTime() - phaseStartTime) / 1e9;
     resetCkptTimer();
 
     if (blockUntilDone) {
@@ -602,6 +811,7 @@ DmtcpCoordinator::recordCkptFilename(CoordClient *client, const char *extraData)
       lookupService.reset();
     }
     _numRestartFilenames = 0;
+    _numLocalImages = 0;
     _numCkptWorkers = 0;
 
     // All the workers have checkpointed so now it is safe to reset this flag.
@@ -609,6 +819,262 @@ DmtcpCoordinator::recordCkptFilename(CoordClient *client, const char *extraData)
   }
 }
 
+/* Sent by the process that drained an image from a node-local ckpt dir (see
+ * ckptserializer.cpp).  It may arrive before the checkpoint is complete.
+ */
+void
+DmtcpCoordinator::recordCkptDurable(const char *extraData, size_t extraBytes)
+{
+  JASSERT(extraData != NULL && extraData[extraBytes - 1] == '\0')
+  .Text("extra data expected with DMT_CKPT_DURABLE message");
+
+  uint32_t generation = strtoul(extraData, NULL, 10);
+  const char *ckptFilename = extraData + strlen(extraData) + 1;
+  JTRACE("checkpoint image drained") (generation) (ckptFilename);
+
+  // An older image, drained just before the newer one replaced it.
+  if (generation <= _lastDurableGeneration) {
+    return;
+  }
+  _numImagesDrained[generation]++;
+  checkCkptDurable(generation);
+}
+
+void
+DmtcpCoordinator::checkCkptDurable(uint32_t generation)
+{
+  map<uint32_t, size_t>::iterator toDrain = _numImagesToDrain.find(generation);
+  map<uint32_t, size_t>::iterator drained = _numImagesDrained.find(generation);
+
+  if (toDrain == _numImagesToDrain.end() ||
+      drained == _numImagesDrained.end() ||
+      drained->second < toDrain->second) {
+    return;
+  }
+
+  double drainTime = (monotonicTime() - _drainStartTime[generation]) / 1e9;
+  JNOTE("Checkpoint is durable; all images drained to ckpt dir")
+    (generation) (drainTime);
+  _lastDurableGeneration = generation;
+
+  // A drain skips an image that a newer checkpoint has already replaced in
+  // the node-local dir (see ckptserializer.cpp), so any older generation
+  // that is still pending will never be durable.
+  _numImagesToDrain.erase(_numImagesToDrain.begin(), ++toDrain);
+  _numImagesDrained.erase(_numImagesDrained.begin(), ++drained);
+  _drainStartTime.erase(_drainStartTime.begin(),
+                        _drainStartTime.upper_bound(generation));
+}
+
+/* An MPI rank checkpoints into <dir>/ckpt_rank_<rank>/.  The manifest is
+ * written only if every client is such a rank, all under the same <dir>,
+ * and the ranks are 0..N-1.
+ */
+void
+DmtcpCoordinator::recordManifestEntry(const string &ckptFilename,
+                                      const char *mpiInfo)
+{
+  if (!_manifestValid) {
+    return;
+  }
+
+  unsigned long libsStart, libsEnd, highMemStart;
+  if (sscanf(mpiInfo, "%lx,%lx,%lx",
+             &libsStart, &libsEnd, &highMemStart) != 3) {
+    _manifestValid = false;
+    return;
+  }
+
+  const string rankDir = jalib::Filesystem::DirName(ckptFilename);
+  const string rankDirName = jalib::Filesystem::BaseName(rankDir);
+  const string baseDir = jalib::Filesystem::DirName(rankDir);
+  char *end;
+  if (!Util::strStartsWith(rankDirName.c_str(), "ckpt_rank_")) {
+    _manifestValid = false;
+    return;
+  }
+  long rank = strtol(rankDirName.c_str() + strlen("ckpt_rank_"), &end, 10);
+  if (*end != '\0' || rank < 0 || _manifestImages.count(rank) > 0 ||
+      (!_manifestImages.empty() && baseDir != _manifestDir)) {
+    _manifestValid = false;
+    return;
+  }
+
+  string relPath = rankDirName + "/" +
+                   jalib::Filesystem::BaseName(ckptFilename);
+  if (relPath.length() >= MTCP_MANIFEST_PATH_LEN) {
+    _manifestValid = false;
+    return;
+  }
+
+  if (_manifestImages.empty()) {
+    _manifestDir = baseDir;
+    _manifestLibsStart = libsStart;
+    _manifestLibsEnd = libsEnd;
+    _manifestHighMemStart = highMemStart;
+  } else {
+    _manifestLibsStart = std::min(_manifestLibsStart, (uint64_t)libsStart);
+    _manifestLibsEnd = std::max(_manifestLibsEnd, (uint64_t)libsEnd);
+    _manifestHighMemStart =
+      std::min(_manifestHighMemStart, (uint64_t)highMemStart);
+  }
+  _manifestImages[rank] = relPath;
+}
+
+// mtcp_restart trusts a manifest that it finds; one left from an older
+// generation would give it the wrong bounds and images.
+static void
+removeCkptManifest(const string &dir)
+{
+  if (dir.empty()) {
+    return;
+  }
+  string path = dir + "/" + MTCP_MANIFEST_FILENAME;
+  JWARNING(unlink(path.c_str()) == 0 || errno == ENOENT)
+    (path) (JASSERT_ERRNO).Text("Failed to remove old checkpoint manifest");
+}
+
+void
+DmtcpCoordinator::writeCkptManifest()
+{
+  size_t numRanks = _manifestImages.size();
+
+  if (!_manifestValid || numRanks == 0 ||
+      _manifestImages.rbegin()->first != (int)numRanks - 1) {
+    JTRACE("Not writing checkpoint manifest") (_manifestValid) (numRanks);
+    removeCkptManifest(_manifestDir);
+    return;
+  }
+
+  MtcpManifestHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  strncpy(hdr.signature, MTCP_MANIFEST_SIGNATURE, sizeof(hdr.signature));
+  hdr.numRanks = numRanks;
+  hdr.libsStart = (void *)_manifestLibsStart;
+  hdr.libsEnd = (void *)_manifestLibsEnd;
+  hdr.highMemStart = (void *)_manifestHighMemStart;
+
+  // Write to a temporary file and rename it, so that a restart never sees a
+  // partially written manifest.
+  string path = _manifestDir + "/" + MTCP_MANIFEST_FILENAME;
+  string tmpPath = path + ".temp";
+  int fd = open(tmpPath.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0600);
+  if (fd == -1) {
+    JWARNING(false) (tmpPath) (JASSERT_ERRNO)
+      .Text("Failed to write checkpoint manifest");
+    return;
+  }
+
+  bool ok = Util::writeAll(fd, &hdr, sizeof(hdr)) == sizeof(hdr);
+  char record[MTCP_MANIFEST_PATH_LEN];
+  for (map<int, string>::iterator it = _manifestImages.begin();
+       ok && it != _manifestImages.end(); ++it) {
+    memset(record, 0, sizeof(record));
+    strcpy(record, it->second.c_str());
+    ok = Util::writeAll(fd, record, sizeof(record)) == sizeof(record);
+  }
+  close(fd);
+
+  if (!ok || rename(tmpPath.c_str(), path.c_str()) == -1) {
+    JWARNING(false) (path) (JASSERT_ERRNO)
+      .Text("Failed to write checkpoint manifest");
+    unlink(tmpPath.c_str());
+    return;
+  }
+  JTRACE("Wrote checkpoint manifest") (path) (numRanks);
+}
+
+/* After each checkpoint and restart, every worker sends its metrics as
+ * "name,value" lines (see ckptmetrics.cpp).  Once all of them have reported,
+ * writeMetrics() aggregates each metric across the workers.
+ */
+void
+DmtcpCoordinator::recordMetrics(CoordClient *client,
+                                const DmtcpMessage &msg,
+                                const char *extraData,
+                                size_t extraBytes)
+{
+  JASSERT(extraData != NULL && extraBytes > 0)
+  .Text("extra data expected with DMT_METRICS message");
+
+  string phase = msg.state == WorkerState::RESTARTING ? "restart" : "ckpt";
+  if (_numMetricsReports > 0 && phase != _metricsPhase) {
+    writeMetrics();
+  }
+  _metricsPhase = phase;
+
+  // The first line is the MPI rank of the worker, or -1.
+  string label = client->hostname() + ":" +
+                 jalib::XToString(client->virtualPid());
+  vector<string> lines = Util::tokenizeString(extraData, "\n");
+  for (size_t i = 0; i < lines.size(); i++) {
+    size_t comma = lines[i].rfind(',');
+    if (comma == string::npos) {
+      continue;
+    }
+    string name = lines[i].substr(0, comma);
+    double value = strtod(lines[i].c_str() + comma + 1, NULL);
+    if (name == "rank") {
+      if (value >= 0) {
+        label = "rank" + jalib::XToString((long)value);
+      }
+      continue;
+    }
+    _metrics[name][label] = value;
+  }
+  _numMetricsReports++;
+
+  if (_numMetricsReports >= (size_t)getStatus().numPeers) {
+    writeMetrics();
+  }
+}
+
+// Writes <ckptdir>/metrics_<phase>_gen<N>.csv with the count, min, median
+// and max of each metric over all processes, and the process with the max.
+void
+DmtcpCoordinator::writeMetrics()
+{
+  ostringstream o;
+  o << std::setprecision(9);
+  o << "metric,count,min,median,max,straggler\n";
+  o << "coord." << _metricsPhase << "_s,1," << phaseTime << ","
+    << phaseTime << "," << phaseTime << ",coordinator\n";
+
+  for (map<string, map<string, double> >::iterator it = _metrics.begin();
+       it != _metrics.end(); ++it) {
+    vector<double> values;
+    map<string, double>::iterator straggler = it->second.begin();
+    for (map<string, double>::iterator v = it->second.begin();
+         v != it->second.end(); ++v) {
+      if (v->second > straggler->second) {
+        straggler = v;
+      }
+      values.push_back(v->second);
+    }
+    std::sort(values.begin(), values.end());
+    size_t n = values.size();
+    double median = n % 2 ? values[n / 2]
+                          : (values[n / 2 - 1] + values[n / 2]) / 2;
+    o << it->first << "," << n << "," << values[0] << "," << median << ","
+      << values[n - 1] << "," << straggler->first << "\n";
+  }
+
+  uint32_t generation = compId.computationGeneration();
+  _metricsSummary = o.str();
+  string path = ckptDir + "/metrics_" + _metricsPhase + "_gen" +
+                jalib::XToString(generation) + ".csv";
+  ofstream file(path.c_str(), std::ios::out | std::ios::trunc);
+  if (file.fail()) {
+    JWARNING(false) (path).Text("Failed to write checkpoint metrics");
+  } else {
+    file << _metricsSummary;
+    JTRACE("Wrote checkpoint metrics") (path) (_numMetricsReports);
+  }
+
+  _metrics.clear();
+  _numMetricsReports = 0;
+}
+
 void
 DmtcpCoordinator::processPreSuspendClientMsg(CoordClient *client,
                                              const DmtcpMessage& msg,
@@ -619,25 +1085,92 @@ DmtcpCoordinator::processPreSuspendClientMsg(CoordClient *client,
 		                   msg, extraData);
 }
 
+// Reads the next message of a client, and returns its extra data, if any.
+static char *
+readClientMessage(CoordClient *client, DmtcpMessage *msg)
+{
+  char *extraData = 0;
+
+  JASSERT(client != NULL);
+
+  client->sock() >> *msg;
+  msg->assertValid();
+  if (msg->extraBytes > 0) {
+    extraData = new char[msg->extraBytes];
+    client->sock().readAll(extraData, msg->extraBytes);
+  }
+  return extraData;
+}
+
+// Answers a request to the name service; returns false if 'msg' is not one.
+// This may be called from an I/O thread.
+static bool
+handleNameServiceMsg(CoordClient *client,
+                     const DmtcpMessage &msg,
+                     const char *extraData)
+{
+  switch (msg.type) {
+  case DMT_REGISTER_NAME_SERVICE_DATA:
+    JTRACE("received REGISTER_NAME_SERVICE_DATA msg") (client->identity());
+    lookupService.registerData(msg, (const void *)extraData);
+    return true;
+
+  case DMT_NAME_SERVICE_QUERY:
+    JTRACE("received NAME_SERVICE_QUERY msg") (client->identity());
+    lookupService.respondToQuery(client->sock(), msg,
+                                 (const void *)extraData);
+    return true;
+
+  case DMT_NAME_SERVICE_GET_UNIQUE_ID:
+    JTRACE("received NAME_SERVICE_GET_UNIQUE_ID msg") (client->identity());
+    lookupService.respondToQuery(client->sock(), msg,
+                                 (const void *)extraData);
+    return true;
+
+  case DMT_NAME_SERVICE_QUERY_ALL:
+    JTRACE("received NAME_SERVICE_QUERY_ALL msg") (client->identity());
+    lookupService.sendAllMappings(client->sock(), msg);
+    return true;
+
+  case DMT_NAME_SERVICE_QUERY_BATCH:
+    JTRACE("received NAME_SERVICE_QUERY_BATCH msg") (client->identity());
+    lookupService.respondToBatchQuery(client->sock(), msg,
+                                      (const void *)extraData);
+    return true;
+
+  default:
+    return false;
+  }
+}
+
 void
 DmtcpCoordinator::onData(CoordClient *client)
 {
   DmtcpMessage msg;
+  char *extraData = readClientMessage(client, &msg);
 
-  JASSERT(client != NULL);
+  processMessage(client, msg, extraData);
+}
 
-  client->sock() >> msg;
-  msg.assertValid();
-  char *extraData = 0;
-  if (msg.extraBytes > 0) {
-    extraData = new char[msg.extraBytes];
-    client->sock().readAll(extraData, msg.extraBytes);
+// Handles a message read from a client; frees 'extraData'.
+void
+DmtcpCoordinator::processMessage(CoordClient *client,
+                                 const DmtcpMessage &msg,
+                                 char *extraData)
+{
+  if (aggregators.find(client) != aggregators.end()) {
+    processAggregatorMessage(client, msg, extraData);
+    return;
   }
 
   switch (msg.type) {
   case DMT_OK:
   {
     JTRACE("got DMT_OK message") (client->state()) (msg.from) (msg.state);
+    if (workersRunningAndSuspendMsgSent &&
+        msg.state == WorkerState::SUSPENDED) {
+      acceptPendingConnections();
+    }
     client->setState(msg.state);
     workersAtCurrentBarrier++;
     updateMinimumState();
@@ -687,15 +1220,18 @@ DmtcpCoordinator::onData(CoordClient *client)
 
   // Fall though
   case DMT_CKPT_FILENAME:
-    recordCkptFilename(client, extraData);
+    recordCkptFilename(client, extraData, msg.extraBytes);
+    break;
+
+  case DMT_METRICS:
+    recordMetrics(client, msg, extraData, msg.extraBytes);
     break;
 
   case DMT_GET_CKPT_DIR:
   {
     DmtcpMessage reply(DMT_GET_CKPT_DIR_RESULT);
     reply.extraBytes = ckptDir.length() + 1;
-    client->sock() << reply;
-    client->sock().writeAll(ckptDir.c_str(), reply.extraBytes);
+    client->send(reply, ckptDir.c_str());
     break;
   }
   case DMT_UPDATE_CKPT_DIR:
@@ -710,34 +1246,12 @@ DmtcpCoordinator::onData(CoordClient *client)
   }
 
   case DMT_REGISTER_NAME_SERVICE_DATA:
-  {
-    JTRACE("received REGISTER_NAME_SERVICE_DATA msg") (client->identity());
-    lookupService.registerData(msg, (const void *)extraData);
-    break;
-  }
-
   case DMT_NAME_SERVICE_QUERY:
-  {
-    JTRACE("received NAME_SERVICE_QUERY msg") (client->identity());
-    lookupService.respondToQuery(client->sock(), msg,
-                                 (const void *)extraData);
-    break;
-  }
-
   case DMT_NAME_SERVICE_GET_UNIQUE_ID:
-  {
-    JTRACE("received NAME_SERVICE_GET_UNIQUE_ID msg") (client->identity());
-    lookupService.respondToQuery(client->sock(), msg,
-                                 (const void *)extraData);
-    break;
-  }
-
   case DMT_NAME_SERVICE_QUERY_ALL:
-  {
-    JTRACE("received NAME_SERVICE_QUERY_ALL msg") (client->identity());
-    lookupService.sendAllMappings(client->sock(), msg);
+  case DMT_NAME_SERVICE_QUERY_BATCH:
+    handleNameServiceMsg(client, msg, extraData);
     break;
-  }
 
   case DMT_UPDATE_PROCESS_INFO_AFTER_FORK:
   {
@@ -747,6 +1261,13 @@ DmtcpCoordinator::onData(CoordClient *client)
     client->realPid(msg.realPid);
     break;
   }
+
+  case DMT_RESERVE_VIRTUAL_PIDS:
+  {
+    JTRACE("received RESERVE_VIRTUAL_PIDS msg") (msg.from) (msg.numPeers);
+    reserveVirtualPids(client, msg);
+    break;
+  }
   case DMT_UPDATE_PROCESS_INFO_AFTER_INIT_OR_EXEC:
   {
     string progname = extraData;
@@ -771,6 +1292,79 @@ DmtcpCoordinator::onData(CoordClient *client)
   delete[] extraData;
 }
 
+/* Handles a message from an aggregator: the hello of one of its workers,
+ * the arrival of several of them at a barrier (DMT_AGGREGATED_OK, with
+ * their routes as extra data), the disconnection of one, or any other
+ * message of one, which is handled as if it came from the worker itself.
+ * Frees 'extraData'.
+ */
+void
+DmtcpCoordinator::processAggregatorMessage(CoordClient *aggregator,
+                                           const DmtcpMessage &msg,
+                                           char *extraData)
+{
+  map<uint32_t, CoordClient *> &routes = aggregators[aggregator];
+  map<uint32_t, CoordClient *>::iterator it;
+
+  switch (msg.type) {
+  case DMT_NEW_WORKER:
+  case DMT_RESTART_WORKER:
+  {
+    // The worker is on the host of the aggregator.
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    JASSERT(getpeername(aggregator->sock().sockfd(),
+                        (struct sockaddr *)&addr, &len) == 0) (JASSERT_ERRNO);
+
+    DmtcpMessage hello_remote = msg;
+    CoordClient *client = new CoordClient(aggregator->sock(), &addr, len,
+                                          hello_remote);
+    client->setRoute(aggregator, msg.route);
+    onWorkerConnect(client, hello_remote, extraData, &addr, len);
+    break;
+  }
+
+  case DMT_AGGREGATED_OK:
+  {
+    const uint32_t *arrived = (const uint32_t *)extraData;
+    size_t numArrived = msg.extraBytes / sizeof(uint32_t);
+
+    JTRACE("got DMT_AGGREGATED_OK message") (numArrived) (msg.state);
+    if (workersRunningAndSuspendMsgSent &&
+        msg.state == WorkerState::SUSPENDED) {
+      acceptPendingConnections();
+    }
+    for (size_t i = 0; i < numArrived; i++) {
+      it = routes.find(arrived[i]);
+      if (it != routes.end()) {
+        it->second->setState(msg.state);
+        workersAtCurrentBarrier++;
+      }
+    }
+    updateMinimumState();
+    break;
+  }
+
+  case DMT_WORKER_DISCONNECTED:
+    // The worker may have been rejected; then, it was never in 'routes'.
+    it = routes.find(msg.route);
+    if (it != routes.end()) {
+      onDisconnect(it->second);
+    }
+    break;
+
+  default:
+    it = routes.find(msg.route);
+    if (it != routes.end()) {
+      processMessage(it->second, msg, extraData);
+      return;
+    }
+    JTRACE("message for a worker that is gone") (msg.type) (msg.route);
+  }
+
+  delete[] extraData;
+}
+
 static void
 removeStaleSharedAreaFile()
 {
@@ -798,17 +1392,49 @@ DmtcpCoordinator::onDisconnect(CoordClient *client)
     delete client;
     return;
   }
+
+  map<CoordClient *, map<uint32_t, CoordClient *> >::iterator agg =
+    aggregators.find(client);
+  if (agg != aggregators.end()) {
+    // Its workers are gone with it.
+    map<uint32_t, CoordClient *> routes;
+    routes.swap(agg->second);
+    aggregators.erase(agg);
+    JNOTE("aggregator disconnected") (client->ip()) (routes.size());
+    for (map<uint32_t, CoordClient *>::iterator it = routes.begin();
+         it != routes.end(); ++it) {
+      onDisconnect(it->second);
+    }
+    client->sock().close();
+    delete client;
+    return;
+  }
+
+  // Count the children that it forked just before it exited.
+  acceptPendingConnections();
+
   for (size_t i = 0; i < clients.size(); i++) {
     if (clients[i] == client) {
       clients.erase(clients.begin() + i);
       break;
     }
   }
-  client->sock().close();
+  if (client->aggregator() == NULL) {
+    client->sock().close();
+  } else {
+    agg = aggregators.find(client->aggregator());
+    if (agg != aggregators.end()) {
+      agg->second.erase(client->route());
+    }
+  }
   JNOTE("client disconnected") (client->identity()) (client->progname());
   _virtualPidToClientMap.erase(client->virtualPid());
+  releaseVirtualPids(client->virtualPid());
 
   ComputationStatus s = getStatus();
+  if (_numMetricsReports > 0 && _numMetricsReports >= (size_t)s.numPeers) {
+    writeMetrics();
+  }
   if (s.numPeers < 1) {
     if (exitOnLast) {
       JNOTE("last client exited, shutting down..");
@@ -883,7 +1509,7 @@ DmtcpCoordinator::onConnect()
 
   if (hello_remote.type == DMT_NAME_SERVICE_WORKER) {
     CoordClient *client = new CoordClient(remote, &remoteAddr, remoteLen,
-                                          hello_remote);
+                                          hello_remote, 1);
 
     addDataSocket(client);
     return;
@@ -924,6 +1550,17 @@ DmtcpCoordinator::onConnect()
     return;
   }
 
+  if (hello_remote.type == DMT_CKPT_DURABLE) {
+    JASSERT(hello_remote.extraBytes > 0) (hello_remote.extraBytes);
+    char *extraData = new char[hello_remote.extraBytes];
+    remote.readAll(extraData, hello_remote.extraBytes);
+
+    recordCkptDurable(extraData, hello_remote.extraBytes);
+    delete[] extraData;
+    remote.close();
+    return;
+  }
+
   if (hello_remote.type == DMT_USER_CMD) {
     // TODO(kapil): Update ckpt interval only if a valid one was supplied to
     // dmtcp_command.
@@ -932,13 +1569,44 @@ DmtcpCoordinator::onConnect()
     return;
   }
 
+  if (hello_remote.type == DMT_AGGREGATOR) {
+    CoordClient *client = new CoordClient(remote, &remoteAddr, remoteLen,
+                                          hello_remote);
+    JNOTE("aggregator connected") (client->ip());
+    aggregators[client].clear();
+    addDataSocket(client);
+    return;
+  }
+
+  char *extraData = NULL;
+  if (hello_remote.extraBytes > 0) {
+    extraData = new char[hello_remote.extraBytes];
+    remote.readAll(extraData, hello_remote.extraBytes);
+  }
+
+  CoordClient *client = new CoordClient(remote, &remoteAddr, remoteLen,
+                                        hello_remote);
+  onWorkerConnect(client, hello_remote, extraData, &remoteAddr, remoteLen);
+  delete[] extraData;
+}
+
+// Validates the hello of a new or restarting worker, which came on its own
+// connection, or through an aggregator; see processAggregatorMessage().
+void
+DmtcpCoordinator::onWorkerConnect(CoordClient *client,
+                                  DmtcpMessage &hello_remote,
+                                  const char *extraData,
+                                  const struct sockaddr_storage *remoteAddr,
+                                  socklen_t remoteLen)
+{
   if (killInProgress) {
     JNOTE("Connection request received in the middle of killing computation. "
           "Sending it the kill message.");
     DmtcpMessage msg;
     msg.type = DMT_KILL_PEER;
-    remote << msg;
-    remote.close();
+    client->send(msg);
+    client->close();
+    delete client;
     return;
   }
 
@@ -948,16 +1616,13 @@ DmtcpCoordinator::onConnect()
     initializeComputation();
   }
 
-  CoordClient *client = new CoordClient(remote, &remoteAddr, remoteLen,
-                                        hello_remote);
-
-  if (hello_remote.extraBytes > 0) {
-    client->readProcessInfo(hello_remote);
+  if (extraData != NULL) {
+    client->setProcessInfo(extraData);
   }
 
   if (hello_remote.type == DMT_RESTART_WORKER) {
-    if (!validateRestartingWorkerProcess(hello_remote, remote,
-                                         &remoteAddr, remoteLen)) {
+    if (!validateRestartingWorkerProcess(hello_remote, client,
+                                         remoteAddr, remoteLen)) {
       return;
     }
     client->virtualPid(hello_remote.from.pid());
@@ -965,10 +1630,23 @@ DmtcpCoordinator::onConnect()
   } else if (hello_remote.type == DMT_NEW_WORKER) {
     JASSERT(hello_remote.state == WorkerState::RUNNING ||
             hello_remote.state == WorkerState::UNKNOWN);
-    JASSERT(hello_remote.virtualPid == -1);
-    client->virtualPid(getNewVirtualPid());
-    if (!validateNewWorkerProcess(hello_remote, remote, client,
-                                  &remoteAddr, remoteLen)) {
+    if (hello_remote.virtualPid == -1) {
+      client->virtualPid(getNewVirtualPid());
+    } else {
+      // A child of fork(), with a pid that its parent reserved.
+      pid_t pid = hello_remote.virtualPid;
+      _reservedVirtualPids.erase(pid);
+      if (_virtualPidToClientMap.find(pid) != _virtualPidToClientMap.end()) {
+        JWARNING(false) (pid) (hello_remote.from)
+          .Text("Virtual pid of new process is in use.  Rejecting.");
+        client->close();
+        delete client;
+        return;
+      }
+      client->virtualPid(pid);
+    }
+    if (!validateNewWorkerProcess(hello_remote, client,
+                                  remoteAddr, remoteLen)) {
       return;
     }
     _virtualPidToClientMap[client->virtualPid()] = client;
@@ -981,7 +1659,11 @@ DmtcpCoordinator::onConnect()
   JNOTE("worker connected") (hello_remote.from) (client->progname());
 
   clients.push_back(client);
-  addDataSocket(client);
+  if (client->aggregator() == NULL) {
+    addDataSocket(client);
+  } else {
+    aggregators[client->aggregator()][client->route()] = client;
+  }
 
   JTRACE("END") (clients.size());
 }
@@ -1034,7 +1716,7 @@ getCurrTimestamp()
 bool
 DmtcpCoordinator::validateRestartingWorkerProcess(
   DmtcpMessage &hello_remote,
-  jalib::JSocket &remote,
+  CoordClient *client,
   const struct sockaddr_storage *remoteAddr,
   socklen_t remoteLen)
 {
@@ -1056,21 +1738,22 @@ DmtcpCoordinator::validateRestartingWorkerProcess(
     JNOTE("FIRST dmtcp_restart connection.  Set numPeers. Generate timestamp")
       (numPeers) (curTimeStamp) (compId);
     JTIMER_START(restart);
+    phaseStartTime = monotonicTime();
   } else if (minimumState() != WorkerState::RESTARTING) {
     JNOTE("Computation not in RESTARTING state."
           "  Reject incoming computation process requesting restart.")
       (compId) (hello_remote.compGroup) (minimumState());
     hello_local.type = DMT_REJECT_NOT_RESTARTING;
-    remote << hello_local;
-    remote.close();
+    client->send(hello_local);
+    client->close();
     return false;
   } else if (hello_remote.compGroup != compId) {
     JNOTE("Reject incoming computation process requesting restart,"
           " since it is not from current computation.")
       (compId) (hello_remote.compGroup);
     hello_local.type = DMT_REJECT_WRONG_COMP;
-    remote << hello_local;
-    remote.close();
+    client->send(hello_local);
+    client->close();
     return false;
   }
 
@@ -1087,7 +1770,7 @@ DmtcpCoordinator::validateRestartingWorkerProcess(
   } else {
     memcpy(&hello_local.ipAddr, &sin->sin_addr, sizeof localhostIPAddr);
   }
-  remote << hello_local;
+  client->send(hello_local);
 
   // NOTE: Sending the same message twice. We want to make sure that the
   // worker process receives/processes the first messages as soon as it
@@ -1111,7 +1794,6 @@ DmtcpCoordinator::validateRestartingWorkerProcess(
 bool
 DmtcpCoordinator::validateNewWorkerProcess(
   DmtcpMessage &hello_remote,
-  jalib::JSocket &remote,
   CoordClient *client,
   const struct sockaddr_storage *remoteAddr,
   socklen_t remoteLen)
@@ -1137,13 +1819,13 @@ DmtcpCoordinator::validateNewWorkerProcess(
 
     // Handshake
     hello_local.compGroup = compId;
-    remote << hello_local;
+    client->send(hello_local);
 
     // Now send DMT_DO_SUSPEND message so that this process can also
     // participate in the current checkpoint
     DmtcpMessage suspendMsg(DMT_DO_SUSPEND);
     suspendMsg.compGroup = compId;
-    remote << suspendMsg;
+    client->send(suspendMsg);
   } else if (s.numPeers > 0 && s.minimumState != WorkerState::RUNNING &&
              s.minimumState != WorkerState::UNKNOWN) {
     // If some of the processes are not in RUNNING state
@@ -1152,8 +1834,8 @@ DmtcpCoordinator::validateNewWorkerProcess(
       (compId) (hello_remote.from)
       (s.numPeers) (s.minimumState);
     hello_local.type = DMT_REJECT_NOT_RUNNING;
-    remote << hello_local;
-    remote.close();
+    client->send(hello_local);
+    client->close();
     return false;
   } else if (hello_remote.compGroup != UniquePid()) {
     // New Process trying to connect to Coordinator but already has compGroup
@@ -1162,8 +1844,8 @@ DmtcpCoordinator::validateNewWorkerProcess(
       (hello_remote.compGroup);
 
     hello_local.type = DMT_REJECT_WRONG_COMP;
-    remote << hello_local;
-    remote.close();
+    client->send(hello_local);
+    client->close();
     return false;
   } else {
     // If first process, create the new computation group
@@ -1189,7 +1871,7 @@ DmtcpCoordinator::validateNewWorkerProcess(
     } else {
       memcpy(&hello_local.ipAddr, &sin->sin_addr, sizeof localhostIPAddr);
     }
-    remote << hello_local;
+    client->send(hello_local);
   }
   return true;
 }
@@ -1225,10 +1907,21 @@ DmtcpCoordinator::startCheckpoint()
       !workersRunningAndSuspendMsgSent) {
     time(&ckptTimeStamp);
     JTIMER_START(checkpoint);
+    phaseStartTime = monotonicTime();
+    if (_numMetricsReports > 0) {
+      // Some process never reported the metrics of the previous phase.
+      writeMetrics();
+    }
     _numRestartFilenames = 0;
+    _numLocalImages = 0;
     _restartFilenames.clear();
     _rshCmdFileNames.clear();
     _sshCmdFileNames.clear();
+    // The manifest of the previous generation no longer describes the
+    // images in its directory once they start to be overwritten.
+    removeCkptManifest(_manifestDir);
+    _manifestValid = true;
+    _manifestImages.clear();
     compId.incrementGeneration();
     JNOTE("starting checkpoint; incrementing generation; suspending all nodes")
       (s.numPeers) (compId.computationGeneration());
@@ -1269,9 +1962,20 @@ DmtcpCoordinator::broadcastMessage(DmtcpMessageType type,
 
   JTRACE("sending message")(type);
   for (size_t i = 0; i < clients.size(); i++) {
-    clients[i]->sock() << msg;
-    if (extraBytes > 0) {
-      clients[i]->sock().writeAll((const char *)extraData, extraBytes);
+    if (clients[i]->aggregator() == NULL) {
+      clients[i]->send(msg, extraData);
+    }
+  }
+
+  // Once per aggregator, which passes it on to each of its workers.
+  msg.route = DMTCPMESSAGE_ROUTE_BROADCAST;
+  for (map<CoordClient *, map<uint32_t, CoordClient *> >::iterator it =
+         aggregators.begin(); it != aggregators.end(); ++it) {
+    if (!it->second.empty()) {
+      it->first->sock() << msg;
+      if (extraBytes > 0) {
+        it->first->sock().writeAll((const char *)extraData, extraBytes);
+      }
     }
   }
   workersAtCurrentBarrier = 0;
@@ -1339,6 +2043,9 @@ setupSignalHandlers()
 
   sigaction(SIGINT, &action, NULL);
   sigaction(SIGALRM, &action, NULL);
+
+  // A child of fork() may exit before it is sent DMT_ACCEPT.
+  signal(SIGPIPE, SIG_IGN);
 }
 
 // This code is also copied to ssh.cpp:updateCoordHost()
@@ -1468,6 +2175,117 @@ DmtcpCoordinator::updateCheckpointInterval(uint32_t interval)
   }
 }
 
+// Queues a message or the disconnection of a client for the main thread.
+static void
+queueClientEvent(CoordClient *client,
+                 const DmtcpMessage &msg,
+                 char *extraData,
+                 bool disconnect)
+{
+  ClientEvent event;
+  uint64_t one = 1;
+
+  event.client = client;
+  event.msg = msg;
+  event.extraData = extraData;
+  event.disconnect = disconnect;
+
+  JASSERT(pthread_mutex_lock(&clientEventsLock) == 0);
+  clientEvents.push_back(event);
+  JASSERT(pthread_mutex_unlock(&clientEventsLock) == 0);
+  JASSERT(write(clientEventsFd, &one, sizeof(one)) == sizeof(one))
+    (JASSERT_ERRNO);
+}
+
+static void *
+ioThread(void *arg)
+{
+  IoShard *shard = (IoShard *)arg;
+  struct epoll_event ioEvents[IO_THREAD_MAX_EVENTS];
+
+  while (true) {
+    int nfds = epoll_wait(shard->epollFd, ioEvents, IO_THREAD_MAX_EVENTS, -1);
+    JASSERT(nfds != -1 || errno == EINTR) (JASSERT_ERRNO);
+
+    for (int n = 0; n < nfds; ++n) {
+      CoordClient *client = (CoordClient *)ioEvents[n].data.ptr;
+      DmtcpMessage msg;
+      char *extraData = NULL;
+      bool disconnect = false;
+
+      if ((ioEvents[n].events & EPOLLHUP) ||
+#ifdef EPOLLRDHUP
+          (ioEvents[n].events & EPOLLRDHUP) ||
+#endif // ifdef EPOLLRDHUP
+          (ioEvents[n].events & EPOLLERR)) {
+        disconnect = true;
+      } else if (ioEvents[n].events & EPOLLIN) {
+        extraData = readClientMessage(client, &msg);
+        if (client->isNSWorker() &&
+            handleNameServiceMsg(client, msg, extraData)) {
+          delete[] extraData;
+          continue;
+        }
+      } else {
+        continue;
+      }
+
+      // The main thread closes the connection on DMT_NULL.
+      if (disconnect || msg.type == DMT_NULL) {
+        JASSERT(epoll_ctl(shard->epollFd, EPOLL_CTL_DEL,
+                          client->sock().sockfd(), &ioEvents[n]) != -1)
+          (JASSERT_ERRNO);
+      }
+      queueClientEvent(client, msg, extraData, disconnect);
+    }
+  }
+  return NULL;
+}
+
+static void
+startIoThreads()
+{
+  sigset_t allSignals;
+  sigset_t oldSignals;
+
+  clientEventsFd = eventfd(0, EFD_CLOEXEC);
+  JASSERT(clientEventsFd != -1) (JASSERT_ERRNO);
+
+  // Only the main thread handles SIGINT and SIGALRM.
+  sigfillset(&allSignals);
+  pthread_sigmask(SIG_BLOCK, &allSignals, &oldSignals);
+  for (int i = 0; i < numIoThreads; i++) {
+    ioShards[i].epollFd = epoll_create(MAX_EVENTS);
+    JASSERT(ioShards[i].epollFd != -1) (JASSERT_ERRNO);
+    JASSERT(pthread_create(&ioShards[i].thread, NULL,
+                           ioThread, &ioShards[i]) == 0);
+  }
+  pthread_sigmask(SIG_SETMASK, &oldSignals, NULL);
+}
+
+// Handles the messages and disconnections queued by the I/O threads.
+void
+DmtcpCoordinator::processClientEvents()
+{
+  vector<ClientEvent> pending;
+  uint64_t count;
+
+  JASSERT(read(clientEventsFd, &count, sizeof(count)) == sizeof(count))
+    (JASSERT_ERRNO);
+  JASSERT(pthread_mutex_lock(&clientEventsLock) == 0);
+  pending.swap(clientEvents);
+  JASSERT(pthread_mutex_unlock(&clientEventsLock) == 0);
+
+  for (size_t i = 0; i < pending.size(); i++) {
+    if (pending[i].disconnect) {
+      onDisconnect(pending[i].client);
+    } else {
+      processMessage(pending[i].client, pending[i].msg,
+                     pending[i].extraData);
+    }
+  }
+}
+
 void
 DmtcpCoordinator::eventLoop(bool daemon)
 {
@@ -1481,6 +2299,14 @@ DmtcpCoordinator::eventLoop(bool daemon)
   JASSERT(epoll_ctl(epollFd, EPOLL_CTL_ADD, listenSock->sockfd(), &ev) != -1)
     (JASSERT_ERRNO);
 
+  if (numIoThreads > 1) {
+    startIoThreads();
+    ev.events = EPOLLIN;
+    ev.data.ptr = &clientEventsFd;
+    JASSERT(epoll_ctl(epollFd, EPOLL_CTL_ADD, clientEventsFd, &ev) != -1)
+      (JASSERT_ERRNO);
+  }
+
   if (!daemon &&
 
       // epoll_ctl below fails if STDIN is pointing to /dev/null.
@@ -1530,7 +2356,11 @@ DmtcpCoordinator::eventLoop(bool daemon)
         }
       } else if (events[n].events & EPOLLIN) {
         if (ptr == (void *)listenSock) {
-          onConnect();
+          // The connections may have been accepted already, by an earlier
+          // event of this batch; see acceptPendingConnections().
+          acceptPendingConnections();
+        } else if (ptr == (void *)&clientEventsFd) {
+          processClientEvents();
         } else if (ptr == (void *)STDIN_FILENO) {
           char buf[1];
           int ret = Util::readAll(STDIN_FD, buf, sizeof(buf));
@@ -1562,7 +2392,21 @@ DmtcpCoordinator::addDataSocket(CoordClient *client)
   ev.events = EPOLLIN;
 #endif // ifdef EPOLLRDHUP
   ev.data.ptr = client;
-  JASSERT(epoll_ctl(epollFd, EPOLL_CTL_ADD, client->sock().sockfd(), &ev) != -1)
+
+  // A reply is a message and its extra data, in two writes; without this,
+  // the second one waits for the delayed ACK of the first (40 ms).
+  int one = 1;
+  setsockopt(client->sock().sockfd(), IPPROTO_TCP, TCP_NODELAY,
+             &one, sizeof(one));
+
+  int fd = epollFd;
+  if (numIoThreads > 1) {
+    // By process, so that its data socket and name-service connection are
+    // served by the same I/O thread.
+    const UniquePid &id = client->identity();
+    fd = ioShards[(id.hostid() * 31 + id.pid()) % numIoThreads].epollFd;
+  }
+  JASSERT(epoll_ctl(fd, EPOLL_CTL_ADD, client->sock().sockfd(), &ev) != -1)
     (JASSERT_ERRNO);
 }
 
@@ -1689,6 +2533,14 @@ main(int argc, char **argv)
     } else if (s == "--mpi") {
       mpiMode = true;
       shift;
+    } else if (argc > 1 && s == "--io-threads") {
+      numIoThreads = jalib::StringToInt(argv[1]);
+      if (numIoThreads < 1 || numIoThreads > MAX_IO_THREADS) {
+        fprintf(stderr, "--io-threads: must be from 1 to %d\n",
+                MAX_IO_THREADS);
+        return 1;
+      }
+      shift; shift;
     } else if (s == "--coord-logfile") {
       useLogFile = true;
       logFilename = argv[1];
@@ -1871,7 +2723,8 @@ main(int argc, char **argv)
     // unblock SIGALRM because we are using alarm() for interval checkpointing
     sigdelset(&set, SIGALRM);
 
-    // sigprocmask is only per-thread; but the coordinator is single-threaded.
+    // sigprocmask is only per-thread; the I/O threads, if any, are created
+    // later and inherit it.
     sigprocmask(SIG_BLOCK, &set, NULL);
   }
 
@@ -76,7 +76,21 @@ class CoordClient
 
     int isNSWorker() { return _isNSWorker; }
 
-    void readProcessInfo(DmtcpMessage &msg);
+    // A worker that is connected through an aggregator shares its socket;
+    // see dmtcp_aggregator.cpp.
+    CoordClient *aggregator() const { return _aggregator; }
+
+    uint32_t route() const { return _route; }
+
+    void setRoute(CoordClient *aggregator, uint32_t route)
+    {
+      _aggregator = aggregator;
+      _route = route;
+    }
+
+    void setProcessInfo(const char *extraData);
+    void send(DmtcpMessage &msg, const void *extraData = NULL);
+    void close();
 
   private:
     UniquePid _identity;
@@ -89,13 +103,27 @@ class CoordClient
     pid_t _realPid;
     pid_t _virtualPid;
     int _isNSWorker;
+    CoordClient *_aggregator;
+    uint32_t _route;
 };
 
 class DmtcpCoordinator
 {
   public:
     void onData(CoordClient *client);
+    void processMessage(CoordClient *client,
+                        const DmtcpMessage &msg,
+                        char *extraData);
+    void processClientEvents();
+    void processAggregatorMessage(CoordClient *aggregator,
+                                  const DmtcpMessage &msg,
+                                  char *extraData);
     void onConnect();
+    void onWorkerConnect(CoordClient *client,
+                         DmtcpMessage &hello_remote,
+                         const char *extraData,
+                         const struct sockaddr_storage *addr,
+                         socklen_t len);
     void onDisconnect(CoordClient *client);
     void eventLoop(bool daemon);
 
@@ -110,7 +138,18 @@ class DmtcpCoordinator
                           const void *extraData = NULL);
     void releaseBarrier(const string &barrier);
     bool startCheckpoint();
-    void recordCkptFilename(CoordClient *client, const char *barrierList);
+    void recordCkptFilename(CoordClient *client,
+                            const char *extraData,
+                            size_t extraBytes);
+    void recordManifestEntry(const string &ckptFilename, const char *mpiInfo);
+    void writeCkptManifest();
+    void recordCkptDurable(const char *extraData, size_t extraBytes);
+    void checkCkptDurable(uint32_t generation);
+    void recordMetrics(CoordClient *client,
+                       const DmtcpMessage &msg,
+                       const char *extraData,
+                       size_t extraBytes);
+    void writeMetrics();
 
     void handleUserCommand(char cmd, DmtcpMessage *reply = NULL);
     void writeSubmissionHostInfo();
@@ -119,12 +158,11 @@ class DmtcpCoordinator
 
     void processDmtUserCmd(DmtcpMessage &hello_remote, jalib::JSocket &remote);
     bool validateNewWorkerProcess(DmtcpMessage &hello_remote,
-                                  jalib::JSocket &remote,
                                   CoordClient *client,
                                   const struct sockaddr_storage *addr,
                                   socklen_t len);
     bool validateRestartingWorkerProcess(DmtcpMessage &hello_remote,
-                                         jalib::JSocket &remote,
+                                         CoordClient *client,
                                          const struct sockaddr_storage *addr,
                                          socklen_t len);
 
@@ -135,6 +173,9 @@ class DmtcpCoordinator
     }
 
     pid_t getNewVirtualPid();
+    void reserveVirtualPids(CoordClient *client, const DmtcpMessage &msg);
+    void releaseVirtualPids(pid_t owner);
+    void acceptPendingConnections();
 
     void writeRestartScript();
 
@@ -150,6 +191,36 @@ class DmtcpCoordinator
     map<string, vector<string> >_restartFilenames;
     map<pid_t, CoordClient *>_virtualPidToClientMap;
 
+    // Virtual pids reserved for the future children of a process: virtual
+    // pid -> virtual pid of the process that reserved it.
+    map<pid_t, pid_t>_reservedVirtualPids;
+
+    // Checkpoint manifest of an MPI job: union of the memory bounds of all
+    // ranks, and map from rank to checkpoint image.
+    bool _manifestValid;
+    string _manifestDir;
+    map<int, string>_manifestImages;
+    uint64_t _manifestLibsStart;
+    uint64_t _manifestLibsEnd;
+    uint64_t _manifestHighMemStart;
+
+    // Metrics reported by the workers for the current checkpoint or restart
+    // (_metricsPhase): metric name -> (process label -> value).  A process is
+    // labeled with its MPI rank, if known, or else with host:virtual-pid.
+    string _metricsPhase;
+    map<string, map<string, double> >_metrics;
+    size_t _numMetricsReports;
+    string _metricsSummary;
+
+    // Multi-level checkpointing: number of images of the current checkpoint
+    // written to a node-local dir, and per generation, the number of images
+    // that are still to be / have been drained to the ckpt dir.
+    size_t _numLocalImages;
+    map<uint32_t, size_t>_numImagesToDrain;
+    map<uint32_t, size_t>_numImagesDrained;
+    map<uint32_t, uint64_t>_drainStartTime;
+    uint32_t _lastDurableGeneration;
+
     vector<string>preSuspendBarriers;
     vector<string>ckptBarriers;
     vector<string>restartBarriers;
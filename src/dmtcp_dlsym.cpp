@@ -58,6 +58,7 @@
 # define _GNU_SOURCE
 #endif
 #include <link.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -346,6 +347,262 @@ get_dt_tags(void *handle, dt_tag *tags)
   }
 }
 
+/*
+ * Cache of the lookups below.  DMTCP, and then each plugin, resolve hundreds
+ * of symbols at startup, and each lookup walks every library after the
+ * caller: its dynamic section (get_dt_tags()), and then its hash chain.  So,
+ * the dt_tags of each library, the outcome of each (library, symbol,
+ * version) lookup, found or not, and the library in which each search
+ * (RTLD_NEXT, RTLD_DEFAULT or by library name) found its symbol, are cached.
+ * A repeated search is then a single probe.
+ *
+ * dlopen() only appends libraries, which cannot change the outcome of a
+ * lookup in an existing library, nor of a search that succeeded.  (A search
+ * that failed might now succeed; so, those are not cached.)  After a
+ * dlclose(), though, a link_map may be freed and reused for a different
+ * library.  So, each entry point compares dlpi_subs of dl_iterate_phdr()
+ * (the number of objects ever unloaded) with its value when the cache was
+ * filled, and empties the cache if it changed.
+ *
+ * This runs while the wrappers are being resolved: so, no malloc() and no
+ * pthread locks.  The cache is guarded by a try-lock; a thread that finds it
+ * busy does its lookup uncached, and so can never block here.
+ */
+#define DLSYM_CACHE_LIBS 128
+#define DLSYM_CACHE_SYMS 4096 // Must be a power of 2.
+#define DLSYM_CACHE_PROBES 8
+#define DLSYM_CACHE_KEY_LEN 64
+
+enum dlsym_cache_kind {
+  DLSYM_CACHE_LIBRARY = 1,  // A lookup in one library
+  DLSYM_CACHE_SEARCH        // A search starting at a library
+};
+
+typedef struct dlsym_cache_lib {
+  void *handle;
+  dt_tag tags;
+} dlsym_cache_lib;
+
+typedef struct dlsym_cache_sym {
+  uint32_t hash;    // 0 for an unused entry
+  uint16_t kind;
+  int16_t lib;      // Library of the symbol in dlsymCacheLibs[], or -1
+  void *handle;
+  Elf32_Word default_symbol_index;
+  void *result;
+
+  // "symbol\0", then "@version\0" if a version was given, and then
+  // "#libname\0" for a search by library name.
+  char key[DLSYM_CACHE_KEY_LEN];
+} dlsym_cache_sym;
+
+static dlsym_cache_lib dlsymCacheLibs[DLSYM_CACHE_LIBS];
+static int dlsymCacheNumLibs = 0;
+static dlsym_cache_sym dlsymCacheSyms[DLSYM_CACHE_SYMS];
+static unsigned long long dlsymCacheSubs = 0;
+static bool dlsymCacheUsable = false;
+static int dlsymCacheLock = 0;
+
+static bool
+dlsym_cache_trylock()
+{
+  return __sync_lock_test_and_set(&dlsymCacheLock, 1) == 0;
+}
+
+static void
+dlsym_cache_unlock()
+{
+  __sync_lock_release(&dlsymCacheLock);
+}
+
+static int
+dlsym_cache_subs(struct dl_phdr_info *info, size_t size, void *data)
+{
+  unsigned long long *subs = (unsigned long long *)data;
+
+  // dlpi_adds is never 0, as the first object has been added.  So, a 0 here
+  // says that this libc does not have the counters.
+  if (size >= offsetof(struct dl_phdr_info, dlpi_subs) +
+      sizeof(info->dlpi_subs) && info->dlpi_adds != 0) {
+    subs[0] = info->dlpi_subs;
+    subs[1] = 1;
+  }
+  return 1;  // Only the first object is needed.
+}
+
+static void
+dlsym_cache_validate()
+{
+  unsigned long long subs[2] = { 0, 0 };
+
+  dl_iterate_phdr(dlsym_cache_subs, subs);
+  if (!dlsym_cache_trylock()) {
+    return;
+  }
+  if (!dlsymCacheUsable || subs[1] == 0 || subs[0] != dlsymCacheSubs) {
+    for (size_t i = 0; i < DLSYM_CACHE_SYMS; i++) {
+      dlsymCacheSyms[i].hash = 0;
+    }
+    dlsymCacheNumLibs = 0;
+    dlsymCacheSubs = subs[0];
+    dlsymCacheUsable = (subs[1] != 0);
+  }
+  dlsym_cache_unlock();
+}
+
+// Returns the length of the key, or 0 if it is too long to be cached.
+static size_t
+dlsym_cache_key(const char *symbol,
+                const char *version,
+                const char *libname,
+                char *key)
+{
+  size_t symlen = strlen(symbol) + 1;
+  size_t verlen = (version != NULL ? strlen(version) + 2 : 0);
+  size_t liblen = (libname != NULL ? strlen(libname) + 2 : 0);
+
+  if (symlen + verlen + liblen > DLSYM_CACHE_KEY_LEN) {
+    return 0;
+  }
+  memset(key, 0, DLSYM_CACHE_KEY_LEN);
+  memcpy(key, symbol, symlen);
+  if (version != NULL) {
+    key[symlen] = '@';
+    memcpy(key + symlen + 1, version, verlen - 1);
+  }
+  if (libname != NULL) {
+    key[symlen + verlen] = '#';
+    memcpy(key + symlen + verlen + 1, libname, liblen - 1);
+  }
+  return symlen + verlen + liblen;
+}
+
+// FNV-1a over the kind, the handle and the key.  Never 0.
+static uint32_t
+dlsym_cache_hash(int kind, void *handle, const char *key, size_t keylen)
+{
+  uintptr_t h = (uintptr_t)handle;
+  uint32_t hash = (2166136261u ^ kind) * 16777619u;
+  size_t i;
+
+  for (i = 0; i < sizeof(h); i++) {
+    hash = (hash ^ ((h >> (8 * i)) & 0xff)) * 16777619u;
+  }
+  for (i = 0; i < keylen; i++) {
+    hash = (hash ^ (unsigned char)key[i]) * 16777619u;
+  }
+  return hash != 0 ? hash : 1;
+}
+
+// Must be called with the cache locked.
+static int
+dlsym_cache_find_lib(void *handle)
+{
+  for (int i = 0; i < dlsymCacheNumLibs; i++) {
+    if (dlsymCacheLibs[i].handle == handle) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static bool
+dlsym_cache_lookup(int kind,
+                   void *handle,
+                   const char *key,
+                   uint32_t hash,
+                   dt_tag *tags_p,
+                   Elf32_Word *default_symbol_index_p,
+                   void **result)
+{
+  bool found = false;
+
+  if (!dlsymCacheUsable || !dlsym_cache_trylock()) {
+    return false;
+  }
+  for (size_t i = 0; i < DLSYM_CACHE_PROBES; i++) {
+    dlsym_cache_sym *sym = &dlsymCacheSyms[(hash + i) & (DLSYM_CACHE_SYMS - 1)];
+    if (sym->hash == 0) {
+      break;
+    }
+    if (sym->hash == hash && sym->kind == kind && sym->handle == handle &&
+        memcmp(sym->key, key, DLSYM_CACHE_KEY_LEN) == 0) {
+      if (sym->lib != -1) {
+        *tags_p = dlsymCacheLibs[sym->lib].tags;
+      }
+      *default_symbol_index_p = sym->default_symbol_index;
+      *result = sym->result;
+      found = true;
+      break;
+    }
+  }
+  dlsym_cache_unlock();
+  return found;
+}
+
+static void
+dlsym_cache_get_dt_tags(void *handle, dt_tag *tags)
+{
+  if (dlsymCacheUsable && dlsym_cache_trylock()) {
+    int lib = dlsym_cache_find_lib(handle);
+    if (lib != -1) {
+      *tags = dlsymCacheLibs[lib].tags;
+      dlsym_cache_unlock();
+      return;
+    }
+    dlsym_cache_unlock();
+  }
+
+  get_dt_tags(handle, tags);
+
+  if (dlsymCacheUsable && dlsym_cache_trylock()) {
+    if (dlsym_cache_find_lib(handle) == -1 &&
+        dlsymCacheNumLibs < DLSYM_CACHE_LIBS) {
+      dlsymCacheLibs[dlsymCacheNumLibs].handle = handle;
+      dlsymCacheLibs[dlsymCacheNumLibs].tags = *tags;
+      dlsymCacheNumLibs++;
+    }
+    dlsym_cache_unlock();
+  }
+}
+
+// 'lib' is the handle of the library in which the symbol was found, if any.
+static void
+dlsym_cache_insert(int kind,
+                   void *handle,
+                   const char *key,
+                   uint32_t hash,
+                   void *lib,
+                   Elf32_Word default_symbol_index,
+                   void *result)
+{
+  if (!dlsymCacheUsable || !dlsym_cache_trylock()) {
+    return;
+  }
+
+  // If all probed entries are taken, replace the first one.
+  dlsym_cache_sym *sym = &dlsymCacheSyms[hash & (DLSYM_CACHE_SYMS - 1)];
+  for (size_t i = 0; i < DLSYM_CACHE_PROBES; i++) {
+    dlsym_cache_sym *s = &dlsymCacheSyms[(hash + i) & (DLSYM_CACHE_SYMS - 1)];
+    if (s->hash == 0) {
+      sym = s;
+      break;
+    }
+  }
+  sym->hash = hash;
+  sym->kind = kind;
+  sym->lib = (lib != NULL ? dlsym_cache_find_lib(lib) : -1);
+  sym->handle = handle;
+  sym->default_symbol_index = default_symbol_index;
+  sym->result = result;
+  memcpy(sym->key, key, DLSYM_CACHE_KEY_LEN);
+  if (lib != NULL && sym->lib == -1) {
+    // The tags of 'lib' did not fit in the cache; callers may need them.
+    sym->hash = 0;
+  }
+  dlsym_cache_unlock();
+}
+
 // Given a handle for a library (not RTLD_DEFAULT or RTLD_NEXT), retrieves the
 // default symbol for the given symbol if it exists in that library.
 // Also sets the tags and default_symbol_index for usage later
@@ -360,8 +617,20 @@ dlsym_default_internal_library_handler(void *handle,
   Elf32_Word default_symbol_index = 0;
   Elf32_Word i;
   uint32_t numNonHiddenSymbols = 0;
+  char key[DLSYM_CACHE_KEY_LEN];
+  size_t keylen = dlsym_cache_key(symbol, version, NULL, key);
+  uint32_t keyhash = 0;
+  void *result = NULL;
+
+  if (keylen > 0) {
+    keyhash = dlsym_cache_hash(DLSYM_CACHE_LIBRARY, handle, key, keylen);
+    if (dlsym_cache_lookup(DLSYM_CACHE_LIBRARY, handle, key, keyhash,
+                           tags_p, default_symbol_index_p, &result)) {
+      return result;
+    }
+  }
 
-  get_dt_tags(handle, &tags);
+  dlsym_cache_get_dt_tags(handle, &tags);
   JASSERT(tags.hash != NULL || tags.gnu_hash != NULL);
   int use_gnu_hash = (tags.hash == NULL);
   Elf32_Word *hash = (use_gnu_hash ? tags.gnu_hash : tags.hash);
@@ -404,20 +673,22 @@ dlsym_default_internal_library_handler(void *handle,
   *default_symbol_index_p = default_symbol_index;
 
   if (default_symbol_index) {
+    result = tags.base_addr + tags.symtab[default_symbol_index].st_value;
 #if __GLIBC_PREREQ(2, 11)
     // See https://gcc.gnu.org/onlinedocs/gcc-4.9.2/gcc/Function-Attributes.html
     if (ELF64_ST_TYPE(tags.symtab[default_symbol_index].st_info) ==
         STT_GNU_IFUNC) {
       typedef void* (*fnc)();
-      fnc f =  (fnc)(tags.base_addr +
-                     tags.symtab[default_symbol_index].st_value);
-      return f();
+      fnc f = (fnc)result;
+      result = f();
     }
 #endif
-    return tags.base_addr + tags.symtab[default_symbol_index].st_value;
-  } else {
-    return NULL;
   }
+  if (keylen > 0) {
+    dlsym_cache_insert(DLSYM_CACHE_LIBRARY, handle, key, keyhash, handle,
+                       default_symbol_index, result);
+  }
+  return result;
 }
 
 // Given a pseudo-handle, symbol name, and addr, returns the address of the
@@ -466,6 +737,19 @@ dlsym_default_internal_flag_handler(void *handle,
     map = map->l_next;
   }
 
+  char key[DLSYM_CACHE_KEY_LEN];
+  size_t keylen = dlsym_cache_key(symbol, version, libname, key);
+  uint32_t keyhash = 0;
+  struct link_map *start = map;
+
+  if (keylen > 0) {
+    keyhash = dlsym_cache_hash(DLSYM_CACHE_SEARCH, start, key, keylen);
+    if (dlsym_cache_lookup(DLSYM_CACHE_SEARCH, start, key, keyhash,
+                           tags_p, default_symbol_index_p, &result)) {
+      return result;
+    }
+  }
+
   // Search through libraries until end of list is reached or symbol is found.
   while (map) {
     // printf("l_name: %s\n", map->l_name);
@@ -482,6 +766,10 @@ dlsym_default_internal_flag_handler(void *handle,
                                                       default_symbol_index_p);
     }
     if (result) {
+      if (keylen > 0) {
+        dlsym_cache_insert(DLSYM_CACHE_SEARCH, start, key, keyhash, map,
+                           *default_symbol_index_p, result);
+      }
       return result;
     }
 
@@ -541,6 +829,8 @@ dmtcp_dlsym(void *handle, const char *symbol)
   dt_tag tags;
   Elf32_Word default_symbol_index = 0;
 
+  dlsym_cache_validate();
+
 #ifdef __USE_GNU
   if (handle == RTLD_NEXT || handle == RTLD_DEFAULT) {
     // Determine where this function will return
@@ -569,6 +859,8 @@ dmtcp_dlvsym(void *handle, char *symbol, const char *version)
   dt_tag tags;
   Elf32_Word default_symbol_index = 0;
 
+  dlsym_cache_validate();
+
 #ifdef __USE_GNU
   if (handle == RTLD_NEXT || handle == RTLD_DEFAULT) {
     // Determine where this function will return
@@ -594,6 +886,8 @@ dmtcp_dlsym_lib(const char *libname, const char *symbol)
   dt_tag tags;
   Elf32_Word default_symbol_index = 0;
 
+  dlsym_cache_validate();
+
   // Determine where this function will return
   void* return_address = __builtin_return_address(0);
   void *result = dlsym_default_internal_flag_handler(NULL, libname, symbol,
@@ -614,6 +908,8 @@ dmtcp_dlsym_lib_fnc_offset(const char *libname, const char *symbol)
   uint64_t ret = LIB_FNC_OFFSET_FAILED;
   Elf32_Word default_symbol_index = 0;
 
+  dlsym_cache_validate();
+
   // Determine where this function will return
   void* return_address = __builtin_return_address(0);
   void *result = dlsym_default_internal_flag_handler(NULL, libname, symbol,
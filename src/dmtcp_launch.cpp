@@ -101,6 +101,10 @@ static const char *theUsage =
   "  --gzip, --no-gzip, (environment variable DMTCP_GZIP=[01])\n"
   "              Enable/disable compression of checkpoint images (default: 1)\n"
   "              WARNING: gzip adds seconds. Without gzip, ckpt is often < 1s\n"
+  "  --lz, --no-lz, (environment variable DMTCP_LZ=[01])\n"
+  "              Enable/disable fast in-process compression of checkpoint\n"
+  "              images; overrides --gzip.  Needed for compressed images\n"
+  "              with MANA (default: 0)\n"
 #ifdef HBICT_DELTACOMP
   "  --hbict, --no-hbict, (environment variable DMTCP_HBICT=[01])\n"
   "              Enable/disable compression of checkpoint images (default: 1)\n"
@@ -108,6 +112,10 @@ static const char *theUsage =
   "  --ckptdir PATH (environment variable DMTCP_CHECKPOINT_DIR)\n"
   "              Directory to store checkpoint images\n"
   "              (default: curr dir at launch)\n"
+  "  --local-ckptdir PATH (environment variable DMTCP_LOCAL_CKPT_DIR)\n"
+  "              Write checkpoint images to this node-local directory, and\n"
+  "              copy them to the --ckptdir in the background, so that\n"
+  "              the processes can resume sooner (default: disabled)\n"
   "  --ckpt-open-files\n"
   "  --checkpoint-open-files\n"
   "              Checkpoint open files and restore old working dir.\n"
@@ -274,6 +282,12 @@ processArgs(int *orig_argc,
     } else if (s == "--no-gzip") {
       setenv(ENV_VAR_COMPRESSION, "0", 1);
       shift;
+    } else if (s == "--lz") {
+      setenv(ENV_VAR_LZ_COMPRESSION, "1", 1);
+      shift;
+    } else if (s == "--no-lz") {
+      setenv(ENV_VAR_LZ_COMPRESSION, "0", 1);
+      shift;
     }
 #ifdef HBICT_DELTACOMP
     else if (s == "--hbict") {
@@ -321,6 +335,9 @@ processArgs(int *orig_argc,
     } else if (argc > 1 && (s == "-c" || s == "--ckptdir")) {
       setenv(ENV_VAR_CHECKPOINT_DIR, argv[1], 1);
       shift; shift;
+    } else if (argc > 1 && s == "--local-ckptdir") {
+      setenv(ENV_VAR_LOCAL_CKPT_DIR, argv[1], 1);
+      shift; shift;
     } else if (argc > 1 && (s == "-t" || s == "--tmpdir")) {
       tmpdir_arg = argv[1];
       shift; shift;
@@ -387,6 +404,7 @@ processArgs(int *orig_argc,
 #ifdef FAST_RST_VIA_MMAP
   // In case of fast restart, we shall not use gzip.
   setenv(ENV_VAR_COMPRESSION, "0", 1);
+  setenv(ENV_VAR_LZ_COMPRESSION, "0", 1);
 #endif
 
 #if __aarch64__
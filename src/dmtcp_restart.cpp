@@ -21,6 +21,7 @@
 
 #include <elf.h>
 #include <limits.h>
+#include <signal.h>
 #include <stdio.h>
 #include <sys/fcntl.h>
 #include <sys/mman.h>
@@ -32,17 +33,20 @@
 #endif  // ifdef HAS_PR_SET_PTRACER
 
 #include "../jalib/jassert.h"
+#include "../jalib/jconvert.h"
 #include "../jalib/jfilesystem.h"
 #include "constants.h"
 #include "coordinatorapi.h"
 #include "dmtcp_dlsym.h"
 #include "processinfo.h"
+#include "restartmanifest.h"
 #include "shareddata.h"
 #include "uniquepid.h"
 #include "util.h"
 
 #define BINARY_NAME         "dmtcp_restart"
 #define MTCP_RESTART_BINARY "mtcp_restart"
+#define DEFAULT_FANOUT      8
 
 using namespace dmtcp;
 
@@ -62,7 +66,8 @@ string restartDir;
 // string has at least one format specifier with corresponding format argument.
 // Ubuntu 9.01 uses -Wformat=2 by default.
 static const char *theUsage =
-  "Usage: dmtcp_restart [OPTIONS] <ckpt1.dmtcp> [ckpt2.dmtcp...]\n\n"
+  "Usage: dmtcp_restart [OPTIONS] <ckpt1.dmtcp> [ckpt2.dmtcp...]\n"
+  "       dmtcp_restart [OPTIONS] --from-manifest FILE\n\n"
   "Restart processes from a checkpoint image.\n\n"
   "  -h, --coord-host HOSTNAME (environment variable DMTCP_COORD_HOST)\n"
   "              Hostname where dmtcp_coordinator is run (default: localhost)\n"
@@ -105,7 +110,28 @@ static const char *theUsage =
   "  --ckptdir (environment variable DMTCP_CHECKPOINT_DIR):\n"
   "              Directory to store checkpoint images\n"
   "              (default: use the same dir used in previous checkpoint)\n"
+  "  --local-ckptdir PATH (environment variable DMTCP_LOCAL_CKPT_DIR)\n"
+  "              Node-local checkpoint directory (see dmtcp_launch).  A\n"
+  "              checkpoint image found there is restarted from in place of\n"
+  "              the given image of the same name.\n"
   "  --restartdir Directory that contains checkpoint image directories\n" 
+  "  --from-manifest FILE\n"
+  "              Restart the computation of a restart manifest (see\n"
+  "              dmtcp_restart_manifest.bin in the checkpoint directory) on\n"
+  "              all of its hosts, in place of the restart script.  The\n"
+  "              images of this host are restarted here.  The other hosts\n"
+  "              are started in a tree: no host starts more than --fanout\n"
+  "              others.  They join the coordinator, which must be running.\n"
+  "  --hostfile FILE\n"
+  "              With --from-manifest, restart the images of the i-th host\n"
+  "              of the manifest on the i-th host of FILE (one per line;\n"
+  "              '#' starts a comment)\n"
+  "  --remote-shell CMD\n"
+  "              With --from-manifest, command to start dmtcp_restart on\n"
+  "              another host, as:  CMD HOST dmtcp_restart ...\n"
+  "              (default: as used at checkpoint time, or ssh)\n"
+  "  --fanout N  With --from-manifest, number of hosts that a host starts,\n"
+  "              at most (default: " STRINGIFY(DEFAULT_FANOUT) ")\n"
   "  --mpi       Use as MPI proxy\n (default: no MPI proxy)"
   "  --tmpdir PATH (environment variable DMTCP_TMPDIR)\n"
   "              Directory to store temp files (default: $TMDPIR or /tmp)\n"
@@ -835,6 +861,244 @@ setNewCkptDir(char *path)
   }
 }
 
+// With --local-ckptdir, the node-local copy of a checkpoint image has the
+// same name as its drained copy in the ckpt dir.  Restart from the local copy
+// if it is still there: it is complete as soon as the checkpoint is, and it
+// is faster to read.
+static char *
+preferLocalCkptImage(char *path)
+{
+  const char *localDir = getenv(ENV_VAR_LOCAL_CKPT_DIR);
+
+  if (localDir == NULL || localDir[0] == '\0') {
+    return path;
+  }
+
+  string localPath = string(localDir) + "/" + jalib::Filesystem::BaseName(path);
+  struct stat st;
+  if (localPath == path || stat(localPath.c_str(), &st) == -1 ||
+      !S_ISREG(st.st_mode)) {
+    return path;
+  }
+  JTRACE("Using node-local checkpoint image") (path) (localPath);
+  return strdup(localPath.c_str());
+}
+
+/* dmtcp_restart --from-manifest FILE restarts a computation on all of its
+ * hosts.  The images of this host are restarted here, as if given on the
+ * command line.  The other hosts are split into up to 'fanout' groups, and
+ * dmtcp_restart is started on the first host of each group, with the
+ * manifest of its group on stdin ('--from-manifest -').  There, the first
+ * host is its own, and it starts the rest of its group in the same way.  So,
+ * no host starts more than 'fanout' others, all hosts are started after
+ * log_fanout(hosts) steps, and no list of images is on a command line.
+ */
+static RestartManifest theManifest;
+static const char *theManifestPath = NULL;
+
+// The command line of dmtcp_restart on the hosts that this one starts.
+static vector<string> theRelayArgs;
+
+static void
+readHostfile(const char *path, vector<string> *names)
+{
+  FILE *fp = fopen(path, "r");
+  char *line = NULL;
+  size_t len = 0;
+
+  JASSERT(fp != NULL) (path) (JASSERT_ERRNO).Text("Failed to open hostfile");
+  while (getline(&line, &len, fp) != -1) {
+    char *comment = strchr(line, '#');
+    if (comment != NULL) {
+      *comment = '\0';
+    }
+    vector<string> words = Util::tokenizeString(line, " \t\r\n");
+    if (!words.empty()) {
+      names->push_back(words[0]);
+    }
+  }
+  free(line);
+  fclose(fp);
+}
+
+static void
+readManifest(const char *hostfile, const char *remoteShell, int fanout)
+{
+  bool relayed = strcmp(theManifestPath, "-") == 0;
+  int fd = relayed ? STDIN_FILENO : open(theManifestPath, O_RDONLY);
+
+  JASSERT(fd != -1) (theManifestPath) (JASSERT_ERRNO)
+    .Text("Failed to open restart manifest");
+  {
+    jalib::JBinarySerializeReaderRaw rdr(theManifestPath, fd);
+    theManifest.serialize(rdr);
+  }
+  if (relayed) {
+    // Nothing more comes from the host that started this one.
+    int nullFd = open("/dev/null", O_RDONLY);
+    JASSERT(nullFd != -1 && dup2(nullFd, STDIN_FILENO) == STDIN_FILENO)
+      (JASSERT_ERRNO);
+    close(nullFd);
+  } else {
+    close(fd);
+  }
+  JASSERT(!theManifest.hosts.empty()) (theManifestPath)
+    .Text("Restart manifest has no hosts");
+
+  if (hostfile != NULL) {
+    vector<string> names;
+    readHostfile(hostfile, &names);
+    JASSERT(names.size() >= theManifest.hosts.size())
+      (hostfile) (names.size()) (theManifest.hosts.size())
+      .Text("Fewer hosts in hostfile than in restart manifest");
+    for (size_t i = 0; i < theManifest.hosts.size(); i++) {
+      theManifest.hosts[i].name = names[i];
+    }
+  }
+  if (remoteShell != NULL) {
+    theManifest.remoteShell = remoteShell;
+  }
+  if (fanout > 0) {
+    theManifest.fanout = fanout;
+  } else if (theManifest.fanout == 0) {
+    theManifest.fanout = DEFAULT_FANOUT;
+  }
+
+  // The coordinator and interval of the checkpoint, unless given.
+  setenv(ENV_VAR_NAME_HOST, theManifest.coordHost.c_str(), 0);
+  setenv(ENV_VAR_NAME_PORT,
+         jalib::XToString(theManifest.coordPort).c_str(), 0);
+  setenv(ENV_VAR_CKPT_INTR, jalib::XToString(theManifest.interval).c_str(), 0);
+
+  // As in the restart script, processes on several hosts need a coordinator
+  // that they all join.
+  if (theManifest.hosts.size() > 1 && allowedModes == COORD_ANY) {
+    allowedModes = COORD_JOIN;
+  }
+}
+
+// Starts dmtcp_restart on the first host of 'group', with 'group' on its
+// stdin, and exits with its status.  The remote shell runs for as long as
+// the processes on that host do.
+static void
+startHost(RestartManifest &group)
+{
+  const RestartManifest::Host &host = group.hosts[0];
+  string shell = group.remoteShell;
+  if (shell.empty()) {
+    shell = host.remoteShell.empty() ? "ssh" : host.remoteShell;
+  }
+
+  vector<string> args = Util::tokenizeString(shell, " ");
+  args.push_back(host.name);
+  args.insert(args.end(), theRelayArgs.begin(), theRelayArgs.end());
+  vector<char *> argv;
+  for (size_t i = 0; i < args.size(); i++) {
+    argv.push_back(const_cast<char *>(args[i].c_str()));
+  }
+  argv.push_back(NULL);
+
+  int fds[2];
+  JASSERT(pipe(fds) == 0) (JASSERT_ERRNO);
+  pid_t pid = fork();
+  JASSERT(pid != -1) (JASSERT_ERRNO);
+  if (pid == 0) {
+    JASSERT(dup2(fds[0], STDIN_FILENO) == STDIN_FILENO) (JASSERT_ERRNO);
+    close(fds[0]);
+    close(fds[1]);
+    execvp(argv[0], &argv[0]);
+    JASSERT(false) (argv[0]) (JASSERT_ERRNO)
+      .Text("Failed to start remote shell");
+  }
+  close(fds[0]);
+
+  // If the remote shell fails, the write fails, rather than kill us.
+  signal(SIGPIPE, SIG_IGN);
+  {
+    jalib::JBinarySerializeWriterRaw wr(host.name, fds[1]);
+    group.serialize(wr);
+  }
+  close(fds[1]);
+
+  int status;
+  JASSERT(waitpid(pid, &status, 0) == pid) (JASSERT_ERRNO);
+  JWARNING(WIFEXITED(status) && WEXITSTATUS(status) == 0)
+    (host.name) (status).Text("dmtcp_restart failed on host");
+  _exit(WIFEXITED(status) ? WEXITSTATUS(status) : DMTCP_FAIL_RC);
+}
+
+static void
+startHosts(const vector<RestartManifest::Host> &hosts)
+{
+  size_t numGroups = std::min((size_t)theManifest.fanout, hosts.size());
+  RestartManifest group = theManifest;
+
+  group.hosts.clear();
+  for (size_t i = 0; i < numGroups; i++) {
+    group.hosts.assign(hosts.begin() + i * hosts.size() / numGroups,
+                       hosts.begin() + (i + 1) * hosts.size() / numGroups);
+    pid_t pid = fork();
+    JASSERT(pid != -1) (JASSERT_ERRNO);
+    if (pid == 0) {
+      startHost(group);
+    }
+  }
+}
+
+// Starts the other hosts of the manifest; returns the images of this host.
+static vector<char *>
+launchFromManifest()
+{
+  bool relayed = strcmp(theManifestPath, "-") == 0;
+  string hostname = jalib::Filesystem::GetCurrentHostname();
+  vector<char *> images;
+  vector<RestartManifest::Host> others;
+
+  // The hosts that this one starts join the coordinator chosen here.
+  theManifest.coordHost = getenv(ENV_VAR_NAME_HOST);
+  theManifest.coordPort = atoi(getenv(ENV_VAR_NAME_PORT));
+
+  for (size_t i = 0; i < theManifest.hosts.size(); i++) {
+    const RestartManifest::Host &host = theManifest.hosts[i];
+    if (relayed ? i == 0 : host.name == hostname) {
+      for (size_t j = 0; j < host.images.size(); j++) {
+        images.push_back(strdup(host.images[j].c_str()));
+      }
+    } else {
+      others.push_back(host);
+    }
+  }
+  JTRACE("restarting from manifest") (theManifestPath) (images.size())
+    (others.size());
+
+  if (others.empty()) {
+    return images;
+  }
+
+  if (images.empty()) {
+    // Nothing to restart here; wait for the hosts, as the restart script
+    // does.
+    startHosts(others);
+    int status;
+    bool failed = false;
+    while (wait(&status) != -1) {
+      failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    }
+    exit(failed ? DMTCP_FAIL_RC : 0);
+  }
+
+  // The processes that start the other hosts must not be children of the
+  // processes restarted here.
+  pid_t pid = fork();
+  JASSERT(pid != -1) (JASSERT_ERRNO);
+  if (pid == 0) {
+    startHosts(others);
+    _exit(0);
+  }
+  JASSERT(waitpid(pid, NULL, 0) == pid) (JASSERT_ERRNO);
+  return images;
+}
+
 // shift args
 #define shift argc--, argv++
 
@@ -843,6 +1107,9 @@ main(int argc, char **argv)
 {
   char *tmpdir_arg = NULL;
   char *ckptdir_arg = NULL;
+  const char *hostfile = NULL;
+  const char *remoteShell = NULL;
+  int fanout = 0;
 
   initializeJalib();
 
@@ -920,6 +1187,9 @@ main(int argc, char **argv)
     } else if (argc > 1 && (s == "-c" || s == "--ckptdir")) {
       ckptdir_arg = argv[1];
       shift; shift;
+    } else if (argc > 1 && s == "--local-ckptdir") {
+      setenv(ENV_VAR_LOCAL_CKPT_DIR, argv[1], 1);
+      shift; shift;
     } else if (argc > 1 && (s == "-t" || s == "--tmpdir")) {
       tmpdir_arg = argv[1];
       shift; shift;
@@ -932,6 +1202,18 @@ main(int argc, char **argv)
     } else if (s == "--mpi") {
       runMpiProxy = true;
       shift;
+    } else if (argc > 1 && s == "--from-manifest") {
+      theManifestPath = argv[1];
+      shift; shift;
+    } else if (argc > 1 && s == "--hostfile") {
+      hostfile = argv[1];
+      shift; shift;
+    } else if (argc > 1 && s == "--remote-shell") {
+      remoteShell = argv[1];
+      shift; shift;
+    } else if (argc > 1 && s == "--fanout") {
+      fanout = atoi(argv[1]);
+      shift; shift;
     } else if (s == "-q" || s == "--quiet") {
       *getenv(ENV_VAR_QUIET) = *getenv(ENV_VAR_QUIET) + 1;
 
@@ -950,6 +1232,14 @@ main(int argc, char **argv)
     }
   }
 
+  if (theManifestPath != NULL) {
+    if (argc > 0 || runMpiProxy) {
+      printf("Invalid Argument\n%s", theUsage);
+      return DMTCP_FAIL_RC;
+    }
+    readManifest(hostfile, remoteShell, fanout);
+  }
+
   if ((getenv(ENV_VAR_NAME_PORT) == NULL ||
        getenv(ENV_VAR_NAME_PORT)[0]== '\0') &&
       allowedModes != COORD_NEW) {
@@ -980,6 +1270,34 @@ main(int argc, char **argv)
 
   JTRACE("New dmtcp_restart process; _argc_ ckpt images") (argc);
 
+  vector<char *> images;
+  images.assign(argv, argv + argc);
+  if (theManifestPath != NULL) {
+    theRelayArgs.push_back(jalib::Filesystem::GetProgramPath());
+    theRelayArgs.push_back("--from-manifest");
+    theRelayArgs.push_back("-");
+    theRelayArgs.push_back("--join-coordinator");
+    if (noStrictChecking) {
+      theRelayArgs.push_back("--no-strict-checking");
+    }
+    if (tmpdir_arg != NULL) {
+      theRelayArgs.push_back("--tmpdir");
+      theRelayArgs.push_back(tmpdir_arg);
+    }
+    if (ckptdir_arg != NULL) {
+      theRelayArgs.push_back("--ckptdir");
+      theRelayArgs.push_back(ckptdir_arg);
+    }
+    if (getenv(ENV_VAR_LOCAL_CKPT_DIR) != NULL) {
+      theRelayArgs.push_back("--local-ckptdir");
+      theRelayArgs.push_back(getenv(ENV_VAR_LOCAL_CKPT_DIR));
+    }
+    for (int i = 0; i < jassert_quiet; i++) {
+      theRelayArgs.push_back("--quiet");
+    }
+    images = launchFromManifest();
+  }
+
   bool doAbort = false;
   vector<char *> mtcpArgList;
   // TODO handle 32-Bit case
@@ -997,8 +1315,12 @@ main(int argc, char **argv)
     mtcpArgList.push_back((char *)"--mtcp-restart-pause");
     mtcpArgList.push_back(pause_param);
   }
-  for (; argc > 0; shift) {
-    string restorename(argv[0]);
+  for (size_t i = 0; i < images.size(); i++) {
+    char *image = images[i];
+    if (Util::strEndsWith(image, ".dmtcp")) {
+      image = preferLocalCkptImage(image);
+    }
+    string restorename(image);
     struct stat buf;
     int rc = stat(restorename.c_str(), &buf);
     if (Util::strEndsWith(restorename, "_files")) {
@@ -1028,12 +1350,12 @@ main(int argc, char **argv)
       exit(DMTCP_FAIL_RC);
     }
 
-    JTRACE("Will restart ckpt image") (argv[0]);
+    JTRACE("Will restart ckpt image") (image);
     if (runMpiProxy) {
         // TODO
-        if(restartDir.empty()) mtcpArgList.push_back(argv[0]);
+        if(restartDir.empty()) mtcpArgList.push_back(image);
     } else {
-      RestoreTarget *t = new RestoreTarget(argv[0]);
+      RestoreTarget *t = new RestoreTarget(image);
       targets[t->upid()] = t;
     }
   }
@@ -0,0 +1,283 @@
+/****************************************************************************
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+/* Checks the checksums of checkpoint images, without restarting them.
+ *
+ * mtcp_restart checks each area as it restores it; this reads every byte of
+ * an image, e.g. after it was copied.  An image written by gzip (DMTCP_GZIP)
+ * is read through 'gzip -dc'.
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mtcp/mtcp_crc32c.h"
+#include "mtcp/mtcp_header.h"
+#include "procmapsarea.h"
+
+#define BINARY_NAME "dmtcp_verify_image"
+#define BLOCK_SIZE  (1024 * 1024)
+
+static const char *theUsage =
+  "Usage:  dmtcp_verify_image [--quiet] IMAGE [IMAGE...]\n"
+  "Check the checksums of checkpoint images.\n\n"
+  "Options:\n\n"
+  "  -q, --quiet\n"
+  "              Print only the images that are corrupt.\n"
+  "  --help\n"
+  "              Print this message and exit.\n"
+  "\n"
+  "Exit status is 0 if every image is intact, 1 otherwise.\n"
+  "\n";
+
+typedef struct Image {
+  const char *path;
+  FILE *fp;
+  bool isPipe;
+  char buf[BLOCK_SIZE];
+} Image;
+
+static bool
+readExactly(Image *img, void *buf, size_t len, uint32_t *crc)
+{
+  if (fread(buf, 1, len, img->fp) != len) {
+    return false;
+  }
+  if (crc != NULL) {
+    *crc = mtcp_crc32c(*crc, buf, len);
+  }
+  return true;
+}
+
+static bool
+openImage(Image *img, const char *path)
+{
+  unsigned char magic[2];
+
+  img->path = path;
+  img->isPipe = false;
+  img->fp = fopen(path, "r");
+  if (img->fp == NULL) {
+    return false;
+  }
+  if (fread(magic, 1, 2, img->fp) == 2 && magic[0] == 0x1f &&
+      magic[1] == 0x8b) {
+    fclose(img->fp);
+    char cmd[PATH_MAX + 32];
+    snprintf(cmd, sizeof(cmd), "gzip -dc < '%s'", path);
+    img->fp = popen(cmd, "r");
+    img->isPipe = true;
+    return img->fp != NULL;
+  }
+  rewind(img->fp);
+  return true;
+}
+
+static void
+closeImage(Image *img)
+{
+  if (img->isPipe) {
+    pclose(img->fp);
+  } else {
+    fclose(img->fp);
+  }
+}
+
+// Reads the DMTCP header, up to the MTCP header; see
+// CkptSerializer::writeDmtcpHeader().
+static const char *
+verifyHeaders(Image *img, bool *checksummed)
+{
+  MtcpHeader mtcpHdr;
+  uint32_t crc = 0;
+
+  while (true) {
+    if (!readExactly(img, &mtcpHdr, 4096, NULL)) {
+      return "no MTCP header";
+    }
+    if (memcmp(mtcpHdr.signature, MTCP_SIGNATURE,
+               strlen(MTCP_SIGNATURE)) == 0) {
+      break;
+    }
+    crc = mtcp_crc32c(crc, &mtcpHdr, 4096);
+  }
+  if (!readExactly(img, (char *)&mtcpHdr + 4096, sizeof(mtcpHdr) - 4096,
+                   NULL)) {
+    return "truncated MTCP header";
+  }
+
+  *checksummed = mtcpHdr.checksummed != 0;
+  if (!*checksummed) {
+    return NULL;
+  }
+  if (crc != mtcpHdr.dmtcpHeaderChecksum) {
+    return "DMTCP header checksum mismatch";
+  }
+  uint32_t headerChecksum = mtcpHdr.headerChecksum;
+  mtcpHdr.headerChecksum = 0;
+  if (mtcp_crc32c(0, &mtcpHdr, sizeof(mtcpHdr)) != headerChecksum) {
+    return "MTCP header checksum mismatch";
+  }
+  return NULL;
+}
+
+// Reads the data that follows an area header; see write_area_with_data() in
+// writeckpt.cpp.
+static bool
+readAreaData(Image *img, const Area *area, uint32_t *crc)
+{
+  if (area->properties & DMTCP_LZ_COMPRESSED) {
+    size_t remaining = area->size;
+    while (remaining > 0) {
+      MtcpLzBlockHeader blk;
+      if (!readExactly(img, &blk, sizeof(blk), crc) ||
+          blk.size == 0 || blk.size > remaining ||
+          blk.compressedSize > BLOCK_SIZE ||
+          !readExactly(img, img->buf, blk.compressedSize, crc)) {
+        return false;
+      }
+      remaining -= blk.size;
+    }
+    return true;
+  }
+
+  size_t remaining = area->size;
+  while (remaining > 0) {
+    size_t len = remaining < BLOCK_SIZE ? remaining : BLOCK_SIZE;
+    if (!readExactly(img, img->buf, len, crc)) {
+      return false;
+    }
+    remaining -= len;
+  }
+  return true;
+}
+
+static const char *
+verifyAreas(Image *img, bool checksummed, int *numAreas)
+{
+  static char msg[FILENAMESIZE + 64];
+  Area area;
+
+  *numAreas = 0;
+  while (true) {
+    if (!readExactly(img, &area, sizeof(area), NULL)) {
+      return "truncated image";
+    }
+
+    bool hasChecksum = (area.properties & DMTCP_CHECKSUMMED) != 0;
+    if (checksummed && !hasChecksum && area.size != (size_t)-1 &&
+        (area.properties & DMTCP_LZ_COMPRESSED) == 0) {
+      // Only LZ areas written to a pipe are left without a checksum.
+      snprintf(msg, sizeof(msg), "area %d (%s) has no checksum",
+               *numAreas, area.name);
+      return msg;
+    }
+    if (hasChecksum) {
+      uint32_t headerChecksum = area.headerChecksum;
+      area.headerChecksum = 0;
+      if (mtcp_crc32c(0, &area, sizeof(area)) != headerChecksum) {
+        snprintf(msg, sizeof(msg), "area %d: header checksum mismatch",
+                 *numAreas);
+        return msg;
+      }
+    }
+    if (area.size == (size_t)-1) {
+      return NULL;
+    }
+
+    if ((area.properties & (DMTCP_ZERO_PAGE |
+                            DMTCP_SKIP_WRITING_TEXT_SEGMENTS |
+                            DMTCP_SYSV_SHM_SEGMENT)) == 0) {
+      uint32_t crc = 0;
+      if (!readAreaData(img, &area, &crc)) {
+        snprintf(msg, sizeof(msg), "area %d (%s): truncated data",
+                 *numAreas, area.name);
+        return msg;
+      }
+      if (hasChecksum && crc != area.checksum) {
+        snprintf(msg, sizeof(msg),
+                 "area %d (%s, %p, %zu bytes): data checksum mismatch",
+                 *numAreas, area.name, area.addr, area.size);
+        return msg;
+      }
+    }
+    (*numAreas)++;
+  }
+}
+
+static bool
+verifyImage(Image *img, const char *path, bool quiet)
+{
+  const char *error = NULL;
+  bool checksummed = false;
+  int numAreas = 0;
+
+  if (!openImage(img, path)) {
+    error = "cannot open";
+  } else {
+    error = verifyHeaders(img, &checksummed);
+    if (error == NULL) {
+      error = verifyAreas(img, checksummed, &numAreas);
+    }
+    closeImage(img);
+  }
+
+  if (error != NULL) {
+    printf("%s: CORRUPT: %s\n", path, error);
+    return false;
+  }
+  if (!quiet) {
+    printf("%s: OK (%d areas%s)\n", path, numAreas,
+           checksummed ? "" : ", no checksums");
+  }
+  return true;
+}
+
+int
+main(int argc, char **argv)
+{
+  bool quiet = false;
+  bool ok = true;
+  int i;
+
+  for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+    if (strcmp(argv[i], "-q") == 0 || strcmp(argv[i], "--quiet") == 0) {
+      quiet = true;
+    } else if (strcmp(argv[i], "--help") == 0) {
+      printf("%s", theUsage);
+      return 0;
+    } else {
+      fprintf(stderr, "%s", theUsage);
+      return 1;
+    }
+  }
+  if (i == argc) {
+    fprintf(stderr, "%s", theUsage);
+    return 1;
+  }
+
+  Image *img = (Image *)malloc(sizeof(Image));
+  for (; i < argc; i++) {
+    ok = verifyImage(img, argv[i], quiet) && ok;
+  }
+  free(img);
+  return ok ? 0 : 1;
+}
@@ -41,6 +41,7 @@ DmtcpMessage::DmtcpMessage(DmtcpMessageType t /*= DMT_NULL*/)
   , coordTimeStamp(0)
   , theCheckpointInterval(DMTCPMESSAGE_SAME_CKPT_INTERVAL)
   , exitAfterCkpt(0)
+  , route(0)
 {
   // struct sockaddr_storage _addr;
   // socklen_t _addrlen;
@@ -98,6 +99,8 @@ dmtcp::operator<<(dmtcp::ostream &o, const DmtcpMessageType &s)
     OSHIFTPRINTF(DMT_REJECT_NOT_RUNNING)
 
     OSHIFTPRINTF(DMT_UPDATE_PROCESS_INFO_AFTER_FORK)
+    OSHIFTPRINTF(DMT_RESERVE_VIRTUAL_PIDS)
+    OSHIFTPRINTF(DMT_RESERVE_VIRTUAL_PIDS_RESPONSE)
     OSHIFTPRINTF(DMT_UPDATE_PROCESS_INFO_AFTER_INIT_OR_EXEC)
     OSHIFTPRINTF(DMT_GET_CKPT_DIR)
     OSHIFTPRINTF(DMT_GET_CKPT_DIR_RESULT)
@@ -128,10 +131,19 @@ dmtcp::operator<<(dmtcp::ostream &o, const DmtcpMessageType &s)
     OSHIFTPRINTF(DMT_NAME_SERVICE_QUERY_RESPONSE)
     OSHIFTPRINTF(DMT_NAME_SERVICE_QUERY_ALL)
     OSHIFTPRINTF(DMT_NAME_SERVICE_QUERY_ALL_RESPONSE)
+    OSHIFTPRINTF(DMT_NAME_SERVICE_QUERY_BATCH)
+    OSHIFTPRINTF(DMT_NAME_SERVICE_QUERY_BATCH_RESPONSE)
 
     OSHIFTPRINTF(DMT_NAME_SERVICE_GET_UNIQUE_ID)
     OSHIFTPRINTF(DMT_NAME_SERVICE_GET_UNIQUE_ID_RESPONSE)
 
+    OSHIFTPRINTF(DMT_METRICS)
+    OSHIFTPRINTF(DMT_CKPT_DURABLE)
+
+    OSHIFTPRINTF(DMT_AGGREGATOR)
+    OSHIFTPRINTF(DMT_AGGREGATED_OK)
+    OSHIFTPRINTF(DMT_WORKER_DISCONNECTED)
+
     OSHIFTPRINTF(DMT_OK)
 
   default:
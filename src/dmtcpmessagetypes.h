@@ -42,6 +42,8 @@ enum DmtcpMessageType {
   DMT_REJECT_NOT_RUNNING,
 
   DMT_UPDATE_PROCESS_INFO_AFTER_FORK,
+  DMT_RESERVE_VIRTUAL_PIDS,  // a block of virtual pids for children of fork()
+  DMT_RESERVE_VIRTUAL_PIDS_RESPONSE,
   DMT_UPDATE_PROCESS_INFO_AFTER_INIT_OR_EXEC,
 
   DMT_GET_CKPT_DIR,
@@ -74,10 +76,19 @@ enum DmtcpMessageType {
   DMT_NAME_SERVICE_QUERY_RESPONSE,
   DMT_NAME_SERVICE_QUERY_ALL,
   DMT_NAME_SERVICE_QUERY_ALL_RESPONSE,
+  DMT_NAME_SERVICE_QUERY_BATCH,
+  DMT_NAME_SERVICE_QUERY_BATCH_RESPONSE,
 
   DMT_NAME_SERVICE_GET_UNIQUE_ID,
   DMT_NAME_SERVICE_GET_UNIQUE_ID_RESPONSE,
 
+  DMT_METRICS,               // slave sending its checkpoint/restart metrics
+  DMT_CKPT_DURABLE,          // image copied from node-local to ckpt dir
+
+  DMT_AGGREGATOR,            // on connect established aggregator-coordinator
+  DMT_AGGREGATED_OK,         // DMT_OK of several workers of an aggregator
+  DMT_WORKER_DISCONNECTED,   // a worker of an aggregator is gone
+
   DMT_OK,                    // slave telling coordinator it is done (response
                              // to DMT_DO_*)  this means slave reached barrier
 };
@@ -97,6 +108,10 @@ ostream&operator<<(ostream &o, const DmtcpMessageType &s);
 #define DMTCPMESSAGE_NUM_PARAMS         2
 #define DMTCPMESSAGE_SAME_CKPT_INTERVAL (~0u) /* default value */
 
+// DmtcpMessage::route of a message that an aggregator sends to all of its
+// workers.  A route of 0 is a direct connection.
+#define DMTCPMESSAGE_ROUTE_BROADCAST    (~0u)
+
 // Make sure the struct is of same size on 32-bit and 64-bit systems.
 struct DmtcpMessage {
   char _magicBits[16];
@@ -130,7 +145,10 @@ struct DmtcpMessage {
   uint32_t uniqueIdOffset;
 
   uint32_t exitAfterCkpt;
-  uint32_t padding;
+
+  // Between an aggregator and the coordinator, the worker that a message is
+  // from or for; see dmtcp_aggregator.cpp.
+  uint32_t route;
 
   DmtcpMessage(DmtcpMessageType t = DMT_NULL);
   void assertValid() const;
@@ -21,6 +21,7 @@
 
 #include <stdlib.h>
 
+#include "ckptmetrics.h"
 #include "coordinatorapi.h"
 #include "dmtcp.h"
 #include "dmtcpworker.h"
@@ -149,6 +150,12 @@ dmtcp_get_ckpt_signal(void)
   return ckpt_signal;
 }
 
+EXTERNC void
+dmtcp_metrics_add(const char *name, double value)
+{
+  CkptMetrics::add(name, value);
+}
+
 EXTERNC const char *
 dmtcp_get_tmpdir(void)
 {
@@ -536,6 +543,18 @@ dmtcp_send_query_all_to_coordinator(const char *id, void **buf, int *len)
   return CoordinatorAPI::sendQueryAllToCoordinator(id, buf, len);
 }
 
+EXTERNC int
+dmtcp_send_queries_to_coordinator(const char *id,
+                                  const void *keys,
+                                  uint32_t key_len,
+                                  uint32_t num_keys,
+                                  void *buf,
+                                  uint32_t *len)
+{
+  return CoordinatorAPI::sendQueriesToCoordinator(id, keys, key_len,
+                                                  num_keys, buf, len);
+}
+
 EXTERNC void
 dmtcp_get_local_ip_addr(struct in_addr *in)
 {
@@ -27,9 +27,11 @@
 #include "../jalib/jconvert.h"
 #include "../jalib/jfilesystem.h"
 #include "../jalib/jsocket.h"
+#include "ckptmetrics.h"
 #include "coordinatorapi.h"
 #include "pluginmanager.h"
 #include "processinfo.h"
+#include "procselfmaps.h"
 #include "shareddata.h"
 #include "syscallwrappers.h"
 #include "syslogwrappers.h"
@@ -555,6 +557,7 @@ void
 DmtcpWorker::preCheckpoint()
 {
   WorkerState::setCurrentState(WorkerState::SUSPENDED);
+  ProcSelfMaps::invalidateSnapshot();
 
   JTRACE("suspended");
 
@@ -582,8 +585,19 @@ DmtcpWorker::preCheckpoint()
 void
 DmtcpWorker::postCheckpoint()
 {
+  void *libsStart, *libsEnd, *highMemStart;
+
   WorkerState::setCurrentState(WorkerState::CHECKPOINTED);
-  CoordinatorAPI::sendCkptFilename();
+  ProcSelfMaps::invalidateSnapshot();
+
+  const ThreadList::SuspendTimings &timings = ThreadList::lastSuspendTimings();
+  CkptMetrics::add("suspend.threads", timings.numThreads);
+  CkptMetrics::add("suspend.signal_s", timings.signalTime);
+  CkptMetrics::add("suspend.ack_s", timings.acknowledgeTime);
+  CkptMetrics::add("suspend.total_s", timings.suspendTime);
+
+  ThreadList::getMpiMemoryBounds(&libsStart, &libsEnd, &highMemStart);
+  CoordinatorAPI::sendCkptFilename(libsStart, libsEnd, highMemStart);
 
   if (_exitAfterCkpt) {
     JTRACE("Asked to exit after checkpoint. Exiting!");
@@ -594,6 +608,7 @@ DmtcpWorker::postCheckpoint()
 #ifdef TIMING
   PluginManager::logCkptResumeBarrierOverhead();
 #endif
+  CkptMetrics::sendToCoordinator();
 
   // Inform Coordinator of RUNNING state.
   WorkerState::setCurrentState(WorkerState::RUNNING);
@@ -605,11 +620,17 @@ DmtcpWorker::postRestart(double ckptReadTime)
 {
   JTRACE("begin postRestart()");
   WorkerState::setCurrentState(WorkerState::RESTARTING);
+  ProcSelfMaps::invalidateSnapshot();
+
+  // Drop the values recorded before the checkpoint image was written.
+  CkptMetrics::reset();
+  CkptMetrics::add("restart.read_s", ckptReadTime);
 
   PluginManager::processRestartBarriers();
 #ifdef TIMING
   PluginManager::logRestartBarrierOverhead(ckptReadTime);
 #endif
+  CkptMetrics::sendToCoordinator();
   JTRACE("got resume message after restart");
 
   // Inform Coordinator of RUNNING state.
@@ -19,6 +19,7 @@
  *  <http://www.gnu.org/licenses/>.                                         *
  ****************************************************************************/
 
+#include <poll.h>
 #include <sys/syscall.h>
 #ifdef __aarch64__
 #define __ARCH_WANT_SYSCALL_DEPRECATED
@@ -321,6 +322,62 @@ execShortLivedProcessAndExit(const char *path, char *const argv[])
   _exit(0);
 }
 
+// Creates the file into which this process and the plugins serialize their
+// state for the new program (the "lifeboat").  It is an anonymous memfd if
+// the kernel supports them, so that exec() does not touch the tmpdir, which
+// may be on a network file system.  Otherwise, it is an unlinked file there.
+static int
+createLifeBoat()
+{
+  int fd = -1;
+
+#ifdef SYS_memfd_create
+  fd = _real_syscall(SYS_memfd_create, "dmtcpLifeBoat", 0);
+  if (fd != -1) {
+    return fd;
+  }
+#endif // ifdef SYS_memfd_create
+
+  ostringstream os;
+  os << dmtcp_get_tmpdir() << "/dmtcpLifeBoat." << UniquePid::ThisProcess()
+     << "-XXXXXX";
+  char *buf = (char *)JALLOC_HELPER_MALLOC(os.str().length() + 1);
+  strcpy(buf, os.str().c_str());
+  fd = _real_mkstemp(buf);
+  JASSERT(fd != -1) (JASSERT_ERRNO);
+  JASSERT(unlink(buf) == 0) (JASSERT_ERRNO);
+  JALLOC_HELPER_FREE(buf);
+  return fd;
+}
+
+// Removes the FD_CLOEXEC flag from the protected fds, so that they survive
+// exec().  Few of them are open; one poll() finds which ones (the others
+// are marked POLLNVAL), and only those are queried and updated.
+static void
+clearCloexecOnProtectedFds()
+{
+  struct pollfd fds[PROTECTED_FD_END - PROTECTED_FD_START];
+  nfds_t nfds = 0;
+
+  for (int fd = PROTECTED_FD_START; fd < PROTECTED_FD_END; fd++) {
+    fds[nfds].fd = fd;
+    fds[nfds].events = 0;
+    fds[nfds].revents = 0;
+    nfds++;
+  }
+  bool polled = _real_poll(fds, nfds, 0) != -1;
+
+  for (nfds_t i = 0; i < nfds; i++) {
+    if (polled && (fds[i].revents & POLLNVAL)) {
+      continue;
+    }
+    int flags = fcntl(fds[i].fd, F_GETFD, NULL);
+    if (flags != -1 && (flags & FD_CLOEXEC)) {
+      fcntl(fds[i].fd, F_SETFD, flags & ~FD_CLOEXEC);
+    }
+  }
+}
+
 // FIXME:  Unify this code with code prior to execvp in dmtcp_launch.cpp
 // Can use argument to dmtcpPrepareForExec() or getenv("DMTCP_...")
 // from DmtcpWorker constructor, to distinguish the two cases.
@@ -392,15 +449,7 @@ dmtcpPrepareForExec(const char *path,
     *newArgv = (char **)argv;
   }
 
-  ostringstream os;
-  os << dmtcp_get_tmpdir() << "/dmtcpLifeBoat." << UniquePid::ThisProcess()
-     << "-XXXXXX";
-  char *buf = (char *)JALLOC_HELPER_MALLOC(os.str().length() + 1);
-  strcpy(buf, os.str().c_str());
-  int fd = _real_mkstemp(buf);
-  JASSERT(fd != -1) (JASSERT_ERRNO);
-  JASSERT(unlink(buf) == 0) (JASSERT_ERRNO);
-  Util::changeFd(fd, PROTECTED_LIFEBOAT_FD);
+  Util::changeFd(createLifeBoat(), PROTECTED_LIFEBOAT_FD);
   jalib::JBinarySerializeWriterRaw wr("", PROTECTED_LIFEBOAT_FD);
   UniquePid::serialize(wr);
   DmtcpEventData_t edata;
@@ -412,13 +461,7 @@ dmtcpPrepareForExec(const char *path,
   Util::adjustRlimitStack();
   Util::prepareDlsymWrapper();
 
-  // Remove FD_CLOEXEC flag from protected file descriptors.
-  for (size_t i = PROTECTED_FD_START; i < PROTECTED_FD_END; i++) {
-    int flags = fcntl(i, F_GETFD, NULL);
-    if (flags != -1) {
-      fcntl(i, F_SETFD, flags & ~FD_CLOEXEC);
-    }
-  }
+  clearCloexecOnProtectedFds();
   JTRACE("Prepared for Exec") (getenv("LD_PRELOAD"));
 }
 
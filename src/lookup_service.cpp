@@ -31,6 +31,8 @@ LookupService::getSummaryStats()
   ostringstream o;
   size_t totalKeys = 0;
   size_t totalSize = 0;
+
+  readLock();
   for (ConstMapIterator i = _maps.begin(); i != _maps.end(); i++) {
     const KeyValueMap &kvmap = i->second;
     o << i->first  << ": " << kvmap.size();
@@ -46,9 +48,12 @@ LookupService::getSummaryStats()
       break;
     }
   }
+  size_t numMaps = _maps.size();
+  unlock();
+
   ostringstream o2;
   o2 << "Nameservice database stats:"
-     << "\n#databases:  " << _maps.size()
+     << "\n#databases:  " << numMaps
      << "\n#total keys: " << totalKeys
      << "\n#total size: " << totalSize << " (" << totalSize / 1024 << " KB)"
      << "\nIndividual database stats:\n"
@@ -71,6 +76,7 @@ LookupService::reset()
 {
   MapIterator i;
 
+  writeLock();
   for (i = _maps.begin(); i != _maps.end(); i++) {
     KeyValueMap &kvmap = i->second;
     KeyValueMap::iterator it;
@@ -86,6 +92,7 @@ LookupService::reset()
   _maps.clear();
   _lastUniqueIds.clear();
   _offsets.clear();
+  unlock();
 }
 
 void
@@ -95,15 +102,43 @@ LookupService::addKeyValue(string id,
                            const void *val,
                            size_t valLen)
 {
-  KeyValueMap &kvmap = _maps[id];
-
   KeyValue k(key, keyLen);
   KeyValue *v = new KeyValue(val, valLen);
 
+  writeLock();
+  KeyValueMap &kvmap = _maps[id];
   if (kvmap.find(k) != kvmap.end()) {
     JTRACE("Duplicate key");
   }
   kvmap[k] = v;
+  unlock();
+}
+
+// Called with _lock held.
+bool
+LookupService::lookup(const string &id,
+                      const void *key,
+                      size_t keyLen,
+                      void **val,
+                      size_t *valLen)
+{
+  MapIterator m = _maps.find(id);
+  if (m == _maps.end()) {
+    return false;
+  }
+
+  KeyValue k(key, keyLen);
+  KeyValueMap::iterator it = m->second.find(k);
+  k.destroy();
+  if (it == m->second.end()) {
+    return false;
+  }
+
+  KeyValue *v = it->second;
+  *valLen = v->len();
+  *val = new char[v->len()];
+  memcpy(*val, v->data(), *valLen);
+  return true;
 }
 
 void
@@ -113,20 +148,15 @@ LookupService::query(string id,
                      void **val,
                      size_t *valLen)
 {
-  KeyValueMap &kvmap = _maps[id];
-  KeyValue k(key, keyLen);
+  readLock();
+  bool found = lookup(id, key, keyLen, val, valLen);
+  unlock();
 
-  if (kvmap.find(k) == kvmap.end()) {
+  if (!found) {
     JTRACE("Lookup Failed, Key not found.");
     *val = NULL;
     *valLen = 0;
-    return;
   }
-
-  KeyValue *v = kvmap[k];
-  *valLen = v->len();
-  *val = new char[v->len()];
-  memcpy(*val, v->data(), *valLen);
 }
 
 void
@@ -167,6 +197,10 @@ LookupService::respondToQuery(jalib::JSocket &remote,
   reply.valLen = valLen;
   reply.extraBytes = reply.valLen;
 
+  // A request that came through an aggregator is answered on its connection;
+  // the route tells it which of its workers the reply is for.
+  reply.route = msg.route;
+
   remote << reply;
   if (valLen > 0) {
     remote.writeAll((char *)val, valLen);
@@ -182,6 +216,17 @@ LookupService::getUniqueId(const char *id,    // DB name
                            uint32_t offset,   // Difference in two unique ids
                            size_t val_len)    // Expected value length
 {
+  // Most requests are for an id that was already assigned.
+  size_t len = 0;
+  readLock();
+  bool found = lookup(id, key, key_len, val, &len);
+  unlock();
+  if (found) {
+    JASSERT(len == val_len) (len) (val_len);
+    return;
+  }
+
+  writeLock();
   KeyValueMap &kvmap = _maps[id];
   KeyValue k(key, key_len);
 
@@ -202,6 +247,7 @@ LookupService::getUniqueId(const char *id,    // DB name
   JASSERT(v->len() == val_len);
   *val = new char[v->len()];
   memcpy(*val, v->data(), val_len);
+  unlock();
 }
 
 void
@@ -209,7 +255,15 @@ LookupService::queryAll(const string& id, void **buf, size_t *buflen)
 {
   ostringstream o;
   map<KeyValue, KeyValue *>::iterator i;
-  KeyValueMap &kvmap = _maps[id];
+
+  readLock();
+  MapIterator m = _maps.find(id);
+  if (m == _maps.end()) {
+    unlock();
+    *buflen = 0;
+    return;
+  }
+  KeyValueMap &kvmap = m->second;
 
   for (i = kvmap.begin(); i != kvmap.end(); i++) {
     KeyValue *k = (KeyValue *)&(i->first);
@@ -225,6 +279,7 @@ LookupService::queryAll(const string& id, void **buf, size_t *buflen)
     o.write((const char*)(&len), sizeof(len));
     o.write((const char*)v->data(), len);
   }
+  unlock();
 
   *buflen = o.tellp();
   if (buflen == 0) {
@@ -239,6 +294,44 @@ LookupService::queryAll(const string& id, void **buf, size_t *buflen)
   memcpy(*buf, o.str().c_str(), *buflen);
 }
 
+void
+LookupService::respondToBatchQuery(jalib::JSocket &remote,
+                                   const DmtcpMessage &msg,
+                                   const void *keys)
+{
+  JASSERT(msg.keyLen > 0 && msg.extraBytes % msg.keyLen == 0)
+    (msg.keyLen) (msg.extraBytes);
+  ostringstream o;
+  size_t numKeys = msg.extraBytes / msg.keyLen;
+  string id = msg.nsid;
+
+  readLock();
+  for (size_t i = 0; i < numKeys; i++) {
+    void *val = NULL;
+    size_t len = 0;
+    if (!lookup(id, (const char *)keys + i * msg.keyLen, msg.keyLen,
+                &val, &len)) {
+      len = 0;
+    }
+    o.write((const char*)(&len), sizeof(len));
+    o.write((const char*)val, len);
+    delete[] (char *)val;
+  }
+  unlock();
+
+  string data = o.str();
+  DmtcpMessage reply(DMT_NAME_SERVICE_QUERY_BATCH_RESPONSE);
+  reply.keyLen = 0;
+  reply.valLen = data.length();
+  reply.extraBytes = reply.valLen;
+  reply.route = msg.route;
+
+  remote << reply;
+  if (data.length() > 0) {
+    remote.writeAll(data.data(), data.length());
+  }
+}
+
 void
 LookupService::sendAllMappings(jalib::JSocket &remote,
                                const DmtcpMessage &msg)
@@ -253,6 +346,7 @@ LookupService::sendAllMappings(jalib::JSocket &remote,
   reply.keyLen = 0;
   reply.valLen = valLen;
   reply.extraBytes = reply.valLen;
+  reply.route = msg.route;
 
   remote << reply;
   if (valLen > 0) {
@@ -22,8 +22,10 @@
 #ifndef LOOKUP_SERVICE_H
 #define LOOKUP_SERVICE_H
 
+#include <pthread.h>
 #include <string.h>
 #include <map>
+#include "../jalib/jassert.h"
 #include "../jalib/jsocket.h"
 #include "dmtcpmessagetypes.h"
 
@@ -76,15 +78,36 @@ class KeyValue
 
 typedef map<KeyValue, KeyValue *>KeyValueMap;
 
+// The databases are read and written concurrently by the I/O threads of the
+// coordinator (see --io-threads), so all accesses take _lock: queries shared,
+// and updates exclusive.  The lock is never held while writing to a socket.
 class LookupService
 {
   public:
-    LookupService() {}
+    LookupService()
+    {
+      pthread_rwlock_t lock = PTHREAD_RWLOCK_INITIALIZER;
+
+      _lock = lock;
+    }
 
     ~LookupService() { reset(); }
 
     string getSummaryStats();
+
+    // The caller must hold readLock() while it uses the returned map.
     const KeyValueMap* getMap(string name) const;
+    void readLock() const
+    {
+      JASSERT(pthread_rwlock_rdlock(&_lock) == 0) (JASSERT_ERRNO);
+    }
+
+    void unlock() const
+    {
+      JASSERT(pthread_rwlock_unlock(&_lock) == 0) (JASSERT_ERRNO);
+    }
+
+
     void reset();
     void registerData(const DmtcpMessage &msg, const void *data);
     void respondToQuery(jalib::JSocket &remote,
@@ -100,6 +123,14 @@ class LookupService
     void sendAllMappings(jalib::JSocket &remote,
                          const DmtcpMessage &msg);
 
+    // Answers a DMT_NAME_SERVICE_QUERY_BATCH: 'keys' holds
+    // msg.extraBytes / msg.keyLen keys of msg.keyLen bytes each.  The reply
+    // holds, for each key in order, the value length (0 if not found) and
+    // the value, in the format of queryAll().
+    void respondToBatchQuery(jalib::JSocket &remote,
+                             const DmtcpMessage &msg,
+                             const void *keys);
+
     void addKeyValue(string id,
                      const void *key,
                      size_t keyLen,
@@ -119,6 +150,18 @@ class LookupService
                   void **buf,
                   size_t *buflen);
 
+  private:
+    void writeLock()
+    {
+      JASSERT(pthread_rwlock_wrlock(&_lock) == 0) (JASSERT_ERRNO);
+    }
+
+    bool lookup(const string &id,
+                const void *key,
+                size_t keyLen,
+                void **val,
+                size_t *valLen);
+
   private:
     typedef map<string, KeyValueMap>::iterator MapIterator;
     typedef map<string, KeyValueMap>::const_iterator ConstMapIterator;
@@ -127,6 +170,7 @@ class LookupService
     map<string, KeyValueMap>_maps;
     map<string, uint64_t>_lastUniqueIds;
     map<string, uint64_t>_offsets;
+    mutable pthread_rwlock_t _lock;
 };
 }
 #endif // ifndef LOOKUP_SERVICE_H
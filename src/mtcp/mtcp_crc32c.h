@@ -0,0 +1,102 @@
+#ifndef MTCP_CRC32C_H
+#define MTCP_CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* CRC32C (Castagnoli), as used for the checksums in the checkpoint image.
+ * It is computed by libdmtcp while it writes the image, by mtcp_restart
+ * while it reads it, and by dmtcp_verify_image.  So, everything here is
+ * static inline, and uses no libc: mtcp_restart has none.
+ *
+ * On x86_64 with SSE4.2, the crc32 instruction processes 8 bytes at a time.
+ * Elsewhere, a table is used, one byte at a time.
+ *
+ * mtcp_crc32c(0, buf, len) is the CRC of buf.  A CRC can be extended with
+ * more data: mtcp_crc32c(mtcp_crc32c(0, a, n), b, m) is the CRC of a + b.
+ */
+
+#define MTCP_CRC32C_POLY 0x82F63B78 /* reflected */
+
+typedef uint64_t __attribute__((may_alias, aligned(1))) mtcp_crc32c_u64_t;
+
+static inline int
+mtcp_crc32c_have_hw(void)
+{
+#ifdef __x86_64__
+  static int have_hw = -1;
+
+  if (have_hw == -1) {
+    /* Not eax, ..., which mtcp_sys.h defines as macros. */
+    uint32_t a = 1, b, c = 0, d;
+    __asm__ volatile ("cpuid" : "+a" (a), "=b" (b), "+c" (c), "=d" (d));
+    have_hw = (c >> 20) & 1; /* SSE4.2 */
+  }
+  return have_hw;
+#else // ifdef __x86_64__
+  return 0;
+#endif // ifdef __x86_64__
+}
+
+#ifdef __x86_64__
+static inline uint32_t
+mtcp_crc32c_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+  uint64_t crc64 = crc;
+
+  while (len >= 8) {
+    __asm__ ("crc32q %1, %0"
+             : "+r" (crc64) : "rm" (*(const mtcp_crc32c_u64_t *)p));
+    p += 8;
+    len -= 8;
+  }
+  crc = (uint32_t)crc64;
+  while (len > 0) {
+    __asm__ ("crc32b %1, %0" : "+r" (crc) : "rm" (*p));
+    p++;
+    len--;
+  }
+  return crc;
+}
+#endif // ifdef __x86_64__
+
+static inline uint32_t
+mtcp_crc32c_sw(uint32_t crc, const unsigned char *p, size_t len)
+{
+  static uint32_t table[256];
+  static int initialized = 0;
+
+  if (!initialized) {
+    uint32_t i, j;
+    for (i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (j = 0; j < 8; j++) {
+        c = (c & 1) ? (c >> 1) ^ MTCP_CRC32C_POLY : c >> 1;
+      }
+      table[i] = c;
+    }
+    initialized = 1;
+  }
+
+  while (len > 0) {
+    crc = table[(crc ^ *p) & 0xff] ^ (crc >> 8);
+    p++;
+    len--;
+  }
+  return crc;
+}
+
+static inline uint32_t
+mtcp_crc32c(uint32_t crc, const void *buf, size_t len)
+{
+  const unsigned char *p = (const unsigned char *)buf;
+
+  crc = ~crc;
+#ifdef __x86_64__
+  if (mtcp_crc32c_have_hw()) {
+    return ~mtcp_crc32c_hw(crc, p, len);
+  }
+#endif // ifdef __x86_64__
+  return ~mtcp_crc32c_sw(crc, p, len);
+}
+#endif // ifndef MTCP_CRC32C_H
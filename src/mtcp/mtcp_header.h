@@ -60,11 +60,61 @@ typedef union _MtcpHeader {
     int tls_pid_offset;
     int tls_tid_offset;
     MYINFO_GS_T myinfo_gs;
+
+    // If 'checksummed' is non-zero, CRC32C checksums of the DMTCP header that
+    // precedes this header, and of this header, with headerChecksum = 0.
+    uint32_t checksummed;
+    uint32_t dmtcpHeaderChecksum;
+    uint32_t headerChecksum;
   };
 
   char _padding[4096];
 } MtcpHeader;
 
+/* With DMTCP_LZ=1, the contents of each memory area are compressed in
+ * process, so that mtcp_restart can restore them without forking gzip.
+ * The area is marked DMTCP_LZ_COMPRESSED, and its contents are written as a
+ * sequence of blocks of at most MTCP_LZ_BLOCK_SIZE bytes.  Each block is an
+ * MtcpLzBlockHeader followed by compressedSize bytes.  A block that does not
+ * compress is stored as is, with compressedSize == size.
+ *
+ * The compressed format is a sequence of LZ77 sequences:
+ *   token:    literal length (high 4 bits), match length - 4 (low 4 bits)
+ *   [255...]: more literal length, if the high bits are 15
+ *   literals
+ *   offset:   2 bytes, little-endian, distance back to the match
+ *   [255...]: more match length, if the low bits are 15
+ * The last sequence of a block has only literals.
+ */
+#define MTCP_LZ_BLOCK_SIZE (1024 * 1024)
+#define MTCP_LZ_MIN_MATCH  4
+typedef struct _MtcpLzBlockHeader {
+  uint32_t size;
+  uint32_t compressedSize;
+} MtcpLzBlockHeader;
+
+/* Job-level manifest of an MPI checkpoint, written by the coordinator into
+ * the directory that holds the ckpt_rank_<N> directories.  It records the
+ * union of libsStart/libsEnd/highMemStart over all ranks, followed by one
+ * fixed-size record per rank holding the path of that rank's image relative
+ * to the manifest's directory.  On restart, each rank reads the header and
+ * its own record, instead of the MTCP header of every image.
+ */
+#define MTCP_MANIFEST_SIGNATURE "MTCP_MANIFEST_v1\n"
+#define MTCP_MANIFEST_FILENAME  "ckpt_manifest.mtcp"
+#define MTCP_MANIFEST_PATH_LEN  512
+typedef union _MtcpManifestHeader {
+  struct {
+    char signature[MTCP_SIGNATURE_LEN];
+    uint64_t numRanks;
+    void *libsStart;
+    void *libsEnd;
+    void *highMemStart;
+  };
+
+  char _padding[4096];
+} MtcpManifestHeader;
+
 typedef void (*fnptr_t)();
 typedef struct RestoreInfo {
   int fd;
@@ -102,12 +152,16 @@ typedef struct RestoreInfo {
   ThreadTLSInfo motherofall_tls_info;
   int tls_pid_offset;
   int tls_tid_offset;
-#ifdef TIMING
   struct timeval startValue;
-#endif
   MYINFO_GS_T myinfo_gs;
   int mtcp_restart_pause;  // Used by env. var. DMTCP_RESTART_PAUSE0
   const char *restart_dir; // Directory to search for checkpoint files
+
+  // How memory areas are read from the ckpt image; see setup_restore_io()
+  // in mtcp_restart.c.
+  int direct_fd;           // The ckpt image, reopened with O_DIRECT; or -1
+  int mmap_ckpt_image;     // Large anonymous areas may be mmapped from it
+  off_t readahead_end;     // End of the file range already prefetched
 } RestoreInfo;
 
 extern RestoreInfo rinfo;
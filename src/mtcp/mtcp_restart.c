@@ -41,6 +41,7 @@
 #include <elf.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <linux/magic.h>
 #include <linux/version.h>
 #include <sched.h>
 #include <signal.h>
@@ -49,14 +50,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/shm.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/vfs.h>
 #include <unistd.h>
 #include <stddef.h>
 
 #include "../membarrier.h"
 #include "config.h"
 #include "mtcp_check_vdso.ic"
+#include "mtcp_crc32c.h"
 #include "mtcp_header.h"
 #include "mtcp_sys.h"
 #include "mtcp_util.ic"
@@ -76,9 +80,7 @@
 #endif /* ifdef __clang__ */
 
 void mtcp_check_vdso(char **environ);
-#ifdef FAST_RST_VIA_MMAP
 static void mmapfile(int fd, void *buf, size_t size, int prot, int flags);
-#endif
 
 #define BINARY_NAME     "mtcp_restart"
 #define BINARY_NAME_M32 "mtcp_restart-32"
@@ -95,8 +97,17 @@ static void mmapfile(int fd, void *buf, size_t size, int prot, int flags);
 RestoreInfo rinfo;
 
 /* Internal routines */
-static void readmemoryareas(int fd, VA endOfStack);
-static int read_one_memory_area(int fd, VA endOfStack);
+static void readmemoryareas(RestoreInfo *rinfo_ptr, void *scratch);
+static int read_one_memory_area(RestoreInfo *rinfo_ptr, void *scratch);
+static void setup_restore_io(RestoreInfo *rinfo_ptr, char **environ);
+static int restore_area_via_mmap(RestoreInfo *rinfo_ptr, const Area *area);
+static void restore_area_data(RestoreInfo *rinfo_ptr, void *addr, size_t size,
+                              uint32_t *crc);
+static void verify_mtcp_header(const MtcpHeader *mtcpHdr);
+static void verify_area_header(const Area *area);
+static void verify_area_data(const Area *area, uint32_t crc);
+static void restore_io_prefetch(RestoreInfo *rinfo_ptr);
+static void restore_sysv_shm_segment(const Area *area);
 #if 0
 static void adjust_for_smaller_file_size(Area *area, int fd);
 #endif /* if 0 */
@@ -419,13 +430,94 @@ int getCkptImageByDir(char *buffer, size_t buflen, int rank) {
   return len;
 }
 
+// Opens the checkpoint manifest written by the coordinator into the restart
+// directory, and reads its header.  Returns the fd, or -1 if there is no
+// valid manifest.
+static int
+openCkptManifest(MtcpManifestHeader *hdr)
+{
+  char path[512];
+  size_t len;
+  int fd;
+
+  if (!rinfo.restart_dir) {
+    return -1;
+  }
+  len = mtcp_strlen(rinfo.restart_dir);
+  if (len + 1 + sizeof(MTCP_MANIFEST_FILENAME) > sizeof(path)) {
+    return -1;
+  }
+  mtcp_strcpy(path, rinfo.restart_dir);
+  path[len] = '/';
+  mtcp_strcpy(path + len + 1, MTCP_MANIFEST_FILENAME);
+
+  fd = mtcp_sys_open2(path, O_RDONLY);
+  if (fd == -1) {
+    return -1;
+  }
+  if (mtcp_readfile(fd, hdr, sizeof(*hdr)) != sizeof(*hdr) ||
+      mtcp_strcmp(hdr->signature, MTCP_MANIFEST_SIGNATURE) != 0) {
+    MTCP_PRINTF("***WARNING: ignoring invalid ckpt manifest (%s)\n", path);
+    mtcp_sys_close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Finds the image of the given rank through the checkpoint manifest.
+// Returns the length of the path, or -1 if there is no manifest.
+static int
+getCkptImageByManifest(char *buffer, size_t buflen, int rank)
+{
+  MtcpManifestHeader hdr;
+  char record[MTCP_MANIFEST_PATH_LEN];
+  size_t len;
+  int fd;
+
+  fd = openCkptManifest(&hdr);
+  if (fd == -1) {
+    return -1;
+  }
+  if (rank < 0 || (uint64_t)rank >= hdr.numRanks ||
+      mtcp_sys_lseek(fd, sizeof(hdr) + rank * sizeof(record), SEEK_SET) < 0 ||
+      mtcp_readfile(fd, record, sizeof(record)) != sizeof(record)) {
+    mtcp_sys_close(fd);
+    return -1;
+  }
+  mtcp_sys_close(fd);
+  record[sizeof(record) - 1] = '\0';
+
+  len = mtcp_strlen(rinfo.restart_dir);
+  if (len + 1 + mtcp_strlen(record) >= buflen) {
+    MTCP_PRINTF("***ERROR Ckpt file name would overflow given buffer!");
+    return -1;
+  }
+  mtcp_strcpy(buffer, rinfo.restart_dir);
+  buffer[len] = '/';
+  mtcp_strcpy(buffer + len + 1, record);
+  return len + 1 + mtcp_strlen(record);
+}
+
 #define min(a,b) (a < b ? a : b)
 #define max(a,b) (a > b ? a : b)
 int discover_union_ckpt_images(char *argv[],
 	                       char **libsStart, char **libsEnd,
 	                       char **highMemStart) {
   MtcpHeader mtcpHdr;
+  MtcpManifestHeader manifest;
   int rank;
+
+  // The coordinator has already computed the union at checkpoint time.
+  int fd = openCkptManifest(&manifest);
+  if (fd != -1) {
+    mtcp_sys_close(fd);
+    *libsStart = manifest.libsStart;
+    *libsEnd = manifest.libsEnd;
+    *highMemStart = manifest.highMemStart;
+    return manifest.numRanks;
+  }
+
+  // Otherwise, read the header of every image.
   *libsStart = (void *)(-1); // We'll take a min later.
   *libsEnd = NULL; // We'll take a max later.
   *highMemStart = (void *)(-1); // We'll take a min later.
@@ -739,8 +831,9 @@ main(int argc, char *argv[], char **environ)
     // half. We need to do this in order to call MPI_Init() in the lower half,
     // which is required to figure out our rank, and hence, figure out which
     // checkpoint image to open for memory restoration.
-    // The other assumption here is that we can only handle uncompressed
-    // checkpoint images.
+    // The other assumption here is that we cannot handle checkpoint images
+    // compressed by gzip (DMTCP_GZIP), since we cannot fork gzip from here.
+    // Images compressed in process (DMTCP_LZ) are fine.
 
     // This creates the lower half and copies the bits to this address space
     splitProcess(argv0, environ);
@@ -805,7 +898,9 @@ main(int argc, char *argv[], char **environ)
     releaseUpperHalfMemoryRegionsForCkptImgs(start1, end1, start2, end2);
     unreserve_fds_upper_half(reserved_fds,total_reserved_fds);
 
-    if(getCkptImageByDir(ckptImageNew, 512, rank) != -1) {
+    if(getCkptImageByManifest(ckptImageNew, 512, rank) != -1) {
+        ckptImage = ckptImageNew;
+    } else if(getCkptImageByDir(ckptImageNew, 512, rank) != -1) {
         ckptImage = ckptImageNew;
     } else {
         ckptImage = getCkptImageByRank(rank, argv);
@@ -815,9 +910,7 @@ main(int argc, char *argv[], char **environ)
     //MTCP_PRINTF("[Rank: %d] Choosing ckpt image: %s\n", rank, ckptImage);
   }
 
-#ifdef TIMING
   mtcp_sys_gettimeofday(&rinfo.startValue, NULL);
-#endif
   if (rinfo.fd != -1) {
     mtcp_readfile(rinfo.fd, &mtcpHdr, sizeof mtcpHdr);
   } else {
@@ -843,6 +936,8 @@ main(int argc, char *argv[], char **environ)
     }
   }
 
+  verify_mtcp_header(&mtcpHdr);
+
   DPRINTF("For debugging:\n"
           "    (gdb) add-symbol-file ../../bin/mtcp_restart %p\n",
           mtcpHdr.restore_addr + rinfo.text_offset);
@@ -856,6 +951,8 @@ main(int argc, char *argv[], char **environ)
     return 0;
   }
 
+  setup_restore_io(&rinfo, environ);
+
   rinfo.saved_brk = mtcpHdr.saved_brk;
   rinfo.restore_addr = mtcpHdr.restore_addr;
   rinfo.restore_end = mtcpHdr.restore_addr + mtcpHdr.restore_size;
@@ -1035,6 +1132,8 @@ restart_fast_path()
    */
   mtcp_memcpy(rinfo.restore_addr, rinfo.text_addr, rinfo.text_size);
   mtcp_memcpy(rinfo.restore_addr + rinfo.text_size, &rinfo, sizeof(rinfo));
+  // The last MB, above the initial stack, is left for restorememoryareas()
+  // to use as scratch space.
   void *stack_ptr = rinfo.restore_addr + rinfo.restore_size - MB;
 
   // The kernel call, __ARM_NR_cacheflush is avail. for __arm__, which
@@ -1194,6 +1293,12 @@ mtcp_simulateread(int fd, MtcpHeader *mtcpHdr)
   mtcp_printf("**** end of stack: %p\n", mtcpHdr->end_of_stack);
 
   Area area;
+  void *scratch = mtcp_sys_mmap(0, MTCP_LZ_BLOCK_SIZE, PROT_WRITE | PROT_READ,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (scratch == MAP_FAILED) {
+    MTCP_PRINTF("***Error: mmap failed; errno: %d\n", mtcp_sys_errno);
+    mtcp_abort();
+  }
   mtcp_printf("\n**** Listing ckpt image area:\n");
   while (1) {
     mtcp_readfile(fd, &area, sizeof area);
@@ -1201,14 +1306,19 @@ mtcp_simulateread(int fd, MtcpHeader *mtcpHdr)
       break;
     }
     if ((area.properties & DMTCP_ZERO_PAGE) == 0 &&
-        (area.properties & DMTCP_SKIP_WRITING_TEXT_SEGMENTS) == 0) {
+        (area.properties & DMTCP_SKIP_WRITING_TEXT_SEGMENTS) == 0 &&
+        (area.properties & DMTCP_SYSV_SHM_SEGMENT) == 0) {
       void *addr = mtcp_sys_mmap(0, area.size, PROT_WRITE | PROT_READ,
                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
       if (addr == MAP_FAILED) {
         MTCP_PRINTF("***Error: mmap failed; errno: %d\n", mtcp_sys_errno);
         mtcp_abort();
       }
-      mtcp_readfile(fd, addr, area.size);
+      if (area.properties & DMTCP_LZ_COMPRESSED) {
+        mtcp_readfile_lz(fd, addr, area.size, scratch, NULL);
+      } else {
+        mtcp_readfile(fd, addr, area.size);
+      }
       if (mtcp_sys_munmap(addr, area.size) == -1) {
         MTCP_PRINTF("***Error: munmap failed; errno: %d\n", mtcp_sys_errno);
         mtcp_abort();
@@ -1229,6 +1339,7 @@ mtcp_simulateread(int fd, MtcpHeader *mtcpHdr)
                 // area.offset, area.devmajor, area.devminor, area.inodenum,
                 area.name);
   }
+  mtcp_sys_munmap(scratch, MTCP_LZ_BLOCK_SIZE);
 }
 
 NO_OPTIMIZE
@@ -1299,20 +1410,22 @@ restorememoryareas(RestoreInfo *rinfo_ptr, LowerHalfInfo_t *linfo_ptr)
   unmap_memory_areas_and_restore_vdso(&restore_info, &lh_info);
   /* Restore memory areas */
   DPRINTF("restoring memory areas\n");
-  readmemoryareas(restore_info.fd, restore_info.endOfStack);
+  readmemoryareas(&restore_info, restore_info.restore_end - MB);
 
   /* Everything restored, close file and finish up */
 
   DPRINTF("close cpfd %d\n", restore_info.fd);
   mtcp_sys_close(restore_info.fd);
+  if (restore_info.direct_fd != -1) {
+    mtcp_sys_close(restore_info.direct_fd);
+  }
+  // Reported to the coordinator as the restart.read_s metric.
   double readTime = 0.0;
-#ifdef TIMING
   struct timeval endValue;
   mtcp_sys_gettimeofday(&endValue, NULL);
   struct timeval diff;
   timersub(&endValue, &restore_info.startValue, &diff);
   readTime = diff.tv_sec + (diff.tv_usec / 1000000.0);
-#endif
 
   IMB; /* flush instruction cache, since mtcp_restart.c code is now gone. */
 
@@ -1640,10 +1753,10 @@ unmap_memory_areas_and_restore_vdso(RestoreInfo *rinfo, LowerHalfInfo_t *lh_info
  *
  **************************************************************************/
 static void
-readmemoryareas(int fd, VA endOfStack)
+readmemoryareas(RestoreInfo *rinfo_ptr, void *scratch)
 {
   while (1) {
-    if (read_one_memory_area(fd, endOfStack) == -1) {
+    if (read_one_memory_area(rinfo_ptr, scratch) == -1) {
       break; /* error */
     }
   }
@@ -1659,9 +1772,11 @@ readmemoryareas(int fd, VA endOfStack)
 
 NO_OPTIMIZE
 static int
-read_one_memory_area(int fd, VA endOfStack)
+read_one_memory_area(RestoreInfo *rinfo_ptr, void *scratch)
 {
   int mtcp_sys_errno;
+  int fd = rinfo_ptr->fd;
+  VA endOfStack = rinfo_ptr->endOfStack;
   int imagefd;
   void *mmappedat;
   int try_skipping_existing_segment = 0;
@@ -1669,11 +1784,43 @@ read_one_memory_area(int fd, VA endOfStack)
   /* Read header of memory area into area; mtcp_readfile() will read header */
   Area area;
 
+  uint32_t crc = 0;
+
   mtcp_readfile(fd, &area, sizeof area);
+  verify_area_header(&area);
   if (area.size == -1) {
     return -1;
   }
 
+  /* CASE SYSV SHM SEGMENT:
+   * The segment is created and attached here, and the DMTCP_SYSV_SHM_DATA
+   * areas that follow are read into it in place.  Its pages start out as
+   * zero, so zero pages need no work.  The SysV plugin adopts the segment
+   * in ShmSegment::postRestart().
+   */
+  if (area.properties & DMTCP_SYSV_SHM_SEGMENT) {
+    restore_sysv_shm_segment(&area);
+    return 0;
+  }
+  if (area.properties & DMTCP_SYSV_SHM_DATA) {
+    if ((area.properties & DMTCP_ZERO_PAGE) == 0) {
+      if (area.properties & DMTCP_LZ_COMPRESSED) {
+        restore_io_prefetch(rinfo_ptr);
+        mtcp_readfile_lz(fd, area.addr, area.size, scratch, &crc);
+      } else {
+        restore_area_data(rinfo_ptr, area.addr, area.size, &crc);
+      }
+      verify_area_data(&area, crc);
+    }
+    if (area.prot != (PROT_READ | PROT_WRITE) &&
+        mtcp_sys_mprotect(area.addr, area.size, area.prot) < 0) {
+      MTCP_PRINTF("error %d setting protection of %p bytes at %p\n",
+                  mtcp_sys_errno, area.size, area.addr);
+      mtcp_abort();
+    }
+    return 0;
+  }
+
   if (area.name[0] && mtcp_strstr(area.name, "[heap]")
       && mtcp_sys_brk(NULL) != area.addr + area.size) {
     DPRINTF("WARNING: break (%p) not equal to end of heap (%p)\n",
@@ -1719,19 +1866,23 @@ read_one_memory_area(int fd, VA endOfStack)
     }
   }
 
-#ifdef FAST_RST_VIA_MMAP
-    /* CASE MAP_ANONYMOUS with FAST_RST enabled
+    /* CASE MAP_ANONYMOUS, mapped directly from the ckpt image:
      * We only want to do this in the MAP_ANONYMOUS case, since we don't want
      *   any writes to RAM to be reflected back into the underlying file.
      * Note that in order to map from a file (ckpt image), we must turn off
      *   anonymous (~MAP_ANONYMOUS).  It's okay, since the fd
      *   should have been opened with read permission, only.
      */
-    else if (area.flags & MAP_ANONYMOUS) {
+    else if ((area.flags & MAP_ANONYMOUS) &&
+             restore_area_via_mmap(rinfo_ptr, &area)) {
+      DPRINTF("mapping anonymous area from ckpt image, %p bytes at %p\n",
+              area.size, area.addr);
       mmapfile (fd, area.addr, area.size, area.prot,
                 area.flags & ~MAP_ANONYMOUS);
+      if (area.properties & DMTCP_CHECKSUMMED) {
+        verify_area_data(&area, mtcp_crc32c(0, area.addr, area.size));
+      }
     }
-#endif
 
   /* CASE MAP_ANONYMOUS (usually implies MAP_PRIVATE):
    * For anonymous areas, the checkpoint file contains the memory contents
@@ -1825,14 +1976,24 @@ read_one_memory_area(int fd, VA endOfStack)
 
     if (try_skipping_existing_segment) {
       // This fails on teracluster.  Presumably extra symbols cause overflow.
-      mtcp_skipfile(fd, area.size);
+      if (area.properties & DMTCP_LZ_COMPRESSED) {
+        mtcp_skipfile_lz(fd, area.size, scratch);
+      } else {
+        mtcp_skipfile(fd, area.size);
+      }
     } else if ((area.properties & DMTCP_SKIP_WRITING_TEXT_SEGMENTS) == 0) {
       /* This mmapfile after prev. mmap is okay; use same args again.
        *  Posix says prev. map will be munmapped.
        */
 
       /* ANALYZE THE CONDITION FOR DOING mmapfile MORE CAREFULLY. */
-      mtcp_readfile(fd, area.addr, area.size);
+      if (area.properties & DMTCP_LZ_COMPRESSED) {
+        restore_io_prefetch(rinfo_ptr);
+        mtcp_readfile_lz(fd, area.addr, area.size, scratch, &crc);
+      } else {
+        restore_area_data(rinfo_ptr, area.addr, area.size, &crc);
+      }
+      verify_area_data(&area, crc);
       if (!(area.prot & PROT_WRITE)) {
         if (mtcp_sys_mprotect(area.addr, area.size, area.prot) < 0) {
           MTCP_PRINTF("error %d write-protecting %p bytes at %p\n",
@@ -2136,7 +2297,305 @@ __intel_security_check_cookie(void)
   mtcp_abort();
 }
 
+/* Restore I/O.  Before the memory areas are read, setup_restore_io() tells
+ * the kernel that the ckpt image is read sequentially, and chooses how
+ * large anonymous areas are restored:
+ *   - On local filesystems, they are read with plain reads; the kernel is
+ *     asked to prefetch the image ahead of them.
+ *   - Elsewhere (e.g., Lustre, NFS, GPFS), they are read with a single
+ *     O_DIRECT read into place, bypassing the page cache.
+ *   - With DMTCP_RESTART_IO=mmap, they are mmapped (MAP_PRIVATE) from the
+ *     image instead, and their pages are brought in from the page cache on
+ *     first touch.  This is opt-in: the mappings keep the image file (and
+ *     its space) in use for the life of the process, and at the next
+ *     checkpoint they are areas of the old image file, not anonymous ones,
+ *     so their zero pages are no longer skipped.
+ * Smaller areas are read with plain reads.  An image that is not a regular
+ * file (e.g., a pipe from gzip) is always read with plain reads.
+ * DMTCP_RESTART_IO=read|direct overrides the choice of the other two.
+ * FAST_RST_VIA_MMAP maps every anonymous area.
+ */
+#define RESTORE_MMAP_MIN_SIZE   (4 * MB)
+#define RESTORE_DIRECT_MIN_SIZE (16 * MB)
+#define RESTORE_READAHEAD_SIZE  (64 * MB)
+#define RESTORE_CHECKSUM_CHUNK  (1 * MB)
+
+static int
+is_local_fs(unsigned int f_type)
+{
+  switch (f_type) {
+  case EXT4_SUPER_MAGIC:  /* Also ext2 and ext3 */
+  case XFS_SUPER_MAGIC:
+  case BTRFS_SUPER_MAGIC:
+  case TMPFS_MAGIC:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+static void
+setup_restore_io(RestoreInfo *rinfo_ptr, char **environ)
+{
+  int mtcp_sys_errno;
+  struct statfs fs;
+  char *mode = mygetenv("DMTCP_RESTART_IO", environ);
+
+  rinfo_ptr->direct_fd = -1;
+  rinfo_ptr->mmap_ckpt_image = 0;
+  rinfo_ptr->readahead_end = -1;
+  if (mtcp_sys_lseek(rinfo_ptr->fd, 0, SEEK_CUR) == -1) {
+    return;  /* Not a regular file */
+  }
+  rinfo_ptr->readahead_end = 0;
+  (void)mtcp_sys_fadvise64(rinfo_ptr->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
 #ifdef FAST_RST_VIA_MMAP
+  rinfo_ptr->mmap_ckpt_image = 1;
+  return;
+#endif
+  if (mode != NULL && mtcp_strcmp(mode, "read") == 0) {
+    return;
+  } else if (mode != NULL && mtcp_strcmp(mode, "mmap") == 0) {
+    rinfo_ptr->mmap_ckpt_image = 1;
+    return;
+  } else if (mode == NULL || mtcp_strcmp(mode, "direct") != 0) {
+    if (mtcp_sys_fstatfs(rinfo_ptr->fd, &fs) == 0 &&
+        is_local_fs((unsigned int)fs.f_type)) {
+      return;
+    }
+  }
+
+  char path[32] = "/proc/self/fd/";
+  itoa2(rinfo_ptr->fd, path + mtcp_strlen(path), 10);
+  rinfo_ptr->direct_fd = mtcp_sys_open(path, O_RDONLY | O_DIRECT, 0);
+  if (rinfo_ptr->direct_fd < 0) {
+    DPRINTF("Could not open %s with O_DIRECT; errno: %d\n",
+            path, mtcp_sys_errno);
+    rinfo_ptr->direct_fd = -1;
+  }
+}
+
+static int
+restore_area_via_mmap(RestoreInfo *rinfo_ptr, const Area *area)
+{
+  int mtcp_sys_errno;
+
+  if (!rinfo_ptr->mmap_ckpt_image ||
+      (area->properties & (DMTCP_SKIP_WRITING_TEXT_SEGMENTS |
+                           DMTCP_LZ_COMPRESSED)) != 0) {
+    return 0;
+  }
+  // The checksum of a mapped area is computed through the mapping.
+  if ((area->properties & DMTCP_CHECKSUMMED) && !(area->prot & PROT_READ)) {
+    return 0;
+  }
+#ifndef FAST_RST_VIA_MMAP
+  // Named areas ([heap], files that no longer match) and stacks keep the
+  // anonymous mapping that they had.
+  if (area->size < RESTORE_MMAP_MIN_SIZE || area->name[0] != '\0' ||
+      (area->flags & MAP_GROWSDOWN)) {
+    return 0;
+  }
+#endif
+  // Area data is page-aligned in the image, unless it follows compressed
+  // data.
+  off_t offset = mtcp_sys_lseek(rinfo_ptr->fd, 0, SEEK_CUR);
+  return offset != -1 && (offset & MTCP_PAGE_OFFSET_MASK) == 0;
+}
+
+// Asks the kernel to read ahead of the current offset in the ckpt image.
+static void
+restore_io_prefetch(RestoreInfo *rinfo_ptr)
+{
+  int mtcp_sys_errno;
+  off_t offset;
+  off_t start;
+
+  if (rinfo_ptr->readahead_end == -1) {
+    return;
+  }
+  offset = mtcp_sys_lseek(rinfo_ptr->fd, 0, SEEK_CUR);
+  if (offset + RESTORE_READAHEAD_SIZE / 2 <= rinfo_ptr->readahead_end) {
+    return;
+  }
+  start = offset > rinfo_ptr->readahead_end ? offset
+                                            : rinfo_ptr->readahead_end;
+  (void)mtcp_sys_fadvise64(rinfo_ptr->fd, start,
+                           offset + RESTORE_READAHEAD_SIZE - start,
+                           POSIX_FADV_WILLNEED);
+  rinfo_ptr->readahead_end = offset + RESTORE_READAHEAD_SIZE;
+}
+
+// Returns 0 on success, or -1 if the O_DIRECT read is not possible here.
+static int
+readfile_direct(int fd, off_t offset, void *buf, size_t size)
+{
+  int mtcp_sys_errno;
+  size_t count = 0;
+
+  if ((offset & MTCP_PAGE_OFFSET_MASK) != 0 ||
+      mtcp_sys_lseek(fd, offset, SEEK_SET) != offset) {
+    return -1;
+  }
+  while (count < size) {
+    ssize_t rc = mtcp_sys_read(fd, (char *)buf + count, size - count);
+    if (rc == -1 && mtcp_sys_errno == EINTR) {
+      continue;
+    }
+    if (rc <= 0) {
+      DPRINTF("O_DIRECT read failed; rc: %d, errno: %d\n",
+              (int)rc, mtcp_sys_errno);
+      return -1;
+    }
+    count += rc;
+  }
+  return 0;
+}
+
+// Reads the data of an anonymous area from the current offset of the
+// ckpt image, and computes its checksum into *crc.
+static void
+restore_area_data(RestoreInfo *rinfo_ptr, void *addr, size_t size,
+                  uint32_t *crc)
+{
+  int mtcp_sys_errno;
+  int fd = rinfo_ptr->fd;
+
+  if (rinfo_ptr->direct_fd != -1 && size >= RESTORE_DIRECT_MIN_SIZE) {
+    off_t offset = mtcp_sys_lseek(fd, 0, SEEK_CUR);
+    if (readfile_direct(rinfo_ptr->direct_fd, offset, addr, size) == 0) {
+      if (mtcp_sys_lseek(fd, offset + size, SEEK_SET) == -1) {
+        MTCP_PRINTF("mtcp_sys_lseek failed with errno %d\n", mtcp_sys_errno);
+        mtcp_abort();
+      }
+      *crc = mtcp_crc32c(*crc, addr, size);
+      return;
+    }
+    // Not supported by this filesystem; don't try again.
+    mtcp_sys_close(rinfo_ptr->direct_fd);
+    rinfo_ptr->direct_fd = -1;
+  }
+
+  // Checksum each chunk right after reading it, while it is in the cache.
+  while (size > 0) {
+    size_t len = size < RESTORE_CHECKSUM_CHUNK ? size : RESTORE_CHECKSUM_CHUNK;
+    restore_io_prefetch(rinfo_ptr);
+    mtcp_readfile(fd, addr, len);
+    *crc = mtcp_crc32c(*crc, addr, len);
+    addr = (char *)addr + len;
+    size -= len;
+  }
+}
+
+/* The checksums were computed by writeckpt.cpp and ckptserializer.cpp as the
+ * image was written.  A mismatch means a truncated or corrupt image, and
+ * continuing would only crash the restarted process later.  An area that is
+ * mmap'ed from the image is checked through the mapping, right after it is
+ * mapped; that brings its pages into the page cache, but does not copy them.
+ */
+static void
+verify_mtcp_header(const MtcpHeader *mtcpHdr)
+{
+  int mtcp_sys_errno;
+  MtcpHeader hdr = *mtcpHdr;
+
+  if (!hdr.checksummed) {
+    return;
+  }
+  hdr.headerChecksum = 0;
+  if (mtcp_crc32c(0, &hdr, sizeof(hdr)) != mtcpHdr->headerChecksum) {
+    MTCP_PRINTF("***ERROR: checksum mismatch in MTCP header;"
+                " ckpt image is corrupt\n");
+    mtcp_abort();
+  }
+}
+
+static void
+verify_area_header(const Area *area)
+{
+  int mtcp_sys_errno;
+  Area hdr = *area;
+
+  if ((hdr.properties & DMTCP_CHECKSUMMED) == 0) {
+    return;
+  }
+  hdr.headerChecksum = 0;
+  if (mtcp_crc32c(0, &hdr, sizeof(hdr)) != area->headerChecksum) {
+    MTCP_PRINTF("***ERROR: checksum mismatch in header of area at %p;"
+                " ckpt image is corrupt\n", area->addr);
+    mtcp_abort();
+  }
+}
+
+static void
+verify_area_data(const Area *area, uint32_t crc)
+{
+  int mtcp_sys_errno;
+
+  if ((area->properties & DMTCP_CHECKSUMMED) != 0 && crc != area->checksum) {
+    MTCP_PRINTF("***ERROR: checksum mismatch in data of area %p-%p (%s);"
+                " ckpt image is corrupt\n",
+                area->addr, area->addr + area->size, area->name);
+    mtcp_abort();
+  }
+}
+
+/* Creates a SysV shm segment for the area and attaches it at the original
+ * address.  The key of the segment is not the original one; the SysV plugin
+ * virtualizes it.  If that fails, the area is restored as private memory,
+ * and the plugin copies it into a new segment, as before.
+ */
+static void
+restore_sysv_shm_segment(const Area *area)
+{
+  int mtcp_sys_errno;
+  void *addr = (void *)-1;
+
+#ifdef __NR_shmget
+  int flags = IPC_CREAT | IPC_EXCL | 0600;
+  int shmid = -1;
+  int i;
+
+# ifdef HUGEPAGES
+  if (area->hugepages) {
+    flags |= SHM_HUGETLB;
+  }
+# endif
+  // Try the key that ShmSegment::postRestart() used to use, then others.
+  for (i = 0; i < 256 && shmid == -1; i++) {
+    key_t key = mtcp_sys_getpid() + (i << 22);
+    shmid = mtcp_sys_shmget(key, area->size, flags);
+    if (shmid == -1 && mtcp_sys_errno != EEXIST) {
+      break;
+    }
+  }
+  if (shmid != -1) {
+    addr = mtcp_sys_shmat(shmid, area->addr, 0);
+    if (addr != area->addr) {
+      if (addr != (void *)-1) {
+        mtcp_sys_shmdt(addr);
+      }
+      mtcp_sys_shmctl(shmid, IPC_RMID, NULL);
+      addr = (void *)-1;
+    }
+  }
+#endif
+  if (addr == (void *)-1) {
+    DPRINTF("could not recreate SysV shm segment (errno %d); restoring"
+            " %p bytes at %p as private memory\n",
+            mtcp_sys_errno, area->size, area->addr);
+    addr = mmap_fixed_noreplace(area->addr, area->size,
+                                PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    if (addr != area->addr) {
+      MTCP_PRINTF("error %d mapping %p bytes at %p\n",
+                  mtcp_sys_errno, area->size, area->addr);
+      mtcp_abort();
+    }
+  }
+}
+
 static void mmapfile(int fd, void *buf, size_t size, int prot, int flags)
 {
   int mtcp_sys_errno;
@@ -2161,4 +2620,3 @@ static void mmapfile(int fd, void *buf, size_t size, int prot, int flags)
     mtcp_abort();
   }
 }
-#endif
@@ -406,6 +406,21 @@ struct linux_dirent64 {
 
 # define mtcp_sys_fcntl2(args ...)      mtcp_inline_syscall(fcntl, 2, args)
 # define mtcp_sys_fcntl3(args ...)      mtcp_inline_syscall(fcntl, 3, args)
+# define mtcp_sys_fstatfs(args ...)     mtcp_inline_syscall(fstatfs, 2, args)
+# ifdef __NR_shmget
+#  define mtcp_sys_shmget(args ...)     mtcp_inline_syscall(shmget, 3, args)
+#  define mtcp_sys_shmat(args ...)                 \
+  (void *)mtcp_inline_syscall(shmat, 3, args)
+#  define mtcp_sys_shmdt(args ...)      mtcp_inline_syscall(shmdt, 1, args)
+#  define mtcp_sys_shmctl(args ...)     mtcp_inline_syscall(shmctl, 3, args)
+# endif // ifdef __NR_shmget
+# if defined(__x86_64__) || defined(__aarch64__)
+#  define mtcp_sys_fadvise64(args ...)  mtcp_inline_syscall(fadvise64, 4, args)
+# else // if defined(__x86_64__) || defined(__aarch64__)
+/* On 32-bit architectures, the kernel splits the 64-bit arguments of
+ * fadvise64 in arch-specific ways.  It is only a hint, so we skip it. */
+#  define mtcp_sys_fadvise64(fd, offset, len, advice) 0
+# endif // if defined(__x86_64__) || defined(__aarch64__)
 # if defined(__aarch64__)
 #  define mtcp_sys_mkdir(args ...)                                   \
                                         mtcp_inline_syscall(mkdirat, \
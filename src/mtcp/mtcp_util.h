@@ -163,6 +163,9 @@ void mtcp_printf(char const *format, ...);
 ssize_t mtcp_read_all(int fd, void *buf, size_t count);
 int mtcp_readfile(int fd, void *buf, size_t size);
 void mtcp_skipfile(int fd, size_t size);
+void mtcp_readfile_lz(int fd, void *buf, size_t size, void *scratch,
+                      uint32_t *crc);
+void mtcp_skipfile_lz(int fd, size_t size, void *scratch);
 unsigned long mtcp_strtol(char *str);
 char mtcp_readchar(int fd);
 char mtcp_readdec(int fd, VA *value);
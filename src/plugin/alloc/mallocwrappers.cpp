@@ -19,6 +19,8 @@
  *  <http://www.gnu.org/licenses/>.                                         *
  ****************************************************************************/
 
+#include <errno.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include "alloc.h"
@@ -31,64 +33,116 @@ extern bool inTrivialBarrierOrPhase1;
 EXTERNC int
 dmtcp_alloc_enabled() { return 1; }
 
+/* A thread must not be suspended for checkpoint while inside malloc(): the
+ * checkpoint thread allocates too, and would block on an arena lock held by
+ * the suspended thread.  Taking the wrapper-execution lock on every call is
+ * expensive for allocation-heavy programs, so instead each thread counts how
+ * deep it is inside these wrappers.  If the checkpoint signal arrives while
+ * the count is non-zero, stopthisthread() calls
+ * dmtcp_alloc_defer_ckpt_signal() below, which records the signal as pending
+ * and tells it to return at once.  The thread raises the signal again when it
+ * leaves the outermost wrapper.  For the same reason, a DMTCP wrapper called
+ * from inside the allocator (e.g., by a replacement malloc library) does not
+ * wait for the checkpoint; see ThreadSync::wrapperExecutionLockLock().  Only
+ * thread-local variables are touched in the common case.  The signal handler
+ * runs on the same thread, so compiler barriers suffice to order accesses.
+ */
+static __thread int allocDepth = 0;
+static __thread int ckptSignalPending = 0;
+
+EXTERNC int
+dmtcp_alloc_in_progress()
+{
+  return allocDepth != 0;
+}
+
+EXTERNC int
+dmtcp_alloc_defer_ckpt_signal()
+{
+  if (allocDepth == 0) {
+    return 0;
+  }
+  ckptSignalPending = 1;
+  return 1;
+}
+
+static inline void
+allocEnter()
+{
+  allocDepth++;
+  asm volatile ("" ::: "memory");
+}
+
+static inline void
+allocExit()
+{
+  asm volatile ("" ::: "memory");
+  if (--allocDepth == 0 && ckptSignalPending) {
+    int saved_errno = errno;
+    ckptSignalPending = 0;
+    raise(dmtcp_get_ckpt_signal());
+    errno = saved_errno;
+  }
+}
+
 extern "C" void *calloc(size_t nmemb, size_t size)
 {
-  DMTCP_PLUGIN_DISABLE_CKPT();
+  allocEnter();
   void *retval = _real_calloc(nmemb, size);
-  DMTCP_PLUGIN_ENABLE_CKPT();
+  allocExit();
   return retval;
 }
 
 extern "C" void *malloc(size_t size)
 {
-  DMTCP_PLUGIN_DISABLE_CKPT();
+  allocEnter();
   void *retval = _real_malloc(size);
-  DMTCP_PLUGIN_ENABLE_CKPT();
+  allocExit();
   return retval;
 }
 
 extern "C" void *memalign(size_t boundary, size_t size)
 {
-  DMTCP_PLUGIN_DISABLE_CKPT();
+  allocEnter();
   void *retval = _real_memalign(boundary, size);
-  DMTCP_PLUGIN_ENABLE_CKPT();
+  allocExit();
   return retval;
 }
 
 extern "C" int
 posix_memalign(void **memptr, size_t alignment, size_t size)
 {
-  DMTCP_PLUGIN_DISABLE_CKPT();
+  allocEnter();
   int retval = _real_posix_memalign(memptr, alignment, size);
-  DMTCP_PLUGIN_ENABLE_CKPT();
+  allocExit();
   return retval;
 }
 
 extern "C" void *valloc(size_t size)
 {
-  DMTCP_PLUGIN_DISABLE_CKPT();
+  allocEnter();
   void *retval = _real_valloc(size);
-  DMTCP_PLUGIN_ENABLE_CKPT();
+  allocExit();
   return retval;
 }
 
 extern "C" void
 free(void *ptr)
 {
-  DMTCP_PLUGIN_DISABLE_CKPT();
+  allocEnter();
   // Because we do setcontext to redo some execution, this can cause a
   // double free error.
 #ifdef MPI
   JASSERT(!inTrivialBarrierOrPhase1);
 #endif
   _real_free(ptr);
-  DMTCP_PLUGIN_ENABLE_CKPT();
+  allocExit();
 }
 
 extern "C" void *realloc(void *ptr, size_t size)
 {
-  DMTCP_PLUGIN_DISABLE_CKPT();
+  allocEnter();
   void *retval = _real_realloc(ptr, size);
-  DMTCP_PLUGIN_ENABLE_CKPT();
+  allocExit();
   return retval;
 }
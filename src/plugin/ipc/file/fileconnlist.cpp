@@ -230,7 +230,7 @@ FileConnList::resume(bool isRestart)
 void
 FileConnList::prepareShmList()
 {
-  ProcSelfMaps procSelfMaps;
+  ProcSelfMaps &procSelfMaps = ProcSelfMaps::snapshot();
   ProcMapsArea area;
 
   shmAreas.clear();
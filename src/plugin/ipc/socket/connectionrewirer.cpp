@@ -22,6 +22,7 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/socket.h>
 #include <unistd.h>
@@ -31,6 +32,7 @@
 #include "protectedfds.h"
 #include "util.h"
 
+#include "../event/eventwrappers.h"
 #include "connectionrewirer.h"
 #include "socketconnection.h"
 #include "socketwrappers.h"
@@ -40,6 +42,24 @@ using namespace dmtcp;
 // FIXME: IP6 Support disabled for now. However, we do go through the exercise
 // of creating the restore socket and all.
 // #define ENABLE_IP6_SUPPORT
+
+// The restore sockets must queue the connections from all peers at once;
+// see doReconnect().
+#define RESTORE_SOCK_BACKLOG SOMAXCONN
+
+// Max. epoll events handled per epoll_wait() in doReconnect().
+#define MAX_EPOLL_EVENTS     256
+
+// If a UNIX-domain restore socket's backlog is full, connect() fails with
+// EAGAIN instead of blocking; it is retried after this many milliseconds.
+#define CONNECT_RETRY_MS     10
+
+static const int restoreSockFds[] = {
+  PROTECTED_RESTORE_IP4_SOCK_FD,
+  PROTECTED_RESTORE_IP6_SOCK_FD,
+  PROTECTED_RESTORE_UDS_SOCK_FD
+};
+
 static void
 markSocketNonBlocking(int sockfd)
 {
@@ -62,6 +82,38 @@ markSocketBlocking(int sockfd)
                       (void *)(long)(flags & ~O_NONBLOCK)) != -1);
 }
 
+// Moves fd to the lowest free fd number that is at least minFd.  The fds
+// that doReconnect() opens for itself must not take the number of a
+// connection that is not restored yet: dup2() onto it, when that connection
+// is restored, would silently close them.
+static int
+moveFdAbove(int fd, int minFd, int dupCmd)
+{
+  if (fd >= minFd) {
+    return fd;
+  }
+  int newfd = _real_fcntl(fd, dupCmd, (void *)(long)minFd);
+  JASSERT(newfd != -1) (fd) (minFd) (JASSERT_ERRNO);
+  _real_close(fd);
+  return newfd;
+}
+
+// Returns one more than the highest fd of the connections in conList.
+static int
+fdsEnd(const ConnectionListT &conList, int end)
+{
+  for (ConnectionListT::const_iterator i = conList.begin();
+       i != conList.end(); ++i) {
+    const vector<int> &fds = i->second->getFds();
+    for (size_t n = 0; n < fds.size(); n++) {
+      if (fds[n] >= end) {
+        end = fds[n] + 1;
+      }
+    }
+  }
+  return end;
+}
+
 static ConnectionRewirer *theRewirer = NULL;
 ConnectionRewirer&
 ConnectionRewirer::instance()
@@ -84,77 +136,217 @@ ConnectionRewirer::destroy()
   theRewirer = NULL;
 }
 
+ConnectionListT *
+ConnectionRewirer::incomingList(int restoreSockFd)
+{
+  switch (restoreSockFd) {
+  case PROTECTED_RESTORE_IP4_SOCK_FD:
+    return &_pendingIP4Incoming;
+  case PROTECTED_RESTORE_IP6_SOCK_FD:
+    return &_pendingIP6Incoming;
+  case PROTECTED_RESTORE_UDS_SOCK_FD:
+    return &_pendingUDSIncoming;
+  default:
+    return NULL;
+  }
+}
+
 void
-ConnectionRewirer::checkForPendingIncoming(int restoreSockFd,
-                                           ConnectionListT *conList)
+ConnectionRewirer::acceptIncoming(int epfd, int restoreSockFd)
 {
-  while (conList->size() > 0) {
-    int fd = _real_accept(restoreSockFd, NULL, NULL);
-    if (fd == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+  while (true) {
+    int fd = _real_accept4(restoreSockFd, NULL, NULL, SOCK_NONBLOCK);
+    if (fd == -1 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+                     errno == EINTR)) {
       return;
     }
     JASSERT(fd != -1) (JASSERT_ERRNO).Text("Accept failed.");
-    ConnectionIdentifier id;
-    JASSERT(Util::readAll(fd, &id, sizeof id) == sizeof id);
+    fd = moveFdAbove(fd, _pendingFdsEnd, F_DUPFD);
+
+    PendingSocket &pending = _inProgress[fd];
+    pending.con = NULL;
+    pending.conList = incomingList(restoreSockFd);
+    pending.offset = 0;
+    pending.connecting = false;
+    pending.flags = 0;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    JASSERT(_real_epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == 0)
+      (fd) (JASSERT_ERRNO);
+  }
+}
+
+// Returns false if the connect() must be retried later.
+bool
+ConnectionRewirer::startConnect(int epfd, int fd)
+{
+  PendingSocket &pending = _inProgress[fd];
+  struct RemoteAddr &remoteAddr = _remoteInfo[pending.id];
+
+  if (_real_connect(fd, (sockaddr *)&remoteAddr.addr, remoteAddr.len) == 0) {
+    pending.connecting = false;
+  } else if (errno == EINPROGRESS) {
+    pending.connecting = true;
+  } else if (errno == EAGAIN) {
+    return false;
+  } else {
+    JASSERT(false) (pending.id) (JASSERT_ERRNO)
+      .Text("failed to restore connection");
+  }
+
+  struct epoll_event ev;
+  ev.events = EPOLLOUT;
+  ev.data.fd = fd;
+  JASSERT(_real_epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == 0)
+    (fd) (JASSERT_ERRNO);
+  return true;
+}
+
+// Continues the connect() of an outgoing socket, and the transfer of the
+// ConnectionIdentifier on an outgoing or accepted socket.
+void
+ConnectionRewirer::handleEvent(int epfd, int fd)
+{
+  map<int, PendingSocket>::iterator it = _inProgress.find(fd);
+  JASSERT(it != _inProgress.end()) (fd);
+  PendingSocket &pending = it->second;
+  char *id = (char *)&pending.id;
+  ssize_t rc;
+
+  if (pending.conList == NULL && pending.connecting) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    JASSERT(_real_getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0)
+      (JASSERT_ERRNO);
+    JASSERT(err == 0) (pending.id) (strerror(err))
+      .Text("failed to restore connection");
+    pending.connecting = false;
+  }
 
-    iterator i = conList->find(id);
-    JASSERT(i != conList->end()) (id)
+  if (pending.conList == NULL) {
+    rc = send(fd, id + pending.offset, sizeof(pending.id) - pending.offset,
+              MSG_DONTWAIT | MSG_NOSIGNAL);
+  } else {
+    rc = recv(fd, id + pending.offset, sizeof(pending.id) - pending.offset,
+              MSG_DONTWAIT);
+  }
+  if (rc == -1 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+                   errno == EINTR)) {
+    return;
+  }
+  JASSERT(rc > 0) (pending.id) (JASSERT_ERRNO)
+    .Text("restore connection closed before its identifier was exchanged");
+  pending.offset += rc;
+  if (pending.offset < sizeof(pending.id)) {
+    return;
+  }
+
+  JASSERT(_real_epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL) == 0)
+    (fd) (JASSERT_ERRNO);
+  if (pending.conList == NULL) {
+    JASSERT(_real_fcntl(fd, F_SETFL, (void *)(long)pending.flags) != -1)
+      (JASSERT_ERRNO);
+    JTRACE("restored outgoing connection") (pending.id);
+  } else {
+    iterator i = pending.conList->find(pending.id);
+    JASSERT(i != pending.conList->end()) (pending.id)
     .Text("got unexpected incoming restore request");
 
+    markSocketBlocking(fd);
     Util::dupFds(fd, (i->second)->getFds());
 
-    JTRACE("restoring incoming connection") (id);
-    conList->erase(i);
+    JTRACE("restoring incoming connection") (pending.id);
+    pending.conList->erase(i);
   }
+  _inProgress.erase(it);
 }
 
+// Restores all connections at once.  Every outgoing connect() is started
+// without blocking, and a single epoll loop completes the connects, writes
+// and reads the ConnectionIdentifiers, and accepts incoming connections, in
+// whatever order the peers get to them.  So, the time taken is about one
+// round trip, rather than one per connection.
 void
 ConnectionRewirer::doReconnect()
 {
-  iterator i;
+  vector<int> listening;
+
+  _pendingFdsEnd = fdsEnd(_pendingOutgoing, 0);
+  _pendingFdsEnd = fdsEnd(_pendingIP4Incoming, _pendingFdsEnd);
+  _pendingFdsEnd = fdsEnd(_pendingIP6Incoming, _pendingFdsEnd);
+  _pendingFdsEnd = fdsEnd(_pendingUDSIncoming, _pendingFdsEnd);
+
+  int epfd = _real_epoll_create1(EPOLL_CLOEXEC);
+  JASSERT(epfd != -1) (JASSERT_ERRNO);
+  epfd = moveFdAbove(epfd, _pendingFdsEnd, F_DUPFD_CLOEXEC);
+
+  for (size_t n = 0; n < sizeof(restoreSockFds) / sizeof(int); n++) {
+    int fd = restoreSockFds[n];
+    if (incomingList(fd)->size() > 0) {
+      listening.push_back(fd);
+      struct epoll_event ev;
+      ev.events = EPOLLIN;
+      ev.data.fd = fd;
+      JASSERT(_real_epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == 0)
+        (fd) (JASSERT_ERRNO);
+    }
+  }
 
-  for (i = _pendingOutgoing.begin(); i != _pendingOutgoing.end(); i++) {
-    const ConnectionIdentifier &id = i->first;
-    Connection *con = i->second;
-    struct RemoteAddr &remoteAddr = _remoteInfo[id];
-    int fd = con->getFds()[0];
-    errno = 0;
-    JASSERT(_real_connect(fd, (sockaddr *)&remoteAddr.addr, remoteAddr.len)
-            == 0)
-      (id) (JASSERT_ERRNO).Text("failed to restore connection");
-
-    Util::writeAll(fd, &id, sizeof id);
-
-    checkForPendingIncoming(PROTECTED_RESTORE_IP4_SOCK_FD,
-                            &_pendingIP4Incoming);
-    checkForPendingIncoming(PROTECTED_RESTORE_IP6_SOCK_FD,
-                            &_pendingIP6Incoming);
-    checkForPendingIncoming(PROTECTED_RESTORE_UDS_SOCK_FD,
-                            &_pendingUDSIncoming);
+  vector<int> retry;
+  for (iterator i = _pendingOutgoing.begin();
+       i != _pendingOutgoing.end(); i++) {
+    int fd = i->second->getFds()[0];
+    PendingSocket &pending = _inProgress[fd];
+    pending.id = i->first;
+    pending.con = i->second;
+    pending.conList = NULL;
+    pending.offset = 0;
+    pending.connecting = false;
+    pending.flags = _real_fcntl(fd, F_GETFL, NULL);
+    JASSERT(pending.flags != -1) (JASSERT_ERRNO);
+    markSocketNonBlocking(fd);
+    if (!startConnect(epfd, fd)) {
+      retry.push_back(fd);
+    }
   }
   _pendingOutgoing.clear();
-  _remoteInfo.clear();
 
-  if (_pendingIP4Incoming.size() > 0) {
-    // Add O_NONBLOCK flag to the listener sockets.
-    markSocketBlocking(PROTECTED_RESTORE_IP4_SOCK_FD);
-    checkForPendingIncoming(PROTECTED_RESTORE_IP4_SOCK_FD,
-                            &_pendingIP4Incoming);
-    _real_close(PROTECTED_RESTORE_IP4_SOCK_FD);
-  }
-  if (_pendingIP6Incoming.size() > 0) {
-    // Add O_NONBLOCK flag to the listener sockets.
-    markSocketBlocking(PROTECTED_RESTORE_IP6_SOCK_FD);
-    checkForPendingIncoming(PROTECTED_RESTORE_IP6_SOCK_FD,
-                            &_pendingIP6Incoming);
-    _real_close(PROTECTED_RESTORE_IP6_SOCK_FD);
+  struct epoll_event events[MAX_EPOLL_EVENTS];
+  while (_inProgress.size() > 0 || _pendingIP4Incoming.size() > 0 ||
+         _pendingIP6Incoming.size() > 0 || _pendingUDSIncoming.size() > 0) {
+    int timeout = retry.empty() ? -1 : CONNECT_RETRY_MS;
+    int n = _real_epoll_wait(epfd, events, MAX_EPOLL_EVENTS, timeout);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    JASSERT(n != -1) (JASSERT_ERRNO);
+
+    for (int k = 0; k < n; k++) {
+      int fd = events[k].data.fd;
+      if (incomingList(fd) != NULL) {
+        acceptIncoming(epfd, fd);
+      } else {
+        handleEvent(epfd, fd);
+      }
+    }
+
+    if (n == 0 && !retry.empty()) {
+      vector<int> again;
+      for (size_t r = 0; r < retry.size(); r++) {
+        if (!startConnect(epfd, retry[r])) {
+          again.push_back(retry[r]);
+        }
+      }
+      retry = again;
+    }
   }
-  if (_pendingUDSIncoming.size() > 0) {
-    // Add O_NONBLOCK flag to the listener sockets.
-    markSocketBlocking(PROTECTED_RESTORE_UDS_SOCK_FD);
-    checkForPendingIncoming(PROTECTED_RESTORE_UDS_SOCK_FD,
-                            &_pendingUDSIncoming);
-    _real_close(PROTECTED_RESTORE_UDS_SOCK_FD);
+  _real_close(epfd);
+  _remoteInfo.clear();
+
+  for (size_t n = 0; n < listening.size(); n++) {
+    _real_close(listening[n]);
   }
   JTRACE("Closed restore sockets");
 }
@@ -173,6 +365,8 @@ ConnectionRewirer::openRestoreSocket(bool hasIPv4Sock,
     jalib::JServerSocket restoreSocket(jalib::JSockAddr::ANY, 0);
     JASSERT(restoreSocket.isValid());
     restoreSocket.changeFd(PROTECTED_RESTORE_IP4_SOCK_FD);
+    JASSERT(_real_listen(PROTECTED_RESTORE_IP4_SOCK_FD,
+                         RESTORE_SOCK_BACKLOG) == 0) (JASSERT_ERRNO);
 
     // Setup restore socket for name service
     _ip4RestoreAddr.sin_family = AF_INET;
@@ -200,7 +394,7 @@ ConnectionRewirer::openRestoreSocket(bool hasIPv4Sock,
     JASSERT(getsockname(ip6fd, (struct sockaddr *)&_ip6RestoreAddr,
                         &_ip6RestoreAddrlen) == 0)
       (JASSERT_ERRNO);
-    JASSERT(_real_listen(ip6fd, 32) == 0) (JASSERT_ERRNO);
+    JASSERT(_real_listen(ip6fd, RESTORE_SOCK_BACKLOG) == 0) (JASSERT_ERRNO);
     Util::changeFd(ip6fd, PROTECTED_RESTORE_IP6_SOCK_FD);
 
     JTRACE("opened ip6 listen socket") (PROTECTED_RESTORE_IP6_SOCK_FD);
@@ -221,7 +415,7 @@ ConnectionRewirer::openRestoreSocket(bool hasIPv4Sock,
     JASSERT(_real_bind(udsfd, (struct sockaddr *)&_udsRestoreAddr,
                        _udsRestoreAddrlen) == 0)
       (JASSERT_ERRNO);
-    JASSERT(_real_listen(udsfd, 32) == 0) (JASSERT_ERRNO);
+    JASSERT(_real_listen(udsfd, RESTORE_SOCK_BACKLOG) == 0) (JASSERT_ERRNO);
     Util::changeFd(udsfd, PROTECTED_RESTORE_UDS_SOCK_FD);
 
     JTRACE("opened UDS listen socket")
@@ -301,29 +495,43 @@ ConnectionRewirer::registerNSData(void *addr,
   // debugPrint();
 }
 
+// Looks up the restore addresses of all outgoing connections in one round
+// trip to the coordinator.
 void
 ConnectionRewirer::sendQueries()
 {
+  vector<ConnectionIdentifier> ids;
   iterator i;
 
+  if (_pendingOutgoing.size() == 0) {
+    return;
+  }
   for (i = _pendingOutgoing.begin(); i != _pendingOutgoing.end(); ++i) {
-    const ConnectionIdentifier &id = i->first;
-    struct RemoteAddr remote;
-    uint32_t len = sizeof(remote.addr);
-    JASSERT(dmtcp_send_query_to_coordinator("Socket",
-                                            (const void *)&id,
-                                            (uint32_t)sizeof(id),
-                                            &remote.addr,
-                                            &len) != 0);
-    remote.len = len;
+    ids.push_back(i->first);
+  }
 
-    /*
-    sockaddr_in *sn = (sockaddr_in*) &remote.addr;
-    unsigned short port = htons(sn->sin_port);
-    char *ip = inet_ntoa(sn->sin_addr);
-    JTRACE("Send Queries. Get remote from coordinator:")(id)(sn->sin_family)(port)(ip);
-    */
-    _remoteInfo[id] = remote;
+  uint32_t len = ids.size() * (sizeof(size_t) + sizeof(sockaddr_storage));
+  vector<char> buf(len);
+  JASSERT(dmtcp_send_queries_to_coordinator("Socket",
+                                            (const void *)&ids[0],
+                                            (uint32_t)sizeof(ids[0]),
+                                            (uint32_t)ids.size(),
+                                            &buf[0],
+                                            &len) == 0) (JASSERT_ERRNO);
+
+  const char *p = &buf[0];
+  for (size_t n = 0; n < ids.size(); n++) {
+    struct RemoteAddr remote;
+    size_t valLen;
+    memcpy(&valLen, p, sizeof(valLen));
+    p += sizeof(valLen);
+    JASSERT(valLen > 0 && valLen <= sizeof(remote.addr)) (ids[n]) (valLen)
+      .Text("no restore address for remote peer");
+    memcpy(&remote.addr, p, valLen);
+    p += valLen;
+    remote.len = valLen;
+    remote.con = NULL;
+    _remoteInfo[ids[n]] = remote;
   }
 }
 
@@ -54,12 +54,26 @@ class ConnectionRewirer
     void registerNSData();
     void sendQueries();
     void doReconnect();
-    void checkForPendingIncoming(int restoreSockFd, ConnectionListT *conList);
 
     void debugPrint() const;
 
   private:
+    // A socket whose ConnectionIdentifier is being written (outgoing) or read
+    // (incoming) by doReconnect().
+    struct PendingSocket {
+      ConnectionIdentifier id;
+      Connection *con;
+      ConnectionListT *conList;  // Incoming only: where to look 'id' up.
+      size_t offset;             // Bytes of 'id' transferred so far.
+      bool connecting;           // Outgoing only: connect() in progress.
+      int flags;                 // Outgoing only: file flags to restore.
+    };
+
     void registerNSData(void *addr, socklen_t len, ConnectionListT *conList);
+    bool startConnect(int epfd, int fd);
+    void acceptIncoming(int epfd, int restoreSockFd);
+    void handleEvent(int epfd, int fd);
+    ConnectionListT *incomingList(int restoreSockFd);
 
     struct sockaddr_in _ip4RestoreAddr;
     socklen_t _ip4RestoreAddrlen;
@@ -79,6 +93,11 @@ class ConnectionRewirer
 
     ConnectionListT _pendingOutgoing;
     RemoteInfoT _remoteInfo;
+    map<int, PendingSocket>_inProgress;
+
+    // One more than the highest fd of the connections being restored; the
+    // accepted sockets and the epoll fd of doReconnect() are kept above it.
+    int _pendingFdsEnd;
 };
 }
 #endif // ifndef CONNECTIONREWIRER_H
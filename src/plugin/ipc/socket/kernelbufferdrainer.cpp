@@ -191,12 +191,14 @@ KernelBufferDrainer::refillAllSockets()
 
   // write all buffers out
   map<int, vector<char> >::iterator i;
+  size_t drainedBytes = 0;
   for (i = _drainedData.begin(); i != _drainedData.end(); ++i) {
     int size = i->second.size();
     JWARNING(size >= 0) (size).Text("a failed drain is in our table???");
     if (size < 0) {
       size = 0;
     }
+    drainedBytes += size;
 
     // Double the send buffer
     scaleSendBuffers(i->first, 2);
@@ -212,6 +214,8 @@ KernelBufferDrainer::refillAllSockets()
     }
     i->second.clear();
   }
+  dmtcp_metrics_add("drain.sockets", _drainedData.size());
+  dmtcp_metrics_add("drain.bytes", drainedBytes);
 
   // JTRACE("repeating our friends buffers...");
 
@@ -38,17 +38,9 @@ extern "C" pid_t dmtcp_update_ppid();
 static string pidMapFile;
 
 #ifdef ENABLE_PTHREAD_MUTEX_WRAPPERS
-dmtcp::map<pthread_mutex_t *, pid_t>&
-mapMutexVirtTid()
-{
-  static dmtcp::map<pthread_mutex_t *, pid_t> *instance = NULL;
-
-  if (instance == NULL) {
-    void *buffer = JALLOC_MALLOC(1024 * 1024);
-    instance = new (buffer)dmtcp::map<pthread_mutex_t *, pid_t>();
-  }
-  return *instance;
-}
+// Defined in pid_mutexwrappers.cpp
+void pidVirt_VirtualizeMutexOwners();
+void pidVirt_RefillMutexOwners();
 #endif
 
 extern "C"
@@ -204,15 +196,9 @@ pidVirt_PostRestart()
 
 #ifdef ENABLE_PTHREAD_MUTEX_WRAPPERS
 static void
-pidVirt_RefillTid()
+pidVirt_PreCkpt()
 {
-  map<pthread_mutex_t *, pid_t>::iterator it;
-
-  for (it = mapMutexVirtTid().begin(); it != mapMutexVirtTid().end(); it++) {
-    if (it->first->__data.__owner != 0) {
-      it->first->__data.__owner = VIRTUAL_TO_REAL_PID(it->second);
-    }
-  }
+  pidVirt_VirtualizeMutexOwners();
 }
 #endif
 
@@ -224,7 +210,7 @@ pidVirt_PostRestartRefill()
   dmtcp_close_protected_fd(PROTECTED_PIDMAP_FD);
   unlink(pidMapFile.c_str());
 #ifdef ENABLE_PTHREAD_MUTEX_WRAPPERS
-  pidVirt_RefillTid();
+  pidVirt_RefillMutexOwners();
 #endif
 }
 
@@ -275,6 +261,9 @@ pid_event_hook(DmtcpEvent_t event, DmtcpEventData_t *data)
 }
 
 static DmtcpBarrier pidBarriers[] = {
+#ifdef ENABLE_PTHREAD_MUTEX_WRAPPERS
+  { DMTCP_PRIVATE_BARRIER_PRE_CKPT, pidVirt_PreCkpt, "PRE_CKPT" },
+#endif
   { DMTCP_PRIVATE_BARRIER_RESTART, pidVirt_PostRestart, "RESTART1" },
   { DMTCP_LOCAL_BARRIER_RESTART, pidVirt_PostRestartRefill, "RESTART2" }
 };
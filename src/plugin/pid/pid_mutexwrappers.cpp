@@ -1,27 +1,347 @@
 #include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <syscall.h>
 #include <time.h>
 #include <unistd.h>
-#include <vector>
 
+#include "dmtcpalloc.h"
+#include "jalloc.h"
 #include "jassert.h"
 #include "pidwrappers.h"
+#include "virtualpidtable.h"
 
 #define __real_pthread_mutex_lock      NEXT_FNC(pthread_mutex_lock)
 #define __real_pthread_mutex_trylock   NEXT_FNC(pthread_mutex_trylock)
 #define __real_pthread_mutex_timedlock NEXT_FNC(pthread_mutex_timedlock)
+#define __real_pthread_mutex_destroy   NEXT_FNC(pthread_mutex_destroy)
 
-/* Globals structs */
-/* This maps mutex addresses to the virtual tid of the owner thread. */
+/* The owner field (__data.__owner) of a locked mutex holds the real tid of
+ * the owner thread.  Recursive and error-checking mutexes compare it against
+ * the tid of the calling thread, so on restart it must be rewritten with the
+ * new real tid of the owner.
+ *
+ * Instead of recording the owner on every lock, we keep a lock-free registry
+ * of the mutexes whose owner matters.  The lock wrappers only insert a mutex
+ * the first time it is seen; re-locking a known mutex is a read-only probe
+ * of at most MUTEX_MAX_PROBE slots.  Mutexes of the default (timed) and
+ * adaptive kinds never check their owner and are not registered at all.
+ *
+ * At checkpoint time, with all user threads suspended, the owner of every
+ * registered mutex is translated to a virtual tid.  At restart, it is
+ * translated back to the new real tid.
+ *
+ * A mutex that is freed without pthread_mutex_destroy() stays in the
+ * registry until the next checkpoint, and its memory may have been reused.
+ * So, at checkpoint time, an entry is kept only if it is mapped and still
+ * looks like a recursive or error-checking mutex that is either unlocked or
+ * owned by a thread of this process; at restart, the owner is rewritten only
+ * if it is still the one seen at checkpoint time.
+ *
+ * A mutex that finds no slot within MUTEX_MAX_PROBE slots, or that comes
+ * once the registry holds MUTEX_REGISTRY_MAX mutexes, goes to an overflow
+ * map under a lock instead.  That is slower, but no mutex is ever dropped.
+ */
 
-/* FIXME:
- * STL map isn't thread-safe. However, if we use mutex to protect it,
- * there is still the problem where checkpoints happen between the lock
- * and the unlock function. */
-dmtcp::map<pthread_mutex_t *, pid_t> &mapMutexVirtTid();
+#define MUTEX_REGISTRY_SIZE (1 << 14) // Must be a power of two.
+#define MUTEX_MAX_PROBE     32
+#define MUTEX_REGISTRY_MAX  (MUTEX_REGISTRY_SIZE / 4 * 3)
+#define MUTEX_TOMBSTONE     ((pthread_mutex_t *)-1)
+
+// PTHREAD_MUTEX_KIND_MASK_NP is internal to glibc.
+#define MUTEX_KIND(mutex)   ((mutex)->__data.__kind & 0x3)
+
+typedef struct MutexRegistryEntry {
+  pthread_mutex_t *mutex;
+  pid_t realOwner;
+  pid_t virtOwner;
+} MutexRegistryEntry;
+
+typedef dmtcp::map<pthread_mutex_t *, MutexRegistryEntry> MutexOverflowMap;
+
+static MutexRegistryEntry *mutexRegistry = NULL;
+
+// The number of mutexes in the registry.  Once it reaches
+// MUTEX_REGISTRY_MAX, new mutexes go to the overflow map.
+static size_t mutexRegistryCount = 0;
+
+// Guarded by mutexOverflowLock, a default mutex locked through the real
+// pthread_mutex_lock().  mutexOverflowCount lets unregisterMutex() skip the
+// lock while the map is empty.
+static MutexOverflowMap *mutexOverflow = NULL;
+static size_t mutexOverflowCount = 0;
+static pthread_mutex_t mutexOverflowLock = PTHREAD_MUTEX_INITIALIZER;
+
+static MutexRegistryEntry *
+getMutexRegistry()
+{
+  if (mutexRegistry == NULL) {
+    size_t size = MUTEX_REGISTRY_SIZE * sizeof(MutexRegistryEntry);
+    void *buffer = JALLOC_MALLOC(size);
+    memset(buffer, 0, size);
+    if (!__sync_bool_compare_and_swap(&mutexRegistry, NULL, buffer)) {
+      JALLOC_FREE(buffer);
+    }
+  }
+  return mutexRegistry;
+}
+
+static size_t
+mutexHash(pthread_mutex_t *mutex)
+{
+  uintptr_t addr = (uintptr_t)mutex;
+
+  return (addr ^ (addr >> 6) ^ (addr >> 20)) & (MUTEX_REGISTRY_SIZE - 1);
+}
+
+static bool
+mutexOwnerMatters(pthread_mutex_t *mutex)
+{
+  return MUTEX_KIND(mutex) == PTHREAD_MUTEX_RECURSIVE_NP ||
+         MUTEX_KIND(mutex) == PTHREAD_MUTEX_ERRORCHECK_NP;
+}
+
+// The warning is issued after the lock is released: JASSERT takes a
+// recursive mutex of its own, which may need the overflow map too.
+static void
+registerOverflowMutex(pthread_mutex_t *mutex)
+{
+  static bool warned = false;
+  bool warn = false;
+
+  __real_pthread_mutex_lock(&mutexOverflowLock);
+  if (mutexOverflow == NULL) {
+    mutexOverflow = new MutexOverflowMap();
+  }
+  if (mutexOverflow->find(mutex) == mutexOverflow->end()) {
+    MutexRegistryEntry entry = { mutex, 0, 0 };
+    (*mutexOverflow)[mutex] = entry;
+    mutexOverflowCount = mutexOverflow->size();
+    warn = !warned;
+    warned = true;
+  }
+  pthread_mutex_unlock(&mutexOverflowLock);
+
+  JWARNING(!warn) (mutex) (mutexRegistryCount)
+    .Text("No room in the mutex registry; using the slower overflow map");
+}
+
+// Only the thread that holds a mutex registers it, so the same mutex is
+// never inserted by two threads at once; a slot (empty, or a tombstone) is
+// claimed with a CAS against the other mutexes that hash nearby.
+static void
+registerMutex(pthread_mutex_t *mutex)
+{
+  MutexRegistryEntry *registry = getMutexRegistry();
+  while (true) {
+    size_t idx = mutexHash(mutex);
+    MutexRegistryEntry *slot = NULL;
+    pthread_mutex_t *slotMutex = NULL;
+
+    for (size_t i = 0; i < MUTEX_MAX_PROBE; i++) {
+      pthread_mutex_t *cur = registry[idx].mutex;
+      if (cur == mutex) {
+        return;
+      }
+      if (slot == NULL && (cur == NULL || cur == MUTEX_TOMBSTONE) &&
+          mutexRegistryCount < MUTEX_REGISTRY_MAX) {
+        slot = &registry[idx];
+        slotMutex = cur;
+      }
+      if (cur == NULL) {
+        break;
+      }
+      idx = (idx + 1) & (MUTEX_REGISTRY_SIZE - 1);
+    }
+
+    if (slot == NULL) {
+      registerOverflowMutex(mutex);
+      return;
+    }
+    if (__sync_bool_compare_and_swap(&slot->mutex, slotMutex, mutex)) {
+      __sync_fetch_and_add(&mutexRegistryCount, 1);
+      return;
+    }
+  }
+}
+
+static void
+unregisterMutex(pthread_mutex_t *mutex)
+{
+  if (mutexOverflowCount > 0) {
+    __real_pthread_mutex_lock(&mutexOverflowLock);
+    if (mutexOverflow->erase(mutex) > 0) {
+      mutexOverflowCount = mutexOverflow->size();
+    }
+    pthread_mutex_unlock(&mutexOverflowLock);
+  }
+
+  if (mutexRegistry == NULL) {
+    return;
+  }
+
+  size_t idx = mutexHash(mutex);
+  for (size_t i = 0; i < MUTEX_MAX_PROBE; i++) {
+    pthread_mutex_t *cur = mutexRegistry[idx].mutex;
+    if (cur == NULL) {
+      return;
+    }
+    if (cur == mutex) {
+      mutexRegistry[idx].mutex = MUTEX_TOMBSTONE;
+      __sync_fetch_and_sub(&mutexRegistryCount, 1);
+      return;
+    }
+    idx = (idx + 1) & (MUTEX_REGISTRY_SIZE - 1);
+  }
+}
+
+// Returns true if the memory of the mutex is mapped; msync() fails with
+// ENOMEM on an unmapped page.
+static bool
+isMutexMapped(pthread_mutex_t *mutex)
+{
+  static uintptr_t pageSize = 0;
+  if (pageSize == 0) {
+    pageSize = sysconf(_SC_PAGESIZE);
+  }
+  uintptr_t start = (uintptr_t)mutex & ~(pageSize - 1);
+  uintptr_t end = (uintptr_t)(mutex + 1);
+
+  return msync((void *)start, end - start, MS_ASYNC) == 0;
+}
+
+// Returns false if the entry can no longer be a live mutex of interest (see
+// above); its memory is then left alone.
+static bool
+isMutexValid(pthread_mutex_t *mutex)
+{
+  if (!isMutexMapped(mutex) || !mutexOwnerMatters(mutex)) {
+    return false;
+  }
+
+  pid_t owner = mutex->__data.__owner;
+  if (owner == 0) {
+    return mutex->__data.__lock == 0;
+  }
+  return mutex->__data.__lock != 0 &&
+         dmtcp::VirtualPidTable::instance().realIdExists(owner);
+}
+
+// Re-inserts a valid mutex while rebuilding the registry at checkpoint time,
+// into the overflow map if the registry has no room for it, and records the
+// virtual tid of its owner.  A mutex may have been in both the registry and
+// the overflow map; it is inserted once.
+static void
+reinsertMutex(pthread_mutex_t *mutex, MutexOverflowMap *overflow)
+{
+  MutexRegistryEntry *entry = NULL;
+
+  size_t idx = mutexHash(mutex);
+  for (size_t i = 0; i < MUTEX_MAX_PROBE; i++) {
+    pthread_mutex_t *cur = mutexRegistry[idx].mutex;
+    if (cur == mutex) {
+      return;
+    }
+    if (cur == NULL) {
+      if (mutexRegistryCount < MUTEX_REGISTRY_MAX) {
+        entry = &mutexRegistry[idx];
+        mutexRegistryCount++;
+      }
+      break;
+    }
+    idx = (idx + 1) & (MUTEX_REGISTRY_SIZE - 1);
+  }
+
+  if (entry == NULL) {
+    if (overflow->find(mutex) != overflow->end()) {
+      return;
+    }
+    entry = &(*overflow)[mutex];
+  }
+
+  pid_t owner = mutex->__data.__owner;
+  entry->mutex = mutex;
+  entry->realOwner = owner;
+  entry->virtOwner = owner != 0 ? REAL_TO_VIRTUAL_PID(owner) : 0;
+}
+
+// Called by the checkpoint thread while user threads are suspended.  Drops
+// the tombstones left by pthread_mutex_destroy() and the entries that are
+// no longer valid, and records the virtual tid of the owner of each
+// registered mutex.
+void
+pidVirt_VirtualizeMutexOwners()
+{
+  if (mutexRegistry == NULL) {
+    return;
+  }
+
+  size_t size = MUTEX_REGISTRY_SIZE * sizeof(MutexRegistryEntry);
+  MutexRegistryEntry *old = (MutexRegistryEntry *)JALLOC_MALLOC(size);
+  memcpy(old, mutexRegistry, size);
+  memset(mutexRegistry, 0, size);
+  mutexRegistryCount = 0;
+
+  MutexOverflowMap *oldOverflow = mutexOverflow;
+  MutexOverflowMap *overflow = new MutexOverflowMap();
+
+  for (size_t i = 0; i < MUTEX_REGISTRY_SIZE; i++) {
+    pthread_mutex_t *mutex = old[i].mutex;
+    if (mutex != NULL && mutex != MUTEX_TOMBSTONE && isMutexValid(mutex)) {
+      reinsertMutex(mutex, overflow);
+    }
+  }
+  if (oldOverflow != NULL) {
+    MutexOverflowMap::iterator it;
+    for (it = oldOverflow->begin(); it != oldOverflow->end(); it++) {
+      if (isMutexValid(it->first)) {
+        reinsertMutex(it->first, overflow);
+      }
+    }
+    delete oldOverflow;
+  }
+  JALLOC_FREE(old);
+
+  mutexOverflow = overflow;
+  mutexOverflowCount = overflow->size();
+
+  dmtcp_metrics_add("mutex.registered", mutexRegistryCount);
+  dmtcp_metrics_add("mutex.overflow", mutexOverflowCount);
+}
+
+void
+pidVirt_RefillMutexOwners()
+{
+  if (mutexRegistry == NULL) {
+    return;
+  }
+
+  for (size_t i = 0; i < MUTEX_REGISTRY_SIZE; i++) {
+    pthread_mutex_t *mutex = mutexRegistry[i].mutex;
+    if (mutex == NULL || mutex == MUTEX_TOMBSTONE ||
+        mutexRegistry[i].virtOwner == 0 ||
+        mutex->__data.__owner != mutexRegistry[i].realOwner) {
+      continue;
+    }
+    mutex->__data.__owner = VIRTUAL_TO_REAL_PID(mutexRegistry[i].virtOwner);
+  }
+
+  if (mutexOverflow != NULL) {
+    MutexOverflowMap::iterator it;
+    for (it = mutexOverflow->begin(); it != mutexOverflow->end(); it++) {
+      pthread_mutex_t *mutex = it->first;
+      if (it->second.virtOwner == 0 ||
+          mutex->__data.__owner != it->second.realOwner) {
+        continue;
+      }
+      mutex->__data.__owner = VIRTUAL_TO_REAL_PID(it->second.virtOwner);
+    }
+  }
+}
 
 extern "C" int
 pthread_mutex_lock(pthread_mutex_t *mutex)
@@ -29,8 +349,8 @@ pthread_mutex_lock(pthread_mutex_t *mutex)
   int rc;
 
   rc = __real_pthread_mutex_lock(mutex);
-  if (rc == 0 && dmtcp_is_running_state()) {
-    mapMutexVirtTid()[mutex] = dmtcp_gettid();
+  if (rc == 0 && mutexOwnerMatters(mutex) && dmtcp_is_running_state()) {
+    registerMutex(mutex);
   }
 
   return rc;
@@ -42,8 +362,8 @@ pthread_mutex_trylock(pthread_mutex_t *mutex)
   int rc;
 
   rc = __real_pthread_mutex_trylock(mutex);
-  if (rc == 0 && dmtcp_is_running_state()) {
-    mapMutexVirtTid()[mutex] = dmtcp_gettid();
+  if (rc == 0 && mutexOwnerMatters(mutex) && dmtcp_is_running_state()) {
+    registerMutex(mutex);
   }
 
   return rc;
@@ -56,8 +376,21 @@ pthread_mutex_timedlock(pthread_mutex_t *mutex,
   int rc;
 
   rc = __real_pthread_mutex_timedlock(mutex, abs_timeout);
-  if (rc == 0 && dmtcp_is_running_state()) {
-    mapMutexVirtTid()[mutex] = dmtcp_gettid();
+  if (rc == 0 && mutexOwnerMatters(mutex) && dmtcp_is_running_state()) {
+    registerMutex(mutex);
+  }
+
+  return rc;
+}
+
+extern "C" int
+pthread_mutex_destroy(pthread_mutex_t *mutex)
+{
+  int rc;
+
+  rc = __real_pthread_mutex_destroy(mutex);
+  if (rc == 0) {
+    unregisterMutex(mutex);
   }
 
   return rc;
@@ -61,7 +61,7 @@ VirtualPidTable::postRestart()
 {
   VirtualIdTable<pid_t>::postRestart();
   _do_lock_tbl();
-  _idMapTable[getpid()] = _real_getpid();
+  _setMapping(getpid(), _real_getpid());
   _do_unlock_tbl();
 }
 
@@ -79,7 +79,7 @@ VirtualPidTable::refresh()
     next++;
     if (isIdCreatedByCurrentProcess(i->second)
         && _real_tgkill(_real_pid, i->second, 0) == -1) {
-      _idMapTable.erase(i);
+      _eraseMapping(i);
     }
   }
   _do_unlock_tbl();
@@ -106,7 +106,9 @@ VirtualPidTable::resetOnFork()
 {
   VirtualIdTable<pid_t>::resetOnFork(getpid());
   _numTids = 1;
-  _idMapTable[getpid()] = _real_getpid();
+  _do_lock_tbl();
+  _setMapping(getpid(), _real_getpid());
+  _do_unlock_tbl();
   refresh();
   printMaps();
 }
@@ -116,7 +118,7 @@ VirtualPidTable::updateMapping(pid_t virtualId, pid_t realId)
 {
   if (virtualId > 0 && realId > 0) {
     _do_lock_tbl();
-    _idMapTable[virtualId] = realId;
+    _setMapping(virtualId, realId);
     _do_unlock_tbl();
   }
 }
@@ -35,6 +35,7 @@
 #include "jserialize.h"
 #include "config.h"
 #include "dmtcp.h"
+#include "procselfmaps.h"
 #include "shareddata.h"
 #include "util.h"
 
@@ -214,6 +215,9 @@ DmtcpPluginDescriptor_t sysvipcPlugin = {
 
 DMTCP_DECL_PLUGIN(sysvipcPlugin);
 
+EXTERNC int
+dmtcp_svipc_enabled() { return 1; }
+
 
 static void
 _do_lock_tbl()
@@ -776,6 +780,21 @@ ShmSegment::preCheckpoint()
   }
 }
 
+// Returns the id of the SysV shm segment that mtcp_restart attached at addr,
+// or -1 if the contents were restored as private memory instead.  For SysV
+// shm mappings, the inode number in /proc/self/maps is the shmid.
+static int
+restoredShmidAt(const void *addr)
+{
+  ProcMapsArea area;
+
+  if (ProcSelfMaps::snapshot().getAreaContaining((VA)addr, &area) &&
+      area.addr == addr) {
+    return Util::isSysVShmArea(area) ? (int)area.inodenum : -1;
+  }
+  return -1;
+}
+
 void
 ShmSegment::postRestart()
 {
@@ -783,6 +802,27 @@ ShmSegment::postRestart()
     return;
   }
 
+  ShmaddrToFlagIter i = _shmaddrToFlag.begin();
+  int restoredShmid = restoredShmidAt(i->first);
+  if (restoredShmid != -1) {
+    struct shmid_ds info;
+    JASSERT(_real_shmctl(restoredShmid, IPC_STAT, &info) != -1)
+      (restoredShmid) (JASSERT_ERRNO);
+    info.shm_perm.mode = _flags & 0777;
+    JASSERT(_real_shmctl(restoredShmid, IPC_SET, &info) != -1)
+      (restoredShmid) (JASSERT_ERRNO);
+
+    _realId = restoredShmid;
+    SysVShm::instance().updateMapping(_id, _realId);
+    SysVShm::instance().updateKeyMapping(_key, info.shm_perm.__key);
+    if (_dmtcpMappedAddr) {
+      JASSERT(_real_shmdt(i->first) == 0) (i->first) (JASSERT_ERRNO);
+      ProcSelfMaps::invalidateSnapshot();
+    }
+    JTRACE("Adopted shared memory segment restored in place") (_id) (_realId);
+    return;
+  }
+
   int tmpShmFlags = (_flags & IPC_CREAT) ? _flags : (_flags | IPC_CREAT);
   key_t realKey = dmtcp_virtual_to_real_pid(getpid());
   _realId = _real_shmget(realKey, _size, tmpShmFlags);
@@ -792,7 +832,6 @@ ShmSegment::postRestart()
 
   // Re-map first address for owner on restart
   JASSERT(_isCkptLeader);
-  ShmaddrToFlagIter i = _shmaddrToFlag.begin();
   void *tmpaddr = _real_shmat(_realId, NULL, 0);
   JASSERT(tmpaddr != (void *)-1) (_realId)(JASSERT_ERRNO);
   huge_memcpy((char *)tmpaddr, (char *)i->first, _size);
@@ -805,6 +844,7 @@ ShmSegment::postRestart()
       (i->first) (i->second) (getpid())
     .Text("Error remapping shared memory segment on restart");
   }
+  ProcSelfMaps::invalidateSnapshot();
   JTRACE("Remapping shared memory segment to original address") (_id) (_realId);
 }
 
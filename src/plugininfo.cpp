@@ -21,8 +21,8 @@
 
 #include "plugininfo.h"
 #include "jassert.h"
-#include "jtimer.h"
 #include "barrierinfo.h"
+#include "ckptmetrics.h"
 #include "config.h"
 #include "coordinatorapi.h"
 #include "dmtcp.h"
@@ -141,9 +141,8 @@ PluginInfo::processBarriers(const void *data)
 void
 PluginInfo::processBarrier(BarrierInfo *barrier, const void *data)
 {
-  JTIMER_NOPRINT(barrier);
+  uint64_t start = CkptMetrics::now();
 
-  JTIMER_START(barrier);
   if (dmtcp_no_coordinator()) {
     // Do nothing.
   } else if (barrier->isGlobal()) {
@@ -156,10 +155,8 @@ PluginInfo::processBarrier(BarrierInfo *barrier, const void *data)
 
   JTRACE("Barrier released") (barrier->toString());
 
-  JTIMER_STOP(barrier);
-  JTIMER_GETDELTA(barrier->execTime, barrier);
-
-  JTIMER_START(barrier);
+  barrier->execTime = CkptMetrics::elapsed(start);
+  start = CkptMetrics::now();
 
   if (barrier->callback) {
     barrier->callback();
@@ -168,7 +165,13 @@ PluginInfo::processBarrier(BarrierInfo *barrier, const void *data)
     barrier->callback2(data);
   }
 
-  JTIMER_STOP(barrier);
-  JTIMER_GETDELTA(barrier->cbExecTime, barrier);
+  barrier->cbExecTime = CkptMetrics::elapsed(start);
+
+  const string name = barrier->toString();
+  CkptMetrics::add("barrier.", name.c_str(), ".wait_s", barrier->execTime);
+  CkptMetrics::add("barrier.", name.c_str(), ".callback_s",
+                   barrier->cbExecTime);
+  CkptMetrics::add("plugin.", pluginName.c_str(), ".callback_s",
+                   barrier->cbExecTime);
 }
 }
@@ -1,17 +1,18 @@
 #include "pluginmanager.h"
 
+#include "ckptmetrics.h"
 #include "coordinatorapi.h"
 #include "config.h"
 #include "dmtcp.h"
 #include "dmtcpalloc.h"
-#include "jtimer.h"
 #include "plugininfo.h"
 #include "util.h"
 
 static const char *firstRestartBarrier = "DMTCP::RESTART";
 
 static dmtcp::PluginManager *pluginManager = NULL;
-JTIMER_NOPRINT(ckptWriteTime);
+static uint64_t ckptWriteStart = 0;
+static double ckptWriteTime = 0.0;
 
 extern "C" void dmtcp_initialize();
 
@@ -149,13 +150,14 @@ PluginManager::processCkptBarriers()
     pluginManager->pluginInfos[i]->processBarriers();
   }
 
-  JTIMER_START(ckptWriteTime);
+  ckptWriteStart = CkptMetrics::now();
 }
 
 void
 PluginManager::processResumeBarriers()
 {
-  JTIMER_STOP(ckptWriteTime);
+  ckptWriteTime = CkptMetrics::elapsed(ckptWriteStart);
+  CkptMetrics::add("ckpt.write_s", ckptWriteTime);
   for (int i = pluginManager->pluginInfos.size() - 1; i >= 0; i--) {
     pluginManager->pluginInfos[i]->processBarriers();
   }
@@ -170,9 +172,7 @@ PluginManager::logCkptResumeBarrierOverhead()
            dmtcp_get_ckpt_dir(), dmtcp_get_uniquepid_str());
   std::ofstream lfile (logFilename, std::ios::out | std::ios::app);
 
-  double writeTime = 0.0;
-  JTIMER_GETDELTA(writeTime, ckptWriteTime);
-  lfile << "Ckpt-write time," << writeTime << std::endl;
+  lfile << "Ckpt-write time," << ckptWriteTime << std::endl;
 
   for (int i = pluginManager->pluginInfos.size() - 1; i >= 0; i--) {
     for (int j = 0;
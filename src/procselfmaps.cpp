@@ -28,15 +28,27 @@
 using namespace dmtcp;
 
 
+// A line of /proc/self/maps has at least this many characters:
+// "00400000-00401000 r-xp 00000000 08:01 0\n".  It bounds the number of lines
+// that a buffer can hold.
+#define MIN_LINE_LEN 32
+
+// The size of the buffer that held /proc/self/maps the last time, so that it
+// is normally read in a single pass.
+static size_t lastBufSize = 16 * 4096;
+
+static ProcSelfMaps *epochSnapshot = NULL;
+
 ProcSelfMaps::ProcSelfMaps()
-  : dataIdx(0),
+  : data(NULL),
+  lineStart(NULL),
+  dataIdx(0),
   numAreas(0),
   numBytes(0),
   fd(-1),
-  numAllocExpands(0)
+  numAllocExpands(0),
+  checkAllocExpands(true)
 {
-  char buf[4096];
-
   // NOTE: preExpand() verifies that we have at least 10 chunks pre-allocated
   // for each level of the allocator.  See jalib/jalloc.cpp:preExpand().
   // It assumes no allocation larger than jalloc.cpp:MAX_CHUNKSIZE.
@@ -54,42 +66,42 @@ ProcSelfMaps::ProcSelfMaps()
   // setcontext() on the various threads will be a memory leak on restart.
   // We should check for that.
 
-  fd = _real_open("/proc/self/maps", O_RDONLY);
-  JASSERT(fd != -1) (JASSERT_ERRNO);
-  ssize_t numRead = 0;
-
-  // Get an approximation of the required buffer size.
-  do {
-    numRead = Util::readAll(fd, buf, sizeof(buf));
-    if (numRead > 0) {
-      numBytes += numRead;
+  // The buffer, and the index of lines after it, are allocated before the
+  // read, so that the read sees the final layout.  If the buffer fills up,
+  // it is doubled and /proc/self/maps is read again.
+  size_t size = lastBufSize;
+  while (true) {
+    size_t maxAreas = size / MIN_LINE_LEN;
+    data = (char *)JALLOC_HELPER_MALLOC(size + maxAreas * sizeof(size_t));
+    JASSERT(data != NULL);
+    lineStart = (size_t *)(data + size);
+
+    fd = _real_open("/proc/self/maps", O_RDONLY);
+    JASSERT(fd != -1) (JASSERT_ERRNO);
+    ssize_t numRead = Util::readAll(fd, data, size);
+    JASSERT(numRead > 0) (numRead) (JASSERT_ERRNO);
+    _real_close(fd);
+    fd = -1;
+
+    numBytes = numRead;
+    if (numBytes < size) {
+      break;
     }
-  } while (numRead > 0);
-
-  // Now allocate a buffer. Note that this will most likely change the layout
-  // of /proc/self/maps, so we need to recalculate numBytes.
-  size_t size = numBytes + 4096; // Add a one page buffer.
-  data = (char *)JALLOC_HELPER_MALLOC(size);
-  JASSERT(lseek(fd, 0, SEEK_SET) == 0);
-
-  numBytes = Util::readAll(fd, data, size);
-  /* JASSERT(numBytes > 0) (numBytes); */
-
-  // patched from commit "Add guard pages around restoreBuf when mmap'ed"
-  JASSERT(numBytes > 0 && numBytes < size) (numBytes);
-
-  // TODO(kapil): Replace this assert with more robust code that would
-  // reallocate the buffer with an extended size.
-  JASSERT(numBytes < size) (numBytes) (size);
+    JALLOC_HELPER_FREE(data);
+    size *= 2;
+  }
+  lastBufSize = size;
 
   // TODO(kapil): Validate the read data.
   JASSERT(isValidData());
 
-  _real_close(fd);
-
+  // The kernel lists the areas in order of address.
+  size_t lineBegin = 0;
   for (size_t i = 0; i < numBytes; i++) {
     if (data[i] == '\n') {
-      numAreas++;
+      JASSERT(numAreas < size / MIN_LINE_LEN) (numAreas) (size);
+      lineStart[numAreas++] = lineBegin;
+      lineBegin = i + 1;
     }
   }
 }
@@ -97,6 +109,8 @@ ProcSelfMaps::ProcSelfMaps()
 ProcSelfMaps::~ProcSelfMaps()
 {
   JALLOC_HELPER_FREE(data);
+  data = NULL;
+  lineStart = NULL;
   fd = -1;
   dataIdx = 0;
   numAreas = 0;
@@ -105,12 +119,73 @@ ProcSelfMaps::~ProcSelfMaps()
   // Verify that JAlloc doesn't expand memory (via mmap)
   // while reading /proc/self/maps.
   // FIXME:  Change from JWARNING to JASSERT when we have confidence in this.
-  JWARNING(numAllocExpands == jalib::JAllocDispatcher::numExpands())
+  JWARNING(!checkAllocExpands ||
+           numAllocExpands == jalib::JAllocDispatcher::numExpands())
     (numAllocExpands)(jalib::JAllocDispatcher::numExpands())
   .Text("JAlloc: memory expanded through call to mmap()."
         "  Inconsistent JAlloc will be a problem on restart");
 }
 
+ProcSelfMaps&
+ProcSelfMaps::snapshot()
+{
+  if (epochSnapshot == NULL) {
+    epochSnapshot = new ProcSelfMaps();
+
+    // Plugins allocate freely while a snapshot is alive.  Only the writer of
+    // the image, with its own ProcSelfMaps, must not.
+    epochSnapshot->checkAllocExpands = false;
+  }
+  epochSnapshot->rewind();
+  return *epochSnapshot;
+}
+
+void
+ProcSelfMaps::invalidateSnapshot()
+{
+  if (epochSnapshot != NULL) {
+    delete epochSnapshot;
+    epochSnapshot = NULL;
+  }
+}
+
+VA
+ProcSelfMaps::lineAddr(size_t line)
+{
+  size_t savedIdx = dataIdx;
+
+  dataIdx = lineStart[line];
+  VA addr = (VA)readHex();
+  dataIdx = savedIdx;
+  return addr;
+}
+
+int
+ProcSelfMaps::getAreaContaining(VA addr, ProcMapsArea *area)
+{
+  // Find the first area that starts above addr; the one before it is the
+  // only one that may contain addr.
+  size_t lo = 0;
+  size_t hi = numAreas;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (lineAddr(mid) <= addr) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == 0) {
+    return 0;
+  }
+
+  size_t savedIdx = dataIdx;
+  dataIdx = lineStart[lo - 1];
+  int found = getNextArea(area) && addr < area->endAddr;
+  dataIdx = savedIdx;
+  return found;
+}
+
 bool
 ProcSelfMaps::isValidData()
 {
@@ -0,0 +1,136 @@
+/****************************************************************************
+ *   Copyright (C) 2006-2013 by Jason Ansel, Kapil Arya, and Gene Cooperman *
+ *   jansel@csail.mit.edu, kapil@ccs.neu.edu, gene@ccs.neu.edu              *
+ *                                                                          *
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#include "restartmanifest.h"
+
+#include <iomanip>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "jassert.h"
+#include "jfilesystem.h"
+
+namespace dmtcp
+{
+void
+RestartManifest::serialize(jalib::JBinarySerializer &o)
+{
+  JSERIALIZE_ASSERT_POINT("DMTCP_RESTART_MANIFEST_v1");
+  o & coordHost & coordPort & interval & remoteShell & fanout;
+
+  uint32_t numHosts = hosts.size();
+  o & numHosts;
+  hosts.resize(numHosts);
+  for (size_t i = 0; i < numHosts; i++) {
+    JSERIALIZE_ASSERT_POINT("[");
+    o & hosts[i].name & hosts[i].remoteShell & hosts[i].images;
+    JSERIALIZE_ASSERT_POINT("]");
+  }
+  JSERIALIZE_ASSERT_POINT("EOF");
+}
+
+// The images of a host that is in more than one of the maps (as with the
+// processes that were started on it both by ssh and directly) are merged.
+static void
+addHosts(vector<RestartManifest::Host> *hosts,
+         map<string, size_t> *hostIndex,
+         const map<string, vector<string> > &filenames,
+         const char *remoteShell)
+{
+  map<string, vector<string> >::const_iterator it;
+
+  for (it = filenames.begin(); it != filenames.end(); ++it) {
+    if (hostIndex->find(it->first) == hostIndex->end()) {
+      (*hostIndex)[it->first] = hosts->size();
+      hosts->push_back(RestartManifest::Host());
+      hosts->back().name = it->first;
+    }
+    RestartManifest::Host &host = (*hosts)[(*hostIndex)[it->first]];
+    if (host.remoteShell.empty()) {
+      host.remoteShell = remoteShell;
+    }
+    host.images.insert(host.images.end(),
+                       it->second.begin(), it->second.end());
+  }
+}
+
+string
+RestartManifest::writeManifest(const string &ckptDir,
+                               bool uniqueCkptFilenames,
+                               const uint32_t theCheckpointInterval,
+                               const int thePort,
+                               const UniquePid &compId,
+                               const map<string, vector<string> >
+                                 &restartFilenames,
+                               const map<string, vector<string> >
+                                 &rshFilenames,
+                               const map<string, vector<string> >
+                                 &sshFilenames)
+{
+  ostringstream o;
+  string uniqueFilename;
+
+  o << string(ckptDir) << "/"
+    << RESTART_MANIFEST_BASENAME << "_" << compId;
+  if (uniqueCkptFilenames) {
+    o << "_" << std::setw(5) << std::setfill('0') <<
+        compId.computationGeneration();
+  }
+  o << "." << RESTART_MANIFEST_EXT;
+  uniqueFilename = o.str();
+
+  RestartManifest manifest;
+  map<string, size_t> hostIndex;
+  manifest.coordHost = jalib::Filesystem::GetCurrentHostname();
+  manifest.coordPort = thePort;
+  manifest.interval = theCheckpointInterval;
+  addHosts(&manifest.hosts, &hostIndex, rshFilenames, "rsh");
+  addHosts(&manifest.hosts, &hostIndex, sshFilenames, "ssh");
+  addHosts(&manifest.hosts, &hostIndex, restartFilenames, "");
+
+  JTRACE("writing restart manifest") (uniqueFilename)
+    (manifest.hosts.size());
+
+  // Write to a temporary file and rename it, so that a restart never sees a
+  // partially written manifest.
+  string tmpFilename = uniqueFilename + ".temp";
+  {
+    jalib::JBinarySerializeWriter wr(tmpFilename);
+    manifest.serialize(wr);
+  }
+  JASSERT(rename(tmpFilename.c_str(), uniqueFilename.c_str()) == 0)
+    (tmpFilename) (uniqueFilename) (JASSERT_ERRNO);
+
+  // Create a symlink from
+  // dmtcp_restart_manifest.bin -> dmtcp_restart_manifest_<curCompId>.bin
+  string filename = RESTART_MANIFEST_BASENAME "." RESTART_MANIFEST_EXT;
+  string dirname = jalib::Filesystem::DirName(uniqueFilename);
+  int dirfd = open(dirname.c_str(), O_DIRECTORY | O_RDONLY);
+  JASSERT(dirfd != -1) (dirname) (JASSERT_ERRNO);
+  unlinkat(dirfd, filename.c_str(), 0);
+  JWARNING(symlinkat(jalib::Filesystem::BaseName(uniqueFilename).c_str(),
+                     dirfd, filename.c_str()) == 0) (JASSERT_ERRNO);
+  JASSERT(close(dirfd) == 0);
+  return uniqueFilename;
+}
+} // namespace dmtcp {
@@ -0,0 +1,75 @@
+/****************************************************************************
+ *   Copyright (C) 2006-2013 by Jason Ansel, Kapil Arya, and Gene Cooperman *
+ *   jansel@csail.mit.edu, kapil@ccs.neu.edu, gene@ccs.neu.edu              *
+ *                                                                          *
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#ifndef __RESTART_MANIFEST_H__
+#define __RESTART_MANIFEST_H__
+
+#include "../jalib/jserialize.h"
+#include "constants.h"
+#include "dmtcpalloc.h"
+#include "uniquepid.h"
+
+namespace dmtcp
+{
+/* The checkpoint images of a computation, by host.  The coordinator writes
+ * one with the restart script of each checkpoint; 'dmtcp_restart
+ * --from-manifest' reads it, restarts the images of its own host, and passes
+ * the other hosts on, in parts, to the dmtcp_restart that it starts on each
+ * of them (see dmtcp_restart.cpp).
+ */
+class RestartManifest
+{
+  public:
+    struct Host {
+      string name;
+      string remoteShell;  // "ssh" or "rsh"; empty for the default.
+      vector<string> images;
+    };
+
+    RestartManifest() : coordPort(UNINITIALIZED_PORT), interval(0), fanout(0)
+    {}
+
+    void serialize(jalib::JBinarySerializer &o);
+
+    static string writeManifest(const string &ckptDir,
+                                bool uniqueCkptFilenames,
+                                const uint32_t theCheckpointInterval,
+                                const int thePort,
+                                const UniquePid &compId,
+                                const map<string, vector<string> >
+                                  &restartFilenames,
+                                const map<string, vector<string> >
+                                  &rshFilenames,
+                                const map<string, vector<string> >
+                                  &sshFilenames);
+
+    string coordHost;
+    int32_t coordPort;
+    uint32_t interval;
+
+    // How dmtcp_restart launches the hosts; not set by the coordinator.
+    string remoteShell;
+    uint32_t fanout;
+
+    vector<Host> hosts;
+};
+} // namespace dmtcp {
+#endif // #ifndef __RESTART_MANIFEST_H__
@@ -128,6 +128,9 @@ static const char *usage =
   "      (default: use the same directory used in previous checkpoint)\n"
   "  --restartdir, -d, (environment variable DMTCP_RESTART_DIR):\n"
   "      Directory to read checkpoint images from\n"
+  "  --local-ckptdir, (environment variable DMTCP_LOCAL_CKPT_DIR):\n"
+  "      Node-local checkpoint directory; images found there are preferred\n"
+  "      over their copies in the checkpoint directory\n"
   "  --tmpdir, -t, (environment variable DMTCP_TMPDIR):\n"
   "      Directory to store temporary files (default: $TMDPIR or /tmp)\n"
   "  --no-strict-checking:\n"
@@ -176,6 +179,9 @@ static const char *cmdlineArgHandler =
   "        --ckptdir|-d)\n"
   "          DMTCP_CKPT_DIR=$2\n"
   "          shift; shift;;\n"
+  "        --local-ckptdir)\n"
+  "          export DMTCP_LOCAL_CKPT_DIR=\"$2\"\n"
+  "          shift; shift;;\n"
   "        --tmpdir|-t)\n"
   "          DMTCP_TMPDIR=$2\n"
   "          shift; shift;;\n"
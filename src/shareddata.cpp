@@ -475,142 +475,146 @@ SharedData::getDlsymOffset_m32(void)
   return sharedDataHeader->dlsymOffset_m32;
 }
 
-pid_t
-SharedData::getRealPid(pid_t virt)
+static size_t
+idMapHash(int32_t virt, size_t nslots)
 {
-  pid_t res = -1;
+  return ((uint32_t)virt * 2654435761U) & (nslots - 1);
+}
 
-  if (sharedDataHeader == NULL) {
-    initialize();
-  }
-  Util::lockFile(PROTECTED_SHM_FD);
-  for (size_t i = 0; i < sharedDataHeader->numPidMaps; i++) {
-    if (sharedDataHeader->pidMap[i].virt == virt) {
-      res = sharedDataHeader->pidMap[i].real;
-    }
-  }
-  Util::unlockFile(PROTECTED_SHM_FD);
-  return res;
+static uint64_t
+idMapWord(int32_t id)
+{
+  return ID_MAP_USED | (uint32_t)id;
 }
 
-void
-SharedData::setPidMap(pid_t virt, pid_t real)
+// Lock-free lookup in one of the open-addressed id maps.  Entries are never
+// removed, so the probe can stop at the first free slot.  A slot whose key
+// is claimed but whose value is not yet published belongs to an insert that
+// has not completed; the id is not mapped yet.
+template<typename IdMap>
+static int32_t
+lookupIdMap(IdMap *map, size_t nslots, int32_t virt)
 {
-  size_t i;
+  uint64_t key = idMapWord(virt);
 
-  if (sharedDataHeader == NULL) {
-    initialize();
-  }
-  Util::lockFile(PROTECTED_SHM_FD);
-  for (i = 0; i < sharedDataHeader->numPidMaps; i++) {
-    if (sharedDataHeader->pidMap[i].virt == virt) {
-      sharedDataHeader->pidMap[i].real = real;
+  size_t idx = idMapHash(virt, nslots);
+  for (size_t i = 0; i < nslots; i++) {
+    uint64_t cur = __atomic_load_n(&map[idx].key, __ATOMIC_ACQUIRE);
+    if (cur == key) {
+      uint64_t value = __atomic_load_n(&map[idx].value, __ATOMIC_ACQUIRE);
+      return value != 0 ? (int32_t)value : -1;
+    }
+    if (cur == 0) {
       break;
     }
+    idx = (idx + 1) & (nslots - 1);
+  }
+  return -1;
+}
+
+// Claims a slot for the virtual id with a CAS on its key, then publishes
+// the value.  A concurrent insert of the same virtual id follows the same
+// probe sequence, so it finds the claimed key and no duplicate slot is
+// created.
+template<typename IdMap>
+static void
+insertIdMap(IdMap *map, size_t nslots, uint64_t *nmaps,
+            int32_t virt, int32_t real)
+{
+  uint64_t key = idMapWord(virt);
+
+  size_t idx = idMapHash(virt, nslots);
+  for (size_t i = 0; i < nslots; i++) {
+    uint64_t cur = __atomic_load_n(&map[idx].key, __ATOMIC_ACQUIRE);
+    if (cur == 0) {
+      cur = __sync_val_compare_and_swap(&map[idx].key, 0, key);
+      if (cur == 0) {
+        __sync_fetch_and_add(nmaps, 1);
+        cur = key;
+      }
+    }
+    if (cur == key) {
+      __atomic_store_n(&map[idx].value, idMapWord(real), __ATOMIC_RELEASE);
+      return;
+    }
+    idx = (idx + 1) & (nslots - 1);
   }
-  if (i == sharedDataHeader->numPidMaps) {
-    JASSERT(sharedDataHeader->numPidMaps < MAX_PID_MAPS);
-    sharedDataHeader->pidMap[i].virt = virt;
-    sharedDataHeader->pidMap[i].real = real;
-    sharedDataHeader->numPidMaps++;
-  }
-  Util::unlockFile(PROTECTED_SHM_FD);
+  JASSERT(false) (virt) (real) (nslots).Text("Id map is full");
 }
 
-int32_t
-SharedData::getRealIPCId(int type, int32_t virt)
+static void
+getIPCIdMap(int type, SharedData::IPCIdMap **map, uint64_t **nmaps)
 {
-  int32_t res = -1;
-  uint32_t nmaps = 0;
-  IPCIdMap *map = NULL;
-
-  if (sharedDataHeader == NULL) {
-    initialize();
-  }
-  Util::lockFile(PROTECTED_SHM_FD);
   switch (type) {
   case SYSV_SHM_ID:
-    nmaps = sharedDataHeader->numSysVShmIdMaps;
-    map = sharedDataHeader->sysvShmIdMap;
+    *nmaps = &sharedDataHeader->numSysVShmIdMaps;
+    *map = sharedDataHeader->sysvShmIdMap;
     break;
 
   case SYSV_SEM_ID:
-    nmaps = sharedDataHeader->numSysVSemIdMaps;
-    map = sharedDataHeader->sysvSemIdMap;
+    *nmaps = &sharedDataHeader->numSysVSemIdMaps;
+    *map = sharedDataHeader->sysvSemIdMap;
     break;
 
   case SYSV_MSQ_ID:
-    nmaps = sharedDataHeader->numSysVMsqIdMaps;
-    map = sharedDataHeader->sysvMsqIdMap;
+    *nmaps = &sharedDataHeader->numSysVMsqIdMaps;
+    *map = sharedDataHeader->sysvMsqIdMap;
     break;
 
   case SYSV_SHM_KEY:
-    nmaps = sharedDataHeader->numSysVShmKeyMaps;
-    map = sharedDataHeader->sysvShmKeyMap;
+    *nmaps = &sharedDataHeader->numSysVShmKeyMaps;
+    *map = sharedDataHeader->sysvShmKeyMap;
     break;
 
   default:
     JASSERT(false) (type).Text("Unknown IPC-Id type.");
     break;
   }
-  for (size_t i = 0; i < nmaps; i++) {
-    if (map[i].virt == virt) {
-      res = map[i].real;
-    }
+}
+
+pid_t
+SharedData::getRealPid(pid_t virt)
+{
+  if (sharedDataHeader == NULL) {
+    initialize();
   }
-  Util::unlockFile(PROTECTED_SHM_FD);
-  return res;
+  return lookupIdMap(sharedDataHeader->pidMap, MAX_PID_MAPS, virt);
 }
 
 void
-SharedData::setIPCIdMap(int type, int32_t virt, int32_t real)
+SharedData::setPidMap(pid_t virt, pid_t real)
+{
+  if (sharedDataHeader == NULL) {
+    initialize();
+  }
+  insertIdMap(sharedDataHeader->pidMap, MAX_PID_MAPS,
+              &sharedDataHeader->numPidMaps, virt, real);
+}
+
+int32_t
+SharedData::getRealIPCId(int type, int32_t virt)
 {
-  size_t i;
   uint64_t *nmaps = NULL;
   IPCIdMap *map = NULL;
 
   if (sharedDataHeader == NULL) {
     initialize();
   }
-  Util::lockFile(PROTECTED_SHM_FD);
-  switch (type) {
-  case SYSV_SHM_ID:
-    nmaps = &sharedDataHeader->numSysVShmIdMaps;
-    map = sharedDataHeader->sysvShmIdMap;
-    break;
-
-  case SYSV_SEM_ID:
-    nmaps = &sharedDataHeader->numSysVSemIdMaps;
-    map = sharedDataHeader->sysvSemIdMap;
-    break;
-
-  case SYSV_MSQ_ID:
-    nmaps = &sharedDataHeader->numSysVMsqIdMaps;
-    map = sharedDataHeader->sysvMsqIdMap;
-    break;
+  getIPCIdMap(type, &map, &nmaps);
+  return lookupIdMap(map, MAX_IPC_ID_MAPS, virt);
+}
 
-  case SYSV_SHM_KEY:
-    nmaps = &sharedDataHeader->numSysVShmKeyMaps;
-    map = sharedDataHeader->sysvShmKeyMap;
-    break;
+void
+SharedData::setIPCIdMap(int type, int32_t virt, int32_t real)
+{
+  uint64_t *nmaps = NULL;
+  IPCIdMap *map = NULL;
 
-  default:
-    JASSERT(false) (type).Text("Unknown IPC-Id type.");
-    break;
-  }
-  for (i = 0; i < *nmaps; i++) {
-    if (map[i].virt == virt) {
-      map[i].real = real;
-      break;
-    }
-  }
-  if (i == *nmaps) {
-    JASSERT(*nmaps < MAX_IPC_ID_MAPS);
-    map[i].virt = virt;
-    map[i].real = real;
-    *nmaps += 1;
+  if (sharedDataHeader == NULL) {
+    initialize();
   }
-  Util::unlockFile(PROTECTED_SHM_FD);
+  getIPCIdMap(type, &map, &nmaps);
+  insertIdMap(map, MAX_IPC_ID_MAPS, nmaps, virt, real);
 }
 
 pid_t
@@ -96,6 +96,9 @@ struct Thread {
 
   Thread *next;
   Thread *prev;
+  Thread *tidNext;    // Next descriptor in the same bucket of the tid index
+  pid_t indexedTid;   // The tid that the descriptor is in the tid index under
+  int onActiveList;
 };
 
 #ifdef __cplusplus
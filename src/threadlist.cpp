@@ -1,3 +1,4 @@
+#include <linux/futex.h>
 #include <linux/version.h>
 #include <pthread.h>
 #include <semaphore.h>
@@ -6,6 +7,7 @@
 #include <sys/resource.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 #include "config.h"
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 11) || \
@@ -65,8 +67,29 @@ ucontext_t beforeTrivialBarrier;
 
 static const char *DMTCP_PRGNAME_PREFIX = "DMTCP:";
 
+/* Descriptors of dead threads, for reuse.  Any thread may push onto
+ * threads_freelist without a lock.  To avoid the ABA problem of a lock-free
+ * pop, a thread needing a descriptor instead takes the whole list at once
+ * into its own localFreelist, and takes descriptors from there.
+ */
 static Thread *threads_freelist = NULL;
+static __thread Thread *localFreelist = NULL;
 static pthread_mutex_t threadlistLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* activeThreads indexed by tid, so that a new thread finds a stale
+ * descriptor with its tid in O(1).  Chained through Thread::tidNext.
+ */
+#define TID_INDEX_SIZE 1024
+static Thread *tidIndex[TID_INDEX_SIZE];
+static int numActiveThreads = 0;
+
+/* Exited threads stay on activeThreads in ST_ZOMBIE until the kernel is done
+ * with them.  Rather than probing every zombie on each new thread, they are
+ * reaped in a batch once as many threads have exited as half the list, and at
+ * each checkpoint.
+ */
+#define ZOMBIE_REAP_MIN 64
+static int numExitsSinceReap = 0;
 static pthread_mutex_t threadStateLock = PTHREAD_MUTEX_INITIALIZER;
 
 static pthread_rwlock_t threadResumeLock = PTHREAD_RWLOCK_INITIALIZER;
@@ -81,11 +104,37 @@ extern sem_t sem_launch; // allocated in coordinatorapi.cpp
 static sem_t semNotifyCkptThread;
 static sem_t semWaitForCkptThreadSignal;
 
+/* Number of signaled user threads that have yet to enter stopthisthread()
+ * (numThreadsToAcknowledge) and to reach ST_SUSPENDED (numThreadsToSuspend).
+ * The checkpoint thread adds one for each thread it waits on, and each thread
+ * subtracts one from stopthisthread().  A thread may subtract before the
+ * checkpoint thread adds, so the counters can briefly go negative.  The
+ * thread that brings numThreadsToSuspend to zero wakes the checkpoint thread.
+ * A signaled thread that exits before handling the signal checks out from
+ * ThreadList::threadExit() instead, and counts itself in numSignaledExits.
+ */
+static int numThreadsToAcknowledge = 0;
+static int numThreadsToSuspend = 0;
+static int numSignaledExits = 0;
+static struct timespec lastAcknowledgeTime;
+static ThreadList::SuspendTimings suspendTimings;
+
+// MPI information from the MTCP header of the last checkpoint image.
+static void *lastLibsStart = NULL;
+static void *lastLibsEnd = NULL;
+static void *lastHighMemStart = NULL;
+
+// Signaled threads that exit check out by themselves.  Only one that left
+// without going through ThreadList::threadExit() (e.g., a raw SYS_exit) is
+// left for this rare rescan to find.
+#define SUSPEND_TIMEOUT_SEC 2
+
 static void *checkpointhread(void *dummy);
 static void suspendThreads();
 static void resumeThreads();
 static void stopthisthread(int sig);
 static int restarthread(void *threadv);
+static void rebuildTidIndex();
 static int Thread_UpdateState(Thread *th, ThreadState newval,
                               ThreadState oldval);
 static void Thread_SaveSigState(Thread *th);
@@ -109,6 +158,13 @@ pid_t dmtcp_get_real_pid()
   return _real_getpid();
 }
 
+static double
+timespecDiff(const struct timespec *end, const struct timespec *start)
+{
+  return (end->tv_sec - start->tv_sec) +
+         (end->tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
 /*****************************************************************************
  *
  * Lock and unlock the 'activeThreads' list
@@ -168,6 +224,7 @@ ThreadList::resetOnFork()
     ThreadList::threadIsDead(activeThreads); // takes care of updating
                                              // "activeThreads" ptr.
   }
+  numExitsSinceReap = 0;
   unlk_threads();
   init();
 }
@@ -253,7 +310,42 @@ ThreadList::initThread(Thread *th, int (*fn)(
 void
 ThreadList::threadExit()
 {
-  curThread->state = ST_ZOMBIE;
+  /* A thread signaled for a checkpoint will never reach stopthisthread();
+   * check out as if it had suspended.  The state is changed with a CAS so
+   * that the checkpoint thread cannot signal it in between.
+   */
+  while (!Thread_UpdateState(curThread, ST_ZOMBIE, ST_RUNNING)) {
+    if (Thread_UpdateState(curThread, ST_ZOMBIE, ST_SIGNALED)) {
+      __sync_add_and_fetch(&numSignaledExits, 1);
+      if (__sync_sub_and_fetch(&numThreadsToAcknowledge, 1) == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &lastAcknowledgeTime);
+      }
+      if (__sync_sub_and_fetch(&numThreadsToSuspend, 1) == 0) {
+        _real_syscall(SYS_futex, &numThreadsToSuspend, FUTEX_WAKE_PRIVATE,
+                      1, NULL, NULL, 0);
+      }
+      break;
+    }
+    if (curThread->state != ST_RUNNING && curThread->state != ST_SIGNALED) {
+      curThread->state = ST_ZOMBIE;
+      break;
+    }
+  }
+  __sync_add_and_fetch(&numExitsSinceReap, 1);
+
+  // Return this thread's unused descriptors for other threads.
+  if (localFreelist != NULL) {
+    Thread *last = localFreelist;
+    while (last->next != NULL) {
+      last = last->next;
+    }
+    do {
+      last->next = threads_freelist;
+    } while (!__sync_bool_compare_and_swap(&threads_freelist, last->next,
+                                           localFreelist));
+    localFreelist = NULL;
+  }
+  jalib::JAllocDispatcher::threadExit();
 }
 
 /*****************************************************************************
@@ -419,6 +511,10 @@ ThreadList::writeCkpt()
 {
   // Remove stale threads from activeThreads list.
   emptyFreeList();
+
+  // The plugins are done with the shared snapshot.  Drop it, so that its
+  // buffer is not written into the image.
+  ProcSelfMaps::invalidateSnapshot();
   SigInfo::saveSigHandlers();
 
   /* Do this once, same for all threads.  But restore for each thread. */
@@ -428,9 +524,22 @@ ThreadList::writeCkpt()
 
   MtcpHeader mtcpHdr;
   prepareMtcpHeader(&mtcpHdr);
+  lastLibsStart = mtcpHdr.libsStart;
+  lastLibsEnd = mtcpHdr.libsEnd;
+  lastHighMemStart = mtcpHdr.highMemStart;
   CkptSerializer::writeCkptImage(&mtcpHdr, sizeof(mtcpHdr));
 }
 
+void
+ThreadList::getMpiMemoryBounds(void **libsStart,
+                               void **libsEnd,
+                               void **highMemStart)
+{
+  *libsStart = lastLibsStart;
+  *libsEnd = lastLibsEnd;
+  *highMemStart = lastHighMemStart;
+}
+
 /*************************************************************************
  *
  *  This executes as a thread.  It sleeps for the checkpoint interval
@@ -534,92 +643,156 @@ checkpointhread(void *dummy)
   return NULL;
 }
 
+/* Called with the threads list locked.  A signaled thread that is gone
+ * without having gone through ThreadList::threadExit() will never check in;
+ * stop waiting for it.
+ */
+static void
+reapSignaledThreads()
+{
+  Thread *thread;
+  Thread *next;
+
+  for (thread = activeThreads; thread != NULL; thread = next) {
+    next = thread->next;
+    if (thread->state == ST_SIGNALED &&
+        THREAD_TGKILL(motherpid, thread->tid, 0) == -1 && errno == ESRCH) {
+      ThreadList::threadIsDead(thread);
+      numUserThreads--;
+      __sync_sub_and_fetch(&numThreadsToAcknowledge, 1);
+      __sync_sub_and_fetch(&numThreadsToSuspend, 1);
+    }
+  }
+}
+
 static void
 suspendThreads()
 {
-  int needrescan;
   Thread *thread;
   Thread *next;
+  struct timespec startTime;
+  struct timespec signalTime;
+  struct timespec suspendTime;
+  int remaining;
 
   JASSERT(pthread_rwlock_destroy(&threadResumeLock) == 0) (JASSERT_ERRNO);
   JASSERT(pthread_rwlock_init(&threadResumeLock, NULL) == 0)
     (JASSERT_ERRNO);
   JASSERT(_real_pthread_rwlock_wrlock(&threadResumeLock) == 0) (JASSERT_ERRNO);
 
-  /* Halt all other threads - force them to call stopthisthread
-   * If any have blocked checkpointing, wait for them to unblock before
-   * signalling
+  JASSERT(clock_gettime(CLOCK_MONOTONIC, &startTime) == 0);
+  lastAcknowledgeTime = startTime;
+
+  /* Halt all other threads - force them to call stopthisthread.  Every
+   * thread is visited once; the threads then check in through
+   * numThreadsToSuspend instead of being rescanned.
    */
   lock_threads();
-  do {
-    needrescan = 0;
-    numUserThreads = 0;
-    for (thread = activeThreads; thread != NULL; thread = next) {
-      next = thread->next;
-      int ret;
-
-      /* Do various things based on thread's state */
-      switch (thread->state) {
-      case ST_RUNNING:
-
-        /* Thread is running. Send it a signal so it will call stopthisthread.
-         * We will need to rescan (hopefully it will be suspended by then)
-         */
-        if (Thread_UpdateState(thread, ST_SIGNALED, ST_RUNNING)) {
-          if (THREAD_TGKILL(motherpid, thread->tid,
-                            SigInfo::ckptSignal()) < 0) {
-            JASSERT(errno == ESRCH) (JASSERT_ERRNO) (thread->tid)
-            .Text("error signalling thread");
-            ThreadList::threadIsDead(thread);
-          } else {
-            needrescan = 1;
-          }
-        }
-        break;
-
-      case ST_ZOMBIE:
-        ret = THREAD_TGKILL(motherpid, thread->tid, 0);
-        JASSERT(ret == 0 || errno == ESRCH);
-        if (ret == -1 && errno == ESRCH) {
-          ThreadList::threadIsDead(thread);
-        }
-        break;
-
-      case ST_SIGNALED:
-        if (THREAD_TGKILL(motherpid, thread->tid, 0) == -1 && errno == ESRCH) {
+  numUserThreads = 0;
+  numSignaledExits = 0;
+  for (thread = activeThreads; thread != NULL; thread = next) {
+    next = thread->next;
+    int ret;
+
+    /* Do various things based on thread's state */
+    switch (thread->state) {
+    case ST_RUNNING:
+
+      /* Thread is running. Send it a signal so it will call stopthisthread.
+       * Count it before signalling, since it may check in right away.
+       */
+      if (Thread_UpdateState(thread, ST_SIGNALED, ST_RUNNING)) {
+        __sync_add_and_fetch(&numThreadsToAcknowledge, 1);
+        __sync_add_and_fetch(&numThreadsToSuspend, 1);
+        if (THREAD_TGKILL(motherpid, thread->tid,
+                          SigInfo::ckptSignal()) < 0) {
+          JASSERT(errno == ESRCH) (JASSERT_ERRNO) (thread->tid)
+          .Text("error signalling thread");
+          __sync_sub_and_fetch(&numThreadsToAcknowledge, 1);
+          __sync_sub_and_fetch(&numThreadsToSuspend, 1);
           ThreadList::threadIsDead(thread);
         } else {
-          needrescan = 1;
+          numUserThreads++;
         }
-        break;
-
-      case ST_SUSPINPROG:
+      } else if (thread->state != ST_ZOMBIE) {
+        // Lost a race with someone else signaling it; see below.
+        __sync_add_and_fetch(&numThreadsToAcknowledge, 1);
+        __sync_add_and_fetch(&numThreadsToSuspend, 1);
         numUserThreads++;
-        break;
+      }
+      break;
 
-      case ST_SUSPENDED:
-        numUserThreads++;
-        break;
+    case ST_ZOMBIE:
+      ret = THREAD_TGKILL(motherpid, thread->tid, 0);
+      JASSERT(ret == 0 || errno == ESRCH);
+      if (ret == -1 && errno == ESRCH) {
+        ThreadList::threadIsDead(thread);
+      }
+      break;
 
-      case ST_CKPNTHREAD:
-        break;
+    case ST_SIGNALED:
+    case ST_SUSPINPROG:
+    case ST_SUSPENDED:
+      /* Already signaled by someone else.  The thread checks in exactly once,
+       * whether or not it has done so yet.
+       */
+      __sync_add_and_fetch(&numThreadsToAcknowledge, 1);
+      __sync_add_and_fetch(&numThreadsToSuspend, 1);
+      numUserThreads++;
+      break;
 
-      default:
-        JASSERT(false);
-      }
-    }
-    if (needrescan) {
-      usleep(10);
+    case ST_CKPNTHREAD:
+      break;
+
+    default:
+      JASSERT(false);
     }
-  } while (needrescan);
+  }
   unlk_threads();
+  JASSERT(clock_gettime(CLOCK_MONOTONIC, &signalTime) == 0);
+
+  while ((remaining = __atomic_load_n(&numThreadsToSuspend,
+                                      __ATOMIC_SEQ_CST)) > 0) {
+    struct timespec timeout = { SUSPEND_TIMEOUT_SEC, 0 };
+    if (_real_syscall(SYS_futex, &numThreadsToSuspend, FUTEX_WAIT_PRIVATE,
+                      remaining, &timeout, NULL, 0) == -1 &&
+        errno == ETIMEDOUT) {
+      lock_threads();
+      reapSignaledThreads();
+      unlk_threads();
+    }
+  }
+  JASSERT(remaining == 0) (remaining);
+  JASSERT(clock_gettime(CLOCK_MONOTONIC, &suspendTime) == 0);
+
+  // The threads that exited instead of suspending are now ST_ZOMBIE; they
+  // are not checkpointed.
+  numUserThreads -= numSignaledExits;
 
-  for (int i = 0; i < numUserThreads; i++) {
-    sem_wait(&semNotifyCkptThread);
+  // All threads have acknowledged by now, so lastAcknowledgeTime is stable.
+  JASSERT(numThreadsToAcknowledge == 0) (numThreadsToAcknowledge);
+  if (numUserThreads == 0) {
+    lastAcknowledgeTime = signalTime;
   }
 
+  suspendTimings.numThreads = numUserThreads;
+  suspendTimings.signalTime = timespecDiff(&signalTime, &startTime);
+  suspendTimings.acknowledgeTime =
+    timespecDiff(&lastAcknowledgeTime, &signalTime);
+  suspendTimings.suspendTime = timespecDiff(&suspendTime, &startTime);
+
   JASSERT(activeThreads != NULL);
-  JTRACE("everything suspended") (numUserThreads);
+  JTRACE("everything suspended")
+    (numUserThreads)
+    (suspendTimings.signalTime)
+    (suspendTimings.acknowledgeTime)
+    (suspendTimings.suspendTime);
+}
+
+const ThreadList::SuspendTimings&
+ThreadList::lastSuspendTimings()
+{
+  return suspendTimings;
 }
 
 /* Resume all threads. */
@@ -678,8 +851,20 @@ stopthisthread(int signum)
    * sigaction(STOPSIGNAL, stopthisthread) to discard all pending signals.
    */
 
+  // A thread inside the alloc plugin's malloc wrappers raises the signal
+  // again once it leaves them.
+  if (curThread->state == ST_SIGNALED &&
+      dmtcp_alloc_defer_ckpt_signal != NULL &&
+      dmtcp_alloc_defer_ckpt_signal()) {
+    return;
+  }
+
   // make sure we don't get called twice for same thread
   if (Thread_UpdateState(curThread, ST_SUSPINPROG, ST_SIGNALED)) {
+    if (__sync_sub_and_fetch(&numThreadsToAcknowledge, 1) == 0) {
+      clock_gettime(CLOCK_MONOTONIC, &lastAcknowledgeTime);
+    }
+
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 11)
     JWARNING(prctl(PR_GET_NAME, curThread->procname) != -1) (JASSERT_ERRNO)
     .Text("prctl(PR_GET_NAME, ...) failed");
@@ -708,7 +893,10 @@ stopthisthread(int signum)
 
       /* Tell the checkpoint thread that we're all saved away */
       JASSERT(Thread_UpdateState(curThread, ST_SUSPENDED, ST_SUSPINPROG));
-      sem_post(&semNotifyCkptThread);
+      if (__sync_sub_and_fetch(&numThreadsToSuspend, 1) == 0) {
+        _real_syscall(SYS_futex, &numThreadsToSuspend, FUTEX_WAKE_PRIVATE,
+                      1, NULL, NULL, 0);
+      }
 
       /* Then wait for the ckpt thread to write the ckpt file then wake us up */
       JTRACE("User thread suspended") (curThread->tid);
@@ -801,6 +989,10 @@ ThreadList::waitForAllRestored(Thread *thread)
       sem_wait(&semNotifyCkptThread);
     }
 
+    // Every thread has a new tid now; index them before any of them resumes
+    // and creates threads.
+    rebuildTidIndex();
+
     // Now that all threads have been created, restore the signal handler. We
     // need to do it before calling DmtcpWorker::postRestart() because that
     // routine will invoke restart hooks for all plugins. Some of the plugins
@@ -888,6 +1080,7 @@ void
 ThreadList::postRestart(double readTime)
 {
   Thread *thread;
+  Thread *next;
   sigset_t tmp;
 
   /* If DMTCP_RESTART_PAUSE==2, wait for gdb attach. */
@@ -919,8 +1112,18 @@ ThreadList::postRestart(double readTime)
   Util::allowGdbDebug(DEBUG_POST_RESTART);
 
   sigfillset(&tmp);
-  for (thread = activeThreads; thread != NULL; thread = thread->next) {
+  for (thread = activeThreads; thread != NULL; thread = next) {
     struct MtcpRestartThreadArg mtcpRestartThreadArg;
+    next = thread->next;
+
+    /* A thread that was exiting at checkpoint time has no context to
+     * restore.
+     */
+    if (thread->state == ST_ZOMBIE && thread != motherofall) {
+      ThreadList::threadIsDead(thread);
+      continue;
+    }
+
     sigandset(&sigpending_global, &tmp, &(thread->sigpending));
     tmp = sigpending_global;
 
@@ -1076,6 +1279,82 @@ Thread_RestoreSigState(Thread *th)
   }
 }
 
+/*****************************************************************************
+ *
+ * The tid index.  Called with the threads list locked.
+ *
+ *****************************************************************************/
+static void
+tidIndexInsert(Thread *thread)
+{
+  Thread **bucket = &tidIndex[(unsigned)thread->tid % TID_INDEX_SIZE];
+
+  thread->indexedTid = thread->tid;
+  thread->tidNext = *bucket;
+  *bucket = thread;
+}
+
+// The tid of the thread may have changed since it was inserted (see
+// updateTid()); it is in the bucket of its old tid.
+static void
+tidIndexRemove(Thread *thread)
+{
+  Thread **p = &tidIndex[(unsigned)thread->indexedTid % TID_INDEX_SIZE];
+
+  while (*p != NULL && *p != thread) {
+    p = &(*p)->tidNext;
+  }
+  if (*p != NULL) {
+    *p = thread->tidNext;
+  }
+  thread->tidNext = NULL;
+}
+
+static Thread *
+tidIndexFind(pid_t tid, Thread *except)
+{
+  Thread *thread = tidIndex[(unsigned)tid % TID_INDEX_SIZE];
+
+  while (thread != NULL && (thread->tid != tid || thread == except)) {
+    thread = thread->tidNext;
+  }
+  return thread;
+}
+
+// On restart, every thread has a new tid.
+static void
+rebuildTidIndex()
+{
+  Thread *thread;
+
+  lock_threads();
+  memset(tidIndex, 0, sizeof(tidIndex));
+  for (thread = activeThreads; thread != NULL; thread = thread->next) {
+    tidIndexInsert(thread);
+  }
+  unlk_threads();
+}
+
+// Called with the threads list locked.
+static void
+reapZombies()
+{
+  Thread *thread;
+  Thread *next;
+
+  numExitsSinceReap = 0;
+  for (thread = activeThreads; thread != NULL; thread = next) {
+    next = thread->next;
+
+    /* if no thread with this tid, then we can remove zombie descriptor */
+    if (thread->state == ST_ZOMBIE &&
+        THREAD_TGKILL(motherpid, thread->tid, 0) == -1 && errno == ESRCH) {
+      JTRACE("Killing zombie thread") (thread->tid);
+      ThreadList::threadIsDead(thread);
+    }
+  }
+}
+
 /*****************************************************************************
  *
  * If there is a thread descriptor with the same tid, it must be from a dead
@@ -1087,7 +1366,6 @@ ThreadList::addToActiveList(Thread *th)
 {
   int tid;
   Thread *thread;
-  Thread *next_thread;
 
   lock_threads();
 
@@ -1113,42 +1391,39 @@ ThreadList::addToActiveList(Thread *th)
   tid = curThread->tid;
   JASSERT(tid != 0);
 
-  // First remove duplicate descriptors.
-  for (thread = activeThreads; thread != NULL; thread = next_thread) {
-    next_thread = thread->next;
-    if (thread != curThread && thread->tid == tid) {
-      JTRACE("Removing duplicate thread descriptor")
-        (thread->tid) (thread->virtual_tid);
-
-      // There will be at most one duplicate descriptor.
-      threadIsDead(thread);
-      continue;
-    }
-
-    // FIXME:  This causes segfault on second restart.  Why?
-    // JASSERT(thread != curThread)(thread)
-    // .Text("adding curThread, but it's already on activeThreads");
+  // First remove the duplicate descriptor, if any.
+  thread = tidIndexFind(tid, curThread);
+  if (thread != NULL) {
+    JTRACE("Removing duplicate thread descriptor")
+      (thread->tid) (thread->virtual_tid);
+    threadIsDead(thread);
+  }
 
-    /* NOTE:  ST_ZOMBIE is used only for the sake of efficiency.  We
-     *   test threads in state ST_ZOMBIE using tgkill to remove them
-     *   early (before reaching a checkpoint) so that the
-     *   threadrdescriptor list does not grow too long.
-     */
-    if (thread->state == ST_ZOMBIE) {
-      /* if no thread with this tid, then we can remove zombie descriptor */
-      if (-1 == THREAD_TGKILL(motherpid, thread->tid, 0)) {
-        JTRACE("Killing zombie thread") (thread->tid);
-        threadIsDead(thread);
-      }
-    }
+  /* NOTE:  ST_ZOMBIE is used only for the sake of efficiency.  We
+   *   test threads in state ST_ZOMBIE using tgkill to remove them
+   *   early (before reaching a checkpoint) so that the
+   *   threadrdescriptor list does not grow too long.  This is done in a
+   *   batch, so that its cost per new thread is constant.
+   */
+  if (numExitsSinceReap >= ZOMBIE_REAP_MIN &&
+      numExitsSinceReap >= numActiveThreads / 2) {
+    reapZombies();
   }
 
-  curThread->next = activeThreads;
-  curThread->prev = NULL;
-  if (activeThreads != NULL) {
-    activeThreads->prev = curThread;
+  if (!curThread->onActiveList) {
+    curThread->next = activeThreads;
+    curThread->prev = NULL;
+    if (activeThreads != NULL) {
+      activeThreads->prev = curThread;
+    }
+    activeThreads = curThread;
+    curThread->onActiveList = 1;
+    numActiveThreads++;
+  } else {
+    // Already listed, but possibly under an older tid.
+    tidIndexRemove(curThread);
   }
-  activeThreads = curThread;
+  tidIndexInsert(curThread);
 
   unlk_threads();
 }
@@ -1172,19 +1447,28 @@ ThreadList::threadIsDead(Thread *thread)
   JASSERT(thread != NULL);
   JTRACE("Putting thread on freelist") (thread->tid);
 
-  /* Remove thread block from 'threads' list */
-  if (thread->prev != NULL) {
-    thread->prev->next = thread->next;
-  }
-  if (thread->next != NULL) {
-    thread->next->prev = thread->prev;
-  }
-  if (thread == activeThreads) {
-    activeThreads = activeThreads->next;
+  /* Remove thread block from 'threads' list.  A thread whose clone() failed
+   * was never on it.
+   */
+  if (thread->onActiveList) {
+    if (thread->prev != NULL) {
+      thread->prev->next = thread->next;
+    }
+    if (thread->next != NULL) {
+      thread->next->prev = thread->prev;
+    }
+    if (thread == activeThreads) {
+      activeThreads = activeThreads->next;
+    }
+    tidIndexRemove(thread);
+    thread->onActiveList = 0;
+    numActiveThreads--;
   }
 
-  thread->next = threads_freelist;
-  threads_freelist = thread;
+  do {
+    thread->next = threads_freelist;
+  } while (!__sync_bool_compare_and_swap(&threads_freelist, thread->next,
+                                         thread));
 }
 
 /*****************************************************************************
@@ -1197,15 +1481,16 @@ ThreadList::getNewThread()
 {
   Thread *thread;
 
-  lock_threads();
-  if (threads_freelist == NULL) {
+  if (localFreelist == NULL) {
+    localFreelist = __sync_lock_test_and_set(&threads_freelist, NULL);
+  }
+  if (localFreelist == NULL) {
     thread = (Thread *)JALLOC_HELPER_MALLOC(sizeof(Thread));
     JASSERT(thread != NULL);
   } else {
-    thread = threads_freelist;
-    threads_freelist = threads_freelist->next;
+    thread = localFreelist;
+    localFreelist = localFreelist->next;
   }
-  unlk_threads();
   memset(thread, 0, sizeof(*thread));
   return thread;
 }
@@ -1218,13 +1503,11 @@ ThreadList::getNewThread()
 void
 ThreadList::emptyFreeList()
 {
-  lock_threads();
+  Thread *thread = __sync_lock_test_and_set(&threads_freelist, NULL);
 
-  while (threads_freelist != NULL) {
-    Thread *thread = threads_freelist;
-    threads_freelist = threads_freelist->next;
+  while (thread != NULL) {
+    Thread *next = thread->next;
     JALLOC_HELPER_FREE(thread);
+    thread = next;
   }
-
-  unlk_threads();
 }
@@ -48,10 +48,19 @@ void addToActiveList(Thread *th);
 void threadIsDead(Thread *thread);
 void emptyFreeList();
 
+struct SuspendTimings {
+  int numThreads;
+  double signalTime;      // Time to signal all user threads.
+  double acknowledgeTime; // From then until the last one entered the handler.
+  double suspendTime;     // Total time until all user threads were suspended.
+};
+
 void suspendThreads();
 void resumeThreads();
+const SuspendTimings& lastSuspendTimings();
 void waitForAllRestored(Thread *thisthread);
 void writeCkpt();
+void getMpiMemoryBounds(void **libsStart, void **libsEnd, void **highMemStart);
 void postRestart(double readTime = 0.0);
 void postRestartDebug(double readTime, int restartPause);
 }
@@ -19,8 +19,12 @@
  *  <http://www.gnu.org/licenses/>.                                         *
  ****************************************************************************/
 
+#include <limits.h>
+#include <linux/futex.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -28,21 +32,35 @@
 #include "dmtcpworker.h"
 #include "syscallwrappers.h"
 #include "threadsync.h"
+#include "util.h"
 #include "workerstate.h"
 
 using namespace dmtcp;
 
 /*
- * _wrapperExecutionLock is used to make the checkpoint safe by making sure
- *   that no user-thread is executing any DMTCP wrapper code when it receives
- *   the checkpoint signal.
+ * The wrapper-execution lock is used to make the checkpoint safe by making
+ *   sure that no user-thread is executing any DMTCP wrapper code when it
+ *   receives the checkpoint signal.
  * Working:
- *   On entering the wrapper in DMTCP, the user-thread acquires the read lock,
- *     and releases it before leaving the wrapper.
+ *   The lock is a "big-reader" lock.  Readers are spread over
+ *     WRAPPER_EXECUTION_SLOTS counters, each in its own cache line.  A thread
+ *     is assigned a slot the first time it enters a wrapper, so that
+ *     concurrent wrapper calls from different threads don't bounce a shared
+ *     cache line.
+ *   On entering the wrapper in DMTCP, the user-thread increments its slot
+ *     and then checks _wrapperExecutionWriterActive.  If no writer is active,
+ *     it has acquired the read lock; it decrements its slot before leaving
+ *     the wrapper.  If a writer is active, it backs out and sleeps on a futex
+ *     until the writer is done.
  *   When the Checkpoint-thread wants to send the SUSPEND signal to user
- *     threads, it must acquire the write lock. It is blocked until all the
- *     existing read-locks by user threads have been released. NOTE that this
- *     is a WRITER-PREFERRED lock.
+ *     threads, it must acquire the write lock.  It sets
+ *     _wrapperExecutionWriterActive and then waits (on a futex) for every
+ *     slot to drain to zero.  The last reader to leave a slot wakes the
+ *     writer.  NOTE that this is a WRITER-PREFERRED lock: new readers back
+ *     off as soon as the flag is set.
+ *   fork() and exec() wrappers take the same write lock (see
+ *     wrapperExecutionLockLockExcl()).  Writers are serialized by
+ *     _wrapperExecutionWriterLock.
  *
  * There is a corner case too -- the newly created thread that has not been
  *   initialized yet; we need to take some extra efforts for that.
@@ -61,9 +79,20 @@ using namespace dmtcp;
  * should be extended to other calls as well.           -- KAPIL
  */
 
+#define WRAPPER_EXECUTION_SLOTS 128
+#define CACHE_LINE_SIZE         64
+
+typedef struct WrapperExecutionSlot {
+  volatile int count;
+  char pad[CACHE_LINE_SIZE - sizeof(int)];
+} __attribute__((aligned(CACHE_LINE_SIZE))) WrapperExecutionSlot;
+
+static WrapperExecutionSlot _wrapperExecutionSlots[WRAPPER_EXECUTION_SLOTS];
+static int _wrapperExecutionNextSlot = 0;
+static volatile int _wrapperExecutionWriterActive = 0;
+static pthread_mutex_t _wrapperExecutionWriterLock = PTHREAD_MUTEX_INITIALIZER;
+
 // NOTE: PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP is not POSIX.
-static pthread_rwlock_t
-  _wrapperExecutionLock = PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP;
 static pthread_rwlock_t
   _threadCreationLock = PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP;
 static bool _wrapperExecutionLockAcquiredByCkptThread = false;
@@ -83,6 +112,8 @@ static bool _checkpointThreadInitialized = false;
 static pthread_mutex_t preResumeThreadCountLock = PTHREAD_MUTEX_INITIALIZER;
 
 static __thread int _wrapperExecutionLockLockCount = 0;
+static __thread int _wrapperExecutionSlot = -1;
+static __thread bool _wrapperExecutionLockHeldExcl = false;
 static __thread int _threadCreationLockLockCount = 0;
 #if TRACK_DLOPEN_DLSYM_FOR_LOCKS
 static __thread bool _threadPerformingDlopenDlsym = false;
@@ -116,6 +147,8 @@ ThreadSync::initThread()
   // pthread_start -> threadFinishedInitialization -> stopthisthread ->
   // callbackHoldsAnyLocks -> JASSERT().
   _wrapperExecutionLockLockCount = 0;
+  _wrapperExecutionSlot = -1;
+  _wrapperExecutionLockHeldExcl = false;
   _threadCreationLockLockCount = 0;
 #if TRACK_DLOPEN_DLSYM_FOR_LOCKS
   _threadPerformingDlopenDlsym = false;
@@ -131,6 +164,86 @@ ThreadSync::initMotherOfAll()
   _hasThreadFinishedInitialization = true;
 }
 
+static long
+futex(volatile int *addr, int op, int val)
+{
+  return _real_syscall(SYS_futex, addr, op, val, NULL, NULL, 0);
+}
+
+static WrapperExecutionSlot *
+wrapperExecutionSlot()
+{
+  if (_wrapperExecutionSlot < 0) {
+    _wrapperExecutionSlot =
+      __sync_fetch_and_add(&_wrapperExecutionNextSlot, 1) %
+      WRAPPER_EXECUTION_SLOTS;
+  }
+  return &_wrapperExecutionSlots[_wrapperExecutionSlot];
+}
+
+static void
+wrapperExecutionReaderExit(WrapperExecutionSlot *slot)
+{
+  // __sync_sub_and_fetch is a full barrier; a writer that set the flag
+  // before we decremented is guaranteed to be seen here.
+  if (__sync_sub_and_fetch(&slot->count, 1) == 0 &&
+      _wrapperExecutionWriterActive != 0) {
+    futex(&slot->count, FUTEX_WAKE_PRIVATE, INT_MAX);
+  }
+}
+
+// Returns false if a writer is active; the caller must wait and retry.
+static bool
+wrapperExecutionReaderEnter()
+{
+  WrapperExecutionSlot *slot = wrapperExecutionSlot();
+
+  __sync_fetch_and_add(&slot->count, 1);
+  if (_wrapperExecutionWriterActive == 0) {
+    return true;
+  }
+  wrapperExecutionReaderExit(slot);
+  return false;
+}
+
+static void
+wrapperExecutionWaitForWriter()
+{
+  while (_wrapperExecutionWriterActive != 0) {
+    // Returns on wake-up, on EAGAIN if the writer is already gone, or on
+    // EINTR if the checkpoint signal arrived while we were waiting.
+    futex(&_wrapperExecutionWriterActive, FUTEX_WAIT_PRIVATE, 1);
+  }
+}
+
+static void
+wrapperExecutionWriterLock()
+{
+  JASSERT(_real_pthread_mutex_lock(&_wrapperExecutionWriterLock) == 0)
+    (JASSERT_ERRNO);
+
+  _wrapperExecutionWriterActive = 1;
+  __sync_synchronize();
+
+  for (size_t i = 0; i < WRAPPER_EXECUTION_SLOTS; i++) {
+    int count;
+    while ((count = _wrapperExecutionSlots[i].count) != 0) {
+      futex(&_wrapperExecutionSlots[i].count, FUTEX_WAIT_PRIVATE, count);
+    }
+  }
+}
+
+static void
+wrapperExecutionWriterUnlock()
+{
+  _wrapperExecutionWriterActive = 0;
+  __sync_synchronize();
+  futex(&_wrapperExecutionWriterActive, FUTEX_WAKE_PRIVATE, INT_MAX);
+
+  JASSERT(_real_pthread_mutex_unlock(&_wrapperExecutionWriterLock) == 0)
+    (JASSERT_ERRNO);
+}
+
 void
 ThreadSync::acquireLocks()
 {
@@ -157,8 +270,7 @@ ThreadSync::acquireLocks()
   _threadCreationLockAcquiredByCkptThread = true;
 
   JTRACE("Waiting for other threads to exit DMTCP-Wrappers");
-  JASSERT(_real_pthread_rwlock_wrlock(&_wrapperExecutionLock) == 0)
-    (JASSERT_ERRNO);
+  wrapperExecutionWriterLock();
   _wrapperExecutionLockAcquiredByCkptThread = true;
 
   JTRACE("Waiting for newly created threads to finish initialization")
@@ -175,8 +287,7 @@ ThreadSync::releaseLocks()
   JASSERT(WorkerState::currentState() == WorkerState::SUSPENDED);
 
   JTRACE("Releasing ThreadSync locks");
-  JASSERT(_real_pthread_rwlock_unlock(&_wrapperExecutionLock) == 0)
-    (JASSERT_ERRNO);
+  wrapperExecutionWriterUnlock();
   _wrapperExecutionLockAcquiredByCkptThread = false;
   JASSERT(_real_pthread_rwlock_unlock(&_threadCreationLock) == 0)
     (JASSERT_ERRNO);
@@ -193,10 +304,17 @@ ThreadSync::resetLocks()
 {
   pthread_rwlock_t newLock = PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP;
 
-  _wrapperExecutionLock = newLock;
   _threadCreationLock = newLock;
 
+  memset(_wrapperExecutionSlots, 0, sizeof(_wrapperExecutionSlots));
+  _wrapperExecutionNextSlot = 0;
+  _wrapperExecutionWriterActive = 0;
+  pthread_mutex_t newWriterLock = PTHREAD_MUTEX_INITIALIZER;
+  _wrapperExecutionWriterLock = newWriterLock;
+
   _wrapperExecutionLockLockCount = 0;
+  _wrapperExecutionSlot = -1;
+  _wrapperExecutionLockHeldExcl = false;
   _threadCreationLockLockCount = 0;
 #if TRACK_DLOPEN_DLSYM_FOR_LOCKS
   _threadPerformingDlopenDlsym = false;
@@ -387,25 +505,21 @@ ThreadSync::wrapperExecutionLockLock()
 #endif // if TRACK_DLOPEN_DLSYM_FOR_LOCKS
         isOkToGrabLock() == true &&
         _wrapperExecutionLockLockCount == 0) {
-      incrementWrapperExecutionLockLockCount();
-      int retVal = _real_pthread_rwlock_tryrdlock(&_wrapperExecutionLock);
-      if (retVal != 0 && retVal == EBUSY) {
-        decrementWrapperExecutionLockLockCount();
-        struct timespec sleepTime = { 0, 100 * 1000 * 1000 };
-        nanosleep(&sleepTime, NULL);
+      if (!wrapperExecutionReaderEnter()) {
+        // A thread inside the alloc plugin's malloc wrappers defers the
+        // checkpoint signal until it leaves them, so it must not wait for
+        // the checkpoint here.  It proceeds without the lock.
+        if (dmtcp_alloc_in_progress != NULL && dmtcp_alloc_in_progress()) {
+          break;
+        }
+
+        // A writer (checkpoint thread, fork, exec) is active.  Sleep until it
+        // is done and then re-examine the worker state.
+        wrapperExecutionWaitForWriter();
         continue;
       }
-      if (retVal != 0 && retVal != EDEADLK) {
-        fprintf(stderr, "ERROR %d at %s:%d %s: Failed to acquire lock\n",
-                errno, __FILE__, __LINE__, __PRETTY_FUNCTION__);
-        _exit(DMTCP_FAIL_RC);
-      }
-
-      // retVal should always be 0 (success) here.
-      lockAcquired = retVal == 0 ? true : false;
-      if (!lockAcquired) {
-        decrementWrapperExecutionLockLockCount();
-      }
+      incrementWrapperExecutionLockLockCount();
+      lockAcquired = true;
     }
     break;
   }
@@ -458,18 +572,13 @@ ThreadSync::wrapperExecutionLockLockExcl()
   if (DmtcpWorker::exitInProgress()) {
     return false;
   }
-  if (WorkerState::currentState() == WorkerState::RUNNING) {
+  // A thread that is already inside a wrapper would wait for itself.
+  if (WorkerState::currentState() == WorkerState::RUNNING &&
+      _wrapperExecutionLockLockCount == 0) {
+    wrapperExecutionWriterLock();
+    _wrapperExecutionLockHeldExcl = true;
     incrementWrapperExecutionLockLockCount();
-    int retVal = _real_pthread_rwlock_wrlock(&_wrapperExecutionLock);
-    if (retVal != 0 && retVal != EDEADLK) {
-      fprintf(stderr, "ERROR %s:%d %s: Failed to acquire lock\n",
-              __FILE__, __LINE__, __PRETTY_FUNCTION__);
-      _exit(DMTCP_FAIL_RC);
-    }
-    lockAcquired = retVal == 0 ? true : false;
-    if (!lockAcquired) {
-      decrementWrapperExecutionLockLockCount();
-    }
+    lockAcquired = true;
   }
   errno = saved_errno;
   return lockAcquired;
@@ -505,13 +614,17 @@ ThreadSync::wrapperExecutionLockUnlock()
   if (DmtcpWorker::exitInProgress()) {
     return;
   }
-  if (_real_pthread_rwlock_unlock(&_wrapperExecutionLock) != 0) {
+  if (_wrapperExecutionLockHeldExcl) {
+    _wrapperExecutionLockHeldExcl = false;
+    wrapperExecutionWriterUnlock();
+  } else if (_wrapperExecutionSlot >= 0 && _wrapperExecutionLockLockCount > 0) {
+    wrapperExecutionReaderExit(&_wrapperExecutionSlots[_wrapperExecutionSlot]);
+  } else {
     fprintf(stderr, "ERROR %s:%d %s: Failed to release lock\n",
             __FILE__, __LINE__, __PRETTY_FUNCTION__);
     _exit(DMTCP_FAIL_RC);
-  } else {
-    decrementWrapperExecutionLockLockCount();
   }
+  decrementWrapperExecutionLockLockCount();
   errno = saved_errno;
 }
 
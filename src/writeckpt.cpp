@@ -30,6 +30,8 @@
 #include <sys/resource.h>
 #include <sys/stat.h>
 #include "jassert.h"
+#include "ckptmetrics.h"
+#include "ckptserializer.h"
 #include "constants.h"
 #include "dmtcp.h"
 #include "processinfo.h"
@@ -37,6 +39,7 @@
 #include "procselfmaps.h"
 #include "shareddata.h"
 #include "util.h"
+#include "mtcp/mtcp_crc32c.h"
 #include "mtcp/mtcp_header.h"  // MtcpHdr
 
 #define HUGEPAGES
@@ -49,6 +52,10 @@
 
 #define DELETED_FILE_SUFFIX  " (deleted)"
 
+// Large areas are checksummed and written in chunks of this size, so that
+// each chunk is still in the cache when it is written.
+#define CHECKSUM_CHUNK_SIZE  (1024 * 1024)
+
 #define _real_open           NEXT_FNC(open)
 #define _real_close          NEXT_FNC(close)
 
@@ -58,6 +65,10 @@ EXTERNC int dmtcp_infiniband_enabled(void) __attribute__((weak));
 
 static bool skipWritingTextSegments = false;
 
+// Bytes of memory written to, and skipped as zero pages in, the image.
+static size_t areaBytesWritten = 0;
+static size_t areaZeroBytes = 0;
+
 // FIXME:  Why do we create two global variable here?  They should at least
 // be static (file-private), and preferably local to a function.
 ProcSelfMaps *procSelfMaps = NULL;
@@ -77,8 +88,10 @@ vector<ProcMapsArea> *nscdAreas = NULL;
 
 // static void sync_shared_mem(void);
 static void writememoryarea(int fd, Area *area, int stack_was_seen);
+static void write_area_header(int fd, Area *area);
 
 static void remap_nscd_areas(const vector<ProcMapsArea> &areas);
+static CkptMetrics::AreaClass area_class(const Area *area);
 
 #ifdef HUGEPAGES
 // read a line from fd
@@ -163,30 +176,10 @@ mtcp_writememoryareas(int fd)
   /* inconsistent state.  See note in restoreverything routine.             */
   /**************************************************************************/
 
-  {
-    if (nscdAreas == NULL) {
-      nscdAreas = new vector<ProcMapsArea>();
-    }
-    nscdAreas->clear();
-
-    // This block is to ensure that the object is deleted as soon as we leave
-    // this block.
-    ProcSelfMaps procSelfMaps;
-
-    // Preprocess memory regions as needed.
-    while (procSelfMaps.getNextArea(&area)) {
-      if (Util::isNscdArea(area)) {
-        /* Special Case Handling: nscd is enabled*/
-        JTRACE("NSCD daemon shared memory area present.\n"
-               "  DMTCP will now try to remap this area in read/write mode as\n"
-               "  private (zero pages), so that glibc will automatically\n"
-               "  stop using NSCD or ask NSCD daemon for new shared area\n")
-          (area.name);
-
-        nscdAreas->push_back(area);
-      }
-    }
+  if (nscdAreas == NULL) {
+    nscdAreas = new vector<ProcMapsArea>();
   }
+  nscdAreas->clear();
 
   if (procSelfMaps != NULL) {
     // We need to explicitly delete this object here because on restart, we
@@ -194,12 +187,31 @@ mtcp_writememoryareas(int fd)
     delete procSelfMaps;
   }
 
+  // Read /proc/self/maps once, for both passes below.  The snapshot shared
+  // with the plugins may predate the mmap()s made while opening the image.
+  procSelfMaps = new ProcSelfMaps();
+
+  // Preprocess memory regions as needed.  Adding to nscdAreas relies on the
+  // allocator's preExpand() (see ProcSelfMaps()) not to mmap() here.
+  while (procSelfMaps->getNextArea(&area)) {
+    if (Util::isNscdArea(area)) {
+      /* Special Case Handling: nscd is enabled*/
+      JTRACE("NSCD daemon shared memory area present.\n"
+             "  DMTCP will now try to remap this area in read/write mode as\n"
+             "  private (zero pages), so that glibc will automatically\n"
+             "  stop using NSCD or ask NSCD daemon for new shared area\n")
+        (area.name);
+
+      nscdAreas->push_back(area);
+    }
+  }
+  procSelfMaps->rewind();
+
   /* Finally comes the memory contents */
   // patched from commit "Add guard pages around restoreBuf when mmap'ed"
   JTRACE("addr and len of restoreBuf (to hold mtcp_restart code)")
     ((void *)ProcessInfo::instance().restoreBufAddr())
     (ProcessInfo::instance().restoreBufLen());
-  procSelfMaps = new ProcSelfMaps();
 
   // We must not cause an mmap() here, or the mem regions will not be correct.
   while (procSelfMaps->getNextArea(&area)) {
@@ -216,6 +228,8 @@ mtcp_writememoryareas(int fd)
       continue;
     } else if (SharedData::isSharedDataRegion(area.addr)) {
       continue;
+    } else if (CkptSerializer::isLzScratchArea(area.addr)) {
+      continue;
     }
 
     /* Original comment:  Skip anything in kernel address space ---
@@ -302,7 +316,21 @@ mtcp_writememoryareas(int fd)
       area.flags = MAP_PRIVATE | MAP_ANONYMOUS;
       area.name[0] = '\0';
     } else if (Util::isSysVShmArea(area)) {
-      JTRACE("saving area as Anonymous") (area.name);
+      if (dmtcp_svipc_enabled != NULL && dmtcp_svipc_enabled()) {
+        // mtcp_restart recreates the segment and restores its contents in
+        // place; the SysV plugin adopts it in ShmSegment::postRestart().
+        JTRACE("saving SysV shm segment") (area.name);
+        Area segment = area;
+        segment.properties = DMTCP_SYSV_SHM_SEGMENT;
+#ifdef HUGEPAGES
+        segment.hugepages = area.size % (2 * 1024 * 1024) == 0
+                            && is_hugepage(area.addr);
+#endif
+        write_area_header(fd, &segment);
+        area.properties |= DMTCP_SYSV_SHM_DATA;
+      } else {
+        JTRACE("saving area as Anonymous") (area.name);
+      }
       area.flags = MAP_PRIVATE | MAP_ANONYMOUS;
       area.name[0] = '\0';
     } else if (Util::isNscdArea(area)) {
@@ -310,7 +338,7 @@ mtcp_writememoryareas(int fd)
       area.prot = PROT_READ | PROT_WRITE;
       area.properties |= DMTCP_ZERO_PAGE;
       area.flags = MAP_PRIVATE | MAP_ANONYMOUS;
-      Util::writeAll(fd, &area, sizeof(area));
+      write_area_header(fd, &area);
       continue;
     } else if (Util::isIBShmArea(area)) {
       // TODO: Don't checkpoint infiniband shared area for now.
@@ -352,7 +380,14 @@ mtcp_writememoryareas(int fd)
 #endif
 
     // the whole thing comes after the restore image
+    uint64_t start = CkptMetrics::now();
+    size_t bytesWritten = areaBytesWritten;
+    size_t zeroBytes = areaZeroBytes;
     writememoryarea(fd, &area, stack_was_seen);
+    CkptMetrics::recordArea(area_class(&area),
+                            areaBytesWritten - bytesWritten,
+                            areaZeroBytes - zeroBytes,
+                            start);
   }
 
   // Release the memory.
@@ -364,7 +399,7 @@ mtcp_writememoryareas(int fd)
 
   area.addr = NULL; // End of data
   area.size = -1; // End of data
-  Util::writeAll(fd, &area, sizeof(area));
+  write_area_header(fd, &area);
 
   /* That's all folks */
   JASSERT(_real_close(fd) == 0);
@@ -423,6 +458,101 @@ mtcp_get_next_page_range(Area *area, size_t *size, int *is_zero)
   }
 }
 
+// Sets the checksum of the header, and writes it.  area->checksum must
+// already be set, unless no data follows.
+static void
+write_area_header(int fd, Area *area)
+{
+  if ((area->properties & DMTCP_CHECKSUMMED) == 0) {
+    area->properties |= DMTCP_CHECKSUMMED;
+    area->checksum = 0;
+  }
+  area->headerChecksum = 0;
+  area->headerChecksum = mtcp_crc32c(0, area, sizeof(*area));
+  Util::writeAll(fd, area, sizeof(*area));
+}
+
+// Writes the data in chunks, each checksummed just before it is written, so
+// that the checksum costs no extra pass over memory.
+static uint32_t
+write_data_with_checksum(int fd, const char *addr, size_t size)
+{
+  uint32_t crc = 0;
+
+  while (size > 0) {
+    size_t len = MIN(size, CHECKSUM_CHUNK_SIZE);
+    crc = mtcp_crc32c(crc, addr, len);
+    Util::writeAll(fd, addr, len);
+    addr += len;
+    size -= len;
+  }
+  return crc;
+}
+
+// Writes the area header followed by its contents, compressed if DMTCP_LZ
+// is enabled.  The checksum of the contents is known only after they are
+// written, so the header is written again, in place, afterwards.  If the
+// image is not seekable (a pipe to gzip), or the area is small, the
+// checksum is computed first instead.
+static void
+write_area_with_data(int fd, Area *area)
+{
+  bool compress = CkptSerializer::lzCompressionEnabled();
+  off_t headerOffset = -1;
+
+  if (compress || area->size > CHECKSUM_CHUNK_SIZE) {
+    headerOffset = lseek(fd, 0, SEEK_CUR);
+  }
+
+  area->properties |= DMTCP_CHECKSUMMED;
+  if (compress) {
+    area->properties |= DMTCP_LZ_COMPRESSED;
+  }
+
+  if (headerOffset == -1 && !compress) {
+    area->checksum = mtcp_crc32c(0, area->addr, area->size);
+    write_area_header(fd, area);
+    Util::writeAll(fd, area->addr, area->size);
+  } else if (headerOffset == -1) {
+    // Compressed data is checksummed as it is written; don't compress twice.
+    area->properties &= ~DMTCP_CHECKSUMMED;
+    Util::writeAll(fd, area, sizeof(*area));
+    CkptSerializer::writeLzCompressed(fd, area->addr, area->size);
+  } else {
+    area->checksum = 0;
+    write_area_header(fd, area);
+    if (compress) {
+      area->checksum =
+        CkptSerializer::writeLzCompressed(fd, area->addr, area->size);
+    } else {
+      area->checksum = write_data_with_checksum(fd, area->addr, area->size);
+    }
+    area->headerChecksum = 0;
+    area->headerChecksum = mtcp_crc32c(0, area, sizeof(*area));
+    JASSERT(pwrite(fd, area, sizeof(*area), headerOffset) ==
+            (ssize_t)sizeof(*area)) (JASSERT_ERRNO);
+  }
+  areaBytesWritten += area->size;
+}
+
+// Classifies an area for the per-area checkpoint metrics.  Called after
+// writememoryarea(), which names the heap.
+static CkptMetrics::AreaClass
+area_class(const Area *area)
+{
+  if (strcmp(area->name, "[heap]") == 0) {
+    return CkptMetrics::AREA_HEAP;
+  } else if (Util::strStartsWith(area->name, "[stack")) {
+    return CkptMetrics::AREA_STACK;
+  } else if ((area->flags & MAP_SHARED) ||
+             (area->properties & DMTCP_SYSV_SHM_DATA)) {
+    return CkptMetrics::AREA_SHM;
+  } else if (area->name[0] == '\0') {
+    return CkptMetrics::AREA_ANON;
+  }
+  return CkptMetrics::AREA_FILE;
+}
+
 static void
 mtcp_write_non_rwx_and_anonymous_pages(int fd, Area *orig_area)
 {
@@ -463,13 +593,15 @@ mtcp_write_non_rwx_and_anonymous_pages(int fd, Area *orig_area)
       mtcp_get_next_page_range(&a, &size, &is_zero);
     }
 
-    a.properties = is_zero ? DMTCP_ZERO_PAGE : 0;
+    a.properties = (area.properties & DMTCP_SYSV_SHM_DATA) |
+                   (is_zero ? DMTCP_ZERO_PAGE : 0);
     a.size = size;
 
-    Util::writeAll(fd, &a, sizeof(a));
     if (!is_zero) {
-      Util::writeAll(fd, a.addr, a.size);
+      write_area_with_data(fd, &a);
     } else {
+      write_area_header(fd, &a);
+      areaZeroBytes += a.size;
       if (madvise(a.addr, a.size, MADV_DONTNEED) == -1) {
         JNOTE("error doing madvise(..., MADV_DONTNEED)")
           (JASSERT_ERRNO) (a.addr) ((int)a.size);
@@ -537,11 +669,10 @@ writememoryarea(int fd, Area *area, int stack_was_seen)
 
     if (skipWritingTextSegments && (area->prot & PROT_EXEC)) {
       area->properties |= DMTCP_SKIP_WRITING_TEXT_SEGMENTS;
-      Util::writeAll(fd, area, sizeof(*area));
+      write_area_header(fd, area);
       JTRACE("Skipping over text segments") (area->name) ((void *)area->addr);
     } else {
-      Util::writeAll(fd, area, sizeof(*area));
-      Util::writeAll(fd, area->addr, area->size);
+      write_area_with_data(fd, area);
     }
   }
 }
@@ -136,6 +136,9 @@ BIN="./bin/"
 #Checkpoint command to send to coordinator
 CKPT_CMD=b'c'
 
+#Extra dmtcp_restart options to restart from the restart manifest, if set
+RESTART_FROM_MANIFEST=None
+
 #Appears as S*SLOW in code.  If --slow, then SLOW=5
 SLOW = pow(5, args.slow)
 TIMEOUT *= SLOW
@@ -544,9 +547,13 @@ def runTestRaw(name, numProcs, cmds):
   def testRestart():
     #build restart command
     cmd=BIN+"dmtcp_restart --quiet"
-    for i in os.listdir(ckptDir):
-      if i.endswith(".dmtcp"):
-        cmd+= " "+ckptDir+"/"+i
+    if RESTART_FROM_MANIFEST:
+      cmd+= " --from-manifest "+ckptDir+"/dmtcp_restart_manifest.bin"
+      cmd+= " "+RESTART_FROM_MANIFEST
+    else:
+      for i in os.listdir(ckptDir):
+        if i.endswith(".dmtcp"):
+          cmd+= " "+ckptDir+"/"+i
     #run restart and test if it worked
     procs.append(runCmd(cmd))
     WAITFOR(lambda: doesStatusSatisfy(getStatus(), status),
@@ -682,6 +689,74 @@ def runTest(name, numProcs, cmds):
         stats[1]-=1
         print("Trying once again")
 
+# Checkpoints ./test/restart-io, flips a byte of its large anonymous area in
+# the image, and checks that both dmtcp_verify_image and mtcp_restart reject
+# the image.  mtcp_restart maps that area from the image
+# (DMTCP_RESTART_IO=mmap), and checks it through the mapping.
+def runCorruptImageTest(name):
+  printFixed(name,15)
+
+  if not shouldRunTest(name):
+    print("SKIPPED")
+    return
+
+  stats[1]+=1
+  oldGzip = os.environ['DMTCP_GZIP']
+  os.environ['DMTCP_GZIP'] = "0"
+  proc = None
+  try:
+    CHECK(getStatus()==(0, False), "coordinator initial state")
+    proc = runCmd(BIN+"dmtcp_launch ./test/restart-io")
+    WAITFOR(lambda: getStatus()==(1, True),
+            lambda: "user program startup error")
+    sleep(S*SLOW)
+
+    printFixed("ckpt:")
+    coordinatorCmd(b'c')
+    WAITFOR(lambda: getNumCkptFiles(ckptDir)>0 and getStatus()==(1, True),
+            lambda: "checkpoint error")
+    coordinatorCmd(b'k')
+    WAITFOR(lambda: getStatus()==(0, False), lambda: "kill error")
+    printFixed("PASSED ")
+
+    printFixed("corrupt:")
+    image = [os.path.join(ckptDir, f) for f in os.listdir(ckptDir)
+             if f.startswith("ckpt_") and f.endswith(".dmtcp")][0]
+    verify = [BIN+"dmtcp_verify_image", "--quiet", image]
+    CHECK(subprocess.call(verify) == 0, "intact image rejected")
+    with open(image, "r+b") as f:
+      f.seek(os.path.getsize(image) // 2)
+      byte = f.read(1)
+      f.seek(-1, os.SEEK_CUR)
+      f.write(bytes([byte[0] ^ 0xff]))
+    CHECK(subprocess.call(verify, stdout=devnullFd) == 1,
+          "corrupt image accepted by dmtcp_verify_image")
+
+    os.environ['DMTCP_RESTART_IO'] = "mmap"
+    try:
+      rc = subprocess.call([BIN+"dmtcp_restart", "--quiet", image],
+                           stdout=devnullFd, stderr=devnullFd,
+                           timeout=TIMEOUT)
+    finally:
+      del os.environ['DMTCP_RESTART_IO']
+    CHECK(rc != 0, "corrupt image restarted")
+    WAITFOR(lambda: getStatus()==(0, False),
+            lambda: "corrupt image restarted")
+    print("PASSED")
+    stats[0]+=1
+  except (CheckFailed, subprocess.TimeoutExpired) as e:
+    print("FAILED")
+    printFixed("",15)
+    print("msg:", getattr(e, "value", e))
+    coordinatorCmd(b'k')
+  if proc != None:
+    try:
+      os.waitpid(proc.pid, os.WNOHANG)
+    except OSError:
+      pass
+  os.environ['DMTCP_GZIP'] = oldGzip
+  clearCkptDir()
+
 def saveResultsNMI():
   if DEBUG == "yes":
     # WARNING:  This can cause a several second delay on some systems.
@@ -718,6 +793,51 @@ if USE_MULTILIB:
 
 runTest("dmtcp1",        1, ["./test/dmtcp1"])
 
+# Multi-level checkpointing: the image is written to a second, "node-local",
+# directory and drained to ckptDir in the background.  testCheckpoint() waits
+# for the drained image; dmtcp_restart then prefers the local copy.
+localCkptDir = os.path.abspath(ckptDir + "-local")
+os.environ['DMTCP_LOCAL_CKPT_DIR'] = localCkptDir
+runTest("local-ckptdir", 1, ["./test/dmtcp1"])
+del os.environ['DMTCP_LOCAL_CKPT_DIR']
+if os.path.isdir(localCkptDir):
+  for f in os.listdir(localCkptDir):
+    os.remove(os.path.join(localCkptDir, f))
+  os.rmdir(localCkptDir)
+
+# Restart from the manifest that the coordinator writes with the restart
+# script.  The host is renamed to one that is not this one, so that
+# dmtcp_restart starts another dmtcp_restart for it through the remote shell,
+# which here only runs it locally.
+hostfile = os.path.abspath(ckptDir + "-hostfile")
+with open(hostfile, "w") as f:
+  f.write("fake-remote-host\n")
+RESTART_FROM_MANIFEST = ("--hostfile " + hostfile + " --remote-shell '/bin/sh "
+                         + os.path.abspath("test/fake-remote-shell.sh") + "'")
+runTest("restart-manifest", 1, ["./test/dmtcp1"])
+RESTART_FROM_MANIFEST = None
+os.remove(hostfile)
+
+# The ways mtcp_restart can restore a large anonymous area (see
+# setup_restore_io() in mtcp_restart.c).  Without DMTCP_GZIP=0, the image is
+# a pipe from gzip, and is always read with plain reads.
+oldGzip = os.environ['DMTCP_GZIP']
+os.environ['DMTCP_GZIP'] = "0"
+for mode in ["read", "direct", "mmap"]:
+  os.environ['DMTCP_RESTART_IO'] = mode
+  runTest("restart-io-" + mode, 1, ["./test/restart-io"])
+del os.environ['DMTCP_RESTART_IO']
+os.environ['DMTCP_GZIP'] = oldGzip
+
+runCorruptImageTest("corrupt-image")
+
+# In-process LZ compression of the memory areas (DMTCP_LZ=1), decompressed
+# by mtcp_restart.  restart-io has an area of many MTCP_LZ_BLOCK_SIZE blocks.
+os.environ['DMTCP_LZ'] = "1"
+runTest("lz-compression", 1, ["./test/dmtcp1"])
+runTest("lz-restart-io", 1, ["./test/restart-io"])
+del os.environ['DMTCP_LZ']
+
 runTest("dmtcp2",        1, ["./test/dmtcp2"])
 
 runTest("dmtcp3",        1, ["./test/dmtcp3"])
@@ -877,6 +997,9 @@ if not USE_M32:  # waitpid forks a 64-bit child process, /bin/sleep
 
 runTest("client-server", 2, ["./test/client-server"])
 
+# 4 processes, fully connected by 64 sockets per pair, half TCP, half UNIX.
+runTest("socket-mesh",   4, ["./test/socket-mesh 4 64"])
+
 # frisbee creates three processes, each with 14 MB, if no gzip is used
 os.environ['DMTCP_GZIP'] = "1"
 POST_LAUNCH_SLEEP=2
@@ -895,6 +1018,7 @@ S=DEFAULT_S
 
 runTest("sysv-shm1",     2, ["./test/sysv-shm1"])
 runTest("sysv-shm2",     2, ["./test/sysv-shm2"])
+runTest("sysv-shm3",     1, ["./test/sysv-shm3"])
 runTest("sysv-sem",      2, ["./test/sysv-sem"])
 runTest("sysv-msg",      2, ["./test/sysv-msg"])
 
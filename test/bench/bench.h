@@ -0,0 +1,34 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Common helpers for the micro-benchmarks in this directory.
+// Each benchmark prints one CSV line per configuration:
+//   benchmark,threads,iterations,ns_per_op
+
+static inline double
+bench_now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static inline long
+bench_arg(int argc, char *argv[], int idx, long dflt)
+{
+  return argc > idx ? atol(argv[idx]) : dflt;
+}
+
+static inline void
+bench_report(const char *name, long threads, long iters, double ns)
+{
+  printf("%s,%ld,%ld,%.1f\n", name, threads, iters, ns / iters);
+  fflush(stdout);
+}
+
+#endif // ifndef BENCH_H
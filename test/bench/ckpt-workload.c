@@ -0,0 +1,151 @@
+/* A synthetic application for measuring checkpoint and restart time.  It
+ * sets up the requested amount of state, prints "ready", and then idles
+ * until killed.  run-bench.py checkpoints and restarts it under DMTCP.
+ *
+ * Usage:  ckpt-workload [-r rss_mb] [-z zero_pct] [-t threads] [-f fds]
+ *                       [-s shm_mb]
+ *   -r:  private anonymous memory, in MB (default: 64)
+ *   -z:  percentage of that memory whose pages are left all-zero; the others
+ *        are filled with non-zero data (default: 50)
+ *   -t:  number of additional threads, all idle (default: 0)
+ *   -f:  number of open descriptors; half are files, half are
+ *        socketpairs (default: 0)
+ *   -s:  size of a SysV shared-memory segment, in MB (default: 0)
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/mman.h>
+#include <sys/shm.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define MB (1024 * 1024)
+
+static void *
+idle_thread(void *arg)
+{
+  while (1) {
+    sleep(1);
+  }
+  return NULL;
+}
+
+static void
+fill_memory(size_t rssMB, long zeroPct)
+{
+  size_t size = rssMB * MB;
+  long pageSize = sysconf(_SC_PAGESIZE);
+  size_t npages = size / pageSize;
+  size_t i;
+  char *mem;
+
+  if (size == 0) {
+    return;
+  }
+  mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+
+  // Interleave zero and non-zero pages, so that the zero-page detection in
+  // writeckpt.cpp sees the mix everywhere, rather than in one long run.
+  for (i = 0; i < npages; i++) {
+    char *page = mem + i * pageSize;
+    if ((long)(i % 100) < zeroPct) {
+      page[0] = 0;  // Touch it, but leave it all-zero.
+    } else {
+      memset(page, (int)(i % 255) + 1, pageSize);
+    }
+  }
+}
+
+static void
+open_fds(long nfds)
+{
+  long i;
+
+  for (i = 0; i < nfds; i += 2) {
+    int sv[2];
+    if (open("/dev/null", O_RDONLY) == -1) {
+      perror("open");
+      exit(1);
+    }
+    if (i + 1 < nfds && socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+      perror("socketpair");
+      exit(1);
+    }
+  }
+}
+
+static void
+create_shm(size_t shmMB)
+{
+  int shmid;
+  char *ptr;
+
+  if (shmMB == 0) {
+    return;
+  }
+  shmid = shmget(IPC_PRIVATE, shmMB * MB, IPC_CREAT | 0600);
+  if (shmid == -1) {
+    perror("shmget");
+    exit(1);
+  }
+  ptr = shmat(shmid, NULL, 0);
+  if (ptr == (void *)-1) {
+    perror("shmat");
+    exit(1);
+  }
+
+  // Remove it once the last process detaches.
+  shmctl(shmid, IPC_RMID, NULL);
+  memset(ptr, 1, shmMB * MB);
+}
+
+int
+main(int argc, char *argv[])
+{
+  long rssMB = 64, zeroPct = 50, nthreads = 0, nfds = 0, shmMB = 0;
+  long i;
+  int c;
+
+  while ((c = getopt(argc, argv, "r:z:t:f:s:")) != -1) {
+    switch (c) {
+    case 'r': rssMB = atol(optarg); break;
+    case 'z': zeroPct = atol(optarg); break;
+    case 't': nthreads = atol(optarg); break;
+    case 'f': nfds = atol(optarg); break;
+    case 's': shmMB = atol(optarg); break;
+    default:
+      fprintf(stderr, "Usage: %s [-r rss_mb] [-z zero_pct] [-t threads]"
+                      " [-f fds] [-s shm_mb]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  fill_memory(rssMB, zeroPct);
+  open_fds(nfds);
+  create_shm(shmMB);
+  for (i = 0; i < nthreads; i++) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, idle_thread, NULL) != 0) {
+      perror("pthread_create");
+      return 1;
+    }
+  }
+
+  printf("ready\n");
+  fflush(stdout);
+  while (1) {
+    sleep(1);
+  }
+  return 0;
+}
@@ -0,0 +1,252 @@
+/* Measures the coordinator's checkpoint barriers with many processes, as in a
+ * large MPI job.  N fake workers connect as new processes and take part in
+ * ROUNDS checkpoints ('dmtcp_command -bc'): each one suspends, goes through
+ * NUM_BARRIERS checkpoint barriers, reports a checkpoint image halfway, and
+ * resumes, without writing anything.  The time is per checkpoint, from the
+ * request until all workers are running again.
+ *
+ * The fake workers do not run under DMTCP; they speak the coordinator's
+ * protocol directly, each over its own TCP connection or, if sockets of
+ * dmtcp_aggregator are given, through them (worker i through socket i % K),
+ * as if spread over K nodes.  After the first barrier, each worker registers
+ * a name-service entry and queries it back on the same connection, as a
+ * process does at restart; a wrong or missing answer fails the run.
+ *
+ * Usage:  coord-barrier [max_workers] [rounds] [aggregator_socket ...]
+ * The coordinator is at DMTCP_COORD_HOST:DMTCP_COORD_PORT (default:
+ * localhost:7779).  Compare, e.g.:
+ *   dmtcp_coordinator --daemon -p 7779
+ *   ./coord-barrier 256
+ *   for i in 1 2 3 4; do
+ *     dmtcp_aggregator -p 7779 --socket /tmp/agg$i --daemon; done
+ *   ./coord-barrier 256 100 /tmp/agg1 /tmp/agg2 /tmp/agg3 /tmp/agg4
+ */
+
+#include <sys/wait.h>
+#include "bench.h"
+#include "fake-worker.h"
+
+using namespace dmtcp;
+
+#define NSID "barrier"
+
+// The image is reported after the first half of the barriers, as a process
+// does after writing it; the rest are the barriers of the resume.
+#define NUM_BARRIERS 8
+
+static const char barrierList[] = "b0,b1,b2,b3,b4,b5,b6,b7;r0";
+static const char ckptInfo[] = "/dev/null\0\0localhost\0\0";
+
+static void
+send_message(int fd, DmtcpMessage *msg, DmtcpMessageType type,
+             WorkerState::eWorkerState state, const void *extraData,
+             size_t extraBytes)
+{
+  msg->type = type;
+  msg->state = state;
+  msg->extraBytes = extraBytes;
+  write_all(fd, msg, sizeof(DmtcpMessage));
+  if (extraBytes > 0) {
+    write_all(fd, extraData, extraBytes);
+  }
+}
+
+// Registers the key 'me' with the value 'round' and queries it back over
+// fd, while not running; exits if the answer is not the one registered.
+static void
+check_name_service(int fd, DmtcpMessage *msg, long me, long round)
+{
+  DmtcpMessage *reply = new_message(DMT_NULL, NSID);
+  long data[2] = { me, round };
+  long val = -1;
+
+  msg->keyLen = sizeof(me);
+  msg->valLen = sizeof(round);
+  send_message(fd, msg, DMT_REGISTER_NAME_SERVICE_DATA,
+               WorkerState::CHECKPOINTING, data, sizeof(data));
+
+  msg->valLen = sizeof(val);
+  send_message(fd, msg, DMT_NAME_SERVICE_QUERY, WorkerState::CHECKPOINTING,
+               &me, sizeof(me));
+  msg->keyLen = 0;
+  msg->valLen = 0;
+
+  read_all(fd, reply, sizeof(DmtcpMessage));
+  if (reply->type != DMT_NAME_SERVICE_QUERY_RESPONSE ||
+      reply->extraBytes != sizeof(val)) {
+    fprintf(stderr, "coord-barrier: bad name-service reply (type %d)\n",
+            (int)reply->type);
+    exit(1);
+  }
+  read_all(fd, &val, sizeof(val));
+  if (val != round) {
+    fprintf(stderr, "coord-barrier: name service returned %ld, not %ld\n",
+            val, round);
+    exit(1);
+  }
+  free(reply);
+}
+
+// Runs the checkpoints until killed; writes a byte to doneFd after each.
+static void
+worker(long me, const char *aggregator, int readyFd, int doneFd)
+{
+  DmtcpMessage *msg = new_message(DMT_NULL, NSID);
+  DmtcpMessage *reply = new_message(DMT_NULL, NSID);
+  char extraData[256];
+  int numReleased = 0;
+  long round = 0;
+
+  msg->from = UniquePid(gethostid(), getpid(), time(NULL));
+  int fd = aggregator ? connect_to_aggregator(aggregator)
+                      : connect_to_coordinator();
+  connect_worker(fd, msg, reply, "coord-barrier");
+  if (me == 0) {
+    send_message(fd, msg, DMT_BARRIER_LIST, WorkerState::RUNNING,
+                 barrierList, sizeof(barrierList));
+  }
+  write_all(readyFd, "r", 1);
+
+  while (1) {
+    read_all(fd, reply, sizeof(DmtcpMessage));
+    if (reply->extraBytes > sizeof(extraData)) {
+      fprintf(stderr, "coord-barrier: message too long (type %d)\n",
+              (int)reply->type);
+      exit(1);
+    }
+    read_all(fd, extraData, reply->extraBytes);
+
+    switch (reply->type) {
+    case DMT_DO_SUSPEND:
+      numReleased = 0;
+      send_message(fd, msg, DMT_OK, WorkerState::SUSPENDED, NULL, 0);
+      break;
+
+    case DMT_COMPUTATION_INFO:
+      send_message(fd, msg, DMT_OK, WorkerState::CHECKPOINTING, NULL, 0);
+      break;
+
+    case DMT_BARRIER_RELEASED:
+      numReleased++;
+      if (numReleased == 1) {
+        check_name_service(fd, msg, me, round++);
+      }
+      if (numReleased == NUM_BARRIERS / 2) {
+        send_message(fd, msg, DMT_CKPT_FILENAME, WorkerState::CHECKPOINTED,
+                     ckptInfo, sizeof(ckptInfo));
+      }
+      if (numReleased < NUM_BARRIERS) {
+        send_message(fd, msg, DMT_OK,
+                     numReleased < NUM_BARRIERS / 2
+                       ? WorkerState::CHECKPOINTING
+                       : WorkerState::CHECKPOINTED, NULL, 0);
+      } else {
+        send_message(fd, msg, DMT_OK, WorkerState::RUNNING, NULL, 0);
+        write_all(doneFd, "d", 1);
+      }
+      break;
+
+    case DMT_KILL_PEER:
+      exit(0);
+
+    default:
+      break;
+    }
+  }
+}
+
+// Waits until the coordinator has nworkers processes, all running.
+static void
+wait_running(long nworkers)
+{
+  DmtcpMessage *reply = new_message(DMT_NULL, NSID);
+
+  while (1) {
+    user_command('s', reply);
+    if (reply->numPeers == (uint32_t)nworkers &&
+        (nworkers == 0 || reply->isRunning)) {
+      break;
+    }
+    usleep(1000);
+  }
+  free(reply);
+}
+
+int
+main(int argc, char *argv[])
+{
+  long maxWorkers = bench_arg(argc, argv, 1, 256);
+  long rounds = bench_arg(argc, argv, 2, 100);
+  char **aggregators = argc > 3 ? &argv[3] : NULL;
+  long numAggregators = argc > 3 ? argc - 3 : 0;
+  DmtcpMessage *reply = new_message(DMT_NULL, NSID);
+  long nworkers;
+
+  for (nworkers = 1; nworkers <= maxWorkers; nworkers *= 2) {
+    int readyPipe[2];
+    int donePipe[2];
+    double start;
+    long i;
+    long r;
+    int failed = 0;
+
+    if (pipe(readyPipe) == -1 || pipe(donePipe) == -1) {
+      die("pipe");
+    }
+    for (i = 0; i < nworkers; i++) {
+      pid_t pid = fork();
+      if (pid == 0) {
+        close(readyPipe[0]);
+        close(donePipe[0]);
+        worker(i, aggregators ? aggregators[i % numAggregators] : NULL,
+               readyPipe[1], donePipe[1]);
+      } else if (pid == -1) {
+        die("fork");
+      }
+    }
+    close(readyPipe[1]);
+    close(donePipe[1]);
+
+    for (i = 0; i < nworkers; i++) {
+      char c;
+      read_all(readyPipe[0], &c, 1);
+    }
+    wait_running(nworkers);
+
+    start = bench_now_ns();
+    for (r = 0; r < rounds; r++) {
+      // The reply to 'c' comes once all images are reported.
+      user_command('b', reply);
+      user_command('c', reply);
+      if (reply->coordCmdStatus != CoordCmdStatus::NOERROR) {
+        fprintf(stderr, "coord-barrier: checkpoint failed (status %d)\n",
+                (int)reply->coordCmdStatus);
+        return 1;
+      }
+      for (i = 0; i < nworkers; i++) {
+        char c;
+        read_all(donePipe[0], &c, 1);
+      }
+      wait_running(nworkers);
+    }
+    bench_report("coord-barrier", nworkers, rounds, bench_now_ns() - start);
+
+    user_command('k', reply);
+    for (i = 0; i < nworkers; i++) {
+      int status;
+      if (wait(&status) == -1) {
+        die("wait");
+      }
+      failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    }
+    if (failed) {
+      fprintf(stderr, "coord-barrier: a worker failed\n");
+      return 1;
+    }
+    wait_running(0);
+
+    close(readyPipe[0]);
+    close(donePipe[0]);
+  }
+  return 0;
+}
@@ -0,0 +1,156 @@
+/* Floods the coordinator with name-service traffic from many processes, as
+ * the ranks of an MPI job do at restart.  Each of N fake workers connects as
+ * a new process and opens a name-service connection, as a process under
+ * DMTCP does, registers one key and value, and waits until all of them have;
+ * then, all at once, each one queries the keys of the others and checks the
+ * values.  A rejected connection, or a wrong or missing value, makes it exit
+ * with an error.
+ *
+ * The fake workers do not run under DMTCP; they speak the coordinator's
+ * protocol directly.  The time is per query, over all workers.
+ *
+ * Usage:  coord-flood [max_workers] [queries_per_worker]
+ * The coordinator is at DMTCP_COORD_HOST:DMTCP_COORD_PORT (default:
+ * localhost:7779).  Compare, e.g.:
+ *   dmtcp_coordinator --daemon -p 7779 --io-threads 1   (or 8)
+ *   ./coord-flood 256
+ */
+
+#include <sys/wait.h>
+#include "bench.h"
+#include "fake-worker.h"
+
+using namespace dmtcp;
+
+#define NSID "flood"
+
+struct FloodKey {
+  long round;
+  long worker;
+};
+
+static void
+worker(long round, long me, long nworkers, long queries, int readyFd,
+       int goFd)
+{
+  DmtcpMessage *msg = new_message(DMT_NAME_SERVICE_WORKER, NSID);
+  DmtcpMessage *reply = new_message(DMT_NULL, NSID);
+  FloodKey key = { round, me };
+  long val = me * 7 + 1;
+  char go;
+  long i;
+
+  msg->from = UniquePid(gethostid(), getpid(), time(NULL));
+  int dataFd = connect_to_coordinator();
+  connect_worker(dataFd, msg, reply, "coord-flood");
+  int fd = connect_to_coordinator();
+  msg->type = DMT_NAME_SERVICE_WORKER;
+  write_all(fd, msg, sizeof(DmtcpMessage));
+
+  msg->type = DMT_REGISTER_NAME_SERVICE_DATA;
+  msg->keyLen = sizeof(key);
+  msg->valLen = sizeof(val);
+  msg->extraBytes = sizeof(key) + sizeof(val);
+  write_all(fd, msg, sizeof(DmtcpMessage));
+  write_all(fd, &key, sizeof(key));
+  write_all(fd, &val, sizeof(val));
+
+  // Registration has no reply; a query on the same connection is answered
+  // only after it.
+  msg->type = DMT_NAME_SERVICE_QUERY;
+  msg->keyLen = sizeof(key);
+  msg->valLen = 0;
+  msg->extraBytes = sizeof(key);
+  write_all(fd, msg, sizeof(DmtcpMessage));
+  write_all(fd, &key, sizeof(key));
+  read_all(fd, reply, sizeof(DmtcpMessage));
+  read_all(fd, &val, reply->extraBytes);
+
+  // All workers start when the parent closes the pipe.
+  write_all(readyFd, "r", 1);
+  if (read(goFd, &go, 1) != 0) {
+    die("read");
+  }
+
+  for (i = 0; i < queries; i++) {
+    long peer = (me + 1 + i) % nworkers;
+
+    key.worker = peer;
+    write_all(fd, msg, sizeof(DmtcpMessage));
+    write_all(fd, &key, sizeof(key));
+    read_all(fd, reply, sizeof(DmtcpMessage));
+    if (reply->type != DMT_NAME_SERVICE_QUERY_RESPONSE ||
+        reply->extraBytes != sizeof(val)) {
+      fprintf(stderr, "coord-flood: worker %ld: no value for worker %ld"
+                      " (type %d, %u bytes)\n",
+              me, peer, (int)reply->type, reply->extraBytes);
+      exit(1);
+    }
+    read_all(fd, &val, sizeof(val));
+    if (val != peer * 7 + 1) {
+      fprintf(stderr, "coord-flood: worker %ld: wrong value for worker %ld:"
+                      " %ld\n", me, peer, val);
+      exit(1);
+    }
+  }
+  close(fd);
+  close(dataFd);
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  long maxWorkers = bench_arg(argc, argv, 1, 256);
+  long queries = bench_arg(argc, argv, 2, 1000);
+  long nworkers;
+  long round = getpid();
+
+  for (nworkers = 1; nworkers <= maxWorkers; nworkers *= 2, round++) {
+    int readyPipe[2];
+    int goPipe[2];
+    double start;
+    long i;
+    int failed = 0;
+
+    if (pipe(readyPipe) == -1 || pipe(goPipe) == -1) {
+      die("pipe");
+    }
+    for (i = 0; i < nworkers; i++) {
+      pid_t pid = fork();
+      if (pid == 0) {
+        close(readyPipe[0]);
+        close(goPipe[1]);
+        worker(round, i, nworkers, queries, readyPipe[1], goPipe[0]);
+      } else if (pid == -1) {
+        die("fork");
+      }
+    }
+    close(readyPipe[1]);
+    close(goPipe[0]);
+
+    for (i = 0; i < nworkers; i++) {
+      char c;
+      read_all(readyPipe[0], &c, 1);
+    }
+
+    start = bench_now_ns();
+    close(goPipe[1]);
+    for (i = 0; i < nworkers; i++) {
+      int status;
+      if (wait(&status) == -1) {
+        die("wait");
+      }
+      failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    }
+    if (failed) {
+      fprintf(stderr, "coord-flood: a worker failed\n");
+      return 1;
+    }
+    bench_report("coord-flood", nworkers, nworkers * queries,
+                 bench_now_ns() - start);
+
+    close(readyPipe[0]);
+  }
+  return 0;
+}
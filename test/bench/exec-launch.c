@@ -0,0 +1,49 @@
+/* Measures the time to start a program: fork() and exec() of a child that
+ * exits at once from main().  Under DMTCP, each child loads libdmtcp.so and
+ * the plugins again, resolves all of their wrappers with dmtcp_dlsym(),
+ * and registers with the coordinator before main() runs.
+ *
+ * Usage:  exec-launch [execs]
+ * Compare:  ./exec-launch  vs.  dmtcp_launch ./exec-launch
+ */
+
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "bench.h"
+
+int
+main(int argc, char *argv[])
+{
+  long execs;
+  double start;
+  long i;
+
+  if (argc > 1 && strcmp(argv[1], "--child") == 0) {
+    return 0;
+  }
+
+  execs = bench_arg(argc, argv, 1, 200);
+  start = bench_now_ns();
+  for (i = 0; i < execs; i++) {
+    int status;
+    pid_t pid = fork();
+
+    if (pid == 0) {
+      execl("/proc/self/exe", argv[0], "--child", (char *)NULL);
+      perror("execl");
+      _exit(1);
+    } else if (pid == -1) {
+      perror("fork");
+      exit(1);
+    }
+    if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "exec-launch: child failed\n");
+      exit(1);
+    }
+  }
+  bench_report("exec-launch", 1, execs, bench_now_ns() - start);
+  return 0;
+}
@@ -0,0 +1,154 @@
+#ifndef FAKE_WORKER_H
+#define FAKE_WORKER_H
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "dmtcpmessagetypes.h"
+
+// Helpers for the benchmarks that speak the coordinator's protocol directly,
+// as fake workers that do not run under DMTCP.  The coordinator is at
+// DMTCP_COORD_HOST:DMTCP_COORD_PORT (default: localhost:7779).
+
+static inline void
+die(const char *msg)
+{
+  perror(msg);
+  exit(1);
+}
+
+static inline void
+write_all(int fd, const void *buf, size_t len)
+{
+  const char *p = (const char *)buf;
+
+  while (len > 0) {
+    ssize_t ret = write(fd, p, len);
+    if (ret <= 0) {
+      die("write");
+    }
+    p += ret;
+    len -= ret;
+  }
+}
+
+static inline void
+read_all(int fd, void *buf, size_t len)
+{
+  char *p = (char *)buf;
+
+  while (len > 0) {
+    ssize_t ret = read(fd, p, len);
+    if (ret <= 0) {
+      die("read");
+    }
+    p += ret;
+    len -= ret;
+  }
+}
+
+// DmtcpMessage's constructor is in libdmtcpinternal; build the header here.
+static inline dmtcp::DmtcpMessage *
+new_message(dmtcp::DmtcpMessageType type, const char *nsid)
+{
+  dmtcp::DmtcpMessage *msg =
+    (dmtcp::DmtcpMessage *)calloc(1, sizeof(dmtcp::DmtcpMessage));
+
+  strncpy(msg->_magicBits, DMTCP_MAGIC_STRING, sizeof(msg->_magicBits));
+  msg->_msgSize = sizeof(dmtcp::DmtcpMessage);
+  msg->type = type;
+  msg->virtualPid = -1;
+  msg->realPid = getpid();
+  msg->theCheckpointInterval = DMTCPMESSAGE_SAME_CKPT_INTERVAL;
+  snprintf(msg->nsid, sizeof(msg->nsid), "%s", nsid);
+  return msg;
+}
+
+static inline int
+connect_to_coordinator()
+{
+  const char *host = getenv("DMTCP_COORD_HOST");
+  const char *port = getenv("DMTCP_COORD_PORT");
+  struct addrinfo hints;
+  struct addrinfo *res;
+  int one = 1;
+  int fd;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host ? host : "localhost", port ? port : "7779",
+                  &hints, &res) != 0) {
+    fprintf(stderr, "cannot resolve the coordinator\n");
+    exit(1);
+  }
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd == -1 || connect(fd, res->ai_addr, res->ai_addrlen) == -1) {
+    die("connect");
+  }
+  freeaddrinfo(res);
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+// A connection to a dmtcp_aggregator, as a process does if
+// DMTCP_AGGREGATOR_SOCKET is set.
+static inline int
+connect_to_aggregator(const char *path)
+{
+  struct sockaddr_un addr;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+  if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    die("connect");
+  }
+  return fd;
+}
+
+// The handshake of a new process on the connection fd.
+static inline void
+connect_worker(int fd, dmtcp::DmtcpMessage *msg, dmtcp::DmtcpMessage *reply,
+               const char *progname)
+{
+  char processInfo[256];
+  size_t len = snprintf(processInfo, sizeof(processInfo), "localhost%c%s",
+                        '\0', progname) + 1;
+
+  msg->type = dmtcp::DMT_NEW_WORKER;
+  msg->state = dmtcp::WorkerState::RUNNING;
+  msg->extraBytes = len;
+  write_all(fd, msg, sizeof(dmtcp::DmtcpMessage));
+  write_all(fd, processInfo, len);
+  read_all(fd, reply, sizeof(dmtcp::DmtcpMessage));
+  if (reply->type != dmtcp::DMT_ACCEPT) {
+    fprintf(stderr, "%s: connection rejected (type %d)\n", progname,
+            (int)reply->type);
+    exit(1);
+  }
+  msg->extraBytes = 0;
+}
+
+// A command of dmtcp_command ('s', 'c', 'k', ...); its result goes to reply.
+static inline void
+user_command(char cmd, dmtcp::DmtcpMessage *reply)
+{
+  dmtcp::DmtcpMessage *msg = new_message(dmtcp::DMT_USER_CMD, "");
+  int fd = connect_to_coordinator();
+
+  msg->coordCmd = cmd;
+  write_all(fd, msg, sizeof(dmtcp::DmtcpMessage));
+  read_all(fd, reply, sizeof(dmtcp::DmtcpMessage));
+  close(fd);
+  free(msg);
+}
+
+#endif // ifndef FAKE_WORKER_H
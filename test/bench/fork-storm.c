@@ -0,0 +1,56 @@
+/* Measures the rate of fork() and exit, as in a process pool, 'make -j' or
+ * a shell pipeline: up to N children that exit at once are kept running,
+ * and a new one is forked as soon as one is reaped.  Under DMTCP, each
+ * child also registers with the coordinator.
+ *
+ * Usage:  fork-storm [max_parallel] [forks]
+ * Compare:  ./fork-storm  vs.  dmtcp_launch ./fork-storm
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "bench.h"
+
+int
+main(int argc, char *argv[])
+{
+  long maxParallel = bench_arg(argc, argv, 1, 16);
+  long forks = bench_arg(argc, argv, 2, 2000);
+  long parallel;
+
+  for (parallel = 1; parallel <= maxParallel; parallel *= 2) {
+    double start = bench_now_ns();
+    long running = 0;
+    long i;
+
+    for (i = 0; i < forks; i++) {
+      pid_t pid;
+
+      if (running == parallel) {
+        if (wait(NULL) == -1) {
+          perror("wait");
+          exit(1);
+        }
+        running--;
+      }
+      pid = fork();
+      if (pid == 0) {
+        _exit(0);
+      } else if (pid == -1) {
+        perror("fork");
+        exit(1);
+      }
+      running++;
+    }
+    while (running > 0) {
+      if (wait(NULL) == -1) {
+        perror("wait");
+        exit(1);
+      }
+      running--;
+    }
+    bench_report("fork-storm", parallel, forks, bench_now_ns() - start);
+  }
+  return 0;
+}
@@ -0,0 +1,36 @@
+/* Measures the cost of fork() followed by waitpid() for a child that exits
+ * immediately.  Under DMTCP, each fork also connects the child to the
+ * coordinator and assigns it a virtual pid.
+ *
+ * Usage:  fork [iterations]
+ * Compare:  ./fork  vs.  dmtcp_launch ./fork
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "bench.h"
+
+int
+main(int argc, char *argv[])
+{
+  long iterations = bench_arg(argc, argv, 1, 200);
+  double start = bench_now_ns();
+  long i;
+
+  for (i = 0; i < iterations; i++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      _exit(0);
+    } else if (pid == -1) {
+      perror("fork");
+      exit(1);
+    }
+    if (waitpid(pid, NULL, 0) != pid) {
+      perror("waitpid");
+      exit(1);
+    }
+  }
+  bench_report("fork", 1, iterations, bench_now_ns() - start);
+  return 0;
+}
@@ -0,0 +1,103 @@
+/* Measures JAllocDispatcher, the allocator that DMTCP uses for its own data
+ * structures, under contention.  Each thread repeatedly allocates a small
+ * batch of chunks of a fixed size and frees them again, as the wrappers do
+ * for their temporary strings and buffers.
+ *
+ * The allocator is compiled in directly from ../../jalib/jalloc.cpp, so this
+ * benchmark runs natively; rebuild it on another tree to compare.
+ *
+ * Usage:  jalloc-threads [max_threads] [iterations_per_thread]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "bench.h"
+#include "jalloc.h"
+#include "jalib.h"
+
+#define BATCH 8
+
+// The allocator only needs these from the rest of jalib.
+void *
+jalib::mmap(void *addr, size_t length, int prot, int flags, int fd,
+            off_t offset)
+{
+  return ::mmap(addr, length, prot, flags, fd, offset);
+}
+
+int
+jalib::munmap(void *addr, size_t length)
+{
+  return ::munmap(addr, length);
+}
+
+ssize_t
+jalib::write(int fd, const void *buf, size_t count)
+{
+  return ::write(fd, buf, count);
+}
+
+static long iterations;
+static size_t chunkSize;
+static pthread_barrier_t barrier;
+
+static void *
+worker(void *arg)
+{
+  void *items[BATCH];
+  long i;
+  int j;
+
+  pthread_barrier_wait(&barrier);
+  for (i = 0; i < iterations; i += BATCH) {
+    for (j = 0; j < BATCH; j++) {
+      items[j] = jalib::JAllocDispatcher::allocate(chunkSize);
+      *(char *)items[j] = j;
+    }
+    for (j = 0; j < BATCH; j++) {
+      jalib::JAllocDispatcher::deallocate(items[j], chunkSize);
+    }
+  }
+  return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+  static const size_t sizes[] = { 48, 200, 1000, 3000, 12000, 60000 };
+  long maxThreads = bench_arg(argc, argv, 1, 16);
+  long nthreads;
+  size_t s;
+
+  iterations = bench_arg(argc, argv, 2, 1000000);
+
+  for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    char name[64];
+
+    chunkSize = sizes[s];
+    snprintf(name, sizeof(name), "jalloc-%zu", chunkSize);
+    for (nthreads = 1; nthreads <= maxThreads; nthreads *= 2) {
+      pthread_t *threads = new pthread_t[nthreads];
+      double start;
+      long i;
+
+      pthread_barrier_init(&barrier, NULL, nthreads + 1);
+      for (i = 0; i < nthreads; i++) {
+        pthread_create(&threads[i], NULL, worker, NULL);
+      }
+      start = bench_now_ns();
+      pthread_barrier_wait(&barrier);
+      for (i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+      }
+
+      // Wall time per allocate/deallocate pair, as seen by a single thread.
+      bench_report(name, nthreads, iterations, bench_now_ns() - start);
+      pthread_barrier_destroy(&barrier);
+      delete[] threads;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,72 @@
+/* Measures the cost that the alloc plugin adds to malloc() and free() in an
+ * allocation-heavy program.  Each thread keeps a small window of live
+ * objects of 16 to 512 bytes and replaces one of them on every iteration.
+ *
+ * Usage:  malloc-storm [max_threads] [iterations_per_thread]
+ * Compare:  ./malloc-storm  vs.  dmtcp_launch ./malloc-storm
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+
+#define WINDOW 64
+
+static long iterations;
+static pthread_barrier_t barrier;
+
+static void *
+worker(void *arg)
+{
+  void *live[WINDOW];
+  unsigned int seed = (unsigned int)(long)arg;
+  long i;
+
+  memset(live, 0, sizeof(live));
+  pthread_barrier_wait(&barrier);
+  for (i = 0; i < iterations; i++) {
+    int slot = i % WINDOW;
+    size_t size = 16 + rand_r(&seed) % 497;
+
+    free(live[slot]);
+    live[slot] = malloc(size);
+    *(char *)live[slot] = (char)i;
+  }
+  for (i = 0; i < WINDOW; i++) {
+    free(live[i]);
+  }
+  return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+  long maxThreads = bench_arg(argc, argv, 1, 16);
+  long nthreads;
+
+  iterations = bench_arg(argc, argv, 2, 1000000);
+
+  for (nthreads = 1; nthreads <= maxThreads; nthreads *= 2) {
+    pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+    double start;
+    long i;
+
+    pthread_barrier_init(&barrier, NULL, nthreads + 1);
+    for (i = 0; i < nthreads; i++) {
+      pthread_create(&threads[i], NULL, worker, (void *)(i + 1));
+    }
+    start = bench_now_ns();
+    pthread_barrier_wait(&barrier);
+    for (i = 0; i < nthreads; i++) {
+      pthread_join(threads[i], NULL);
+    }
+
+    // Wall time per malloc/free pair, as seen by a single thread.
+    bench_report("malloc-storm", nthreads, iterations,
+                 bench_now_ns() - start);
+    pthread_barrier_destroy(&barrier);
+    free(threads);
+  }
+  return 0;
+}
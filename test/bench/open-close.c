@@ -0,0 +1,63 @@
+/* Measures the cost of open("/dev/null") followed by close() from many
+ * threads at once.  Both calls go through the file plugin's wrappers, which
+ * record and then forget the new file descriptor.
+ *
+ * Usage:  open-close [max_threads] [iterations_per_thread]
+ * Compare:  ./open-close  vs.  dmtcp_launch ./open-close
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "bench.h"
+
+static long iterations;
+static pthread_barrier_t barrier;
+
+static void *
+worker(void *arg)
+{
+  long i;
+
+  pthread_barrier_wait(&barrier);
+  for (i = 0; i < iterations; i++) {
+    int fd = open("/dev/null", O_RDONLY);
+    if (fd == -1) {
+      perror("open");
+      exit(1);
+    }
+    close(fd);
+  }
+  return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+  long maxThreads = bench_arg(argc, argv, 1, 16);
+  long nthreads;
+
+  iterations = bench_arg(argc, argv, 2, 100000);
+
+  for (nthreads = 1; nthreads <= maxThreads; nthreads *= 2) {
+    pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+    double start;
+    long i;
+
+    pthread_barrier_init(&barrier, NULL, nthreads + 1);
+    for (i = 0; i < nthreads; i++) {
+      pthread_create(&threads[i], NULL, worker, NULL);
+    }
+    start = bench_now_ns();
+    pthread_barrier_wait(&barrier);
+    for (i = 0; i < nthreads; i++) {
+      pthread_join(threads[i], NULL);
+    }
+
+    // Wall time per open/close pair, as seen by a single thread.
+    bench_report("open-close", nthreads, iterations, bench_now_ns() - start);
+    pthread_barrier_destroy(&barrier);
+    free(threads);
+  }
+  return 0;
+}
@@ -0,0 +1,149 @@
+/* Measures stat() and open()/close() of a file, from many threads at once,
+ * with and without a path prefix that the pathvirt plugin translates.
+ *
+ * pathvirt translates paths only after a restart, or after an exec once
+ * both DMTCP_ORIGINAL_PATH_PREFIX and DMTCP_NEW_PATH_PREFIX are set.  So,
+ * this program creates <tmpdir>/virt/file and <tmpdir>/phys/file, sets
+ * DMTCP_ORIGINAL_PATH_PREFIX=<tmpdir>/virt and
+ * DMTCP_NEW_PATH_PREFIX=<tmpdir>/phys, and re-executes itself.  Natively,
+ * <tmpdir>/virt/file is used as is.
+ *
+ *   stat-hit:  stat("<tmpdir>/virt/file"), a path that is translated.
+ *   stat-miss: stat("<tmpdir>/phys/file"), a path under no prefix.
+ *   open-hit:  open("<tmpdir>/virt/file") and close().
+ *
+ * Usage:  path-stat [max_threads] [iterations_per_thread]
+ * Compare:  ./path-stat  vs.
+ *   dmtcp_launch --with-plugin $DMTCP_ROOT/lib/dmtcp/libdmtcp_pathvirt.so \
+ *     ./path-stat
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bench.h"
+
+#define ENV_ORIG_DPP "DMTCP_ORIGINAL_PATH_PREFIX"
+#define ENV_NEW_DPP  "DMTCP_NEW_PATH_PREFIX"
+
+enum Op { STAT_HIT, STAT_MISS, OPEN_HIT };
+
+static long iterations;
+static enum Op op;
+static char virtFile[PATH_MAX];
+static char physFile[PATH_MAX];
+static pthread_barrier_t barrier;
+
+static void
+create_file(const char *dir, char *file)
+{
+  int fd;
+
+  mkdir(dir, 0700);
+  snprintf(file, PATH_MAX, "%s/file", dir);
+  fd = open(file, O_CREAT | O_WRONLY, 0600);
+  if (fd == -1) {
+    perror("open");
+    exit(1);
+  }
+  close(fd);
+}
+
+static void *
+worker(void *arg)
+{
+  struct stat st;
+  long i;
+
+  pthread_barrier_wait(&barrier);
+  for (i = 0; i < iterations; i++) {
+    if (op == STAT_HIT) {
+      stat(virtFile, &st);
+    } else if (op == STAT_MISS) {
+      stat(physFile, &st);
+    } else {
+      int fd = open(virtFile, O_RDONLY);
+      if (fd == -1) {
+        perror("open");
+        exit(1);
+      }
+      close(fd);
+    }
+  }
+  return NULL;
+}
+
+static void
+run(const char *name, enum Op thisOp, long maxThreads)
+{
+  long nthreads;
+
+  op = thisOp;
+  for (nthreads = 1; nthreads <= maxThreads; nthreads *= 2) {
+    pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+    double start;
+    long i;
+
+    pthread_barrier_init(&barrier, NULL, nthreads + 1);
+    for (i = 0; i < nthreads; i++) {
+      pthread_create(&threads[i], NULL, worker, NULL);
+    }
+    start = bench_now_ns();
+    pthread_barrier_wait(&barrier);
+    for (i = 0; i < nthreads; i++) {
+      pthread_join(threads[i], NULL);
+    }
+
+    bench_report(name, nthreads, iterations, bench_now_ns() - start);
+    pthread_barrier_destroy(&barrier);
+    free(threads);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  long maxThreads = bench_arg(argc, argv, 1, 16);
+  char dir[PATH_MAX - 16];
+  char virtDir[PATH_MAX];
+  char physDir[PATH_MAX];
+  const char *tmpdir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+
+  iterations = bench_arg(argc, argv, 2, 200000);
+
+  if (getenv(ENV_NEW_DPP) == NULL) {
+    snprintf(dir, sizeof(dir), "%s/path-stat.XXXXXX", tmpdir);
+    if (mkdtemp(dir) == NULL) {
+      perror("mkdtemp");
+      return 1;
+    }
+    snprintf(virtDir, sizeof(virtDir), "%s/virt", dir);
+    snprintf(physDir, sizeof(physDir), "%s/phys", dir);
+    setenv(ENV_ORIG_DPP, virtDir, 1);
+    setenv(ENV_NEW_DPP, physDir, 1);
+    execv("/proc/self/exe", argv);
+    perror("execv");
+    return 1;
+  }
+
+  snprintf(virtDir, sizeof(virtDir), "%s", getenv(ENV_ORIG_DPP));
+  snprintf(physDir, sizeof(physDir), "%s", getenv(ENV_NEW_DPP));
+  create_file(virtDir, virtFile);
+  create_file(physDir, physFile);
+
+  run("stat-hit", STAT_HIT, maxThreads);
+  run("stat-miss", STAT_MISS, maxThreads);
+  run("open-hit", OPEN_HIT, maxThreads);
+
+  unlink(virtFile);
+  unlink(physFile);
+  rmdir(virtDir);
+  rmdir(physDir);
+  *strrchr(virtDir, '/') = '\0';
+  rmdir(virtDir);
+  return 0;
+}
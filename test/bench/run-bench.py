@@ -0,0 +1,342 @@
+#!/usr/bin/env python
+#
+# Runs the DMTCP benchmark suite and writes one CSV with all results:
+#   benchmark,mode,parameters,metric,value
+#
+#  - The wrapper micro-benchmarks (malloc, pthread_mutex_lock, open/close,
+#    fork, exec, ...) run natively and under dmtcp_launch; metric ns_per_op.
+#  - coord-flood floods a coordinator, run with each of COORD_IO_THREADS
+#    (--io-threads), with name-service queries; metric ns_per_op.
+#  - coord-barrier runs checkpoints of many fake workers, connected directly
+#    and through each of COORD_AGGREGATORS dmtcp_aggregators; metric
+#    ns_per_op, per checkpoint.
+#  - ckpt-workload is checkpointed and restarted while sweeping, one at a
+#    time, its RSS, zero-page percentage, thread count, fd count and SysV shm
+#    size; metrics ckpt_s, restart_s, bytes_written and zero_bytes_skipped.
+#
+# 'parameters' is a ';'-separated list of key=value pairs.  Rows are always
+# emitted in the same order, so two runs can be compared with diff or joined
+# on the first four columns.
+#
+# Usage:  run-bench.py [--quick] [--out FILE] [--no-micro] [--no-coord]
+#                      [--no-ckpt]
+#                      [--rss LIST] [--zero-pct LIST] [--threads LIST]
+#                      [--fds LIST] [--shm-mb LIST] [--repeat N]
+
+from __future__ import print_function
+
+import glob
+import optparse
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+DMTCP_ROOT = os.path.abspath(os.environ.get('DMTCP_ROOT',
+                                            os.path.join(BENCH_DIR, '..', '..')))
+BIN = os.path.join(DMTCP_ROOT, 'bin')
+
+# Benchmark name -> arguments (max_threads, iterations).
+MICRO_BENCHMARKS = [
+  ('malloc-storm', ['16', '1000000']),
+  ('mutex-lock', ['16', '1000000']),
+  ('open-close', ['16', '100000']),
+  ('path-stat', ['16', '200000']),
+  ('wrapper-lock', ['16', '1000000']),
+  ('fork', ['200']),
+  ('fork-storm', ['16', '2000']),
+  ('exec-launch', ['200']),
+  ('thread-churn', ['1024', '5000']),
+]
+
+# Arguments (max_workers, queries_per_worker) of coord-flood, and the
+# numbers of coordinator I/O threads to compare.
+COORD_FLOOD_ARGS = ['256', '1000']
+COORD_IO_THREADS = [1, 4, 16]
+
+# Arguments (max_workers, rounds) of coord-barrier, and the numbers of
+# dmtcp_aggregators to compare; 0 is a direct connection to the coordinator.
+COORD_BARRIER_ARGS = ['256', '20']
+COORD_AGGREGATORS = [0, 4, 16]
+
+# Plugins that a micro-benchmark needs under dmtcp_launch.
+BENCHMARK_PLUGINS = {
+  'path-stat': ['libdmtcp_pathvirt.so'],
+}
+
+# The sweeps vary one parameter of this configuration at a time.
+BASE_CONFIG = [('rss_mb', 64), ('zero_pct', 50), ('threads', 0),
+               ('fds', 0), ('shm_mb', 0)]
+WORKLOAD_FLAGS = {'rss_mb': '-r', 'zero_pct': '-z', 'threads': '-t',
+                  'fds': '-f', 'shm_mb': '-s'}
+
+TIMEOUT = 300
+
+
+def int_list(s):
+  return [int(x) for x in s.split(',') if x != '']
+
+
+def parse_args():
+  parser = optparse.OptionParser()
+  parser.add_option('--out', help='write the CSV to this file')
+  parser.add_option('--quick', action='store_true',
+                    help='run smaller sweeps')
+  parser.add_option('--no-micro', action='store_true',
+                    help='skip the wrapper micro-benchmarks')
+  parser.add_option('--no-coord', action='store_true',
+                    help='skip the coordinator benchmarks')
+  parser.add_option('--no-ckpt', action='store_true',
+                    help='skip the checkpoint/restart sweeps')
+  parser.add_option('--rss', default='64,256,1024')
+  parser.add_option('--zero-pct', default='0,50,90')
+  parser.add_option('--threads', default='1,16,128')
+  parser.add_option('--fds', default='16,256,1024')
+  parser.add_option('--shm-mb', default='16,256')
+  parser.add_option('--repeat', type='int', default=1,
+                    help='repeat each checkpoint/restart N times, and '
+                         'report the minimum')
+  opts, _ = parser.parse_args()
+  if opts.quick:
+    opts.rss, opts.zero_pct, opts.threads = '64', '0,90', '1,16'
+    opts.fds, opts.shm_mb = '16', '16'
+  return opts
+
+
+class Coordinator(object):
+  def __init__(self, ckptdir, args=[]):
+    self.ckptdir = ckptdir
+    portfile = os.path.join(ckptdir, 'coord-port')
+    subprocess.check_call([os.path.join(BIN, 'dmtcp_coordinator'),
+                           '--daemon', '--quiet', '--coord-port', '0',
+                           '--port-file', portfile, '--ckptdir', ckptdir] +
+                          args)
+    deadline = time.time() + 10
+    while not os.path.exists(portfile) or os.path.getsize(portfile) == 0:
+      if time.time() > deadline:
+        raise RuntimeError('coordinator did not start')
+      time.sleep(0.01)
+    self.port = open(portfile).read().strip()
+
+  def command(self, cmd):
+    return subprocess.check_output(
+      [os.path.join(BIN, 'dmtcp_command'), '--coord-port', self.port, cmd],
+      stderr=subprocess.STDOUT).decode()
+
+  def wait_running(self, numPeers):
+    deadline = time.time() + TIMEOUT
+    while time.time() < deadline:
+      status = self.command('-s')
+      if ('RUNNING=yes' in status and
+          'NUM_PEERS=%d' % numPeers in status):
+        return
+      time.sleep(0.005)
+    raise RuntimeError('computation did not reach RUNNING state')
+
+  def start_aggregators(self, num):
+    # Returns their sockets; they exit with the coordinator.
+    sockets = []
+    for i in range(num):
+      path = os.path.join(self.ckptdir, 'aggregator-%d' % i)
+      subprocess.check_call([os.path.join(BIN, 'dmtcp_aggregator'),
+                             '--daemon', '--coord-port', self.port,
+                             '--socket', path])
+      sockets.append(path)
+    deadline = time.time() + 10
+    while not all(os.path.exists(path) for path in sockets):
+      if time.time() > deadline:
+        raise RuntimeError('dmtcp_aggregator did not start')
+      time.sleep(0.01)
+    return sockets
+
+  def quit(self):
+    try:
+      self.command('-q')
+    except subprocess.CalledProcessError:
+      pass
+
+  def launch_cmd(self):
+    return [os.path.join(BIN, 'dmtcp_launch'), '--coord-port', self.port,
+            '--ckptdir', self.ckptdir]
+
+
+def run_micro(rows, coord):
+  for name, args in MICRO_BENCHMARKS:
+    exe = os.path.join(BENCH_DIR, name)
+    for mode in ['native', 'dmtcp']:
+      cmd = [exe] + args
+      if mode == 'dmtcp':
+        plugins = []
+        for plugin in BENCHMARK_PLUGINS.get(name, []):
+          plugins += ['--with-plugin',
+                      os.path.join(DMTCP_ROOT, 'lib', 'dmtcp', plugin)]
+        cmd = coord.launch_cmd() + plugins + cmd
+      out = subprocess.check_output(cmd).decode()
+      for line in out.splitlines():
+        fields = line.split(',')
+        if len(fields) != 4:
+          continue
+        rows.append((fields[0], mode, 'threads=%s' % fields[1],
+                     'ns_per_op', fields[3]))
+
+
+def run_coord(rows):
+  for ioThreads in COORD_IO_THREADS:
+    ckptdir = tempfile.mkdtemp(prefix='dmtcp-bench-')
+    coord = Coordinator(ckptdir, ['--io-threads', str(ioThreads)])
+    try:
+      env = dict(os.environ, DMTCP_COORD_HOST='localhost',
+                 DMTCP_COORD_PORT=coord.port)
+      out = subprocess.check_output(
+        [os.path.join(BENCH_DIR, 'coord-flood')] + COORD_FLOOD_ARGS,
+        env=env).decode()
+      for line in out.splitlines():
+        fields = line.split(',')
+        if len(fields) != 4:
+          continue
+        rows.append((fields[0], 'native',
+                     'workers=%s;io_threads=%d' % (fields[1], ioThreads),
+                     'ns_per_op', fields[3]))
+    finally:
+      coord.quit()
+      shutil.rmtree(ckptdir, ignore_errors=True)
+
+
+def run_coord_barrier(rows):
+  for numAggregators in COORD_AGGREGATORS:
+    ckptdir = tempfile.mkdtemp(prefix='dmtcp-bench-')
+    coord = Coordinator(ckptdir)
+    try:
+      sockets = coord.start_aggregators(numAggregators)
+      env = dict(os.environ, DMTCP_COORD_HOST='localhost',
+                 DMTCP_COORD_PORT=coord.port)
+      out = subprocess.check_output(
+        [os.path.join(BENCH_DIR, 'coord-barrier')] + COORD_BARRIER_ARGS +
+        sockets, env=env).decode()
+      for line in out.splitlines():
+        fields = line.split(',')
+        if len(fields) != 4:
+          continue
+        rows.append((fields[0], 'native',
+                     'workers=%s;aggregators=%d' % (fields[1], numAggregators),
+                     'ns_per_op', fields[3]))
+    finally:
+      coord.quit()
+      shutil.rmtree(ckptdir, ignore_errors=True)
+
+
+def read_metric(ckptdir, pattern, metric):
+  # Sum of 'metric' over all processes, from the coordinator's metrics CSV.
+  total = None
+  for path in glob.glob(os.path.join(ckptdir, pattern)):
+    for line in open(path):
+      fields = line.strip().split(',')
+      if len(fields) == 6 and fields[0] == metric:
+        total = (total or 0) + float(fields[3]) * int(fields[1])
+  return total
+
+
+def ckpt_restart(config, ckptdir):
+  for f in os.listdir(ckptdir):
+    path = os.path.join(ckptdir, f)
+    if os.path.isdir(path):
+      shutil.rmtree(path)
+    else:
+      os.unlink(path)
+
+  coord = Coordinator(ckptdir)
+  try:
+    cmd = [os.path.join(BENCH_DIR, 'ckpt-workload')]
+    for key, value in config:
+      cmd += [WORKLOAD_FLAGS[key], str(value)]
+    proc = subprocess.Popen(coord.launch_cmd() + cmd, stdout=subprocess.PIPE)
+    if proc.stdout.readline().decode().strip() != 'ready':
+      raise RuntimeError('ckpt-workload failed to start')
+
+    start = time.time()
+    coord.command('-bc')
+    ckptTime = time.time() - start
+    images = glob.glob(os.path.join(ckptdir, 'ckpt_*.dmtcp'))
+    bytesWritten = sum(os.path.getsize(f) for f in images)
+
+    coord.command('-k')
+    proc.wait()
+
+    devnull = open(os.devnull, 'w')
+    start = time.time()
+    restart = subprocess.Popen([os.path.join(BIN, 'dmtcp_restart'),
+                                '--coord-port', coord.port] + images,
+                               stdout=devnull, stderr=devnull)
+    coord.wait_running(1)
+    restartTime = time.time() - start
+
+    coord.command('-k')
+    restart.wait()
+
+    zeroBytes = 0
+    for cls in ['heap', 'stack', 'anon', 'file', 'shm']:
+      zeroBytes += read_metric(ckptdir, 'metrics_ckpt_gen*.csv',
+                               'area.%s.zero_bytes' % cls) or 0
+  finally:
+    coord.quit()
+  return ckptTime, restartTime, bytesWritten, zeroBytes
+
+
+def run_ckpt(rows, opts):
+  sweeps = [('ckpt-rss', 'rss_mb', int_list(opts.rss)),
+            ('ckpt-zero', 'zero_pct', int_list(opts.zero_pct)),
+            ('ckpt-threads', 'threads', int_list(opts.threads)),
+            ('ckpt-fds', 'fds', int_list(opts.fds)),
+            ('ckpt-shm', 'shm_mb', int_list(opts.shm_mb))]
+  ckptdir = tempfile.mkdtemp(prefix='dmtcp-bench-')
+  try:
+    for bench, key, values in sweeps:
+      for value in values:
+        config = [(k, value if k == key else v) for k, v in BASE_CONFIG]
+        params = ';'.join('%s=%d' % kv for kv in config)
+        results = [ckpt_restart(config, ckptdir) for _ in range(opts.repeat)]
+        ckptTime, restartTime, bytesWritten, zeroBytes = \
+          [min(r[i] for r in results) for i in range(4)]
+        rows.append((bench, 'dmtcp', params, 'ckpt_s', '%.3f' % ckptTime))
+        rows.append((bench, 'dmtcp', params, 'restart_s',
+                     '%.3f' % restartTime))
+        rows.append((bench, 'dmtcp', params, 'bytes_written',
+                     '%d' % bytesWritten))
+        rows.append((bench, 'dmtcp', params, 'zero_bytes_skipped',
+                     '%d' % zeroBytes))
+  finally:
+    shutil.rmtree(ckptdir, ignore_errors=True)
+
+
+def main():
+  opts = parse_args()
+  rows = []
+
+  if not opts.no_micro:
+    ckptdir = tempfile.mkdtemp(prefix='dmtcp-bench-')
+    coord = Coordinator(ckptdir)
+    try:
+      run_micro(rows, coord)
+    finally:
+      coord.quit()
+      shutil.rmtree(ckptdir, ignore_errors=True)
+  if not opts.no_coord:
+    run_coord(rows)
+    run_coord_barrier(rows)
+  if not opts.no_ckpt:
+    run_ckpt(rows, opts)
+
+  out = open(opts.out, 'w') if opts.out else sys.stdout
+  out.write('benchmark,mode,parameters,metric,value\n')
+  for row in rows:
+    out.write(','.join(row) + '\n')
+  if opts.out:
+    out.close()
+  return 0
+
+
+if __name__ == '__main__':
+  sys.exit(main())
@@ -0,0 +1,76 @@
+/* Measures pthread_create() and pthread_join() of a thread that returns at
+ * once, as in a thread-per-task server, while 1, 2, 4, ... other threads
+ * stay alive and idle.  Under DMTCP, each new thread registers itself in the
+ * list of the process' threads; the 'threads' column is the number of idle
+ * threads on that list.
+ *
+ * Usage:  thread-churn [max_idle_threads] [creates]
+ * Compare:  ./thread-churn  vs.  dmtcp_launch ./thread-churn
+ */
+
+#include <pthread.h>
+#include "bench.h"
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int done = 0;
+
+static void *
+idle(void *arg)
+{
+  pthread_mutex_lock(&lock);
+  while (!done) {
+    pthread_cond_wait(&cond, &lock);
+  }
+  pthread_mutex_unlock(&lock);
+  return NULL;
+}
+
+static void *
+task(void *arg)
+{
+  return arg;
+}
+
+int
+main(int argc, char *argv[])
+{
+  long maxIdle = bench_arg(argc, argv, 1, 1024);
+  long creates = bench_arg(argc, argv, 2, 5000);
+  pthread_t *idlers = malloc(maxIdle * sizeof(pthread_t));
+  long numIdle = 0;
+  long nidle;
+
+  for (nidle = 1; nidle <= maxIdle; nidle *= 2) {
+    double start;
+    long i;
+
+    for (; numIdle < nidle; numIdle++) {
+      if (pthread_create(&idlers[numIdle], NULL, idle, NULL) != 0) {
+        perror("pthread_create");
+        exit(1);
+      }
+    }
+
+    start = bench_now_ns();
+    for (i = 0; i < creates; i++) {
+      pthread_t thread;
+      if (pthread_create(&thread, NULL, task, NULL) != 0) {
+        perror("pthread_create");
+        exit(1);
+      }
+      pthread_join(thread, NULL);
+    }
+    bench_report("thread-churn", nidle, creates, bench_now_ns() - start);
+  }
+
+  pthread_mutex_lock(&lock);
+  done = 1;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&lock);
+  for (nidle = 0; nidle < numIdle; nidle++) {
+    pthread_join(idlers[nidle], NULL);
+  }
+  free(idlers);
+  return 0;
+}
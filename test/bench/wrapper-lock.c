@@ -0,0 +1,59 @@
+/* Measures the cost of entering and leaving a DMTCP wrapper from many
+ * threads at once.  close(-1) is wrapped by the IPC plugin under
+ * DMTCP_PLUGIN_DISABLE_CKPT(), and fails in the kernel with EBADF
+ * immediately, so the time per call is dominated by the wrapper-execution
+ * lock.
+ *
+ * Usage:  wrapper-lock [max_threads] [iterations_per_thread]
+ * Compare:  ./wrapper-lock  vs.  dmtcp_launch ./wrapper-lock
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+#include "bench.h"
+
+static long iterations;
+static pthread_barrier_t barrier;
+
+static void *
+worker(void *arg)
+{
+  long i;
+
+  pthread_barrier_wait(&barrier);
+  for (i = 0; i < iterations; i++) {
+    close(-1);
+  }
+  return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+  long maxThreads = bench_arg(argc, argv, 1, 16);
+  long nthreads;
+
+  iterations = bench_arg(argc, argv, 2, 1000000);
+
+  for (nthreads = 1; nthreads <= maxThreads; nthreads *= 2) {
+    pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+    double start;
+    long i;
+
+    pthread_barrier_init(&barrier, NULL, nthreads + 1);
+    for (i = 0; i < nthreads; i++) {
+      pthread_create(&threads[i], NULL, worker, NULL);
+    }
+    start = bench_now_ns();
+    pthread_barrier_wait(&barrier);
+    for (i = 0; i < nthreads; i++) {
+      pthread_join(threads[i], NULL);
+    }
+    // Wall time per call, as seen by a single thread.
+    bench_report("wrapper-lock", nthreads, iterations,
+                 bench_now_ns() - start);
+    pthread_barrier_destroy(&barrier);
+    free(threads);
+  }
+  return 0;
+}
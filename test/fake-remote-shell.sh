@@ -0,0 +1,6 @@
+#!/bin/sh
+
+# Stands in for ssh in 'dmtcp_restart --remote-shell': drops the host name
+# and runs the command here.
+shift
+exec "$@"
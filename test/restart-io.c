@@ -0,0 +1,52 @@
+/* A large anonymous area, as mtcp_restart restores with DMTCP_RESTART_IO
+ * (read, direct or mmap).  Each page holds its own index; the process checks
+ * them all, and writes to some of them, after every restart.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SIZE (64 * 1024 * 1024)
+
+int
+main()
+{
+  long pageSize = sysconf(_SC_PAGESIZE);
+  long numPages = SIZE / pageSize;
+  long *area = mmap(NULL, SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  struct timespec eighth_second = {0, 2<<26};
+  long i;
+  long count;
+
+  if (area == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+  for (i = 0; i < numPages; i++) {
+    area[i * pageSize / sizeof(long)] = i;
+  }
+
+  for (count = 0; ; count++) {
+    for (i = 0; i < numPages; i++) {
+      long *page = &area[i * pageSize / sizeof(long)];
+      if (page[0] != i) {
+        printf("page %ld of the area holds %ld\n", i, page[0]);
+        return 1;
+      }
+      if (i % 64 == count % 64) {
+        page[1] = count;
+      }
+    }
+    nanosleep(&eighth_second, NULL);
+    if (count % 8 == 0) {
+      printf("."); fflush(stdout);
+    }
+  }
+  return 0;
+}
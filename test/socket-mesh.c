@@ -0,0 +1,183 @@
+/* A mesh of sockets among several processes, to exercise the restoring of
+ * many connections at once on restart.
+ *
+ * Usage:  socket-mesh [nprocs] [sockets-per-pair]
+ *   Every pair of processes is connected by sockets-per-pair sockets, half
+ *   over TCP on the loopback interface, and half over UNIX-domain sockets.
+ *   In each round, every process writes the round number on all of its
+ *   sockets, and then reads it back from all of them; a mismatch, or a
+ *   connection that was not restored, makes it exit.
+ */
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define MAX_PROCS 64
+
+static struct sockaddr_in tcpAddr[MAX_PROCS];
+static struct sockaddr_un udsAddr[MAX_PROCS];
+static socklen_t udsAddrLen[MAX_PROCS];
+static int tcpListener[MAX_PROCS];
+static int udsListener[MAX_PROCS];
+
+static void
+die(const char *msg)
+{
+  perror(msg);
+  exit(1);
+}
+
+static void
+open_listeners(int nprocs)
+{
+  int i;
+
+  for (i = 0; i < nprocs; i++) {
+    socklen_t len = sizeof(tcpAddr[i]);
+
+    tcpListener[i] = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&tcpAddr[i], 0, sizeof(tcpAddr[i]));
+    tcpAddr[i].sin_family = AF_INET;
+    inet_aton("127.0.0.1", &tcpAddr[i].sin_addr);
+    if (bind(tcpListener[i], (struct sockaddr *)&tcpAddr[i], len) == -1 ||
+        getsockname(tcpListener[i], (struct sockaddr *)&tcpAddr[i],
+                    &len) == -1 ||
+        listen(tcpListener[i], SOMAXCONN) == -1) {
+      die("tcp listener");
+    }
+
+    // Abstract namespace, so that there is no file to clean up.
+    udsListener[i] = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&udsAddr[i], 0, sizeof(udsAddr[i]));
+    udsAddr[i].sun_family = AF_UNIX;
+    snprintf(&udsAddr[i].sun_path[1], sizeof(udsAddr[i].sun_path) - 1,
+             "socket-mesh-%d-%d", getpid(), i);
+    udsAddrLen[i] = sizeof(sa_family_t) + 1 + strlen(&udsAddr[i].sun_path[1]);
+    if (bind(udsListener[i], (struct sockaddr *)&udsAddr[i],
+             udsAddrLen[i]) == -1 ||
+        listen(udsListener[i], SOMAXCONN) == -1) {
+      die("uds listener");
+    }
+  }
+}
+
+// Process 'me' connects to every lower-numbered process, and then accepts
+// the connections from every higher-numbered one.
+static int
+connect_mesh(int me, int nprocs, int perPair, int *fds)
+{
+  int nfds = 0;
+  int i, j, k;
+
+  for (i = 0; i < nprocs; i++) {
+    if (i != me) {
+      close(tcpListener[i]);
+      close(udsListener[i]);
+    }
+  }
+
+  for (j = 0; j < me; j++) {
+    for (k = 0; k < perPair; k++) {
+      int fd;
+      if (k % 2 == 0) {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(fd, (struct sockaddr *)&tcpAddr[j],
+                    sizeof(tcpAddr[j])) == -1) {
+          die("connect (tcp)");
+        }
+      } else {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (connect(fd, (struct sockaddr *)&udsAddr[j], udsAddrLen[j]) == -1) {
+          die("connect (uds)");
+        }
+      }
+      fds[nfds++] = fd;
+    }
+  }
+
+  for (j = me + 1; j < nprocs; j++) {
+    for (k = 0; k < perPair; k++) {
+      int listener = (k % 2 == 0) ? tcpListener[me] : udsListener[me];
+      int fd = accept(listener, NULL, NULL);
+      if (fd == -1) {
+        die("accept");
+      }
+      fds[nfds++] = fd;
+    }
+  }
+
+  close(tcpListener[me]);
+  close(udsListener[me]);
+  return nfds;
+}
+
+static void
+run(int me, int nfds, int *fds)
+{
+  unsigned int round;
+  int i;
+
+  for (round = 0;; round++) {
+    for (i = 0; i < nfds; i++) {
+      if (write(fds[i], &round, sizeof(round)) != sizeof(round)) {
+        die("write");
+      }
+    }
+    for (i = 0; i < nfds; i++) {
+      unsigned int peerRound;
+      if (read(fds[i], &peerRound, sizeof(peerRound)) != sizeof(peerRound)) {
+        die("read");
+      }
+      if (peerRound != round) {
+        fprintf(stderr, "socket-mesh: process %d, socket %d: expected %u,"
+                        " got %u\n", me, i, round, peerRound);
+        exit(1);
+      }
+    }
+    if (me == 0 && round % 1000 == 0) {
+      printf(".");
+      fflush(stdout);
+    }
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nprocs = (argc > 1 ? atoi(argv[1]) : 4);
+  int perPair = (argc > 2 ? atoi(argv[2]) : 64);
+  int *fds;
+  int me;
+
+  if (nprocs < 2 || nprocs > MAX_PROCS || perPair < 1) {
+    fprintf(stderr, "Usage: %s [nprocs] [sockets-per-pair]\n", argv[0]);
+    return 1;
+  }
+  fds = malloc(nprocs * perPair * sizeof(int));
+
+  open_listeners(nprocs);
+  for (me = 1; me < nprocs; me++) {
+    pid_t pid = fork();
+    if (pid == -1) {
+      die("fork");
+    }
+    if (pid == 0) {
+      break;
+    }
+  }
+  if (me == nprocs) {
+    me = 0;
+  }
+
+  run(me, connect_mesh(me, nprocs, perPair, fds), fds);
+  return 0;
+}
@@ -0,0 +1,82 @@
+// shmget() needs sysv/ipc.h, which needs _XOPEN_SOURCE
+#define _XOPEN_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/* A single large SysV shm segment.  On restart, its contents should be
+ * restored directly into the new segment, without an intermediate private
+ * copy.  So, the peak RSS of the process (VmHWM) should never exceed the
+ * size of the segment by much, before or after restart.
+ */
+#define SIZE  (128 * 1024 * 1024)
+#define SLACK (64 * 1024 * 1024)
+
+static long
+peak_rss_kb()
+{
+  char line[256];
+  long kb = -1;
+  FILE *fp = fopen("/proc/self/status", "r");
+
+  if (fp == NULL) {
+    perror("fopen");
+    abort();
+  }
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    if (sscanf(line, "VmHWM: %ld kB", &kb) == 1) {
+      break;
+    }
+  }
+  fclose(fp);
+  return kb;
+}
+
+int
+main(int argc, char **argv)
+{
+  int shmid;
+  size_t i;
+
+  if ((shmid = shmget((key_t)9981, SIZE, IPC_CREAT | 0666)) < 0) {
+    perror("shmget");
+    exit(1);
+  }
+
+  unsigned long *ptr = (unsigned long *)shmat(shmid, NULL, 0);
+  if (ptr == (void *)-1) {
+    perror("shmat");
+    abort();
+  }
+
+  const size_t n = SIZE / sizeof(*ptr);
+  for (i = 0; i < n; i++) {
+    ptr[i] = i * 2654435761UL;
+  }
+
+  unsigned long count;
+  for (count = 1; count < 100000; count++) {
+    for (i = 0; i < n; i++) {
+      if (ptr[i] != i * 2654435761UL + count - 1) {
+        printf("Mismatch at %zu: %lx\n", i, ptr[i]);
+        abort();
+      }
+      ptr[i]++;
+    }
+
+    long peak = peak_rss_kb();
+    printf("%lu: peak RSS %ld kB\n", count, peak);
+    fflush(stdout);
+    if (peak > (SIZE + SLACK) / 1024) {
+      printf("Peak RSS (%ld kB) exceeds segment size (%d kB) by too much\n",
+             peak, SIZE / 1024);
+      abort();
+    }
+    sleep(1);
+  }
+  return 0;
+}